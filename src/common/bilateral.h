@@ -26,6 +26,8 @@
 #define DT_COMMON_BILATERAL_MAX_RES_S 6000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
 
+#include <xmmintrin.h>
+
 #ifdef HAVE_OPENCL
 // function definition on opencl path takes precedence
 #include "common/bilateralcl.h"
@@ -44,7 +46,8 @@ dt_bilateral_memory_use(
   size_t size_y = CLAMPS((int)_y, 4, DT_COMMON_BILATERAL_MAX_RES_S) + 1;
   size_t size_z = CLAMPS((int)_z, 4, DT_COMMON_BILATERAL_MAX_RES_R) + 1;
 
-  return size_x*size_y*size_z*sizeof(float);
+  // the grid and the per slab copies of it during splatting:
+  return size_x*size_y*size_z*sizeof(float)*2;
 }
 
 
@@ -124,21 +127,44 @@ dt_bilateral_init(
   return b;
 }
 
-void
-dt_bilateral_splat(
-  dt_bilateral_t *b,
-  const float    *const in)
+// the four grid values around gi in the x/y plane, as { (0,0), (1,0), (0,1), (1,1) }
+static inline __m128
+_bilateral_load_2x2(const float *const gi, const int oy)
+{
+  return _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64 *)gi), (const __m64 *)(gi + oy));
+}
+
+static inline void
+_bilateral_store_2x2(float *const gi, const int oy, const __m128 v)
+{
+  _mm_storel_pi((__m64 *)gi, v);
+  _mm_storeh_pi((__m64 *)(gi + oy), v);
+}
+
+// bilinear weights in the x/y plane, same order as above.
+static inline __m128
+_bilateral_weights_2x2(const float xf, const float yf)
+{
+  return _mm_set_ps(xf*yf, (1.0f-xf)*yf, xf*(1.0f-yf), (1.0f-xf)*(1.0f-yf));
+}
+
+// splat rows j0..j1-1 into grid, which holds grid lines y0..y0+ny-1 of every z slice.
+static void
+_bilateral_splat_rows(
+  const dt_bilateral_t *const b,
+  const float          *const in,
+  const int             j0,
+  const int             j1,
+  float                *grid,
+  const int             y0,
+  const int             ny)
 {
-  const int ox = 1;
   const int oy = b->size_x;
-  const int oz = b->size_y*b->size_x;
-  // splat into downsampled grid
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(b)
-#endif
-  for(int j=0; j<b->height; j++)
+  const int oz = ny*b->size_x;
+  const __m128 norm = _mm_set1_ps(100.0f/(b->sigma_s*b->sigma_s));
+  for(int j=j0; j<j1; j++)
   {
-    size_t index = 4*j*b->width;
+    size_t index = (size_t)4*j*b->width;
     for(int i=0; i<b->width; i++)
     {
       float x, y, z;
@@ -150,136 +176,225 @@ dt_bilateral_splat(
       const float xf = x - xi;
       const float yf = y - yi;
       const float zf = z - zi;
-      // nearest neighbour splatting:
-      const size_t grid_index = xi + b->size_x*(yi + b->size_y*zi);
+      const size_t gi = xi + oy*(yi - y0) + (size_t)oz*zi;
       // sum up payload here, doesn't have to be same as edge stopping data
       // for cross bilateral applications.
       // also note that this is not clipped (as L->z is), so potentially hdr/out of gamut
       // should not cause clipping here.
-      for(int k=0; k<8; k++)
-      {
-        const size_t ii = grid_index + ((k&1)?ox:0) + ((k&2)?oy:0) + ((k&4)?oz:0);
-        const float contrib = ((k&1)?xf:(1.0f-xf)) * ((k&2)?yf:(1.0f-yf)) * ((k&4)?zf:(1.0f-zf))
-                              *100.0f/(b->sigma_s*b->sigma_s);
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        b->buf[ii] += contrib;
-      }
+      const __m128 w = _mm_mul_ps(norm, _bilateral_weights_2x2(xf, yf));
+      _bilateral_store_2x2(grid + gi, oy, _mm_add_ps(_bilateral_load_2x2(grid + gi, oy),
+                                                     _mm_mul_ps(w, _mm_set1_ps(1.0f - zf))));
+      _bilateral_store_2x2(grid + gi + oz, oy, _mm_add_ps(_bilateral_load_2x2(grid + gi + oz, oy),
+                                                          _mm_mul_ps(w, _mm_set1_ps(zf))));
       index += 4;
     }
   }
 }
 
-static void
-blur_line_z(
-  float    *buf,
-  const int offset1,
-  const int offset2,
-  const int offset3,
-  const int size1,
-  const int size2,
-  const int size3)
+void
+dt_bilateral_splat(
+  dt_bilateral_t *b,
+  const float    *const in)
 {
-  const float w1 = 4.f/16.f;
-  const float w2 = 2.f/16.f;
+  // every thread splats a slab of rows into its own copy of the grid lines
+  // these rows touch, the copies are summed up afterwards. adjacent slabs
+  // overlap by one grid line, so this needs at most twice the grid memory.
+  const int slabs = MAX(1, MIN(dt_get_num_threads(), MIN(b->height, (int)b->size_y - 1)));
+  const int rows = (b->height + slabs - 1)/slabs;
+  int y0[slabs], ny[slabs];
+  size_t offset[slabs+1];
+  offset[0] = 0;
+  for(int s=0; s<slabs; s++)
+  {
+    float x, y, z;
+    const int j0 = MIN(b->height, s*rows), j1 = MIN(b->height, j0 + rows);
+    image_to_grid(b, 0, j0, 0.0f, &x, &y, &z);
+    y0[s] = MIN((int)y, b->size_y-2);
+    image_to_grid(b, 0, MAX(j0, j1 - 1), 0.0f, &x, &y, &z);
+    ny[s] = j1 > j0 ? MIN((int)y, b->size_y-2) + 2 - y0[s] : 0;
+    offset[s+1] = offset[s] + (size_t)ny[s]*b->size_x*b->size_z;
+  }
+
+  float *slab = slabs > 1 ? dt_alloc_align(16, offset[slabs]*sizeof(float)) : NULL;
+  if(!slab)
+  {
+    // single threaded, or out of memory: straight into the grid.
+    _bilateral_splat_rows(b, in, 0, b->height, b->buf, 0, b->size_y);
+    return;
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(b, slab, y0, ny, offset)
+#endif
+  for(int s=0; s<slabs; s++)
+  {
+    memset(slab + offset[s], 0, (offset[s+1] - offset[s])*sizeof(float));
+    _bilateral_splat_rows(b, in, s*rows, MIN(b->height, (s+1)*rows), slab + offset[s], y0[s], ny[s]);
+  }
+
+  // the slabs are sorted by y, every grid line is touched by one or two of them:
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(buf)
+  #pragma omp parallel for schedule(static) collapse(2) shared(b, slab, y0, ny, offset)
 #endif
-  for(int k=0; k<size1; k++)
+  for(int z=0; z<b->size_z; z++)
   {
-    size_t index = (size_t)k*offset1;
-    for(int j=0; j<size2; j++)
+    for(int y=0; y<b->size_y; y++)
     {
-      float tmp1 = buf[index];
-      buf[index] = w1*buf[index + offset3] + w2*buf[index + 2*offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = w1*(buf[index + offset3] - tmp1) + w2*buf[index + 2*offset3];
-      index += offset3;
-      for(int i=2; i<size3-2; i++)
+      float *line = b->buf + b->size_x*(y + b->size_y*(size_t)z);
+      for(int s=0; s<slabs; s++)
       {
-        const float tmp3 = buf[index];
-        buf[index] =
-          + w1*(buf[index + offset3]   - tmp2)
-          + w2*(buf[index + 2*offset3] - tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
+        if(y < y0[s] || y >= y0[s] + ny[s]) continue;
+        const float *sline = slab + offset[s] + b->size_x*(y - y0[s] + ny[s]*(size_t)z);
+        for(int x=0; x<b->size_x; x++) line[x] += sline[x];
       }
-      const float tmp3 = buf[index];
-      buf[index] = w1*(buf[index + offset3] - tmp2) - w2*tmp1;
-      index += offset3;
-      buf[index] = - w1*tmp3 - w2*tmp2;
-      index += offset3;
-      index += offset2 - offset3*size3;
     }
   }
+  dt_free_align(slab);
 }
 
+// the blur is a five tap filter with zero boundaries:
+// out[i] = w0*in[i] + w1*(in[i+1] + s*in[i-1]) + w2*(in[i+2] + s*in[i-2])
+// so s = 1 is a smoothing filter, s = -1 and w0 = 0 a derivative.
+
+// lines along offset3, starting at k*offset1 for every x. four neighbouring x at a time.
 static void
 blur_line(
-  float    *buf,
-  const int offset1,
-  const int offset2,
-  const int offset3,
-  const int size1,
-  const int size2,
-  const int size3)
+  float      *buf,
+  const int   offset1,
+  const int   offset3,
+  const int   size1,
+  const int   size3,
+  const int   size_x,
+  const float w0,
+  const float w1,
+  const float w2,
+  const float s)
 {
-  const float w0 = 6.f/16.f;
-  const float w1 = 4.f/16.f;
-  const float w2 = 1.f/16.f;
+  const int chunks = (size_x + 3)/4;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(buf)
+  #pragma omp parallel for schedule(static) shared(buf)
 #endif
-  for(int k=0; k<size1; k++)
+  for(int c=0; c<size1*chunks; c++)
   {
-    size_t index = (size_t)k*offset1;
-    for(int j=0; j<size2; j++)
+    const int x = 4*(c % chunks);
+    float *line = buf + (size_t)(c / chunks)*offset1 + x;
+    if(x + 4 <= size_x)
     {
-      float tmp1 = buf[index];
-      buf[index] = buf[index]*w0 + w1*buf[index + offset3] + w2*buf[index + 2*offset3];
-      index += offset3;
-      float tmp2 = buf[index];
-      buf[index] = buf[index]*w0 + w1*(buf[index + offset3] + tmp1) + w2*buf[index + 2*offset3];
-      index += offset3;
-      for(int i=2; i<size3-2; i++)
+      const __m128 w0v = _mm_set1_ps(w0), w1v = _mm_set1_ps(w1), w2v = _mm_set1_ps(w2), sv = _mm_set1_ps(s);
+      __m128 p2 = _mm_setzero_ps(), p1 = _mm_setzero_ps();
+      __m128 c0 = _mm_loadu_ps(line), n1 = _mm_loadu_ps(line + offset3), n2 = _mm_loadu_ps(line + 2*offset3);
+      for(int i=0; i<size3; i++)
       {
-        const float tmp3 = buf[index];
-        buf[index] = buf[index]*w0
-                     + w1*(buf[index + offset3]   + tmp2)
-                     + w2*(buf[index + 2*offset3] + tmp1);
-        index += offset3;
-        tmp1 = tmp2;
-        tmp2 = tmp3;
+        const __m128 n3 = i + 3 < size3 ? _mm_loadu_ps(line + (size_t)(i+3)*offset3) : _mm_setzero_ps();
+        _mm_storeu_ps(line + (size_t)i*offset3,
+                      _mm_add_ps(_mm_mul_ps(w0v, c0),
+                      _mm_add_ps(_mm_mul_ps(w1v, _mm_add_ps(n1, _mm_mul_ps(sv, p1))),
+                                 _mm_mul_ps(w2v, _mm_add_ps(n2, _mm_mul_ps(sv, p2))))));
+        p2 = p1;
+        p1 = c0;
+        c0 = n1;
+        n1 = n2;
+        n2 = n3;
+      }
+    }
+    else for(int xx=0; xx<size_x-x; xx++)
+    {
+      float p2 = 0.0f, p1 = 0.0f;
+      float c0 = line[xx], n1 = line[xx + offset3], n2 = line[xx + 2*offset3];
+      for(int i=0; i<size3; i++)
+      {
+        const float n3 = i + 3 < size3 ? line[xx + (size_t)(i+3)*offset3] : 0.0f;
+        line[xx + (size_t)i*offset3] = w0*c0 + w1*(n1 + s*p1) + w2*(n2 + s*p2);
+        p2 = p1;
+        p1 = c0;
+        c0 = n1;
+        n1 = n2;
+        n2 = n3;
       }
-      const float tmp3 = buf[index];
-      buf[index] = buf[index]*w0 + w1*(buf[index + offset3] + tmp2) + w2*tmp1;
-      index += offset3;
-      buf[index] = buf[index]*w0 + w1*tmp3 + w2*tmp2;
-      index += offset3;
-      index += offset2 - offset3*size3;
     }
   }
 }
 
+// the same along x, for all lines of the grid.
+static void
+blur_line_x(
+  float      *buf,
+  const int   size_x,
+  const int   lines,
+  const float w0,
+  const float w1,
+  const float w2,
+  const float s)
+{
+#ifdef _OPENMP
+  #pragma omp parallel shared(buf)
+#endif
+  {
+    // zero padded copy of the line:
+    float *tmp = dt_alloc_align(16, sizeof(float)*(size_x + 4));
+    const __m128 w0v = _mm_set1_ps(w0), w1v = _mm_set1_ps(w1), w2v = _mm_set1_ps(w2), sv = _mm_set1_ps(s);
+#ifdef _OPENMP
+    #pragma omp for schedule(static)
+#endif
+    for(int l=0; l<lines; l++)
+    {
+      float *line = buf + (size_t)l*size_x;
+      tmp[0] = tmp[1] = tmp[size_x+2] = tmp[size_x+3] = 0.0f;
+      memcpy(tmp + 2, line, sizeof(float)*size_x);
+      int i = 0;
+      for(; i+4<=size_x; i+=4)
+        _mm_storeu_ps(line + i,
+                      _mm_add_ps(_mm_mul_ps(w0v, _mm_loadu_ps(tmp + i + 2)),
+                      _mm_add_ps(_mm_mul_ps(w1v, _mm_add_ps(_mm_loadu_ps(tmp + i + 3), _mm_mul_ps(sv, _mm_loadu_ps(tmp + i + 1)))),
+                                 _mm_mul_ps(w2v, _mm_add_ps(_mm_loadu_ps(tmp + i + 4), _mm_mul_ps(sv, _mm_loadu_ps(tmp + i)))))));
+      for(; i<size_x; i++)
+        line[i] = w0*tmp[i+2] + w1*(tmp[i+3] + s*tmp[i+1]) + w2*(tmp[i+4] + s*tmp[i]);
+    }
+    dt_free_align(tmp);
+  }
+}
+
 
 void
 dt_bilateral_blur(
   dt_bilateral_t *b)
 {
   // gaussian up to 3 sigma
-  blur_line(b->buf, b->size_x*b->size_y, b->size_x, 1,
-            b->size_z, b->size_y, b->size_x);
+  blur_line_x(b->buf, b->size_x, b->size_y*b->size_z, 6.f/16.f, 4.f/16.f, 1.f/16.f, 1.0f);
   // gaussian up to 3 sigma
-  blur_line(b->buf, b->size_x*b->size_y, 1, b->size_x,
-            b->size_z, b->size_x, b->size_y);
+  blur_line(b->buf, b->size_x*b->size_y, b->size_x,
+            b->size_z, b->size_y, b->size_x, 6.f/16.f, 4.f/16.f, 1.f/16.f, 1.0f);
   // -2 derivative of the gaussian up to 3 sigma: x*exp(-x*x)
-  blur_line_z(b->buf, 1, b->size_x, b->size_x*b->size_y,
-              b->size_x, b->size_y, b->size_z);
+  blur_line(b->buf, b->size_x, b->size_x*b->size_y,
+            b->size_y, b->size_z, b->size_x, 0.0f, 4.f/16.f, 2.f/16.f, -1.0f);
 }
 
+// trilinear lookup in the blurred grid at pixel (i,j) with luma L.
+static inline float
+_bilateral_lookup(
+  const dt_bilateral_t *const b,
+  const int             i,
+  const int             j,
+  const float           L)
+{
+  float x, y, z;
+  image_to_grid(b, i, j, L, &x, &y, &z);
+  const int xi = MIN((int)x, b->size_x-2);
+  const int yi = MIN((int)y, b->size_y-2);
+  const int zi = MIN((int)z, b->size_z-2);
+  const float xf = x - xi;
+  const float yf = y - yi;
+  const float zf = z - zi;
+  const int oy = b->size_x;
+  const size_t oz = b->size_y*b->size_x;
+  const float *gi = b->buf + xi + b->size_x*(yi + b->size_y*(size_t)zi);
+  const __m128 g = _mm_add_ps(_mm_mul_ps(_bilateral_load_2x2(gi, oy), _mm_set1_ps(1.0f - zf)),
+                              _mm_mul_ps(_bilateral_load_2x2(gi + oz, oy), _mm_set1_ps(zf)));
+  __m128 sum = _mm_mul_ps(g, _bilateral_weights_2x2(xf, yf));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
 
 void
 dt_bilateral_slice(
@@ -290,42 +405,19 @@ dt_bilateral_slice(
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y*b->size_x;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out)
+  #pragma omp parallel for schedule(static) shared(out)
 #endif
   for(int j=0; j<b->height; j++)
   {
-    size_t index = 4*j*b->width;
+    size_t index = (size_t)4*j*b->width;
     for(int i=0; i<b->width; i++)
     {
-      float x, y, z;
       const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x-2);
-      const int yi = MIN((int)y, b->size_y-2);
-      const int zi = MIN((int)z, b->size_z-2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x*(yi + b->size_y*zi);
-      const float Lout = L + norm * (
-                           b->buf[gi]          * (1.0f - xf) * (1.0f - yf) * (1.0f - zf) +
-                           b->buf[gi+ox]       * (       xf) * (1.0f - yf) * (1.0f - zf) +
-                           b->buf[gi+oy]       * (1.0f - xf) * (       yf) * (1.0f - zf) +
-                           b->buf[gi+ox+oy]    * (       xf) * (       yf) * (1.0f - zf) +
-                           b->buf[gi+oz]       * (1.0f - xf) * (1.0f - yf) * (       zf) +
-                           b->buf[gi+ox+oz]    * (       xf) * (1.0f - yf) * (       zf) +
-                           b->buf[gi+oy+oz]    * (1.0f - xf) * (       yf) * (       zf) +
-                           b->buf[gi+ox+oy+oz] * (       xf) * (       yf) * (       zf));
-      out[index] = MAX(0.0f, Lout);
+      const float Lout = L + norm * _bilateral_lookup(b, i, j, L);
       // and copy color and mask
-      out[index+1] = in[index+1];
-      out[index+2] = in[index+2];
-      out[index+3] = in[index+3];
+      _mm_storeu_ps(out + index, _mm_loadu_ps(in + index));
+      out[index] = MAX(0.0f, Lout);
       index += 4;
     }
   }
@@ -340,37 +432,15 @@ dt_bilateral_slice_to_output(
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
-  const int ox = 1;
-  const int oy = b->size_x;
-  const int oz = b->size_y*b->size_x;
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out)
+  #pragma omp parallel for schedule(static) shared(out)
 #endif
   for(int j=0; j<b->height; j++)
   {
-    size_t index = 4*j*b->width;
+    size_t index = (size_t)4*j*b->width;
     for(int i=0; i<b->width; i++)
     {
-      float x, y, z;
-      const float L = in[index];
-      image_to_grid(b, i, j, L, &x, &y, &z);
-      // trilinear lookup:
-      const int xi = MIN((int)x, b->size_x-2);
-      const int yi = MIN((int)y, b->size_y-2);
-      const int zi = MIN((int)z, b->size_z-2);
-      const float xf = x - xi;
-      const float yf = y - yi;
-      const float zf = z - zi;
-      const size_t gi = xi + b->size_x*(yi + b->size_y*zi);
-      const float Lout = norm * (
-                           b->buf[gi]          * (1.0f - xf) * (1.0f - yf) * (1.0f - zf) +
-                           b->buf[gi+ox]       * (       xf) * (1.0f - yf) * (1.0f - zf) +
-                           b->buf[gi+oy]       * (1.0f - xf) * (       yf) * (1.0f - zf) +
-                           b->buf[gi+ox+oy]    * (       xf) * (       yf) * (1.0f - zf) +
-                           b->buf[gi+oz]       * (1.0f - xf) * (1.0f - yf) * (       zf) +
-                           b->buf[gi+ox+oz]    * (       xf) * (1.0f - yf) * (       zf) +
-                           b->buf[gi+oy+oz]    * (1.0f - xf) * (       yf) * (       zf) +
-                           b->buf[gi+ox+oy+oz] * (       xf) * (       yf) * (       zf));
+      const float Lout = norm * _bilateral_lookup(b, i, j, in[index]);
       out[index] = MAX(0.0f, out[index] + Lout);
       index += 4;
     }
@@ -109,10 +109,23 @@ static int usage(const char *argv0)
   printf(" [--cachedir <user cache directory>]");
   printf(" [--localedir <locale directory>]");
   printf(" [--conf <key>=<value>]");
+  printf(" [--bench-startup]");
   printf("\n");
   return 1;
 }
 
+// --bench-startup: time spent in each phase of dt_init()
+static int _bench_startup = 0;
+static double _bench_start = 0.0, _bench_last = 0.0;
+
+static void _bench_mark(const char *phase)
+{
+  if(!_bench_startup) return;
+  const double now = dt_get_wtime();
+  fprintf(stderr, "[bench-startup] %-20s %8.3f s  (total %8.3f s)\n", phase, now - _bench_last, now - _bench_start);
+  _bench_last = now;
+}
+
 #if !defined __APPLE__ && !defined __WIN32__
 typedef void (dt_signal_handler_t)(int) ;
 // static dt_signal_handler_t *_dt_sigill_old_handler = NULL;
@@ -447,6 +460,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(&darktable, 0, sizeof(darktable_t));
 
   darktable.progname = argv[0];
+  _bench_start = _bench_last = dt_get_wtime();
 
   // database
   gchar *dbfilename_from_command = NULL;
@@ -540,6 +554,10 @@ int dt_init(int argc, char *argv[], const int init_gui)
         printf("[dt_init] using %d threads for openmp parallel sections\n", darktable.num_openmp_threads);
         k ++;
       }
+      else if(!strcmp(argv[k], "--bench-startup"))
+      {
+        _bench_startup = 1;
+      }
       else if(!strcmp(argv[k], "--conf"))
       {
         gchar *keyval = g_strdup(argv[++k]), *c = keyval;
@@ -616,6 +634,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
   memset(darktable.conf, 0, sizeof(dt_conf_t));
   dt_conf_init(darktable.conf, filename, config_override);
   g_slist_free_full(config_override, g_free);
+  _bench_mark("config");
 
   // set the interface language
   const gchar* lang = dt_conf_get_string("ui_last/gui_language"); // we may not g_free 'lang' since it is owned by setlocale afterwards
@@ -672,6 +691,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
 
   // Initialize the signal system
   darktable.signals = dt_control_signal_init();
+  _bench_mark("database");
 
   // Make sure that the database and xmp files are in sync before starting the fswatch.
   // We need conf and db to be up and running for that which is the case here.
@@ -681,9 +701,11 @@ int dt_init(int argc, char *argv[], const int init_gui)
   {
     changed_xmp_files = dt_control_crawler_run();
   }
+  _bench_mark("crawler");
 
   // Initialize the filesystem watcher
   darktable.fswatch=dt_fswatch_new();
+  if(init_gui) dt_fswatch_add_hot_folders(darktable.fswatch);
 
 #ifdef HAVE_GPHOTO2
   // Initialize the camera control
@@ -720,6 +742,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
     darktable.control->accelerators = NULL;
     dt_pthread_mutex_init(&darktable.control->run_mutex, NULL);
   }
+  _bench_mark("control");
 
   // initialize collection query
   darktable.collection_listeners = NULL;
@@ -741,6 +764,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
 #ifdef HAVE_OPENCL
   dt_opencl_init(darktable.opencl, argc, argv);
 #endif
+  _bench_mark("opencl");
 
   darktable.blendop = (dt_blendop_t *)malloc(sizeof(dt_blendop_t));
   memset(darktable.blendop, 0, sizeof(dt_blendop_t));
@@ -759,6 +783,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
   darktable.mipmap_cache = (dt_mipmap_cache_t *)malloc(sizeof(dt_mipmap_cache_t));
   memset(darktable.mipmap_cache, 0, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
+  _bench_mark("caches");
 
   // The GUI must be initialized before the views, because the init()
   // functions of the views depend on darktable.control->accels_* to register
@@ -772,13 +797,16 @@ int dt_init(int argc, char *argv[], const int init_gui)
     dt_bauhaus_init();
   }
   else darktable.gui = NULL;
+  _bench_mark("gui");
 
   darktable.view_manager = (dt_view_manager_t *)malloc(sizeof(dt_view_manager_t));
   memset(darktable.view_manager, 0, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
+  _bench_mark("views");
 
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
+  _bench_mark("iop modules");
 
   if(init_gui)
   {
@@ -788,9 +816,11 @@ int dt_init(int argc, char *argv[], const int init_gui)
 
     dt_control_load_config(darktable.control);
   }
+  _bench_mark("lib modules");
   darktable.imageio = (dt_imageio_t *)malloc(sizeof(dt_imageio_t));
   memset(darktable.imageio, 0, sizeof(dt_imageio_t));
   dt_imageio_init(darktable.imageio);
+  _bench_mark("imageio modules");
 
   if(init_gui)
   {
@@ -855,6 +885,7 @@ int dt_init(int argc, char *argv[], const int init_gui)
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state.state,init_gui);
 #endif
+  _bench_mark("lua");
 
   // last but not least construct the popup that asks the user about images whose xmp files are newer than the db entry
   if(init_gui && changed_xmp_files)
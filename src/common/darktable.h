@@ -75,6 +75,7 @@ typedef	unsigned int	u_int;
 #else
 #define omp_get_max_threads() 1
 #define omp_get_thread_num() 0
+#define omp_get_num_threads() 1
 #endif
 
 #ifndef _RELEASE
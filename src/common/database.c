@@ -882,6 +882,12 @@ lock_again:
                         "operation VARCHAR(256) UNIQUE ON CONFLICT REPLACE, op_params BLOB, enabled INTEGER, "
                         "blendop_params BLOB, blendop_version INTEGER, multi_priority INTEGER, multi_name VARCHAR(256))",
                         NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TABLE memory.paste_targets (imgid INTEGER PRIMARY KEY, src INTEGER, offs INTEGER)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(db->handle,
+                        "CREATE TABLE memory.lua_images (rowid INTEGER PRIMARY KEY, imgid INTEGER)",
+                        NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(db->handle,
                         "CREATE TABLE MEMORY.style_items (styleid INTEGER, num INTEGER, module INTEGER, "
                         "operation VARCHAR(256), op_params BLOB, enabled INTEGER, "
@@ -973,6 +979,21 @@ gboolean dt_database_get_lock_acquired(const dt_database_t *db)
   return db->lock_acquired;
 }
 
+/* all threads share the one sqlite connection, so only one of them may be inside a transaction at a time */
+G_LOCK_DEFINE_STATIC(_database_transaction);
+
+void dt_database_start_transaction(const dt_database_t *db)
+{
+  G_LOCK(_database_transaction);
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "BEGIN TRANSACTION", NULL, NULL, NULL);
+}
+
+void dt_database_release_transaction(const dt_database_t *db)
+{
+  DT_DEBUG_SQLITE3_EXEC(db->handle, "COMMIT", NULL, NULL, NULL);
+  G_UNLOCK(_database_transaction);
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -35,6 +35,10 @@ gboolean dt_database_is_new(const struct dt_database_t *db);
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
 gboolean dt_database_get_lock_acquired(const struct dt_database_t *db);
+/** begin a transaction on the shared connection, waits for the one another thread may have running */
+void dt_database_start_transaction(const struct dt_database_t *db);
+/** commit the transaction started by dt_database_start_transaction() */
+void dt_database_release_transaction(const struct dt_database_t *db);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -31,6 +31,8 @@
 #include <glib.h>
 #include <zlib.h>
 #include <string>
+#include <vector>
+#include <map>
 #include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -879,7 +881,7 @@ int dt_exif_read(dt_image_t *img, const char* path)
   }
 }
 
-int dt_exif_write_blob(uint8_t *blob,uint32_t size, const char* path)
+int dt_exif_write_blob(uint8_t *blob,uint32_t size, const char* path, const char *xmp)
 {
   try
   {
@@ -887,15 +889,21 @@ int dt_exif_write_blob(uint8_t *blob,uint32_t size, const char* path)
     assert (image.get() != 0);
     image->readMetadata();
     Exiv2::ExifData &imgExifData = image->exifData();
-    Exiv2::ExifData blobExifData;
-    Exiv2::ExifParser::decode(blobExifData, blob+6, size);
-    Exiv2::ExifData::const_iterator end = blobExifData.end();
-    for (Exiv2::ExifData::const_iterator i = blobExifData.begin(); i != end; ++i)
+    if(blob)
     {
-      Exiv2::ExifKey key(i->key());
-      if( imgExifData.findKey(key) == imgExifData.end() )
-        imgExifData.add(Exiv2::ExifKey(i->key()),&i->value());
+      Exiv2::ExifData blobExifData;
+      Exiv2::ExifParser::decode(blobExifData, blob+6, size);
+      Exiv2::ExifData::const_iterator end = blobExifData.end();
+      for (Exiv2::ExifData::const_iterator i = blobExifData.begin(); i != end; ++i)
+      {
+        Exiv2::ExifKey key(i->key());
+        if( imgExifData.findKey(key) == imgExifData.end() )
+          imgExifData.add(Exiv2::ExifKey(i->key()),&i->value());
+      }
     }
+    // the xmp packet goes into the same pass, so the file is only rewritten once
+    if(xmp && Exiv2::XmpParser::decode(image->xmpData(), std::string(xmp)) != 0)
+      throw Exiv2::Error(1, "[exif_write_blob] failed to parse xmp packet");
     // Remove thumbnail
     Exiv2::ExifData::iterator it;
     if( (it=imgExifData.findKey(Exiv2::ExifKey("Exif.Thumbnail.Compression"))) !=imgExifData.end() ) imgExifData.erase(it);
@@ -1710,35 +1718,178 @@ int dt_exif_xmp_read (dt_image_t *img, const char* filename, const int history_o
   return 0;
 }
 
-// helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
-static void
-dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
+// everything the xmp data of one image is built from. it is fetched from the db up front, for many images
+// at once when syncing sidecars, so building and serializing the xmp doesn't have to touch the db.
+struct dt_exif_xmp_mask_t
 {
-  const int xmp_version = 1;
-  int stars = 1, raw_params = 0;
-  double longitude = NAN, latitude = NAN;
-  gchar *filename = NULL;
-  // get stars and raw params from db
+  int formid, form, version, points_count;
+  std::string name, points, source;
+};
+
+struct dt_exif_xmp_history_t
+{
+  int modversion, enabled, blendop_version, multi_priority;
+  bool has_operation, has_blendop_params;
+  std::string operation, op_params, blendop_params, multi_name;
+};
+
+struct dt_exif_xmp_image_t
+{
+  int id;
+  bool has_filename;
+  std::string filename;
+  int stars, raw_params;
+  double longitude, latitude;
+  std::vector<std::pair<int, std::string> > metadata;
+  std::vector<std::string> tags;
+  std::vector<int> colorlabels;
+  std::vector<dt_exif_xmp_mask_t> masks;
+  std::vector<dt_exif_xmp_history_t> history;
+
+  dt_exif_xmp_image_t() : id(-1), has_filename(false), stars(1), raw_params(0), longitude(NAN), latitude(NAN) {}
+};
+
+static inline std::string dt_exif_xmp_column_text(sqlite3_stmt *stmt, const int col)
+{
+  const char *text = (const char *)sqlite3_column_text(stmt, col);
+  return text ? std::string(text) : std::string();
+}
+
+static inline std::string dt_exif_xmp_column_blob(sqlite3_stmt *stmt, const int col)
+{
+  const char *blob = (const char *)sqlite3_column_blob(stmt, col);
+  return blob ? std::string(blob, sqlite3_column_bytes(stmt, col)) : std::string();
+}
+
+// fetch the rows of all given images with one query per table
+static void dt_exif_xmp_fetch(std::vector<dt_exif_xmp_image_t> &images)
+{
+  if(images.empty()) return;
+
+  std::map<int, size_t> index;
+  GString *ids = g_string_new(NULL);
+  for(size_t i = 0; i < images.size(); i++)
+  {
+    index[images[i].id] = i;
+    g_string_append_printf(ids, i ? ",%d" : "%d", images[i].id);
+  }
+
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select filename, flags, raw_parameters, longitude, latitude from images where id = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  gchar *query;
+
+  query = g_strdup_printf("select id, filename, flags, raw_parameters, longitude, latitude from images "
+                          "where id in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    filename   = (gchar*)sqlite3_column_text(stmt, 0);
-    stars      = sqlite3_column_int(stmt, 1);
-    raw_params = sqlite3_column_int(stmt, 2);
-    if(sqlite3_column_type(stmt, 3) == SQLITE_FLOAT)
-      longitude  = sqlite3_column_double(stmt, 3);
+    dt_exif_xmp_image_t &image = images[index[sqlite3_column_int(stmt, 0)]];
+    image.has_filename = sqlite3_column_text(stmt, 1) != NULL;
+    image.filename = dt_exif_xmp_column_text(stmt, 1);
+    image.stars = sqlite3_column_int(stmt, 2);
+    image.raw_params = sqlite3_column_int(stmt, 3);
     if(sqlite3_column_type(stmt, 4) == SQLITE_FLOAT)
-      latitude   = sqlite3_column_double(stmt, 4);
+      image.longitude = sqlite3_column_double(stmt, 4);
+    if(sqlite3_column_type(stmt, 5) == SQLITE_FLOAT)
+      image.latitude = sqlite3_column_double(stmt, 5);
   }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf("select id, key, value from meta_data where id in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    images[index[sqlite3_column_int(stmt, 0)]].metadata.push_back(
+        std::make_pair(sqlite3_column_int(stmt, 1), dt_exif_xmp_column_text(stmt, 2)));
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf("select distinct tagged_images.imgid, T.id, T.name from tagged_images "
+                          "join tags T on T.id = tagged_images.tagid where tagged_images.imgid in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    images[index[sqlite3_column_int(stmt, 0)]].tags.push_back(dt_exif_xmp_column_text(stmt, 2));
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf("select imgid, color from color_labels where imgid in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    images[index[sqlite3_column_int(stmt, 0)]].colorlabels.push_back(sqlite3_column_int(stmt, 1));
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf("select imgid, formid, form, name, version, points, points_count, source from mask "
+                          "where imgid in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_exif_xmp_mask_t mask;
+    mask.formid = sqlite3_column_int(stmt, 1);
+    mask.form = sqlite3_column_int(stmt, 2);
+    mask.name = dt_exif_xmp_column_text(stmt, 3);
+    mask.version = sqlite3_column_int(stmt, 4);
+    mask.points = dt_exif_xmp_column_blob(stmt, 5);
+    mask.points_count = sqlite3_column_int(stmt, 6);
+    mask.source = dt_exif_xmp_column_blob(stmt, 7);
+    images[index[sqlite3_column_int(stmt, 0)]].masks.push_back(mask);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  query = g_strdup_printf("select imgid, num, module, operation, op_params, enabled, blendop_params, "
+                          "blendop_version, multi_priority, multi_name from history where imgid in (%s) "
+                          "order by imgid, num", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_exif_xmp_history_t item;
+    item.modversion = sqlite3_column_int(stmt, 2);
+    item.has_operation = sqlite3_column_text(stmt, 3) != NULL;
+    item.operation = dt_exif_xmp_column_text(stmt, 3);
+    item.op_params = dt_exif_xmp_column_blob(stmt, 4);
+    item.enabled = sqlite3_column_int(stmt, 5);
+    item.has_blendop_params = sqlite3_column_blob(stmt, 6) != NULL;
+    item.blendop_params = dt_exif_xmp_column_blob(stmt, 6);
+    item.blendop_version = sqlite3_column_int(stmt, 7);
+    item.multi_priority = sqlite3_column_int(stmt, 8);
+    item.multi_name = dt_exif_xmp_column_text(stmt, 9);
+    images[index[sqlite3_column_int(stmt, 0)]].history.push_back(item);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  g_string_free(ids, TRUE);
+}
+
+// add tags to an xmp array the way they used to be read back from dt_tag_get_list() and friends:
+// last attached first, names containing ',' split up.
+static void dt_exif_xmp_read_tags(Exiv2::Value *v, const std::vector<std::string> &tags)
+{
+  for(std::vector<std::string>::const_reverse_iterator t = tags.rbegin(); t != tags.rend(); ++t)
+  {
+    size_t beg = 0, next;
+    while((next = t->find(',', beg)) != std::string::npos)
+    {
+      v->read(t->substr(beg, next - beg));
+      beg = next + 1;
+    }
+    v->read(t->substr(beg));
+  }
+}
+
+// helper to create an xmp data thing. throws exiv2 exceptions if stuff goes wrong.
+static void
+dt_exif_xmp_fill(Exiv2::XmpData &xmpData, const dt_exif_xmp_image_t &image)
+{
+  const int xmp_version = 1;
+  const int stars = image.stars;
+  double longitude = image.longitude, latitude = image.latitude;
+
   xmpData["Xmp.xmp.Rating"] = ((stars & 0x7) == 6) ? -1 : (stars & 0x7); //rejected image = -1, others = 0..5
 
   // The original file name
-  if(filename)
-    xmpData["Xmp.xmpMM.DerivedFrom"] = filename;
+  if(image.has_filename)
+    xmpData["Xmp.xmpMM.DerivedFrom"] = image.filename;
 
   // GPS data
   if(!isnan(longitude) && !isnan(latitude))
@@ -1768,71 +1919,60 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
     g_free(lat_str);
     g_free(str);
   }
-  sqlite3_finalize(stmt);
 
   // the meta data
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select key, value from meta_data where id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(std::vector<std::pair<int, std::string> >::const_iterator m = image.metadata.begin(); m != image.metadata.end(); ++m)
   {
-    int key = sqlite3_column_int(stmt, 0);
-    switch(key)
+    switch(m->first)
     {
       case DT_METADATA_XMP_DC_CREATOR:
-        xmpData["Xmp.dc.creator"] = sqlite3_column_text(stmt, 1);
+        xmpData["Xmp.dc.creator"] = m->second;
         break;
       case DT_METADATA_XMP_DC_PUBLISHER:
-        xmpData["Xmp.dc.publisher"] = sqlite3_column_text(stmt, 1);
+        xmpData["Xmp.dc.publisher"] = m->second;
         break;
       case DT_METADATA_XMP_DC_TITLE:
-        xmpData["Xmp.dc.title"] = sqlite3_column_text(stmt, 1);
+        xmpData["Xmp.dc.title"] = m->second;
         break;
       case DT_METADATA_XMP_DC_DESCRIPTION:
-        xmpData["Xmp.dc.description"] = sqlite3_column_text(stmt, 1);
+        xmpData["Xmp.dc.description"] = m->second;
         break;
       case DT_METADATA_XMP_DC_RIGHTS:
-        xmpData["Xmp.dc.rights"] = sqlite3_column_text(stmt, 1);
+        xmpData["Xmp.dc.rights"] = m->second;
         break;
 
     }
   }
-  sqlite3_finalize(stmt);
 
   xmpData["Xmp.darktable.xmp_version"] = xmp_version;
-  xmpData["Xmp.darktable.raw_params"] = raw_params;
+  xmpData["Xmp.darktable.raw_params"] = image.raw_params;
 
   if(stars & DT_IMAGE_AUTO_PRESETS_APPLIED)
     xmpData["Xmp.darktable.auto_presets_applied"] = 1;
   else
     xmpData["Xmp.darktable.auto_presets_applied"] = 0;
 
-  // get tags from db, store in dublin core
+  // get tags, store in dublin core. internal darktable tags are omitted, the flat list gets every
+  // level of the hierarchical ones.
   Exiv2::Value::AutoPtr v1 = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.
   Exiv2::Value::AutoPtr v2 = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.
 
-  gchar *tags = NULL;
-  gchar *hierarchical = NULL;
-
-  tags = dt_tag_get_list(imgid, ",");
-  char *beg = tags;
-  while(beg)
-  {
-    char *next = strstr(beg, ",");
-    if(next) *(next++) = 0;
-    v1->read(beg);
-    beg = next;
-  }
-
-  hierarchical = dt_tag_get_hierarchical(imgid, ",");
-  beg = hierarchical;
-  while(beg)
+  std::vector<std::string> tags, hierarchical;
+  for(std::vector<std::string>::const_iterator t = image.tags.begin(); t != image.tags.end(); ++t)
   {
-    char *next = strstr(beg, ",");
-    if(next) *(next++) = 0;
-    v2->read(beg);
-    beg = next;
+    if(g_str_has_prefix(t->c_str(), "darktable|")) continue;
+    hierarchical.push_back(*t);
+    if(t->find('|') == std::string::npos)
+    {
+      tags.push_back(*t);
+      continue;
+    }
+    gchar **pch = g_strsplit(t->c_str(), "|", -1);
+    for(gchar **p = pch; *p; p++) tags.push_back(*p);
+    g_strfreev(pch);
   }
+  dt_exif_xmp_read_tags(v1.get(), tags);
+  dt_exif_xmp_read_tags(v2.get(), hierarchical);
 
   if(v1->count() > 0)
     xmpData.add(Exiv2::XmpKey("Xmp.dc.subject"), v1.get());
@@ -1843,16 +1983,11 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   // color labels
   char val[2048];
   Exiv2::Value::AutoPtr v = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.
-  /* Already initialized v = Exiv2::Value::create(Exiv2::xmpSeq); // or xmpBag or xmpAlt.*/
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select color from color_labels where imgid=?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(std::vector<int>::const_iterator c = image.colorlabels.begin(); c != image.colorlabels.end(); ++c)
   {
-    snprintf(val, sizeof(val), "%d", sqlite3_column_int(stmt, 0));
+    snprintf(val, sizeof(val), "%d", *c);
     v->read(val);
   }
-  sqlite3_finalize(stmt);
   if(v->count() > 0)
     xmpData.add(Exiv2::XmpKey("Xmp.darktable.colorlabels"), v.get());
 
@@ -1874,50 +2009,39 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   // reset tv
   tvm.setXmpArrayType(Exiv2::XmpValue::xaNone);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select imgid, formid, form, name, version, points, points_count, source from mask where imgid = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(std::vector<dt_exif_xmp_mask_t>::const_iterator m = image.masks.begin(); m != image.masks.end(); ++m)
   {
-    int32_t mask_id = sqlite3_column_int(stmt, 1);
-    snprintf(val, sizeof(val), "%d", mask_id);
+    snprintf(val, sizeof(val), "%d", m->formid);
     tvm.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_id[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
 
-    int32_t mask_type = sqlite3_column_int(stmt, 2);
-    snprintf(val, sizeof(val), "%d", mask_type);
+    snprintf(val, sizeof(val), "%d", m->form);
     tvm.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_type[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
 
-    const char *mask_name = (const char *)sqlite3_column_text(stmt, 3);
-    tvm.read(mask_name);
+    tvm.read(m->name);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_name[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
 
-    int32_t mask_version = sqlite3_column_int(stmt, 4);
-    snprintf(val, sizeof(val), "%d", mask_version);
+    snprintf(val, sizeof(val), "%d", m->version);
     tvm.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_version[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
 
-    int32_t len = sqlite3_column_bytes(stmt, 5);
-    char *mask_d = dt_exif_xmp_encode ((const unsigned char *)sqlite3_column_blob(stmt, 5), len, NULL);
+    char *mask_d = dt_exif_xmp_encode ((const unsigned char *)m->points.data(), m->points.size(), NULL);
     tvm.read(mask_d);
     snprintf(key, sizeof(key), "Xmp.darktable.mask[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
     free(mask_d);
 
-    int32_t mask_nb = sqlite3_column_int(stmt, 6);
-    snprintf(val, sizeof(val), "%d", mask_nb);
+    snprintf(val, sizeof(val), "%d", m->points_count);
     tvm.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_nb[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
 
-    len = sqlite3_column_bytes(stmt, 7);
-    char *mask_src = dt_exif_xmp_encode ((const unsigned char *)sqlite3_column_blob(stmt, 7), len, NULL);
+    char *mask_src = dt_exif_xmp_encode ((const unsigned char *)m->source.data(), m->source.size(), NULL);
     tvm.read(mask_src);
     snprintf(key, sizeof(key), "Xmp.darktable.mask_src[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tvm);
@@ -1925,7 +2049,6 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
 
     num ++;
   }
-  sqlite3_finalize (stmt);
 
 
   // history stack:
@@ -1946,73 +2069,64 @@ dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
   // reset tv
   tv.setXmpArrayType(Exiv2::XmpValue::xaNone);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select imgid, num, module, operation, op_params, enabled, blendop_params, "
-                              "blendop_version, multi_priority, multi_name from history where imgid = ?1 order by num",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(std::vector<dt_exif_xmp_history_t>::const_iterator h = image.history.begin(); h != image.history.end(); ++h)
   {
-    int32_t modversion = sqlite3_column_int(stmt, 2);
-    snprintf(val, sizeof(val), "%d", modversion);
+    snprintf(val, sizeof(val), "%d", h->modversion);
     tv.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.history_modversion[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
 
-    int32_t enabled = sqlite3_column_int(stmt, 5);
-    snprintf(val, sizeof(val), "%d", enabled);
+    snprintf(val, sizeof(val), "%d", h->enabled);
     tv.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.history_enabled[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
 
-    const char *op = (const char *)sqlite3_column_text(stmt, 3);
-    if(!op) continue; // no op is fatal.
-    tv.read(op);
+    if(!h->has_operation) continue; // no op is fatal.
+    tv.read(h->operation);
     snprintf(key, sizeof(key), "Xmp.darktable.history_operation[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
 
     /* read and add history params */
-    int32_t len = sqlite3_column_bytes(stmt, 4);
-    char *vparams = dt_exif_xmp_encode ((const unsigned char *)sqlite3_column_blob(stmt, 4), len, NULL);
+    char *vparams = dt_exif_xmp_encode ((const unsigned char *)h->op_params.data(), h->op_params.size(), NULL);
     tv.read(vparams);
     snprintf(key, sizeof(key), "Xmp.darktable.history_params[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
     free(vparams);
 
     /* read and add blendop params */
-    const void *blob = sqlite3_column_blob(stmt, 6);
-    if(!blob) continue; // no params, no history item.
-    len = sqlite3_column_bytes(stmt, 6);
-    vparams = dt_exif_xmp_encode ((const unsigned char *)blob, len, NULL);
+    if(!h->has_blendop_params) continue; // no params, no history item.
+    vparams = dt_exif_xmp_encode ((const unsigned char *)h->blendop_params.data(), h->blendop_params.size(), NULL);
     tv.read(vparams);
     snprintf(key, sizeof(key), "Xmp.darktable.blendop_params[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
     free(vparams);
 
     /* read and add blendop version */
-    int32_t blversion = sqlite3_column_int(stmt, 7);
-    snprintf(val, sizeof(val), "%d", blversion);
+    snprintf(val, sizeof(val), "%d", h->blendop_version);
     tv.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.blendop_version[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
 
     /* read and add multi instances */
-    int32_t mprio = sqlite3_column_int(stmt, 8);
-    snprintf(val, sizeof(val), "%d", mprio);
+    snprintf(val, sizeof(val), "%d", h->multi_priority);
     tv.read(val);
     snprintf(key, sizeof(key), "Xmp.darktable.multi_priority[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
-    const char *mname = (const char *)sqlite3_column_text(stmt, 9);
-    if(mname) tv.read(mname);
-    else tv.read("");
+    tv.read(h->multi_name);
     snprintf(key, sizeof(key), "Xmp.darktable.multi_name[%d]", num);
     xmpData.add(Exiv2::XmpKey(key), &tv);
 
     num ++;
   }
-  sqlite3_finalize (stmt);
-  g_free(tags);
-  g_free(hierarchical);
+}
+
+static void
+dt_exif_xmp_read_data(Exiv2::XmpData &xmpData, const int imgid)
+{
+  std::vector<dt_exif_xmp_image_t> images(1);
+  images[0].id = imgid;
+  dt_exif_xmp_fetch(images);
+  dt_exif_xmp_fill(xmpData, images[0]);
 }
 
 int dt_exif_xmp_attach (const int imgid, const char* filename)
@@ -2048,43 +2162,84 @@ int dt_exif_xmp_attach (const int imgid, const char* filename)
   }
 }
 
-// write xmp sidecar file:
-int dt_exif_xmp_write (const int imgid, const char* filename)
+char *dt_exif_xmp_read_string (const int imgid)
 {
-  // refuse to write sidecar for non-existent image:
-  char imgfname[1024];
-  gboolean from_cache = TRUE;
+  try
+  {
+    char input_filename[1024];
+    gboolean from_cache = FALSE;
+    dt_image_full_path(imgid, input_filename, sizeof(input_filename), &from_cache);
 
-  dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
-  if(!g_file_test(imgfname, G_FILE_TEST_IS_REGULAR)) return 1;
+    // initialize XMP with the one from the original file
+    Exiv2::XmpData xmpData;
+    if(g_file_test(input_filename, G_FILE_TEST_IS_REGULAR))
+    {
+      Exiv2::Image::AutoPtr input_image = Exiv2::ImageFactory::open(input_filename);
+      if(input_image.get() != 0)
+      {
+        input_image->readMetadata();
+        // the IPTC block can't go into the packet, let dt_exif_xmp_attach() copy it as it is
+        if(!input_image->iptcData().empty()) return NULL;
+        xmpData = input_image->xmpData();
+        // the original might have been written by us, don't duplicate our own keys
+        dt_remove_known_keys(xmpData);
+      }
+    }
+    dt_exif_xmp_read_data(xmpData, imgid);
 
+    std::string xmpPacket;
+    if(Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0)
+    {
+      throw Exiv2::Error(1, "[xmp_read_string] failed to serialize xmp data");
+    }
+    return g_strdup(xmpPacket.c_str());
+  }
+  catch (Exiv2::AnyError& e)
+  {
+    std::cerr << "[xmp_read_string] caught exiv2 exception '" << e << "'\n";
+    return NULL;
+  }
+}
+
+// merge the image's data into the sidecar file and replace it atomically, but only if that changes anything.
+// returns 0 if written, 1 if the file was up to date already and -1 on error.
+static int dt_exif_xmp_write_file(const dt_exif_xmp_image_t &image, const char *filename)
+{
   try
   {
     Exiv2::XmpData xmpData;
-    std::string xmpPacket;
+    std::string xmpPacket, oldPacket;
     if(g_file_test(filename, G_FILE_TEST_EXISTS))
     {
-      Exiv2::DataBuf buf = Exiv2::readFile(filename);
-      xmpPacket.assign(reinterpret_cast<char*>(buf.pData_), buf.size_);
-      Exiv2::XmpParser::decode(xmpData, xmpPacket);
+      gchar *contents = NULL;
+      gsize length = 0;
+      if(!g_file_get_contents(filename, &contents, &length, NULL))
+        throw Exiv2::Error(1, "[xmp_write] failed to read existing sidecar");
+      oldPacket.assign(contents, length);
+      g_free(contents);
+      Exiv2::XmpParser::decode(xmpData, oldPacket);
       //because XmpSeq or XmpBag are added to the list, we first have
       //to remove these so that we don't end up with a string of duplicates
       dt_remove_known_keys(xmpData);
     }
 
     // initialize xmp data:
-    dt_exif_xmp_read_data(xmpData, imgid);
+    dt_exif_xmp_fill(xmpData, image);
 
     // serialize the xmp data and output the xmp packet
     if (Exiv2::XmpParser::encode(xmpPacket, xmpData) != 0)
     {
       throw Exiv2::Error(1, "[xmp_write] failed to serialize xmp data");
     }
-    std::ofstream fout(filename);
-    if(fout.is_open())
+    if(xmpPacket == oldPacket) return 1;
+
+    // goes through a temporary file and a rename, so a crash never leaves a truncated sidecar behind
+    GError *error = NULL;
+    if(!g_file_set_contents(filename, xmpPacket.data(), xmpPacket.size(), &error))
     {
-      fout << xmpPacket;
-      fout.close();
+      std::cerr << "[xmp_write] failed to write `" << filename << "': " << error->message << "\n";
+      g_error_free(error);
+      return -1;
     }
     return 0;
   }
@@ -2095,6 +2250,35 @@ int dt_exif_xmp_write (const int imgid, const char* filename)
   }
 }
 
+void dt_exif_xmp_write_files (const int *imgids, const char *const *filenames, const int count, int *results)
+{
+  std::vector<dt_exif_xmp_image_t> images(count);
+  for(int i = 0; i < count; i++) images[i].id = imgids[i];
+  dt_exif_xmp_fetch(images);
+
+  // the db isn't needed anymore, encoding and file io run on all cores
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(images)
+#endif
+  for(int i = 0; i < count; i++)
+    results[i] = dt_exif_xmp_write_file(images[i], filenames[i]);
+}
+
+// write xmp sidecar file:
+int dt_exif_xmp_write (const int imgid, const char* filename)
+{
+  // refuse to write sidecar for non-existent image:
+  char imgfname[1024];
+  gboolean from_cache = TRUE;
+
+  dt_image_full_path(imgid, imgfname, sizeof(imgfname), &from_cache);
+  if(!g_file_test(imgfname, G_FILE_TEST_IS_REGULAR)) return 1;
+
+  int res = 0;
+  dt_exif_xmp_write_files(&imgid, &filename, 1, &res);
+  return res < 0 ? -1 : 0;
+}
+
 int dt_exif_thumbnail(
   const char *filename,
   uint8_t    *out,
@@ -2167,6 +2351,18 @@ static void dt_exif_log_handler(int log_level, const char *message)
     fprintf(stderr, "[exiv2] %s\n", message);
 }
 
+// exiv2's xmp parser is only safe to use from several threads (parallel exports and sidecar writes)
+// when it gets a lock function at initialization.
+static dt_pthread_mutex_t dt_exif_xmp_mutex;
+
+static void dt_exif_xmp_lock(void *data, bool lock)
+{
+  if(lock)
+    dt_pthread_mutex_lock((dt_pthread_mutex_t *)data);
+  else
+    dt_pthread_mutex_unlock((dt_pthread_mutex_t *)data);
+}
+
 void dt_exif_init()
 {
   // mute exiv2:
@@ -2174,7 +2370,8 @@ void dt_exif_init()
   // preface the exiv2 messages with "[exiv2] "
   Exiv2::LogMsg::setHandler(&dt_exif_log_handler);
 
-  Exiv2::XmpParser::initialize();
+  dt_pthread_mutex_init(&dt_exif_xmp_mutex, NULL);
+  Exiv2::XmpParser::initialize(&dt_exif_xmp_lock, &dt_exif_xmp_mutex);
   // this has te stay with the old url (namespace already propagated outside dt)
   Exiv2::XmpProperties::registerNs("http://darktable.sf.net/", "darktable");
   Exiv2::XmpProperties::registerNs("http://ns.adobe.com/lightroom/1.0/", "lr");
@@ -2183,6 +2380,7 @@ void dt_exif_init()
 void dt_exif_cleanup()
 {
   Exiv2::XmpParser::terminate();
+  dt_pthread_mutex_destroy(&dt_exif_xmp_mutex);
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
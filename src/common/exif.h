@@ -36,15 +36,25 @@ extern "C"
   /** write exif to blob, return length in bytes. blob needs to be as large at 65535 bytes. sRGB should be true if sRGB colorspace is used as output. */
   int dt_exif_read_blob(uint8_t *blob, const char* path, const int imgid, const int sRGB, const int out_width, const int out_height, const int dng_mode);
 
-  /** write blob to file exif. merges with existing exif information.*/
-  int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char* path);
+  /** write blob to file exif. merges with existing exif information. blob may be NULL.
+      a non-NULL xmp packet (see dt_exif_xmp_read_string) is written in the same pass. */
+  int dt_exif_write_blob(uint8_t *blob, uint32_t size, const char* path, const char *xmp);
 
   /** write xmp sidecar file. */
   int dt_exif_xmp_write (const int imgid, const char* filename);
 
+  /** write the xmp sidecar files of many images in one go: the db is queried for all of them up front, the
+      files are then merged, serialized and replaced in parallel. results[i] is 0 if filenames[i] was written,
+      1 if it was up to date already and -1 on error. */
+  void dt_exif_xmp_write_files (const int *imgids, const char *const *filenames, const int count, int *results);
+
   /** write xmp packet inside an image. */
   int dt_exif_xmp_attach (const int imgid, const char* filename);
 
+  /** serialize the xmp packet dt_exif_xmp_attach would write, for formats that embed it while encoding. free with g_free().
+      returns NULL if the original carries IPTC data, which only dt_exif_xmp_attach preserves. */
+  char *dt_exif_xmp_read_string (const int imgid);
+
   /** read xmp sidecar file. */
   int dt_exif_xmp_read (dt_image_t * img, const char* filename, const int history_only);
 
@@ -24,6 +24,7 @@
 #include "common/dtpthread.h"
 #include "common/collection.h"
 #include "common/image_cache.h"
+#include "common/mipmap_cache.h"
 #include "common/debug.h"
 #include "views/view.h"
 
@@ -475,6 +476,41 @@ void dt_film_import1(dt_film_t *film)
 
 
 
+void dt_film_import_files(const char *dirname, GList *files)
+{
+  dt_film_t film;
+  dt_film_init(&film);
+  if(!dt_film_new(&film, dirname))
+  {
+    dt_film_cleanup(&film);
+    return;
+  }
+
+  uint32_t imgids[DT_MIPMAP_PREFETCH_MAX];
+  int num = 0;
+  for(GList *f = files; f; f = g_list_next(f))
+  {
+    const uint32_t imgid = dt_image_import(film.id, (const gchar *)f->data, FALSE);
+    if(imgid && num < DT_MIPMAP_PREFETCH_MAX) imgids[num++] = imgid;
+  }
+  dt_film_cleanup(&film);
+  if(!num) return;
+
+  dt_print(DT_DEBUG_FSWATCH, "[film_import_files] imported %d images into `%s'\n", num, dirname);
+
+  // don't touch the collection rules like a full import does, only recount and redraw
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED);
+  dt_control_queue_redraw_center();
+
+  // and have the thumbnails ready at the size the lighttable currently uses:
+  const int iir = MAX(1, dt_conf_get_int("plugins/lighttable/images_in_row"));
+  const int wd = darktable.control->width / iir;
+  const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, wd, wd);
+  dt_mipmap_size_t mips[DT_MIPMAP_PREFETCH_MAX];
+  for(int k=0; k<num; k++) mips[k] = mip;
+  dt_mipmap_cache_prefetch(darktable.mipmap_cache, imgids, mips, num);
+}
+
 void dt_film_remove_empty()
 {
   // remove all empty film rolls from db:
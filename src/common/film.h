@@ -53,6 +53,8 @@ int dt_film_open_recent(const int32_t num);
 int dt_film_import(const char *dirname);
 /** helper for import threads. */
 void dt_film_import1(dt_film_t *film);
+/** import the given files (full paths) into the film roll of dirname, creating it if needed, and load their thumbnails in the background. */
+void dt_film_import_files(const char *dirname, GList *files);
 /** constructs the lighttable/query setting for this film, respecting stars and filters. */
 void dt_film_set_query(const int32_t id);
 /** removes this film and all its images from db. */
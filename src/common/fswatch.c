@@ -20,9 +20,14 @@
 #endif
 
 #include "common/darktable.h"
+#include "common/debug.h"
 #include "common/dtpthread.h"
 #include "common/image.h"
 #include "common/fswatch.h"
+#include "common/mipmap_cache.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs/film_jobs.h"
 #include "develop/develop.h"
 
 #include <stdio.h>
@@ -30,7 +35,8 @@
 #include <errno.h>
 #include <glib.h>
 #include <strings.h>
-#if 0//def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
+#include <poll.h>
 #include <sys/inotify.h>
 #endif
 
@@ -41,106 +47,229 @@ typedef struct _watch_t
   dt_fswatch_type_t type;        // DT_FSWATCH_* type
   void *data;				// Assigned data
   int events;				// events occurred..
+  GHashTable *ready;    // DT_FSWATCH_IMPORT_DIRECTORY: names of written files not imported yet
+  gint64 last_event;    // DT_FSWATCH_IMPORT_DIRECTORY: time of the last event, to coalesce them
 } _watch_t;
 
 
-#if 0// def  HAVE_INOTIFY
+#ifdef HAVE_INOTIFY
 
-typedef struct inotify_event_t
+// new files of a directory are imported once nothing happened in there for this long (in us),
+#define DT_FSWATCH_IMPORT_QUIET 1000000
+// or when this many are written already, so the lighttable fills while a big copy is running.
+#define DT_FSWATCH_IMPORT_BATCH 256
+
+static void _fswatch_item_free(gpointer data)
 {
-  uint32_t wd;       /* Watch descriptor */
-  uint32_t mask;     /* Mask of events */
-  uint32_t cookie;   /* Unique cookie associating related events (for rename(2)) */
-  uint32_t len;      /* Size of 'name' field */
-  char     name[];   /* Optional null-terminated name */
-} inotify_event_t;
-
-// Compare func for GList
-static gint _fswatch_items_by_data(const void* a,const void *b)
+  _watch_t *item = (_watch_t *)data;
+  if(item->ready) g_hash_table_destroy(item->ready);
+  g_free(item);
+}
+
+static gboolean _fswatch_image_reload(gpointer data)
+{
+  // runs in the gui thread: drop the thumbnails and reload the image if it's being developed
+  const int imgid = GPOINTER_TO_INT(data);
+  gboolean i_own_lock = dt_control_gdk_lock();
+  dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+  if(darktable.develop && darktable.develop->image_storage.id == imgid)
+    dt_dev_reload_image(darktable.develop, imgid);
+  if(i_own_lock) dt_control_gdk_unlock();
+  return FALSE;
+}
+
+static void _fswatch_image_changed(const dt_image_t *img)
+{
+  // something wrote on image externally. the watch thread holds fswatch->mutex, leave the reload to the gui.
+  g_idle_add(_fswatch_image_reload, GINT_TO_POINTER(img->id));
+}
+
+static void _fswatch_directory_event(_watch_t *item, const struct inotify_event *event)
 {
-  return (((_watch_t*)a)->data<b)?-1:((((_watch_t*)a)->data==b)?0:1);
+  // only complete, visible image files count. a file that is created again or
+  // moved away before we got to import it has to wait for the next close.
+  if(event->len == 0 || event->name[0] == '.' || !dt_supported_image(event->name)) return;
+  item->last_event = g_get_monotonic_time();
+  if(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+    g_hash_table_insert(item->ready, g_strdup(event->name), GINT_TO_POINTER(1));
+  else if(event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM))
+    g_hash_table_remove(item->ready, event->name);
 }
 
-// Compare func for GList
-static gint _fswatch_items_by_descriptor(const void *a,const void *b)
+static void _fswatch_directory_rescan(_watch_t *item)
 {
-  gint result=(((_watch_t*)a)->descriptor < *(const int *)b)?-1:((((_watch_t*)a)->descriptor==*(const int *)b)?0:1);
-  return result;
+  // the kernel queue overflowed and events are lost: pick up every image in there
+  // that isn't in the film roll yet. files still being written are imported once
+  // things have been quiet for a while, like everything else.
+  const char *dirname = (const char *)item->data;
+  GDir *dir = g_dir_open(dirname, 0, NULL);
+  if(!dir) return;
+
+  GHashTable *known = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select filename from images join film_rolls on images.film_id = film_rolls.id "
+                              "where film_rolls.folder = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, dirname, -1, SQLITE_STATIC);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    g_hash_table_insert(known, g_strdup((const char *)sqlite3_column_text(stmt, 0)), GINT_TO_POINTER(1));
+  sqlite3_finalize(stmt);
+
+  const gchar *name;
+  int num = 0;
+  while((name = g_dir_read_name(dir)))
+  {
+    if(name[0] == '.' || !dt_supported_image(name) || g_hash_table_lookup(known, name)) continue;
+    gchar *filename = g_build_filename(dirname, name, NULL);
+    if(g_file_test(filename, G_FILE_TEST_IS_REGULAR))
+    {
+      g_hash_table_insert(item->ready, g_strdup(name), GINT_TO_POINTER(1));
+      num++;
+    }
+    g_free(filename);
+  }
+  g_dir_close(dir);
+  g_hash_table_destroy(known);
+  item->last_event = g_get_monotonic_time();
+  dt_print(DT_DEBUG_FSWATCH, "[fswatch_thread] rescanned %s after queue overflow, %d files not imported\n", dirname, num);
+}
+
+static void _fswatch_directory_flush(_watch_t *item, const gint64 now)
+{
+  const guint num = g_hash_table_size(item->ready);
+  if(num == 0) return;
+  if(num < DT_FSWATCH_IMPORT_BATCH && now - item->last_event < DT_FSWATCH_IMPORT_QUIET) return;
+  if(!dt_control_running()) return;
+
+  const char *dirname = (const char *)item->data;
+  GList *files = NULL;
+  GHashTableIter it;
+  gpointer name;
+  g_hash_table_iter_init(&it, item->ready);
+  while(g_hash_table_iter_next(&it, &name, NULL))
+    files = g_list_prepend(files, g_build_filename(dirname, (const char *)name, NULL));
+  files = g_list_sort(files, (GCompareFunc)g_strcmp0);
+
+  dt_job_t job;
+  dt_film_import_files_init(&job, g_strdup(dirname), files);
+  if(dt_control_add_job(darktable.control, &job))
+  {
+    // queue is full, keep the files and try again later
+    g_list_free_full(files, g_free);
+    g_free(((dt_film_import_files_t *)job.param)->dirname);
+    return;
+  }
+  dt_print(DT_DEBUG_FSWATCH, "[fswatch_thread] importing %d new files in %s\n", num, dirname);
+  g_hash_table_remove_all(item->ready);
 }
 
+static void _fswatch_event(dt_fswatch_t *fswatch, const struct inotify_event *event)
+{
+  if(event->mask & IN_Q_OVERFLOW)
+  {
+    // comes without a watch (wd is -1), any of them might have missed events
+    dt_print(DT_DEBUG_FSWATCH, "[fswatch_thread] inotify queue overflow\n");
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, fswatch->items);
+    while(g_hash_table_iter_next(&it, NULL, &value))
+    {
+      _watch_t *item = (_watch_t *)value;
+      if(item->type == DT_FSWATCH_IMPORT_DIRECTORY) _fswatch_directory_rescan(item);
+    }
+    return;
+  }
+
+  _watch_t *item = g_hash_table_lookup(fswatch->items, GINT_TO_POINTER(event->wd));
+  if(!item)
+  {
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %d\n", event->wd );
+    return;
+  }
+  item->events=item->events|event->mask;
+
+  switch( item->type )
+  {
+    case DT_FSWATCH_IMAGE:
+    {
+      if( (event->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
+      {
+        _fswatch_image_changed((const dt_image_t *)item->data);
+        item->events=0;
+      }
+      else if( (event->mask&IN_IGNORED) && (item->events&IN_DELETE_SELF) )
+      {
+        // This pattern showed up when another file is replacing the original,
+        // the watch is gone with the old file then.
+        _fswatch_image_changed((const dt_image_t *)item->data);
+        item->events=0;
+      }
+    }
+    break;
+
+    case DT_FSWATCH_IMPORT_DIRECTORY:
+      _fswatch_directory_event(item, event);
+      item->events=0;
+      break;
+
+    default:
+      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %d\n", item->type, event->wd );
+      break;
+  }
+
+  if(event->mask & IN_IGNORED)
+  {
+    // the kernel dropped the watch, the file or directory is gone
+    g_hash_table_remove(fswatch->items_by_data, item->data);
+    g_hash_table_remove(fswatch->items, GINT_TO_POINTER(event->wd));
+  }
+}
 
 static void *_fswatch_thread(void *data)
 {
   dt_fswatch_t *fswatch=(dt_fswatch_t *)data;
-  uint32_t res=0;
-  uint32_t event_hdr_size=sizeof(inotify_event_t);
-  inotify_event_t *event_hdr=g_malloc(sizeof(inotify_event_t));
-  memset (event_hdr,0,event_hdr_size);
-  char *name=g_malloc(2048);
-  memset (name,0, 2048);
+  // one read gets all events queued so far, copying a few thousand files
+  // shouldn't mean a few thousand wakeups.
+  char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd = { .fd = fswatch->inotify_fd, .events = POLLIN };
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Starting thread of context %p\n", data);
-  while(1)
+  while(!fswatch->quit)
   {
-    // Blocking read loop of event fd into event
-    if(read(fswatch->inotify_fd,event_hdr,event_hdr_size) != event_hdr_size)
+    // wake up now and then to flush batches and to notice quit
+    const int res = poll(&pfd, 1, 250);
+    if(res < 0 && errno != EINTR)
     {
-      if(errno == EINTR) continue;
-      perror("[fswatch_thread] read inotify fd");
+      perror("[fswatch_thread] poll inotify fd");
       break;
     }
-
-    // Read name into buffer if any...
-    if( event_hdr->len > 0 )
+    ssize_t len = 0;
+    if(res > 0 && (len = read(fswatch->inotify_fd, buf, sizeof(buf))) < 0)
     {
-      res=read(fswatch->inotify_fd,name,event_hdr_size);
-      name[res]='\0';
+      if(errno == EINTR || errno == EAGAIN) continue;
+      perror("[fswatch_thread] read inotify fd");
+      break;
     }
 
     dt_pthread_mutex_lock(&fswatch->mutex);
-    GList *gitem=g_list_find_custom(fswatch->items,&event_hdr->wd,&_fswatch_items_by_descriptor);
-    if( gitem )
+    for(char *p = buf; p < buf + len; )
     {
-      _watch_t *item = gitem->data;
-      item->events=item->events|event_hdr->mask;
-
-      switch( item->type )
-      {
-        case DT_FSWATCH_IMAGE:
-        {
-          if( (event_hdr->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
-          {
-            //  Something wrote on image externally and closed it, lets tag item as dirty...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-          else if( (event_hdr->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
-          {
-            // This pattern showed up when another file is replacing the original...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-        }
-        break;
-
-        default:
-          dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %ld\n", item->type, event_hdr->wd );
-          break;
-      }
+      const struct inotify_event *event = (const struct inotify_event *)p;
+      _fswatch_event(fswatch, event);
+      p += sizeof(struct inotify_event) + event->len;
     }
-    else
-      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %ld\n", event_hdr->wd );
 
+    const gint64 now = g_get_monotonic_time();
+    GHashTableIter it;
+    gpointer value;
+    g_hash_table_iter_init(&it, fswatch->items);
+    while(g_hash_table_iter_next(&it, NULL, &value))
+    {
+      _watch_t *item = (_watch_t *)value;
+      if(item->type == DT_FSWATCH_IMPORT_DIRECTORY) _fswatch_directory_flush(item, now);
+    }
     dt_pthread_mutex_unlock(&fswatch->mutex);
   }
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] terminating.\n");
-  g_free(event_hdr);
-  g_free(name);
   return NULL;
 }
 
@@ -152,12 +281,13 @@ const dt_fswatch_t* dt_fswatch_new()
 {
   dt_fswatch_t *fswatch=g_malloc(sizeof(dt_fswatch_t));
   memset (fswatch, 0, sizeof(dt_fswatch_t));
-  if((fswatch->inotify_fd=inotify_init())==-1)
+  if((fswatch->inotify_fd=inotify_init1(IN_NONBLOCK | IN_CLOEXEC))==-1)
   {
     g_free(fswatch);
     return NULL;
   }
-  fswatch->items=NULL;
+  fswatch->items=g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _fswatch_item_free);
+  fswatch->items_by_data=g_hash_table_new(g_direct_hash, g_direct_equal);
   dt_pthread_mutex_init(&fswatch->mutex, NULL);
   pthread_create(&fswatch->thread, NULL, &_fswatch_thread, fswatch);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_new] Creating new context %p\n", fswatch);
@@ -167,22 +297,21 @@ const dt_fswatch_t* dt_fswatch_new()
 
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
 {
+  if(!fswatch) return;
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_destroy] Destroying context %p\n", fswatch);
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  ctx->quit = 1;
+  pthread_join(ctx->thread, NULL);
+  close(ctx->inotify_fd);
   dt_pthread_mutex_destroy(&ctx->mutex);
-//FIXME: g_list_free_full maybe?
-  GList *item=g_list_first(fswatch->items);
-  while(item)
-  {
-    g_free( item->data );
-    item=g_list_next(item);
-  }
-  g_list_free(fswatch->items);
+  g_hash_table_destroy(ctx->items_by_data);
+  g_hash_table_destroy(ctx->items);
   g_free(ctx);
 }
 
 void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
+  if(!fswatch) return;
   char filename[DT_MAX_PATH_LEN];
   uint32_t mask=0;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
@@ -191,8 +320,19 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   switch(type)
   {
     case DT_FSWATCH_IMAGE:
+    {
+      gboolean from_cache = FALSE;
       mask=IN_ALL_EVENTS;
-      dt_image_full_path(((dt_image_t *)data)->id, filename, DT_MAX_PATH_LEN);
+      dt_image_full_path(((dt_image_t *)data)->id, filename, DT_MAX_PATH_LEN, &from_cache);
+      break;
+    }
+    case DT_FSWATCH_IMPORT_DIRECTORY:
+      // no IN_MODIFY, that's one event per write() of every file being copied in
+      mask=IN_CLOSE_WRITE|IN_MOVED_TO|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_ONLYDIR;
+      g_strlcpy(filename, (const char *)data, sizeof(filename));
+      // film rolls are looked up by folder name, so no trailing separator
+      for(size_t l = strlen(filename); l > 1 && filename[l-1] == G_DIR_SEPARATOR; l--) filename[l-1] = '\0';
+      data = (void *)g_intern_string(filename);
       break;
     case DT_FSWATCH_CURVE_DIRECTORY:
       break;
@@ -204,11 +344,22 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   if(filename[0] != '\0')
   {
     dt_pthread_mutex_lock(&ctx->mutex);
-    _watch_t *item = g_malloc(sizeof(_watch_t));
+    const int descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
+    if(descriptor == -1 || g_hash_table_lookup(ctx->items, GINT_TO_POINTER(descriptor)))
+    {
+      // inotify hands out the same descriptor for the same file twice
+      dt_pthread_mutex_unlock(&ctx->mutex);
+      dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] No watch added on file %s\n", filename);
+      return;
+    }
+    _watch_t *item = g_malloc0(sizeof(_watch_t));
     item->type=type;
     item->data=data;
-    ctx->items=g_list_append(fswatch->items, item);
-    item->descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
+    item->descriptor=descriptor;
+    if(type == DT_FSWATCH_IMPORT_DIRECTORY)
+      item->ready=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    g_hash_table_insert(ctx->items, GINT_TO_POINTER(descriptor), item);
+    g_hash_table_insert(ctx->items_by_data, data, item);
     dt_pthread_mutex_unlock(&ctx->mutex);
     dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Watch on object %p added on file %s\n", data,filename);
   }
@@ -219,16 +370,23 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
 
 void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
+  if(!fswatch) return;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  if(type == DT_FSWATCH_IMPORT_DIRECTORY)
+  {
+    char dirname[DT_MAX_PATH_LEN];
+    g_strlcpy(dirname, (const char *)data, sizeof(dirname));
+    for(size_t l = strlen(dirname); l > 1 && dirname[l-1] == G_DIR_SEPARATOR; l--) dirname[l-1] = '\0';
+    data = (void *)g_intern_string(dirname);
+  }
   dt_pthread_mutex_lock(&ctx->mutex);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_remove] removing watch on object %p\n", data);
-  GList *gitem=g_list_find_custom(fswatch->items,data,&_fswatch_items_by_data);
-  if( gitem )
+  _watch_t *item=g_hash_table_lookup(ctx->items_by_data, data);
+  if( item )
   {
-    _watch_t *item=gitem->data;
-    ctx->items=g_list_remove(ctx->items,item);
+    g_hash_table_remove(ctx->items_by_data, data);
     inotify_rm_watch(fswatch->inotify_fd,item->descriptor);
-    g_free(item);
+    g_hash_table_remove(ctx->items, GINT_TO_POINTER(item->descriptor));
   }
   else
     dt_print(DT_DEBUG_FSWATCH,"[fswatch_remove] Didn't find watch on object %p type %d\n", data,type);
@@ -236,6 +394,21 @@ void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void
   dt_pthread_mutex_unlock(&ctx->mutex);
 }
 
+void dt_fswatch_add_hot_folders(const dt_fswatch_t *fswatch)
+{
+  gchar *folders = dt_conf_get_string("plugins/lighttable/import/hot_folders");
+  if(!folders) return;
+  gchar **dirs = g_strsplit(folders, G_SEARCHPATH_SEPARATOR_S, -1);
+  for(int k=0; dirs[k]; k++)
+  {
+    gchar *dir = g_strstrip(dirs[k]);
+    if(dir[0] && g_file_test(dir, G_FILE_TEST_IS_DIR))
+      dt_fswatch_add(fswatch, DT_FSWATCH_IMPORT_DIRECTORY, dir);
+  }
+  g_strfreev(dirs);
+  g_free(folders);
+}
+
 #else	// HAVE_INOTIFY
 const dt_fswatch_t* dt_fswatch_new()
 {
@@ -245,6 +418,7 @@ const dt_fswatch_t* dt_fswatch_new()
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch) {}
 void dt_fswatch_add(const dt_fswatch_t *fswatch, dt_fswatch_type_t type, void *data) {}
 void dt_fswatch_remove(const dt_fswatch_t * fswatch, dt_fswatch_type_t type, void *data) {}
+void dt_fswatch_add_hot_folders(const dt_fswatch_t *fswatch) {}
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -25,10 +25,12 @@
 /** fswatch context */
 typedef struct dt_fswatch_t
 {
-  uint32_t inotify_fd;
+  int inotify_fd;
   dt_pthread_mutex_t mutex;
   pthread_t thread;
-  GList *items;
+  int quit;
+  GHashTable *items;          // watch descriptor -> watch
+  GHashTable *items_by_data;  // assigned data -> watch
 }
 dt_fswatch_t;
 
@@ -39,6 +41,9 @@ typedef enum dt_fswatch_type_t
   DT_FSWATCH_IMAGE = 0,
   /** watch is on directory for curves files << Just an test  */
   DT_FSWATCH_CURVE_DIRECTORY,
+  /** watch is on a directory, image files are imported once they are written.
+      data is the directory name. */
+  DT_FSWATCH_IMPORT_DIRECTORY,
 }
 dt_fswatch_type_t;
 
@@ -50,6 +55,8 @@ void dt_fswatch_destroy(const dt_fswatch_t *fswatch);
 void dt_fswatch_add(const dt_fswatch_t *fswatch, dt_fswatch_type_t type, void *data);
 /** removes an watch of type and assigned data. */
 void dt_fswatch_remove(const dt_fswatch_t * fswatch, dt_fswatch_type_t type, void *data);
+/** adds import directory watches for the hot folders set in the config. */
+void dt_fswatch_add_hot_folders(const dt_fswatch_t *fswatch);
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -17,6 +17,9 @@
 */
 
 
+#ifndef DT_UNIT_TEST
+#include "common/darktable.h"
+#endif
 #include <math.h>
 #include <assert.h>
 #include <xmmintrin.h>
@@ -26,6 +29,20 @@
 #define CLAMPF(a, mn, mx) ((a) < (mn) ? (mn) : ((a) > (mx) ? (mx) : (a)))
 #define MMCLAMPPS(a, mn, mx) (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
 #define BLOCKSIZE 32
+// number of lines (columns in the vertical, rows in the horizontal pass) that are
+// filtered together. the recursion along a line is strictly serial, interleaving
+// several independent lines fills the sse lanes and hides the latency.
+#define STRIP 16
+
+static inline size_t
+_scratch_size(const int width, const int height, const int channels)
+{
+  // two transposed strips of the longest line plus the ring buffer for the box filter,
+  // whose radius never needs to exceed the line length.
+  const size_t len = MAX(width, height);
+  const size_t n = (STRIP*channels + 3) & ~3;
+  return (3*len + 1) * n;
+}
 
 static
 void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1, float *a2, float *a3,
@@ -87,9 +104,10 @@ dt_gaussian_memory_use(
   const int height,      // height of input image
   const int channels)    // channels per pixel
 {
-  size_t mem_use = (size_t)width*height*channels*sizeof(float);
+  size_t mem_use = (size_t)width*height*channels*sizeof(float)
+                   + _scratch_size(width, height, channels)*dt_get_num_threads()*sizeof(float);
 #ifdef HAVE_OPENCL
-  mem_use = (size_t)(width+BLOCKSIZE)*(height+BLOCKSIZE)*channels*sizeof(float)*2;
+  mem_use = MAX(mem_use, (size_t)(width+BLOCKSIZE)*(height+BLOCKSIZE)*channels*sizeof(float)*2);
 #endif
   return mem_use;
 }
@@ -126,7 +144,9 @@ dt_gaussian_init(
   g->channels = channels;
   g->sigma = sigma;
   g->order = order;
+  g->approximate = 0;
   g->buf = NULL;
+  g->scratch = NULL;
   g->max = (float *)malloc(channels * sizeof(float));
   g->min = (float *)malloc(channels * sizeof(float));
 
@@ -141,9 +161,13 @@ dt_gaussian_init(
   g->buf = dt_alloc_align(64, (size_t)width*height*channels*sizeof(float));
   if(!g->buf) goto error;
 
+  g->scratch = dt_alloc_align(64, _scratch_size(width, height, channels)*dt_get_num_threads()*sizeof(float));
+  if(!g->scratch) goto error;
+
   return g;
 
 error:
+  dt_free_align(g->scratch);
   dt_free_align(g->buf);
   free(g->max);
   free(g->min);
@@ -152,173 +176,214 @@ error:
 }
 
 
-void
-dt_gaussian_blur(
-  dt_gaussian_t *g,
-  float    *in,
-  float    *out)
+typedef struct dt_gaussian_coeffs_t
 {
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+}
+dt_gaussian_coeffs_t;
 
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = g->channels;
 
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+static inline int
+_box_radius(const float sigma)
+{
+  // three passes of a box of width w have a variance of 3*(w*w - 1)/12
+  return MAX(0, (int)((sqrtf(4.0f*sigma*sigma + 1.0f) - 1.0f) * 0.5f + 0.5f));
+}
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+static inline int
+_use_box(const dt_gaussian_t *g)
+{
+  return g->approximate && g->order == DT_IOP_GAUSSIAN_ZERO && g->sigma >= DT_GAUSSIAN_BOX_MIN_SIGMA;
+}
 
-  float *temp = g->buf;
+/**
+ * run the recursive filter along len steps over n interleaved values
+ * (lines times channels). value c of step k is found at in[k*stride + c],
+ * vmin/vmax hold the clamping bounds per value. n needs to be a multiple of 4,
+ * in and out must not overlap.
+ */
+static void
+_strip_iir(const float *const in, float *const out, const int len, const int n, const size_t stride,
+           const float *const vmin, const float *const vmax, const dt_gaussian_coeffs_t *c)
+{
+  const int nv = n / 4;
+  __m128 xp[nv], yb[nv], yp[nv];
 
-  float *Labmax = g->max;
-  float *Labmin = g->min;
+  const __m128 a0 = _mm_set1_ps(c->a0), a1 = _mm_set1_ps(c->a1), a2 = _mm_set1_ps(c->a2), a3 = _mm_set1_ps(c->a3);
+  const __m128 b1 = _mm_set1_ps(c->b1), b2 = _mm_set1_ps(c->b2);
 
-  // vertical blur column by column
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int i=0; i<width; i++)
+  // forward filter
+  for(int v=0; v<nv; v++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k=0; k<ch; k++)
-    {
-      xp[k] = CLAMPF(in[(size_t)i*ch+k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
-    }
+    xp[v] = MMCLAMPPS(_mm_loadu_ps(in + 4*v), _mm_loadu_ps(vmin + 4*v), _mm_loadu_ps(vmax + 4*v));
+    yb[v] = _mm_mul_ps(_mm_set1_ps(c->coefp), xp[v]);
+    yp[v] = yb[v];
+  }
 
-    for(int j=0; j<height; j++)
+  for(int k=0; k<len; k++)
+  {
+    const float *x = in + k*stride;
+    float *y = out + k*stride;
+    for(int v=0; v<nv; v++)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        temp[offset+k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(x + 4*v), _mm_loadu_ps(vmin + 4*v), _mm_loadu_ps(vmax + 4*v));
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xc, a0),
+                                   _mm_sub_ps(_mm_mul_ps(xp[v], a1),
+                                              _mm_add_ps(_mm_mul_ps(yp[v], b1), _mm_mul_ps(yb[v], b2))));
+      _mm_storeu_ps(y + 4*v, yc);
+      xp[v] = xc;
+      yb[v] = yp[v];
+      yp[v] = yc;
     }
+  }
 
-    // backward filter
-    for(int k=0; k<ch; k++)
-    {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i)*ch+k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
+  // backward filter, reusing the state arrays as xn, xa, yn, ya
+  __m128 *xn = xp, *yn = yp, *ya = yb, xa[nv];
+  for(int v=0; v<nv; v++)
+  {
+    xn[v] = MMCLAMPPS(_mm_loadu_ps(in + (len-1)*stride + 4*v), _mm_loadu_ps(vmin + 4*v), _mm_loadu_ps(vmax + 4*v));
+    xa[v] = xn[v];
+    yn[v] = _mm_mul_ps(_mm_set1_ps(c->coefn), xn[v]);
+    ya[v] = yn[v];
+  }
 
-    for(int j=height - 1; j > -1; j--)
+  for(int k=len-1; k>=0; k--)
+  {
+    const float *x = in + k*stride;
+    float *y = out + k*stride;
+    for(int v=0; v<nv; v++)
     {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset+k], Labmin[k], Labmax[k]);
+      const __m128 xc = MMCLAMPPS(_mm_loadu_ps(x + 4*v), _mm_loadu_ps(vmin + 4*v), _mm_loadu_ps(vmax + 4*v));
+      const __m128 yc = _mm_add_ps(_mm_mul_ps(xn[v], a2),
+                                   _mm_sub_ps(_mm_mul_ps(xa[v], a3),
+                                              _mm_add_ps(_mm_mul_ps(yn[v], b1), _mm_mul_ps(ya[v], b2))));
+      xa[v] = xn[v];
+      xn[v] = xc;
+      ya[v] = yn[v];
+      yn[v] = yc;
+      _mm_storeu_ps(y + 4*v, _mm_add_ps(_mm_loadu_ps(y + 4*v), yc));
+    }
+  }
+}
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+/**
+ * one pass of a box filter of the given radius along len steps over n interleaved
+ * values, with the image edges repeated. in and out may be the same buffer, ring
+ * holds (radius+1)*n floats of scratch space to keep the overwritten inputs.
+ * the input is clamped to vmin/vmax. n needs to be a multiple of 4.
+ */
+static void
+_strip_box(const float *const in, float *const out, const int len, const int n, const size_t stride,
+           const int radius, float *const ring, const float *const vmin, const float *const vmax)
+{
+  const int nv = n / 4;
+  const int rs = radius + 1;
+  const __m128 norm = _mm_set1_ps(1.0f / (2*radius + 1));
+  __m128 sum[nv];
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+#define BOX_LOAD(k, v) MMCLAMPPS(_mm_loadu_ps(in + (size_t)CLAMPF((k), 0, len-1)*stride + 4*(v)), \
+                                 _mm_loadu_ps(vmin + 4*(v)), _mm_loadu_ps(vmax + 4*(v)))
 
-        temp[offset+k] += yc[k];
-      }
-    }
+  // window around the first step, and the inputs left of the image go to the ring buffer.
+  // input m lives in slot m % (radius+1) until it drops out of the window.
+  for(int v=0; v<nv; v++)
+  {
+    sum[v] = _mm_setzero_ps();
+    for(int k=-radius; k<=radius; k++) sum[v] = _mm_add_ps(sum[v], BOX_LOAD(k, v));
+    for(int m=-radius; m<0; m++) _mm_storeu_ps(ring + (m + rs)*n + 4*v, BOX_LOAD(m, v));
   }
 
-  // horizontal blur line by line
-#ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,temp,Labmin,Labmax,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
-#endif
-  for(int j=0; j<height; j++)
+  for(int k=0; k<len; k++)
   {
-    float xp[ch];
-    float yb[ch];
-    float yp[ch];
-    float xc[ch];
-    float yc[ch];
-    float xn[ch];
-    float xa[ch];
-    float yn[ch];
-    float ya[ch];
-
-    // forward filter
-    for(int k=0; k<ch; k++)
+    const float *x = in + k*stride;
+    const float *xnext = in + (size_t)MIN(k + radius + 1, len - 1)*stride;
+    float *y = out + k*stride;
+    float *cur = ring + (k % rs)*n;
+    const float *old = ring + (((k - radius) % rs + rs) % rs)*n;
+    for(int v=0; v<nv; v++)
     {
-      xp[k] = CLAMPF(temp[(size_t)j*width*ch+k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-      xc[k] = yc[k] = xn[k] = xa[k] = yn[k] = ya[k] = 0.0f;
+      const __m128 lo = _mm_loadu_ps(vmin + 4*v), hi = _mm_loadu_ps(vmax + 4*v);
+      // keep input k before it is overwritten in place, input k+radius+1 is still untouched.
+      _mm_storeu_ps(cur + 4*v, MMCLAMPPS(_mm_loadu_ps(x + 4*v), lo, hi));
+      const __m128 next = MMCLAMPPS(_mm_loadu_ps(xnext + 4*v), lo, hi);
+      _mm_storeu_ps(y + 4*v, _mm_mul_ps(sum[v], norm));
+      sum[v] = _mm_add_ps(sum[v], _mm_sub_ps(next, _mm_loadu_ps(old + 4*v)));
     }
+  }
+#undef BOX_LOAD
+}
 
-    for(int i=0; i<width; i++)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        out[offset+k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
+/**
+ * filter up to STRIP lines of len pixels each. pixel k of line l starts at
+ * in[l*lstride + k*kstride]. lines which are interleaved in memory (neighbouring
+ * columns) are filtered directly, everything else is gathered into a transposed
+ * strip in scratch first, one cache sized block of steps at a time.
+ */
+static void
+_blur_strip(const dt_gaussian_t *g, const dt_gaussian_coeffs_t *c, const int radius,
+            const float *const in, float *const out, const int lines, const int len,
+            const size_t lstride, const size_t kstride,
+            const float *const vmin, const float *const vmax, float *const scratch)
+{
+  const int ch = g->channels;
+  const int r = MIN(radius, len);
 
-    // backward filter
-    for(int k=0; k<ch; k++)
+  if(lstride == ch && kstride >= (size_t)lines*ch && (lines*ch) % 4 == 0)
+  {
+    if(radius > 0)
     {
-      xn[k] = CLAMPF(temp[((size_t)(j + 1)*width - 1)*ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
+      _strip_box(in, out, len, lines*ch, kstride, r, scratch, vmin, vmax);
+      _strip_box(out, out, len, lines*ch, kstride, r, scratch, vmin, vmax);
+      _strip_box(out, out, len, lines*ch, kstride, r, scratch, vmin, vmax);
     }
+    else
+      _strip_iir(in, out, len, lines*ch, kstride, vmin, vmax, c);
+    return;
+  }
 
-    for(int i=width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      for(int k=0; k<ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset+k], Labmin[k], Labmax[k]);
+  const int n = (lines*ch + 3) & ~3;
+  float *tin = scratch;
+  float *tout = scratch + (size_t)len*n;
+  float *ring = scratch + (size_t)2*len*n;
 
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
+  for(int k0=0; k0<len; k0+=BLOCKSIZE)
+  {
+    const int k1 = MIN(k0 + BLOCKSIZE, len);
+    for(int l=0; l<lines; l++)
+      for(int k=k0; k<k1; k++)
+        for(int i=0; i<ch; i++)
+          tin[(size_t)k*n + l*ch + i] = in[l*lstride + k*kstride + i];
+    for(int k=k0; k<k1; k++)
+      for(int i=lines*ch; i<n; i++)
+        tin[(size_t)k*n + i] = 0.0f;
+  }
 
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+  float *res = tin;
+  if(radius > 0)
+  {
+    _strip_box(tin, tin, len, n, n, r, ring, vmin, vmax);
+    _strip_box(tin, tin, len, n, n, r, ring, vmin, vmax);
+    _strip_box(tin, tin, len, n, n, r, ring, vmin, vmax);
+  }
+  else
+  {
+    _strip_iir(tin, tout, len, n, n, vmin, vmax, c);
+    res = tout;
+  }
 
-        out[offset+k] += yc[k];
-      }
-    }
+  for(int k0=0; k0<len; k0+=BLOCKSIZE)
+  {
+    const int k1 = MIN(k0 + BLOCKSIZE, len);
+    for(int l=0; l<lines; l++)
+      for(int k=k0; k<k1; k++)
+        for(int i=0; i<ch; i++)
+          out[l*lstride + k*kstride + i] = res[(size_t)k*n + l*ch + i];
   }
 }
 
 
-
 void
-dt_gaussian_blur_4c(
+dt_gaussian_blur(
   dt_gaussian_t *g,
   float    *in,
   float    *out)
@@ -326,152 +391,58 @@ dt_gaussian_blur_4c(
 
   const int width = g->width;
   const int height = g->height;
-  const int ch = 4;
-
-  assert(g->channels == 4);
-
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+  const int ch = g->channels;
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  dt_gaussian_coeffs_t c;
+  compute_gauss_params(g->sigma, g->order, &c.a0, &c.a1, &c.a2, &c.a3, &c.b1, &c.b2, &c.coefp, &c.coefn);
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+  const int radius = _use_box(g) ? _box_radius(g->sigma) : 0;
 
   float *temp = g->buf;
+  float *scratch = g->scratch;
+  const size_t scratch_size = _scratch_size(width, height, ch);
 
+  // clamping bounds for every value of a strip, padded to full sse vectors
+  const int n = (STRIP*ch + 3) & ~3;
+  float vmin[n], vmax[n];
+  for(int k=0; k<n; k++)
+  {
+    vmin[k] = g->min[k % ch];
+    vmax[k] = g->max[k % ch];
+  }
 
-  // vertical blur column by column
+  // vertical blur, STRIP columns at a time
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(in,out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+  #pragma omp parallel for shared(in,temp,scratch,vmin,vmax,c) schedule(static)
 #endif
-  for(int i=0; i<width; i++)
+  for(int i=0; i<width; i+=STRIP)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in+i*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int j=0; j<height; j++)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
-
-
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-                      _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                                 _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(temp+offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
-
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in+((size_t)(height - 1) * width + i)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-    for(int j=height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in+offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-                      _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                                 _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
-
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
-
-      _mm_store_ps(temp+offset, _mm_add_ps(_mm_load_ps(temp+offset), yc));
-    }
+    _blur_strip(g, &c, radius, in + (size_t)i*ch, temp + (size_t)i*ch, MIN(STRIP, width - i), height,
+                ch, (size_t)width*ch, vmin, vmax, scratch + dt_get_thread_num()*scratch_size);
   }
 
-  // horizontal blur line by line
+  // horizontal blur, STRIP rows at a time
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out,temp,a0,a1,a2,a3,b1,b2,coefp,coefn) schedule(static)
+  #pragma omp parallel for shared(out,temp,scratch,vmin,vmax,c) schedule(static)
 #endif
-  for(size_t j=0; j<height; j++)
+  for(int j=0; j<height; j+=STRIP)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp+j*width*ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int i=0; i<width; i++)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(_mm_mul_ps(xc, _mm_set_ps1(a0)),
-                      _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                                 _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(out+offset, yc);
-
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp+((size_t)(j + 1)*width - 1)*ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-
-    for(int i=width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i)*ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp+offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(_mm_mul_ps(xn, _mm_set_ps1(a2)),
-                      _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                                 _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+    _blur_strip(g, &c, radius, temp + (size_t)j*width*ch, out + (size_t)j*width*ch, MIN(STRIP, height - j), width,
+                (size_t)width*ch, ch, vmin, vmax, scratch + dt_get_thread_num()*scratch_size);
+  }
+}
 
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+void
+dt_gaussian_blur_4c(
+  dt_gaussian_t *g,
+  float    *in,
+  float    *out)
+{
+  assert(g->channels == 4);
 
-      _mm_store_ps(out+offset, _mm_add_ps(_mm_load_ps(out+offset), yc));
-    }
-  }
+  // the generic code filters four channel pixels with full sse vectors already.
+  dt_gaussian_blur(g, in, out);
 }
 
 
@@ -480,6 +451,7 @@ dt_gaussian_free(
   dt_gaussian_t *g)
 {
   if(!g) return;
+  dt_free_align(g->scratch);
   dt_free_align(g->buf);
   free(g->min);
   free(g->max);
@@ -32,15 +32,19 @@ typedef enum dt_gaussian_order_t
 }
 dt_gaussian_order_t;
 
+/** sigma from which on the zero order blur may be approximated by three box filter passes */
+#define DT_GAUSSIAN_BOX_MIN_SIGMA 8.0f
 
 typedef struct dt_gaussian_t
 {
   int width, height, channels;
   float sigma;
   int order;
+  int approximate;   // set to allow the box filter approximation for large sigma
   float *max;
   float *min;
   float *buf;
+  float *scratch;
 }
 dt_gaussian_t;
 
@@ -240,7 +240,7 @@ dt_histogram_worker(const dt_dev_histogram_params_t *histogram_params,
 
   const size_t bins_total = histogram_params->bins_count * 4;
   const size_t buf_size = bins_total * sizeof(float);
-  void *partial_hists = dt_alloc_align(16, buf_size * nthreads);
+  float *partial_hists = dt_alloc_align(16, buf_size * nthreads);
   memset (partial_hists, 0, buf_size * nthreads);
 
   const dt_iop_roi_t *roi = histogram_params->roi;
@@ -250,28 +250,23 @@ dt_histogram_worker(const dt_dev_histogram_params_t *histogram_params,
 #endif
   for(int j = roi->y; j < roi->height; j++)
   {
-    float *thread_hist = (float *)partial_hists + bins_total * omp_get_thread_num();
+    float *thread_hist = partial_hists + bins_total * omp_get_thread_num();
     Worker(histogram_params, pixel, thread_hist, j);
   }
 
-#ifdef _OPENMP
-  *histogram = dt_alloc_align(16, buf_size);
+  // the histogram buffer of a module is reused from run to run (its bin count
+  // does not change), so the gui keeps a valid pointer and nothing is leaked.
+  if(*histogram == NULL) *histogram = dt_alloc_align(16, buf_size);
   float *hist = *histogram;
-  memset (hist, 0, buf_size);
 
-  #pragma omp parallel for schedule(static) default(none) shared(hist,partial_hists)
-  for(size_t k = 0; k < bins_total; k++)
+  // a few kilobytes: reducing these serially is cheaper than another parallel region.
+  memcpy(hist, partial_hists, buf_size);
+  for(int n = 1; n < nthreads; n++)
   {
-    for(size_t n = 0; n < nthreads; n++)
-    {
-      const float *thread_hist = (float *)partial_hists + bins_total * n;
-      hist[k] += thread_hist[k];
-    }
+    const float *thread_hist = partial_hists + bins_total * n;
+    for(size_t k = 0; k < bins_total; k++) hist[k] += thread_hist[k];
   }
-  free(partial_hists);
-#else
-  *histogram = partial_hists;
-#endif
+  dt_free_align(partial_hists);
 }
 
 //------------------------------------------------------------------------------
@@ -28,6 +28,11 @@
 #include "common/mipmap_cache.h"
 #include "common/tags.h"
 #include "common/utility.h"
+#include "control/conf.h"
+#include "control/jobs/control_jobs.h"
+
+// images pasted onto per transaction
+#define DT_HISTORY_PASTE_BATCH 256
 
 static void
 remove_preset_flag(const int imgid)
@@ -44,23 +49,18 @@ remove_preset_flag(const int imgid)
 }
 
 static void
-_dt_history_cleanup_multi_instance(int imgid, int minnum)
+_dt_history_cleanup_multi_instance()
 {
-  sqlite3_stmt *stmt;
-
   /* let's clean-up the history multi-instance. What we want to do is have a unique multi_priority value for each iop.
      Furthermore this value must start to 0 and increment one by one for each multi-instance of the same module. On
      SQLite there is no notion of ROW_NUMBER, so we use rather resource consuming SQL statement, but as an history has
      never a huge number of items that's not a real issue.
 
-     We only do this for the given imgid and only for num>minnum, that is we only handle new history items just copied.
+     We only do this for the images in memory.paste_targets and only for num>=offs, that is we only handle new history
+     items just copied.
   */
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "update history set multi_priority=(select COUNT(0)-1 from history hst2 where hst2.num<=history.num and hst2.num>=?2 and hst2.operation=history.operation and hst2.imgid=?1) where imgid=?1 and num>=?2", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, minnum);
-  sqlite3_step (stmt);
-  sqlite3_finalize (stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "update history set multi_priority=(select COUNT(0)-1 from history hst2 where hst2.num<=history.num and hst2.num>=(select offs from memory.paste_targets t where t.imgid=history.imgid) and hst2.operation=history.operation and hst2.imgid=history.imgid) where imgid in (select imgid from memory.paste_targets) and num>=(select offs from memory.paste_targets t where t.imgid=history.imgid)", NULL, NULL, NULL);
 }
 
 void dt_history_delete_on_image(int32_t imgid)
@@ -139,46 +139,54 @@ dt_history_load_and_apply_on_selection (gchar *filename)
   return res;
 }
 
-int
-dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+void
+dt_history_images_changed(GList *imgs)
 {
-  sqlite3_stmt *stmt;
-  if(imgid==dest_imgid) return 1;
+  /* if current image in develop reload history */
+  for(GList *l = imgs; l; l = g_list_next(l))
+    if (dt_dev_is_current_image(darktable.develop, GPOINTER_TO_INT(l->data)))
+    {
+      dt_dev_reload_history_items (darktable.develop);
+      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+      break;
+    }
 
-  if(imgid==-1)
-  {
-    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
-    return 1;
-  }
+  /* drop the thumbnails, they are regenerated in the background once they are needed again */
+  for(GList *l = imgs; l; l = g_list_next(l))
+    dt_mipmap_cache_remove(darktable.mipmap_cache, GPOINTER_TO_INT(l->data));
+
+  /* update xmp files */
+  if(dt_conf_get_bool("write_sidecar_files"))
+    dt_control_write_sidecar_files_list(g_list_copy(imgs));
+}
 
-  /* if merge onto history stack, lets find history offest in destination image */
-  int32_t offs = 0;
+/* paste the history of each image in memory.paste_targets' src column onto the image of its row. this is the same
+   handful of statements however many images there are. */
+static void
+_history_copy_and_paste_on_targets (gboolean merge, GList *ops)
+{
+  /* if merge onto history stack, lets find history offest in destination images */
   if (merge)
   {
     /* apply on top of history stack */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    if (sqlite3_step (stmt) == SQLITE_ROW) offs = sqlite3_column_int (stmt, 0);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "update memory.paste_targets set offs = (select IFNULL(MAX(num)+1, 0) from history where history.imgid = paste_targets.imgid)", NULL, NULL, NULL);
   }
   else
   {
     /* replace history stack */
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    sqlite3_step (stmt);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from history where imgid in (select imgid from memory.paste_targets)", NULL, NULL, NULL);
   }
-  sqlite3_finalize (stmt);
 
   //  prepare SQL request
   char req[2048];
-  g_strlcpy (req, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority) select ?1, num+?2, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority from history where imgid = ?3", sizeof(req));
+  g_strlcpy (req, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority) select t.imgid, h.num+t.offs, h.module, h.operation, h.op_params, h.enabled, h.blendop_params, h.blendop_version, h.multi_name, h.multi_priority from history h, memory.paste_targets t where h.imgid = t.src", sizeof(req));
 
   //  Add ops selection if any format: ... and num in (val1, val2)
   if (ops)
   {
     GList *l = ops;
     int first = 1;
-    g_strlcat(req, " and num in (", sizeof(req));
+    g_strlcat(req, " and h.num in (", sizeof(req));
 
     while (l)
     {
@@ -195,15 +203,10 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   }
 
   /* add the history items to stack offest */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, imgid);
-  sqlite3_step (stmt);
-  sqlite3_finalize (stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), req, NULL, NULL, NULL);
 
   if (merge && ops)
-    _dt_history_cleanup_multi_instance(dest_imgid, offs);
+    _dt_history_cleanup_multi_instance();
 
   //we have to copy masks too
   //what to do with existing masks ?
@@ -216,31 +219,67 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   else
   {
     //let's remove all existing shapes
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from mask where imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from mask where imgid in (select imgid from memory.paste_targets)", NULL, NULL, NULL);
   }
 
   //let's copy now
-  g_strlcpy (req, "insert into mask (imgid, formid, form, name, version, points, points_count, source) select ?1, formid, form, name, version, points, points_count, source from mask where imgid = ?2", sizeof(req));
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dest_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-  sqlite3_step (stmt);
-  sqlite3_finalize (stmt);
+  g_strlcpy (req, "insert into mask (imgid, formid, form, name, version, points, points_count, source) select t.imgid, m.formid, m.form, m.name, m.version, m.points, m.points_count, m.source from mask m, memory.paste_targets t where m.imgid = t.src", sizeof(req));
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), req, NULL, NULL, NULL);
+}
 
-  /* if current image in develop reload history */
-  if (dt_dev_is_current_image(darktable.develop, dest_imgid))
+/* paste onto dest_imgids, one transaction per batch of images. the source is imgid, or the image at the same
+   position in src_imgids if given. */
+static void
+_history_copy_and_paste_on_batches (int32_t imgid, GList *src_imgids, GList *dest_imgids, gboolean merge, GList *ops)
+{
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or ignore into memory.paste_targets (imgid, src, offs) values (?1, ?2, 0)", -1, &stmt, NULL);
+  GList *l = dest_imgids, *s = src_imgids;
+  while (l)
   {
-    dt_dev_reload_history_items (darktable.develop);
-    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+    dt_database_start_transaction(darktable.db);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.paste_targets", NULL, NULL, NULL);
+    for (int n = 0; l && n < DT_HISTORY_PASTE_BATCH; l = g_list_next(l), s = g_list_next(s), n++)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(l->data));
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, s ? GPOINTER_TO_INT(s->data) : imgid);
+      sqlite3_step (stmt);
+      sqlite3_reset (stmt);
+      sqlite3_clear_bindings (stmt);
+    }
+    _history_copy_and_paste_on_targets(merge, ops);
+    dt_database_release_transaction(darktable.db);
   }
+  sqlite3_finalize (stmt);
+}
+
+static void
+_history_copy_and_paste_on_images (int32_t imgid, GList *dest_imgids, gboolean merge, GList *ops)
+{
+  _history_copy_and_paste_on_batches(imgid, NULL, dest_imgids, merge, ops);
+  dt_history_images_changed(dest_imgids);
+}
+
+void
+dt_history_copy_on_duplicates (GList *imgids, GList *dupids)
+{
+  _history_copy_and_paste_on_batches(-1, imgids, dupids, FALSE, NULL);
+}
+
+int
+dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
+{
+  if(imgid==dest_imgid) return 1;
 
-  /* update xmp file */
-  dt_image_synch_xmp(dest_imgid);
+  if(imgid==-1)
+  {
+    dt_control_log(_("you need to copy history from an image before you paste it onto another"));
+    return 1;
+  }
 
-  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  GList *dest = g_list_prepend(NULL, GINT_TO_POINTER(dest_imgid));
+  _history_copy_and_paste_on_images(imgid, dest, merge, ops);
+  g_list_free(dest);
 
   return 0;
 }
@@ -320,25 +359,21 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge, GList *op
   if (imgid < 0) return 1;
 
   int res=0;
+  GList *dest = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int (stmt, 0);
-
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid,dest_imgid,merge,ops);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    dest = g_list_prepend(dest, GINT_TO_POINTER(sqlite3_column_int (stmt, 0)));
+  sqlite3_finalize(stmt);
 
-    }
-    while (sqlite3_step (stmt) == SQLITE_ROW);
-  }
+  /* paste history stack onto all of them */
+  dest = g_list_reverse(dest);
+  if (dest)
+    _history_copy_and_paste_on_images(imgid, dest, merge, ops);
   else res = 1;
 
-  sqlite3_finalize(stmt);
+  g_list_free(dest);
   return res;
 }
 
@@ -27,6 +27,14 @@ int dt_history_copy_and_paste_on_image(int32_t imgid, int32_t dest_imgid, gboole
 
 void dt_history_delete_on_image(int32_t imgid);
 
+/** copy the history of each image in imgids onto its duplicate at the same position in dupids, in one go.
+    only touches the db, call dt_history_images_changed() for the duplicates afterwards. */
+void dt_history_copy_on_duplicates(GList *imgids, GList *dupids);
+
+/** the history of the images in the list changed in the db: reload the darkroom if it shows one of them,
+    drop their thumbnails and write their sidecars in a background job. */
+void dt_history_images_changed(GList *imgs);
+
 /** copy history from imgid and pasts on selected images, merge or overwrite... */
 int dt_history_copy_and_paste_on_selection(int32_t imgid, gboolean merge,GList *ops);
 
@@ -43,6 +43,8 @@
 #include <glib/gstdio.h>
 
 static void _image_local_copy_full_path(const int imgid, char *pathname, size_t pathname_len);
+static void _image_local_copy_full_path_no_db(const int imgid, const char *image_path, char *pathname,
+                                              size_t pathname_len);
 
 int dt_image_is_ldr(const dt_image_t *img)
 {
@@ -186,23 +188,27 @@ static void _image_local_copy_full_path(const int imgid, char *pathname, size_t
                               "WHERE images.film_id = film_rolls.id AND images.id = ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    char filename[DT_MAX_PATH_LEN];
-    char cachedir[DT_MAX_PATH_LEN];
-    g_strlcpy(filename, (char *)sqlite3_column_text(stmt, 0), pathname_len);
-    char *md5_filename = g_compute_checksum_for_string (G_CHECKSUM_MD5, filename, strlen (filename));
-    dt_loc_get_user_cache_dir(cachedir, DT_MAX_PATH_LEN);
+    _image_local_copy_full_path_no_db(imgid, (char *)sqlite3_column_text(stmt, 0), pathname, pathname_len);
+  sqlite3_finalize(stmt);
+}
 
-    // and finally, add extension, needed as some part of the code is looking for the extension
-    char *c = filename + strlen(filename);
-    while(*c != '.' && c > filename) c--;
+static void _image_local_copy_full_path_no_db(const int imgid, const char *image_path, char *pathname,
+                                              size_t pathname_len)
+{
+  char filename[DT_MAX_PATH_LEN];
+  char cachedir[DT_MAX_PATH_LEN];
+  g_strlcpy(filename, image_path, sizeof(filename));
+  char *md5_filename = g_compute_checksum_for_string (G_CHECKSUM_MD5, filename, strlen (filename));
+  dt_loc_get_user_cache_dir(cachedir, DT_MAX_PATH_LEN);
 
-    // cache filename format: <cachedir>/imf-<id>-<MD5>.<ext>
-    snprintf(pathname, pathname_len, "%s/img-%d-%s%s", cachedir, imgid, md5_filename, c);
+  // and finally, add extension, needed as some part of the code is looking for the extension
+  char *c = filename + strlen(filename);
+  while(*c != '.' && c > filename) c--;
 
-    g_free(md5_filename);
-  }
-  sqlite3_finalize(stmt);
+  // cache filename format: <cachedir>/imf-<id>-<MD5>.<ext>
+  snprintf(pathname, pathname_len, "%s/img-%d-%s%s", cachedir, imgid, md5_filename, c);
+
+  g_free(md5_filename);
 }
 
 void dt_image_path_append_version_no_db(int version, char *pathname, size_t pathname_len)
@@ -1268,30 +1274,148 @@ int dt_image_local_copy_reset(const int32_t imgid)
 // xmp stuff
 // *******************************************************
 
-void dt_image_write_sidecar_file(int imgid)
+// images per round of set based queries when writing many sidecars
+#define DT_IMAGE_SIDECAR_BATCH 256
+
+static void _image_write_sidecar_batch(const int *imgids, const int count)
 {
-  // TODO: compute hash and don't write if not needed!
-  // write .xmp file
-  if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
+  GString *ids = g_string_new(NULL);
+  for(int i = 0; i < count; i++) g_string_append_printf(ids, i ? ",%d" : "%d", imgids[i]);
+
+  // what dt_image_full_path() and dt_image_path_append_version() would look up, for the whole batch
+  char **image_path = (char **)calloc(count, sizeof(char *));
+  int *version = (int *)calloc(count, sizeof(int));
+  sqlite3_stmt *stmt;
+  gchar *query = g_strdup_printf("select images.id, folder || '/' || filename, version from images, film_rolls "
+                                 "where images.film_id = film_rolls.id and images.id in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    gboolean from_cache = TRUE;
+    const int imgid = sqlite3_column_int(stmt, 0);
+    for(int i = 0; i < count; i++)
+      if(imgids[i] == imgid)
+      {
+        image_path[i] = g_strdup((const char *)sqlite3_column_text(stmt, 1));
+        version[i] = sqlite3_column_int(stmt, 2);
+        break;
+      }
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+
+  // resolve local copies and skip images which are gone. that's file system work, do it in parallel.
+  char **xmp_path = (char **)calloc(count, sizeof(char *));
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic) shared(image_path, version, xmp_path)
+#endif
+  for(int i = 0; i < count; i++)
+  {
+    if(!image_path[i]) continue;
     char filename[DT_MAX_PATH_LEN];
-    dt_image_full_path(imgid, filename, DT_MAX_PATH_LEN, &from_cache);
-    dt_image_path_append_version(imgid, filename, DT_MAX_PATH_LEN);
-    g_strlcat(filename, ".xmp", DT_MAX_PATH_LEN);
-    if(!dt_exif_xmp_write(imgid, filename))
+    g_strlcpy(filename, image_path[i], sizeof(filename));
+    if(!g_file_test(filename, G_FILE_TEST_EXISTS))
+      _image_local_copy_full_path_no_db(imgids[i], image_path[i], filename, sizeof(filename));
+    if(!g_file_test(filename, G_FILE_TEST_IS_REGULAR)) continue;
+    dt_image_path_append_version_no_db(version[i], filename, sizeof(filename));
+    g_strlcat(filename, ".xmp", sizeof(filename));
+    xmp_path[i] = g_strdup(filename);
+  }
+
+  int *wids = (int *)malloc(sizeof(int) * count);
+  const char **wpaths = (const char **)malloc(sizeof(char *) * count);
+  int *results = (int *)malloc(sizeof(int) * count);
+  int wcount = 0;
+  for(int i = 0; i < count; i++)
+    if(xmp_path[i])
     {
-      // put the timestamp into db. this can't be done in exif.cc since that code gets called
-      // for the copy exporter, too
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "UPDATE images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1", -1, &stmt, NULL);
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_finalize(stmt);
+      wids[wcount] = imgids[i];
+      wpaths[wcount++] = xmp_path[i];
     }
+
+  dt_exif_xmp_write_files(wids, wpaths, wcount, results);
+
+  // put the timestamp into db, for unchanged files too: they are in sync. this can't be done in exif.cc
+  // since that code gets called for the copy exporter, too
+  int written = 0, unchanged = 0;
+  g_string_truncate(ids, 0);
+  for(int i = 0; i < wcount; i++)
+  {
+    if(results[i] < 0) continue;
+    if(results[i] == 0) written++;
+    else unchanged++;
+    g_string_append_printf(ids, ids->len ? ",%d" : "%d", wids[i]);
+  }
+  if(ids->len)
+  {
+    query = g_strdup_printf("UPDATE images SET write_timestamp = STRFTIME('%%s', 'now') WHERE id IN (%s)", ids->str);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+    g_free(query);
+  }
+  dt_print(DT_DEBUG_PERF, "[xmp] %d sidecar files: %d written, %d up to date, %d failed or skipped\n", count,
+           written, unchanged, count - written - unchanged);
+
+  for(int i = 0; i < count; i++)
+  {
+    g_free(image_path[i]);
+    g_free(xmp_path[i]);
+  }
+  free(image_path);
+  free(xmp_path);
+  free(version);
+  free(wids);
+  free(wpaths);
+  free(results);
+  g_string_free(ids, TRUE);
+}
+
+void dt_image_write_sidecar_files(GList *imgs)
+{
+  dt_times_t start;
+  dt_get_times(&start);
+
+  GHashTable *seen = g_hash_table_new(NULL, NULL);
+  int imgids[DT_IMAGE_SIDECAR_BATCH];
+  int count = 0, total = 0;
+  for(GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int imgid = GPOINTER_TO_INT(l->data);
+    if(imgid <= 0 || g_hash_table_lookup(seen, GINT_TO_POINTER(imgid))) continue;
+    g_hash_table_insert(seen, GINT_TO_POINTER(imgid), GINT_TO_POINTER(1));
+    imgids[count++] = imgid;
+    total++;
+    if(count == DT_IMAGE_SIDECAR_BATCH)
+    {
+      _image_write_sidecar_batch(imgids, count);
+      count = 0;
+    }
+  }
+  if(count) _image_write_sidecar_batch(imgids, count);
+  g_hash_table_destroy(seen);
+
+  dt_show_times(&start, "[xmp] writing sidecar files", "(%d images)", total);
+}
+
+void dt_image_write_sidecar_file(int imgid)
+{
+  // write .xmp file
+  if(imgid > 0 && dt_conf_get_bool("write_sidecar_files"))
+  {
+    GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+    dt_image_write_sidecar_files(imgs);
+    g_list_free(imgs);
   }
 }
 
+// collect the ids a query returns and write their sidecars in batches
+static void _image_write_sidecar_files_stmt(sqlite3_stmt *stmt)
+{
+  GList *imgs = NULL;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  imgs = g_list_reverse(imgs);
+  dt_image_write_sidecar_files(imgs);
+  g_list_free(imgs);
+}
 
 void dt_image_synch_xmp(const int selected)
 {
@@ -1304,11 +1428,7 @@ void dt_image_synch_xmp(const int selected)
     sqlite3_stmt *stmt;
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "select imgid from selected_images", -1, &stmt, NULL);
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
-    }
+    _image_write_sidecar_files_stmt(stmt);
     sqlite3_finalize(stmt);
   }
 }
@@ -1327,11 +1447,7 @@ void dt_image_synch_all_xmp(const gchar *pathname)
                                SQLITE_TRANSIENT);
     DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, imgfname, strlen(imgfname),
                                SQLITE_TRANSIENT);
-    while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
-    }
+    _image_write_sidecar_files_stmt(stmt);
     sqlite3_finalize(stmt);
     g_free(imgfname);
     g_free(imgpath);
@@ -346,6 +346,8 @@ gboolean dt_image_safe_remove(const int32_t imgid);
 void dt_image_local_copy_synch(void);
 // xmp functions:
 void dt_image_write_sidecar_file(int imgid);
+/* write the .xmp of all images in the list (GINT_TO_POINTER ids) in batches, regardless of write_sidecar_files */
+void dt_image_write_sidecar_files(GList *imgs);
 void dt_image_synch_xmp(const int selected);
 void dt_image_synch_all_xmp(const gchar *pathname);
 
@@ -150,6 +150,164 @@ void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const
   }
 }
 
+// dxt1 (bc1) blocks as they are stored in the mipmap cache: two 565 endpoints,
+// then 2 bits per pixel, four pixels per byte, first pixel in the lowest bits.
+// the byte order of the pixels is passed through as is (bgra for our mipmaps).
+
+static inline uint16_t _dxt1_pack_565(const int c0, const int c1, const int c2)
+{
+  return ((c0 >> 3) << 11) | ((c1 >> 2) << 5) | (c2 >> 3);
+}
+
+static inline void _dxt1_unpack_565(const uint16_t v, int *c)
+{
+  const int c0 = (v >> 11) & 0x1f, c1 = (v >> 5) & 0x3f, c2 = v & 0x1f;
+  c[0] = (c0 << 3) | (c0 >> 2);
+  c[1] = (c1 << 2) | (c1 >> 4);
+  c[2] = (c2 << 3) | (c2 >> 2);
+}
+
+void dt_image_uncompress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height)
+{
+  uint32_t *out32 = (uint32_t *)out;
+  const uint8_t *block = in;
+  for(int j=0; j<height; j+=4)
+  {
+    for(int i=0; i<width; i+=4)
+    {
+      const uint16_t e0 = block[0] | (block[1] << 8), e1 = block[2] | (block[3] << 8);
+      int p[4][3];
+      _dxt1_unpack_565(e0, p[0]);
+      _dxt1_unpack_565(e1, p[1]);
+      uint32_t palette[4];
+      if(e0 > e1)
+      {
+        for(int c=0; c<3; c++)
+        {
+          p[2][c] = (2*p[0][c] + p[1][c])/3;
+          p[3][c] = (p[0][c] + 2*p[1][c])/3;
+        }
+        palette[3] = p[3][0] | (p[3][1] << 8) | (p[3][2] << 16) | 0xff000000u;
+      }
+      else
+      {
+        // three colour block (never written by us, but squish does):
+        for(int c=0; c<3; c++) p[2][c] = (p[0][c] + p[1][c])/2;
+        palette[3] = 0;
+      }
+      for(int k=0; k<3; k++) palette[k] = p[k][0] | (p[k][1] << 8) | (p[k][2] << 16) | 0xff000000u;
+
+      const int bw = width  - i < 4 ? width  - i : 4;
+      const int bh = height - j < 4 ? height - j : 4;
+      for(int pj=0; pj<bh; pj++)
+      {
+        const uint8_t idx = block[4+pj];
+        uint32_t *o = out32 + (size_t)width*(j+pj) + i;
+        for(int pi=0; pi<bw; pi++) o[pi] = palette[(idx >> (2*pi)) & 3];
+      }
+      block += 8*sizeof(uint8_t);
+    }
+  }
+}
+
+void dt_image_compress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height)
+{
+  uint8_t *block = out;
+  for(int j=0; j<height; j+=4)
+  {
+    for(int i=0; i<width; i+=4)
+    {
+      // fetch the block, replicating the borders of partial blocks:
+      int px[16][3];
+      int mn[3] = {255, 255, 255}, mx[3] = {0, 0, 0};
+      for(int k=0; k<16; k++)
+      {
+        const int ii = i + (k&3) < width  ? i + (k&3)  : width  - 1;
+        const int jj = j + (k>>2) < height ? j + (k>>2) : height - 1;
+        const uint8_t *pin = in + 4*((size_t)width*jj + ii);
+        for(int c=0; c<3; c++)
+        {
+          px[k][c] = pin[c];
+          mn[c] = mn[c] < pin[c] ? mn[c] : pin[c];
+          mx[c] = mx[c] > pin[c] ? mx[c] : pin[c];
+        }
+      }
+      // range fit on the bounding box, inset by 1/16 of its extent so the
+      // interpolated colours land on the bulk of the pixels, not the outliers:
+      for(int c=0; c<3; c++)
+      {
+        const int inset = (mx[c] - mn[c]) >> 4;
+        mn[c] += inset;
+        mx[c] -= inset;
+      }
+      // pick the diagonal of the box that follows the colours: flip the outer
+      // channels where they are anti-correlated to the middle (green) one.
+      int cov0 = 0, cov2 = 0;
+      for(int k=0; k<16; k++)
+      {
+        const int d1 = 2*px[k][1] - mx[1] - mn[1];
+        cov0 += (2*px[k][0] - mx[0] - mn[0]) * d1;
+        cov2 += (2*px[k][2] - mx[2] - mn[2]) * d1;
+      }
+      if(cov0 < 0)
+      {
+        const int t = mx[0];
+        mx[0] = mn[0];
+        mn[0] = t;
+      }
+      if(cov2 < 0)
+      {
+        const int t = mx[2];
+        mx[2] = mn[2];
+        mn[2] = t;
+      }
+      uint16_t e0 = _dxt1_pack_565(mx[0], mx[1], mx[2]);
+      uint16_t e1 = _dxt1_pack_565(mn[0], mn[1], mn[2]);
+      // e0 > e1 selects the four colour mode. e0 == e1 is a three colour
+      // block, but then all indices are 0 anyways.
+      if(e0 < e1)
+      {
+        const uint16_t t = e0;
+        e0 = e1;
+        e1 = t;
+      }
+      int p[4][3];
+      _dxt1_unpack_565(e0, p[0]);
+      _dxt1_unpack_565(e1, p[1]);
+      for(int c=0; c<3; c++)
+      {
+        p[2][c] = (2*p[0][c] + p[1][c])/3;
+        p[3][c] = (p[0][c] + 2*p[1][c])/3;
+      }
+      block[0] = e0 & 0xff;
+      block[1] = e0 >> 8;
+      block[2] = e1 & 0xff;
+      block[3] = e1 >> 8;
+      uint32_t indices = 0;
+      if(e0 != e1) for(int k=0; k<16; k++)
+      {
+        int best = 0, dmin = 0x7fffffff;
+        for(int q=0; q<4; q++)
+        {
+          const int d0 = px[k][0] - p[q][0], d1 = px[k][1] - p[q][1], d2 = px[k][2] - p[q][2];
+          const int d = d0*d0 + d1*d1 + d2*d2;
+          if(d < dmin)
+          {
+            dmin = d;
+            best = q;
+          }
+        }
+        indices |= (uint32_t)best << (2*k);
+      }
+      block[4] = indices & 0xff;
+      block[5] = (indices >> 8) & 0xff;
+      block[6] = (indices >> 16) & 0xff;
+      block[7] = indices >> 24;
+      block += 8*sizeof(uint8_t);
+    }
+  }
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -22,6 +22,10 @@
 void dt_image_compress(const float *in, uint8_t *out, const int32_t width, const int32_t height);
 void dt_image_uncompress(const uint8_t *in, float *out, const int32_t width, const int32_t height);
 
+/** fast dxt1 (bc1) codec for 8-bit 4-channel images, alpha is dropped. needs 8 bytes per 4x4 block. */
+void dt_image_compress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height);
+void dt_image_uncompress_dxt1(const uint8_t *in, uint8_t *out, const int32_t width, const int32_t height);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -57,11 +57,13 @@
 #include <assert.h>
 #include <string.h>
 #include <strings.h>
+#include <emmintrin.h>
 #include <glib/gstdio.h>
 
 
 // load a full-res thumbnail:
-int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height, int32_t *orientation)
+int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height, int32_t *orientation,
+                               const int32_t max_width, const int32_t max_height)
 {
   int ret = 0;
   int res = 1;
@@ -82,6 +84,12 @@ int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *
   {
     dt_imageio_jpeg_t jpg;
     if(dt_imageio_jpeg_decompress_header(image->data, image->data_size, &jpg)) goto libraw_fail;
+    // the box is given after flipping
+    if(max_width > 0 && max_height > 0)
+    {
+      if(*orientation & 4) dt_imageio_jpeg_set_scale(&jpg, max_height, max_width);
+      else dt_imageio_jpeg_set_scale(&jpg, max_width, max_height);
+    }
     *buffer = (uint8_t *)malloc((size_t)sizeof(uint8_t)*jpg.width*jpg.height*4);
     if(!*buffer) goto libraw_fail;
     *width = jpg.width;
@@ -624,12 +632,62 @@ int dt_imageio_export(
 {
   if (strcmp(format->mime(format_params),"x-copy")==0)
     /* This is a just a copy, skip process and just export */
-    return format->write_image(format_params, filename, NULL, NULL, 0, imgid);
+    return format->write_image(format_params, filename, NULL, NULL, 0, NULL, imgid);
   else
     return dt_imageio_export_with_flags(imgid, filename, format, format_params,
                                         0, 0, high_quality, 0, NULL,copy_metadata,storage,storage_params);
 }
 
+// export pipes kept per thread between images, see dt_imageio_export_pipe_acquire().
+typedef struct dt_imageio_export_pipe_t
+{
+  dt_develop_t *dev;       // develop the nodes are bound to, NULL if the pipe is not inited
+  dt_dev_pixelpipe_t pipe;
+}
+dt_imageio_export_pipe_t;
+
+static __thread dt_imageio_export_pipe_t *_export_pipe = NULL;
+
+static void _export_pipe_cleanup(dt_imageio_export_pipe_t *pool)
+{
+  if(!pool->dev) return;
+  dt_dev_pixelpipe_cleanup(&pool->pipe);
+  dt_dev_cleanup(pool->dev);
+  free(pool->dev);
+  pool->dev = NULL;
+}
+
+void dt_imageio_export_pipe_acquire()
+{
+  if(!_export_pipe) _export_pipe = (dt_imageio_export_pipe_t *)calloc(1, sizeof(dt_imageio_export_pipe_t));
+}
+
+void dt_imageio_export_pipe_release()
+{
+  if(!_export_pipe) return;
+  _export_pipe_cleanup(_export_pipe);
+  free(_export_pipe);
+  _export_pipe = NULL;
+}
+
+// float rgba -> 8 bit, with bgr byte order for the display. the alpha byte is undefined.
+static void _export_float_to_8bit(uint8_t *const out, const float *const in, const size_t npixels, const int display_byteorder)
+{
+  const __m128 max = _mm_set1_ps(255.0f), zero = _mm_setzero_ps();
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for(size_t k=0; k<npixels; k++)
+  {
+    __m128 rgb = _mm_load_ps(in + 4*k);
+    if(display_byteorder) rgb = _mm_shuffle_ps(rgb, rgb, _MM_SHUFFLE(3, 0, 1, 2));
+    // truncating conversion, as the old CLAMP() to uint8_t did
+    const __m128i i32 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(rgb, max), zero), max));
+    const __m128i i8 = _mm_packus_epi16(_mm_packs_epi32(i32, i32), i32);
+    *(int32_t *)(out + 4*k) = _mm_cvtsi128_si32(i8);
+  }
+}
+
 // internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
 int dt_imageio_export_with_flags(
   const uint32_t              imgid,
@@ -645,15 +703,16 @@ int dt_imageio_export_with_flags(
   dt_imageio_module_storage_t *storage,
   dt_imageio_module_data_t   *storage_params)
 {
-  dt_develop_t dev;
-  dt_dev_init(&dev, 0);
+  dt_imageio_export_pipe_t *pool = thumbnail_export ? NULL : _export_pipe;
+  dt_develop_t *dev = (dt_develop_t *)malloc(sizeof(dt_develop_t));
+  dt_dev_init(dev, 0);
   dt_mipmap_buffer_t buf;
   if(thumbnail_export && dt_conf_get_bool("plugins/lighttable/low_quality_thumbnails"))
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_F, DT_MIPMAP_BLOCKING);
   else
     dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
-  dt_dev_load_image(&dev, imgid);
-  const dt_image_t *img = &dev.image_storage;
+  dt_dev_load_image(dev, imgid);
+  const dt_image_t *img = &dev->image_storage;
   const int wd = img->width;
   const int ht = img->height;
 
@@ -661,12 +720,23 @@ int dt_imageio_export_with_flags(
 
   dt_times_t start;
   dt_get_times(&start);
-  dt_dev_pixelpipe_t pipe;
-  res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(&pipe, wd, ht) : dt_dev_pixelpipe_init_export(&pipe, wd, ht, format->levels(format_params));
+  dt_dev_pixelpipe_t pipe_local;
+  dt_dev_pixelpipe_t *pipe = pool ? &pool->pipe : &pipe_local;
+  // a pooled pipe can be kept if its buffers are large enough for this image:
+  if(pool && pool->dev && (size_t)4*sizeof(float)*wd*ht > pipe->backbuf_size)
+    _export_pipe_cleanup(pool);
+  if(pool && pool->dev)
+  {
+    pipe->levels = format->levels(format_params);
+    res = 1;
+  }
+  else
+    res = thumbnail_export ? dt_dev_pixelpipe_init_thumbnail(pipe, wd, ht) : dt_dev_pixelpipe_init_export(pipe, wd, ht, format->levels(format_params));
   if(!res)
   {
     dt_control_log(_("failed to allocate memory for %s, please lower the threads used for export or buy more memory."), thumbnail_export ? C_("noun", "thumbnail export") : C_("noun", "export"));
-    dt_dev_cleanup(&dev);
+    dt_dev_cleanup(dev);
+    free(dev);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
     return 1;
   }
@@ -675,7 +745,9 @@ int dt_imageio_export_with_flags(
   {
     dt_control_log(_("image `%s' is not available!"), img->filename);
     dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-    dt_dev_cleanup(&dev);
+    if(!(pool && pool->dev)) dt_dev_pixelpipe_cleanup(pipe);
+    dt_dev_cleanup(dev);
+    free(dev);
     return 1;
   }
 
@@ -684,13 +756,15 @@ int dt_imageio_export_with_flags(
   {
     GList *stls;
 
-    GList *modules = dev.iop;
+    GList *modules = dev->iop;
     dt_iop_module_t *m = NULL;
 
     if ((stls=dt_styles_get_item_list(format_params->style, TRUE, -1)) == 0)
     {
       dt_control_log(_("cannot find the style '%s' to apply during export."), format_params->style);
-      dt_dev_cleanup(&dev);
+      if(!(pool && pool->dev)) dt_dev_pixelpipe_cleanup(pipe);
+      dt_dev_cleanup(dev);
+      free(dev);
       dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
       return 1;
     }
@@ -700,7 +774,7 @@ int dt_imageio_export_with_flags(
     {
       dt_style_item_t *s = (dt_style_item_t *) stls->data;
 
-      modules = dev.iop;
+      modules = dev->iop;
       while (modules)
       {
         m = (dt_iop_module_t *)modules->data;
@@ -717,8 +791,8 @@ int dt_imageio_export_with_flags(
           h->multi_priority = 1;
           g_strlcpy(h->multi_name, "", sizeof(h->multi_name));
 
-          dev.history_end++;
-          dev.history = g_list_append(dev.history, h);
+          dev->history_end++;
+          dev->history = g_list_append(dev->history, h);
           break;
         }
         modules = g_list_next(modules);
@@ -727,16 +801,39 @@ int dt_imageio_export_with_flags(
     }
   }
 
-  dt_dev_pixelpipe_set_input(&pipe, &dev, (float *)buf.buf, buf.width, buf.height, 1.0);
-  dt_dev_pixelpipe_create_nodes(&pipe, &dev);
-  dt_dev_pixelpipe_synch_all(&pipe, &dev);
-  dt_dev_pixelpipe_get_dimensions(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width, &pipe.processed_height);
+  dt_dev_pixelpipe_set_input(pipe, dev, (float *)buf.buf, buf.width, buf.height, 1.0);
+  if(pool && pool->dev && dt_dev_pixelpipe_rebind_nodes(pipe, dev))
+  {
+    // same module stack as the previous image of this thread: keep the nodes and
+    // only commit the params which differ. the old develop is not needed any more.
+    dt_dev_pixelpipe_flush_caches(pipe);
+    dt_dev_cleanup(pool->dev);
+    free(pool->dev);
+    pool->dev = dev;
+  }
+  else
+  {
+    if(pool && pool->dev)
+    {
+      dt_dev_pixelpipe_cleanup_nodes(pipe);
+      dt_dev_pixelpipe_flush_caches(pipe);
+      dt_dev_cleanup(pool->dev);
+      free(pool->dev);
+    }
+    dt_dev_pixelpipe_create_nodes(pipe, dev);
+    if(pool) pool->dev = dev;
+  }
+  if(pool)
+    dt_dev_pixelpipe_synch_all_changed(pipe, dev);
+  else
+    dt_dev_pixelpipe_synch_all(pipe, dev);
+  dt_dev_pixelpipe_get_dimensions(pipe, dev, pipe->iwidth, pipe->iheight, &pipe->processed_width, &pipe->processed_height);
   if(filter)
   {
     if(!strncmp(filter, "pre:", 4))
-      dt_dev_pixelpipe_disable_after(&pipe, filter+4);
+      dt_dev_pixelpipe_disable_after(pipe, filter+4);
     if(!strncmp(filter, "post:", 5))
-      dt_dev_pixelpipe_disable_before(&pipe, filter+5);
+      dt_dev_pixelpipe_disable_before(pipe, filter+5);
   }
   dt_show_times(&start, "[export] creating pixelpipe", NULL);
 
@@ -749,7 +846,7 @@ int dt_imageio_export_with_flags(
   }
   else if(!overprofile || !strcmp(overprofile, "image"))
   {
-    GList *modules = dev.iop;
+    GList *modules = dev->iop;
     dt_iop_module_t *colorout = NULL;
     while (modules)
     {
@@ -770,107 +867,81 @@ int dt_imageio_export_with_flags(
   g_free(overprofile);
 
   // get only once at the beginning, in case the user changes it on the way:
-  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
-      (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
+  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe->processed_width ) &&
+      (format_params->max_height == 0 || format_params->max_height >= pipe->processed_height)) ? FALSE :
       high_quality;
-  const int width  = high_quality_processing ? 0 : format_params->max_width;
-  const int height = high_quality_processing ? 0 : format_params->max_height;
-  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
-  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
-  const double scale = fminf(scalex, scaley);
-  int processed_width  = scale*pipe.processed_width  + .5f;
-  int processed_height = scale*pipe.processed_height + .5f;
+  const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe->processed_width,  1.0) : 1.0;
+  const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe->processed_height, 1.0) : 1.0;
+  const double target_scale = fminf(scalex, scaley);
+  // high quality: demosaic (and everything before it) always works on the full raw, the rest of the pipe
+  // runs at the given oversampling of the target size (0: full resolution), and we downscale at the very end.
+  const int oversampling = dt_conf_get_int("plugins/lighttable/export/high_quality_oversampling");
+  const double scale = !high_quality_processing ? target_scale :
+                       oversampling > 0 ? fmin(oversampling*target_scale, 1.0) : 1.0;
+  int processed_width  = scale*pipe->processed_width  + .5f;
+  int processed_height = scale*pipe->processed_height + .5f;
   const int bpp = format->bpp(format_params);
 
   // downsampling done last, if high quality processing was requested:
-  uint8_t *outbuf = pipe.backbuf;
+  uint8_t *outbuf = pipe->backbuf;
   uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
   dt_get_times(&start);
   if(high_quality_processing)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
-    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
-    const double scale = fminf(scalex, scaley);
-    processed_width  = scale*pipe.processed_width  + .5f;
-    processed_height = scale*pipe.processed_height + .5f;
+    dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
+    const int hq_width = processed_width, hq_height = processed_height;
+    processed_width  = target_scale*pipe->processed_width  + .5f;
+    processed_height = target_scale*pipe->processed_height + .5f;
     moutbuf = (uint8_t *)dt_alloc_align(64, (size_t)sizeof(float)*processed_width*processed_height*4);
     outbuf = moutbuf;
     // now downscale into the new buffer:
     dt_iop_roi_t roi_in, roi_out;
     roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
     roi_in.scale = 1.0;
-    roi_out.scale = scale;
-    roi_in.width = pipe.processed_width;
-    roi_in.height = pipe.processed_height;
+    roi_out.scale = target_scale/scale;
+    roi_in.width = hq_width;
+    roi_in.height = hq_height;
     roi_out.width = processed_width;
     roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe->backbuf, &roi_out, &roi_in, processed_width, hq_width);
   }
   else
   {
     // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
     if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      dt_dev_pixelpipe_process(pipe, dev, 0, 0, processed_width, processed_height, scale);
     else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    outbuf = pipe.backbuf;
+      dt_dev_pixelpipe_process_no_gamma(pipe, dev, 0, 0, processed_width, processed_height, scale);
+    outbuf = pipe->backbuf;
   }
   dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
 
   // downconversion to low-precision formats:
   if(bpp == 8)
   {
-    if(display_byteorder)
+    if(high_quality_processing)
     {
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k=0; k<(size_t)processed_width*processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
-          outbuf[4*k+0] = r;
-          outbuf[4*k+1] = g;
-          outbuf[4*k+2] = b;
-        }
-      }
-      // else processing output was 8-bit already, and no need to swap order
+      // the processed buffer is not needed any more and is larger than the
+      // downscaled one, so convert out of place into it, in parallel:
+      _export_float_to_8bit(pipe->backbuf, (const float *)outbuf, (size_t)processed_width*processed_height, display_byteorder);
+      outbuf = pipe->backbuf;
     }
-    else // need to flip 
+    else if(!display_byteorder)
     {
-      // ldr output: char
-      if(high_quality_processing)
-      {
-        const float *const inbuf = (float *)outbuf;
-        for(size_t k=0; k<(size_t)processed_width*processed_height; k++)
-        {
-          // convert in place, this is unfortunately very serial..
-          const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
-          const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
-          const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
-          outbuf[4*k+0] = r;
-          outbuf[4*k+1] = g;
-          outbuf[4*k+2] = b;
-        }
-      }
-      else
-      { // !display_byteorder, need to swap:
-        uint8_t *const buf8 = pipe.backbuf;
+      // processing output was 8-bit already, need to swap:
+      uint8_t *const buf8 = pipe->backbuf;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
 #endif
-        // just flip byte order
-        for(size_t k=0; k<(size_t)processed_width*processed_height; k++)
-        {
-          uint8_t tmp = buf8[4*k+0];
-          buf8[4*k+0] = buf8[4*k+2];
-          buf8[4*k+2] = tmp;
-        }
+      // just flip byte order
+      for(size_t k=0; k<(size_t)processed_width*processed_height; k++)
+      {
+        uint8_t tmp = buf8[4*k+0];
+        buf8[4*k+0] = buf8[4*k+2];
+        buf8[4*k+2] = tmp;
       }
     }
+    // else processing output was 8-bit already, and no need to swap order
   }
   else if(bpp == 16)
   {
@@ -889,6 +960,13 @@ int dt_imageio_export_with_flags(
   format_params->width  = processed_width;
   format_params->height = processed_height;
 
+  // formats that can embed xmp get the whole packet now, so the file is written only once
+  const int format_flags = format->flags(format_params);
+  char *xmp = NULL;
+  if(copy_metadata && (format_flags & FORMAT_FLAGS_SUPPORT_XMP) && (format_flags & FORMAT_FLAGS_EMBED_XMP))
+    xmp = dt_exif_xmp_read_string(imgid);
+
+  dt_get_times(&start);
   if(!ignore_exif)
   {
     int length;
@@ -899,22 +977,29 @@ int dt_imageio_export_with_flags(
     // last param is dng mode, it's false here
     length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
 
-    res = format->write_image (format_params, filename, outbuf, exif_profile, length, imgid);
+    res = format->write_image (format_params, filename, outbuf, exif_profile, length, xmp, imgid);
   }
   else
   {
-    res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
+    res = format->write_image (format_params, filename, outbuf, NULL, 0, xmp, imgid);
   }
+  dt_show_times(&start, "[export] writing image", "(%s)", format->name());
 
-  dt_dev_pixelpipe_cleanup(&pipe);
-  dt_dev_cleanup(&dev);
+  // pooled pipes and their develop stay around for the next image:
+  if(!pool)
+  {
+    dt_dev_pixelpipe_cleanup(pipe);
+    dt_dev_cleanup(dev);
+    free(dev);
+  }
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
   dt_free_align(moutbuf);
-  /* now write xmp into that container, if possible */
-  if(copy_metadata && (format->flags(format_params) & FORMAT_FLAGS_SUPPORT_XMP)) {
+  /* now write xmp into that container, if possible and not done while writing */
+  if(copy_metadata && (format_flags & FORMAT_FLAGS_SUPPORT_XMP) && (!(format_flags & FORMAT_FLAGS_EMBED_XMP) || !xmp)) {
     dt_exif_xmp_attach(imgid, filename);
     // no need to cancel the export if this fail
   }
+  g_free(xmp);
 
 
   if(!thumbnail_export && strcmp(format->mime(format_params), "memory"))
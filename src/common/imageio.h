@@ -64,6 +64,12 @@ dt_imageio_export(
   dt_imageio_module_storage_t *storage,
   dt_imageio_module_data_t   *storage_params);
 
+/** keep the export pipe of the calling thread alive between dt_imageio_export() calls, so consecutive
+ *  images with the same module stack reuse its nodes and only re-commit params that changed. */
+void dt_imageio_export_pipe_acquire();
+/** free the export pipe of the calling thread again. */
+void dt_imageio_export_pipe_release();
+
 int
 dt_imageio_export_with_flags(
   const uint32_t                     imgid,
@@ -98,7 +104,9 @@ void dt_imageio_flip_buffers_ui16_to_float(float *out, const uint16_t *in, const
 void dt_imageio_flip_buffers_ui8_to_float(float *out, const uint8_t *in, const float black, const float white, const int ch, const int wd, const int ht, const int fwd, const int fht, const int stride, const int orientation);
 
 // allocate buffer and return 0 on success along with largest jpg thumbnail from raw.
-int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height, int32_t *orientation);
+// if max_width and max_height are > 0, it may be decoded at a reduced size which still covers that (flipped) box.
+int dt_imageio_large_thumbnail(const char *filename, uint8_t **buffer, int32_t *width, int32_t *height, int32_t *orientation,
+                               const int32_t max_width, const int32_t max_height);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -32,6 +32,7 @@
 
 /** Flag for the format modules */
 #define FORMAT_FLAGS_SUPPORT_XMP   1
+#define FORMAT_FLAGS_EMBED_XMP     2 // write_image() embeds the xmp packet it is given, no separate pass needed
 
 /**
  * defines the plugin structure for image import and export.
@@ -101,7 +102,7 @@ typedef struct dt_imageio_module_format_t
   /* bits per pixel and color channel we want to write: 8: char x3, 16: uint16_t x3, 32: float x3. */
   int (*bpp)(dt_imageio_module_data_t *data);
   /* write to file, with exif if not NULL, and icc profile if supported. */
-  int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid);
+  int (*write_image)(dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid);
   /* flag that describes the available precision/levels of output format. mainly used for dithering. */
   int (*levels)(dt_imageio_module_data_t *data);
 
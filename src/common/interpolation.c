@@ -1269,15 +1269,17 @@ prepare_resampling_plan(
   return 0;
 }
 
-void
-dt_interpolation_resample(
+/* in holds the input lines from in_y0 on, the plans index lines of the whole input */
+static void
+_interpolation_resample(
   const struct dt_interpolation* itor,
   float *out,
   const dt_iop_roi_t* const roi_out,
   const int32_t out_stride,
   const float* const in,
   const dt_iop_roi_t* const roi_in,
-  const int32_t in_stride)
+  const int32_t in_stride,
+  int in_y0)
 {
   int* hindex = NULL;
   int* hlength = NULL;
@@ -1305,11 +1307,11 @@ dt_interpolation_resample(
     int64_t ts_resampling = getts();
 #endif
 #ifdef _OPENMP
-    #pragma omp parallel for default(none) shared(out)
+    #pragma omp parallel for default(none) shared(out, in_y0)
 #endif
     for (int y=0; y<roi_out->height; y++)
     {
-      float* i = (float*)((char*)in + (size_t)in_stride*(y + roi_out->y) + x0);
+      float* i = (float*)((char*)in + (size_t)in_stride*(y + roi_out->y - in_y0) + x0);
       float* o = (float*)((char*)out + (size_t)out_stride*y);
       memcpy(o, i, l);
     }
@@ -1349,7 +1351,7 @@ dt_interpolation_resample(
 
   // Process each output line
 #ifdef _OPENMP
-  #pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta)
+  #pragma omp parallel for default(none) shared(out, hindex, hlength, hkernel, vindex, vlength, vkernel, vmeta, in_y0)
 #endif
   for (int oy=0; oy<roi_out->height; oy++)
   {
@@ -1380,7 +1382,7 @@ dt_interpolation_resample(
       for (int iy=0; iy < vl; iy++)
       {
         // This is our input line
-        const float* i = (float*)((char*)in + (size_t)in_stride*vindex[viidx++]);
+        const float* i = (float*)((char*)in + (size_t)in_stride*(vindex[viidx++] - in_y0));
 
         __m128 vhs = _mm_setzero_ps();
 
@@ -1436,6 +1438,32 @@ exit:
   dt_free_align(vlength);
 }
 
+void
+dt_interpolation_resample(
+  const struct dt_interpolation* itor,
+  float *out,
+  const dt_iop_roi_t* const roi_out,
+  const int32_t out_stride,
+  const float* const in,
+  const dt_iop_roi_t* const roi_in,
+  const int32_t in_stride)
+{
+  _interpolation_resample(itor, out, roi_out, out_stride, in, roi_in, in_stride, 0);
+}
+
+void
+dt_interpolation_resample_band(
+  const struct dt_interpolation* itor,
+  float *out,
+  const dt_iop_roi_t* const roi_out,
+  const int32_t out_stride,
+  const float* const in,
+  const dt_iop_roi_t* const roi_in,
+  const int32_t in_stride)
+{
+  _interpolation_resample(itor, out, roi_out, out_stride, in, roi_in, in_stride, roi_in->y);
+}
+
 
 #ifdef HAVE_OPENCL
 dt_interpolation_cl_global_t *
@@ -153,6 +153,23 @@ dt_interpolation_resample(
   const dt_iop_roi_t* const roi_in,
   const int32_t in_stride);
 
+/** Band resampler.
+ *
+ * Same as dt_interpolation_resample(), for an input buffer that only holds
+ * a band of the original image: "in" starts with line roi_in->y, and holds
+ * all the lines the output lines roi_out->y to roi_out->y + roi_out->height
+ * are computed from. roi_in->height is still the height of the whole image.
+ */
+void
+dt_interpolation_resample_band(
+  const struct dt_interpolation* itor,
+  float *out,
+  const dt_iop_roi_t* const roi_out,
+  const int32_t out_stride,
+  const float* const in,
+  const dt_iop_roi_t* const roi_in,
+  const int32_t in_stride);
+
 #ifdef HAVE_OPENCL
 typedef struct dt_interpolation_cl_global_t
 {
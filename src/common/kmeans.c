@@ -0,0 +1,263 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "common/darktable.h"
+#include "common/kmeans.h"
+#include "common/points.h"
+
+// squared distance in a/b the means may still move for the fit to count as settled.
+#define DT_KMEANS_EPS (0.01f*0.01f)
+// number of fitted buffers remembered
+#define DT_KMEANS_CACHE_SIZE 4
+
+typedef struct dt_kmeans_cache_t
+{
+  uint64_t hash;
+  int width, height, ch, n, samples, max_iterations;
+  float mean[DT_KMEANS_MAXN][2];
+  float var[DT_KMEANS_MAXN][2];
+  float weight[DT_KMEANS_MAXN];
+}
+dt_kmeans_cache_t;
+
+static dt_kmeans_cache_t _cache[DT_KMEANS_CACHE_SIZE];
+static int _cache_next = 0;
+G_LOCK_DEFINE_STATIC(_cache);
+
+// fnv-1a over the a/b channels, which is all the fit ever looks at.
+static uint64_t
+_hash(const float *col, const size_t num, const int ch)
+{
+  uint64_t hash = 14695981039346656037ull;
+  for(size_t k=0; k<num; k++)
+  {
+    uint32_t ab[2];
+    memcpy(ab, col + ch*k + 1, sizeof(ab));
+    hash = (hash ^ ab[0]) * 1099511628211ull;
+    hash = (hash ^ ab[1]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+// index of the entry for key, or -1. needs the _cache lock.
+static int
+_cache_find(const dt_kmeans_cache_t *key)
+{
+  for(int k=0; k<DT_KMEANS_CACHE_SIZE; k++)
+  {
+    const dt_kmeans_cache_t *c = _cache + k;
+    if(c->n > 0 && c->hash == key->hash && c->width == key->width && c->height == key->height && c->ch == key->ch
+       && c->n == key->n && c->samples == key->samples && c->max_iterations == key->max_iterations)
+      return k;
+  }
+  return -1;
+}
+
+static int
+_cache_lookup(const dt_kmeans_cache_t *key, float mean_out[][2], float var_out[][2], float weight_out[])
+{
+  G_LOCK(_cache);
+  const int k = _cache_find(key);
+  if(k >= 0)
+  {
+    const dt_kmeans_cache_t *c = _cache + k;
+    memcpy(mean_out, c->mean, sizeof(float)*2*c->n);
+    memcpy(var_out, c->var, sizeof(float)*2*c->n);
+    memcpy(weight_out, c->weight, sizeof(float)*c->n);
+  }
+  G_UNLOCK(_cache);
+  return k >= 0;
+}
+
+static void
+_cache_insert(dt_kmeans_cache_t *entry, float mean[][2], float var[][2], float weight[])
+{
+  memcpy(entry->mean, mean, sizeof(float)*2*entry->n);
+  memcpy(entry->var, var, sizeof(float)*2*entry->n);
+  memcpy(entry->weight, weight, sizeof(float)*entry->n);
+  G_LOCK(_cache);
+  // a refreshed fit replaces the old one
+  const int k = _cache_find(entry);
+  if(k >= 0)
+    _cache[k] = *entry;
+  else
+  {
+    _cache[_cache_next] = *entry;
+    _cache_next = (_cache_next + 1) % DT_KMEANS_CACHE_SIZE;
+  }
+  G_UNLOCK(_cache);
+}
+
+static inline int
+_nearest(const float *ab, const int n, float mean[n][2])
+{
+  float mdist = FLT_MAX;
+  int cluster = 0;
+  for(int k=0; k<n; k++)
+  {
+    const float dist = (ab[0]-mean[k][0])*(ab[0]-mean[k][0]) + (ab[1]-mean[k][1])*(ab[1]-mean[k][1]);
+    if(dist < mdist)
+    {
+      mdist = dist;
+      cluster = k;
+    }
+  }
+  return cluster;
+}
+
+void
+dt_kmeans_ab(const float *col, const int width, const int height, const int ch, const int n,
+             const int samples, const int max_iterations, const int refresh,
+             float mean_out[n][2], float var_out[n][2], float weight_out[n])
+{
+  const size_t num = (size_t)width*height;
+  const int cache = n <= DT_KMEANS_MAXN;
+  dt_kmeans_cache_t key = { 0 };
+  if(cache)
+  {
+    key = (dt_kmeans_cache_t){ _hash(col, num, ch), width, height, ch, n, samples, max_iterations };
+    if(!refresh && _cache_lookup(&key, mean_out, var_out, weight_out)) return;
+  }
+
+  for(int k=0; k<n; k++)
+    mean_out[k][0] = mean_out[k][1] = var_out[k][0] = var_out[k][1] = weight_out[k] = 0.0f;
+
+  // gather the a/b values we fit on once, every iteration then runs over these.
+  const int all = samples <= 0 || (size_t)samples >= num;
+  const size_t ns = all ? num : samples;
+  float *ab = dt_alloc_align(16, sizeof(float)*2*ns);
+  if(!ab || ns == 0)
+  {
+    dt_free_align(ab);
+    return;
+  }
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(ab)
+#endif
+  for(size_t s=0; s<ns; s++)
+  {
+    size_t k = s;
+    if(!all)
+    {
+      const int j = CLAMP(dt_points_get()*height, 0, height-1);
+      const int i = CLAMP(dt_points_get()*width, 0, width-1);
+      k = (size_t)width*j + i;
+    }
+    ab[2*s+0] = col[ch*k+1];
+    ab[2*s+1] = col[ch*k+2];
+  }
+
+  float a_min = FLT_MAX, b_min = FLT_MAX, a_max = -FLT_MAX, b_max = -FLT_MAX;
+  for(size_t s=0; s<ns; s++)
+  {
+    a_min = fminf(ab[2*s+0], a_min);
+    a_max = fmaxf(ab[2*s+0], a_max);
+    b_min = fminf(ab[2*s+1], b_min);
+    b_max = fmaxf(ab[2*s+1], b_max);
+  }
+
+  // init n clusters for a, b channels at random
+  float mean[n][2];
+  for(int k=0; k<n; k++)
+  {
+    mean[k][0] = 0.9f * (a_min + (a_max - a_min) * dt_points_get());
+    mean[k][1] = 0.9f * (b_min + (b_max - b_min) * dt_points_get());
+  }
+
+  // every chunk of samples sums up count, a, b, a^2, b^2 per cluster into its own
+  // accumulators, padded to a cache line. the chunks are fixed, so is the summation order,
+  // and the result doesn't depend on the number of threads.
+  const int chunks = CLAMP(ns/4096, 1, 256);
+  const int stride = (5*n + 7) & ~7;
+  double *acc = dt_alloc_align(64, sizeof(double)*stride*chunks);
+  if(!acc)
+  {
+    dt_free_align(ab);
+    return;
+  }
+
+  double sum[n][5];
+  for(int it=0; it<max_iterations; it++)
+  {
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(ab, acc, mean)
+#endif
+    for(int c=0; c<chunks; c++)
+    {
+      double *a = acc + (size_t)stride*c;
+      memset(a, 0, sizeof(double)*5*n);
+      const size_t s1 = ns*(c+1)/chunks;
+      for(size_t s=ns*c/chunks; s<s1; s++)
+      {
+        const float *v = ab + 2*s;
+        double *ak = a + 5*_nearest(v, n, mean);
+        ak[0] += 1.0;
+        ak[1] += v[0];
+        ak[2] += v[1];
+        ak[3] += v[0]*v[0];
+        ak[4] += v[1]*v[1];
+      }
+    }
+    memset(sum, 0, sizeof(sum));
+    for(int c=0; c<chunks; c++)
+      for(int k=0; k<5*n; k++) sum[k/5][k%5] += acc[(size_t)stride*c + k];
+
+    // update the means and see how far they moved:
+    float shift = 0.0f;
+    for(int k=0; k<n; k++)
+    {
+      weight_out[k] = sum[k][0]/ns;
+      if(sum[k][0] == 0.0) continue;
+      const float a = sum[k][1]/sum[k][0], b = sum[k][2]/sum[k][0];
+      shift = fmaxf(shift, (a-mean[k][0])*(a-mean[k][0]) + (b-mean[k][1])*(b-mean[k][1]));
+      mean[k][0] = a;
+      mean[k][1] = b;
+      var_out[k][0] = fmax(0.0, sum[k][3]/sum[k][0] - (double)a*a);
+      var_out[k][1] = fmax(0.0, sum[k][4]/sum[k][0] - (double)b*b);
+    }
+    if(shift < DT_KMEANS_EPS)
+    {
+      dt_print(DT_DEBUG_PERF, "[kmeans] %d clusters on %zu samples settled after %d iterations\n", n, ns, it+1);
+      break;
+    }
+  }
+
+  for(int k=0; k<n; k++)
+  {
+    mean_out[k][0] = mean[k][0];
+    mean_out[k][1] = mean[k][1];
+    // we actually want the std deviation.
+    var_out[k][0] = sqrtf(var_out[k][0]);
+    var_out[k][1] = sqrtf(var_out[k][1]);
+  }
+
+  dt_free_align(acc);
+  dt_free_align(ab);
+
+  if(cache) _cache_insert(&key, mean_out, var_out, weight_out);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
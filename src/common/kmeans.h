@@ -0,0 +1,42 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_KMEANS_H
+#define DT_COMMON_KMEANS_H
+
+/** largest number of clusters whose results are cached */
+#define DT_KMEANS_MAXN 8
+
+/**
+ * cluster the a and b channels of a Lab buffer with ch floats per pixel into n clusters.
+ * the fit runs on samples random pixels, or on all of them if samples <= 0, and stops after
+ * max_iterations or as soon as the means have settled. returns mean, standard deviation and
+ * fraction of pixels for each cluster. results are cached by a hash of the buffer, so fitting
+ * the same buffer again is free. refresh skips the lookup and fits anew, replacing the cached
+ * result, for when the user explicitly asks for it.
+ */
+void
+dt_kmeans_ab(const float *col, const int width, const int height, const int ch, const int n,
+             const int samples, const int max_iterations, const int refresh,
+             float mean_out[n][2], float var_out[n][2], float weight_out[n]);
+
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -20,6 +20,7 @@
 #include "common/exif.h"
 #include "common/grealpath.h"
 #include "common/image_cache.h"
+#include "common/image_compression.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
@@ -48,6 +49,8 @@
 #define DT_MIPMAP_CACHE_DEFAULT_FILE_NAME "mipmaps"
 
 #define DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE (1<<0)
+// loaded by the prefetcher and not requested since
+#define DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED (1<<1)
 
 struct dt_mipmap_buffer_dsc
 {
@@ -108,6 +111,13 @@ dead_image_f(dt_mipmap_buffer_t *buf)
   memcpy(buf->buf, image, sizeof(__m128)*64);
 }
 
+// skulls and other tiny buffers are never compressed
+static inline int
+is_compressed(const int32_t compression_type, const int width, const int height)
+{
+  return compression_type && (width > 8 || height > 8);
+}
+
 static inline int32_t
 compressed_buffer_size(const int32_t compression_type, const int width, const int height)
 {
@@ -484,13 +494,24 @@ read_finalize:
 static void _init_f(float   *buf, uint32_t *width, uint32_t *height, const uint32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, const uint32_t imgid, const dt_mipmap_size_t size);
 
-static int32_t
-scratchmem_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
+// per-thread uncompressed buffer for thumbnail creation, allocated on first use
+// and released by the thread key's destructor once the thread exits.
+static void
+_free_scratchmem(void *mem)
 {
-  dt_mipmap_cache_one_t *c = (dt_mipmap_cache_one_t *)data;
-  // slot is exactly aligned with encapsulated cache's position and already allocated
-  *cost = c->buffer_size;
-  return 0;
+  dt_free_align(mem);
+}
+
+static uint8_t *
+_get_scratchmem(const dt_mipmap_cache_t *cache)
+{
+  uint8_t *mem = (uint8_t *)pthread_getspecific(cache->scratchmem);
+  if(!mem)
+  {
+    mem = (uint8_t *)dt_alloc_align(64, cache->scratchmem_size);
+    pthread_setspecific(cache->scratchmem, mem);
+  }
+  return mem;
 }
 
 int32_t
@@ -676,25 +697,16 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
     cache->mip[k].max_height = cache->mip[k+1].max_height / 2;
   }
 
-  // initialize some per-thread cached scratchmem for uncompressed buffers during thumb creation:
-  if(cache->compression_type)
-  {
-    cache->scratchmem.max_width = wd;
-    cache->scratchmem.max_height = ht;
-    cache->scratchmem.buffer_size = wd*ht*sizeof(uint32_t);
-    cache->scratchmem.size = DT_MIPMAP_3; // at max.
-    // TODO: use thread local storage instead (zero performance penalty on linux)
-    dt_cache_init(&cache->scratchmem.cache, parallel, parallel, 64, 0.9f*parallel*wd*ht*sizeof(uint32_t));
-    // might have been rounded to power of two:
-    const int cnt = dt_cache_capacity(&cache->scratchmem.cache);
-    cache->scratchmem.buf = dt_alloc_align(64, cnt * wd*ht*sizeof(uint32_t));
-    dt_cache_static_allocation(&cache->scratchmem.cache, (uint8_t *)cache->scratchmem.buf, wd*ht*sizeof(uint32_t));
-    dt_cache_set_allocate_callback(&cache->scratchmem.cache,
-                                   scratchmem_allocate, &cache->scratchmem);
-    dt_print(DT_DEBUG_CACHE,
-             "[mipmap_cache_init] cache has % 5d entries for temporary compression buffers (% 4.02f MB).\n",
-             cnt, cnt* wd*ht*sizeof(uint32_t)/(1024.0*1024.0));
-  }
+  // uncompressed buffers during thumb creation are thread local, see _get_scratchmem():
+  cache->scratchmem_size = (size_t)wd*ht*sizeof(uint32_t);
+  pthread_key_create(&cache->scratchmem, _free_scratchmem);
+
+  // leave one worker for whatever the user is waiting for:
+  dt_pthread_mutex_init(&cache->prefetch.mutex, NULL);
+  cache->prefetch.num = cache->prefetch.pos = 0;
+  cache->prefetch.jobs = 0;
+  cache->prefetch.serial = 0;
+  cache->prefetch.max_jobs = MAX(1, dt_conf_get_int("worker_threads") - 1);
 
   for(int k=DT_MIPMAP_3; k>=0; k--)
   {
@@ -704,6 +716,8 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
     cache->mip[k].stats_misses = 0;
     cache->mip[k].stats_fetches = 0;
     cache->mip[k].stats_standin = 0;
+    cache->mip[k].stats_prefetch = 0;
+    cache->mip[k].stats_prefetch_hit = 0;
     // buffer stores width and height + actual data
     const int width  = cache->mip[k].max_width;
     const int height = cache->mip[k].max_height;
@@ -782,13 +796,10 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   }
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_FULL].cache);
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_F].cache);
-
-  // clean up temporary buffers for decompressed images, if any:
-  if(cache->compression_type)
-  {
-    dt_cache_cleanup(&cache->scratchmem.cache);
-    dt_free_align(cache->scratchmem.buf);
-  }
+  dt_pthread_mutex_destroy(&cache->prefetch.mutex);
+  // the worker threads are gone by now and freed theirs, only ours is left.
+  _free_scratchmem(pthread_getspecific(cache->scratchmem));
+  pthread_key_delete(cache->scratchmem);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -811,14 +822,6 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
            dt_cache_size(&cache->mip[k].cache),
            dt_cache_capacity(&cache->mip[k].cache));
   }
-  if(cache->compression_type)
-  {
-    printf("[mipmap_cache] scratch fill %.2f/%.2f MB (%.2f%% in %u/%u buffers)\n", cache->scratchmem.cache.cost/(1024.0*1024.0),
-           cache->scratchmem.cache.cost_quota/(1024.0*1024.0),
-           100.0f*(float)cache->scratchmem.cache.cost/(float)cache->scratchmem.cache.cost_quota,
-           dt_cache_size(&cache->scratchmem.cache),
-           dt_cache_capacity(&cache->scratchmem.cache));
-  }
   uint64_t sum = 0;
   uint64_t sum_fetches = 0;
   uint64_t sum_standins = 0;
@@ -828,14 +831,16 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
     sum_fetches += cache->mip[k].stats_fetches;
     sum_standins += cache->mip[k].stats_standin;
   }
-  printf("[mipmap_cache] level | near match | miss | stand-in | fetches | total rq\n");
+  printf("[mipmap_cache] level | near match | miss | stand-in | fetches | total rq | prefetched | prefetch hits\n");
   for(int k=0; k<=(int)DT_MIPMAP_FULL; k++)
-    printf("[mipmap_cache] %c%d    | %6.2f%% | %6.2f%% | %6.2f%%  | %6.2f%% | %6.2f%%\n", k > 3 ? 'f' : 'i', k,
+    printf("[mipmap_cache] %c%d    | %6.2f%% | %6.2f%% | %6.2f%%  | %6.2f%% | %6.2f%% | %6ld | %6.2f%%\n", k > 3 ? 'f' : 'i', k,
         100.0*cache->mip[k].stats_near_match/(float)cache->mip[k].stats_requests,
         100.0*cache->mip[k].stats_misses/(float)cache->mip[k].stats_requests,
         100.0*cache->mip[k].stats_standin/(float)sum_standins,
         100.0*cache->mip[k].stats_fetches/(float)sum_fetches,
-        100.0*cache->mip[k].stats_requests/(float)sum);
+        100.0*cache->mip[k].stats_requests/(float)sum,
+        cache->mip[k].stats_prefetch,
+        100.0*cache->mip[k].stats_prefetch_hit/(float)cache->mip[k].stats_prefetch);
   printf("\n\n");
   // very verbose stats about locks/users
   //dt_cache_print(&cache->mip[DT_MIPMAP_3].cache);
@@ -964,11 +969,8 @@ dt_mipmap_cache_read_get(
           // 8-bit thumbs, possibly need to be compressed:
           if(cache->compression_type)
           {
-            // get per-thread temporary storage without malloc from a separate cache:
-            const int key = dt_control_get_threadid();
-            // const void *cbuf =
-            dt_cache_read_get(&cache->scratchmem.cache, key);
-            uint8_t *scratchmem = (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
+            // per-thread temporary storage, no locking needed:
+            uint8_t *scratchmem = _get_scratchmem(cache);
             _init_8(scratchmem, &dsc->width, &dsc->height, imgid, mip);
             buf->width  = dsc->width;
             buf->height = dsc->height;
@@ -976,8 +978,6 @@ dt_mipmap_cache_read_get(
             buf->size   = mip;
             buf->buf = (uint8_t *)(dsc+1);
             dt_mipmap_cache_compress(buf, scratchmem);
-            dt_cache_write_release(&cache->scratchmem.cache, key);
-            dt_cache_read_release(&cache->scratchmem.cache, key);
           }
           else
           {
@@ -1017,6 +1017,13 @@ dt_mipmap_cache_read_get(
       if(buf->buf && buf->width > 0 && buf->height > 0)
       {
         if(mip != k) __sync_fetch_and_add (&(cache->mip[k].stats_standin), 1);
+        struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)buf->buf - 1;
+        if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED)
+        {
+          // the prefetcher was right:
+          __sync_fetch_and_and (&dsc->flags, ~DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED);
+          __sync_fetch_and_add (&(cache->mip[k].stats_prefetch_hit), 1);
+        }
         return;
       }
       // didn't succeed the first time? prefetch for later!
@@ -1110,6 +1117,83 @@ dt_mipmap_cache_get_matching_size(
   return best;
 }
 
+// add prefetch jobs while there is work left and not enough jobs queued already.
+// expects the prefetch mutex to be held, returns with it held.
+static void
+_prefetch_add_jobs(dt_mipmap_cache_t *cache)
+{
+  while(cache->prefetch.jobs < MIN(cache->prefetch.max_jobs, cache->prefetch.num - cache->prefetch.pos))
+  {
+    cache->prefetch.jobs++;
+    const int serial = cache->prefetch.serial++;
+    dt_pthread_mutex_unlock(&cache->prefetch.mutex);
+    dt_job_t j;
+    dt_image_prefetch_job_init(&j, serial);
+    const int failed = dt_control_add_job(darktable.control, &j);
+    dt_pthread_mutex_lock(&cache->prefetch.mutex);
+    if(failed)
+    {
+      // queue is full, try again with the next list:
+      cache->prefetch.jobs--;
+      break;
+    }
+  }
+}
+
+void
+dt_mipmap_cache_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t *imgids,
+  const dt_mipmap_size_t *mips,
+  const int num)
+{
+  const int n = MIN(num, DT_MIPMAP_PREFETCH_MAX);
+  dt_pthread_mutex_lock(&cache->prefetch.mutex);
+  memcpy(cache->prefetch.imgid, imgids, sizeof(uint32_t)*n);
+  memcpy(cache->prefetch.mip, mips, sizeof(dt_mipmap_size_t)*n);
+  cache->prefetch.num = n;
+  cache->prefetch.pos = 0;
+  _prefetch_add_jobs(cache);
+  dt_pthread_mutex_unlock(&cache->prefetch.mutex);
+}
+
+void
+dt_mipmap_cache_prefetch_next(
+  dt_mipmap_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->prefetch.mutex);
+  if(cache->prefetch.pos >= cache->prefetch.num)
+  {
+    cache->prefetch.jobs--;
+    dt_pthread_mutex_unlock(&cache->prefetch.mutex);
+    return;
+  }
+  const uint32_t imgid = cache->prefetch.imgid[cache->prefetch.pos];
+  const dt_mipmap_size_t mip = cache->prefetch.mip[cache->prefetch.pos];
+  cache->prefetch.pos++;
+  dt_pthread_mutex_unlock(&cache->prefetch.mutex);
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK);
+  if(!buf.buf)
+  {
+    dt_mipmap_cache_read_get(cache, &buf, imgid, mip, DT_MIPMAP_BLOCKING);
+    if(buf.buf)
+    {
+      struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)buf.buf - 1;
+      __sync_fetch_and_or (&dsc->flags, DT_MIPMAP_BUFFER_DSC_FLAG_PREFETCHED);
+      __sync_fetch_and_add (&(cache->mip[mip].stats_prefetch), 1);
+    }
+  }
+  if(buf.buf) dt_mipmap_cache_read_release(cache, &buf);
+
+  // go to the end of the queue again, or stop if the list is done:
+  dt_pthread_mutex_lock(&cache->prefetch.mutex);
+  cache->prefetch.jobs--;
+  _prefetch_add_jobs(cache);
+  dt_pthread_mutex_unlock(&cache->prefetch.mutex);
+}
+
 void
 dt_mipmap_cache_remove(
   dt_mipmap_cache_t *cache,
@@ -1225,6 +1309,7 @@ _write_image(
   const void               *in,
   void                     *exif,
   int                       exif_len,
+  const char               *xmp,
   int                       imgid)
 {
   _dummy_data_t *d = (_dummy_data_t *)data;
@@ -1284,6 +1369,9 @@ _init_8(
       dt_imageio_jpeg_t jpg;
       if(!dt_imageio_jpeg_read_header(filename, &jpg))
       {
+        // no need to decode more than what gets scaled down to the mip size anyways
+        if(orientation & 4) dt_imageio_jpeg_set_scale(&jpg, ht, wd);
+        else dt_imageio_jpeg_set_scale(&jpg, wd, ht);
         uint8_t *tmp = (uint8_t *)malloc(sizeof(uint8_t)*jpg.width*jpg.height*4);
         if(!dt_imageio_jpeg_read(&jpg, tmp))
         {
@@ -1298,7 +1386,7 @@ _init_8(
     {
       uint8_t *tmp = 0;
       int32_t thumb_width, thumb_height, orientation;
-      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, &orientation);
+      res = dt_imageio_large_thumbnail(filename, &tmp, &thumb_width, &thumb_height, &orientation, wd, ht);
       if(!res)
       {
         // scale to fit
@@ -1350,12 +1438,9 @@ uint8_t*
 dt_mipmap_cache_alloc_scratchmem(
   const dt_mipmap_cache_t *cache)
 {
-  const size_t size = cache->mip[DT_MIPMAP_3].max_width *
-                      cache->mip[DT_MIPMAP_3].max_height;
-
   if(cache->compression_type)
   {
-    return dt_alloc_align(64, size * 4 * sizeof(uint8_t));
+    return dt_alloc_align(64, cache->scratchmem_size);
   }
   else // no compression, no buffer:
     return NULL;
@@ -1370,14 +1455,13 @@ dt_mipmap_cache_decompress(
   const dt_mipmap_buffer_t *buf,
   uint8_t *scratchmem)
 {
-#ifdef HAVE_SQUISH
-  if(darktable.mipmap_cache->compression_type && buf->width > 8 && buf->height > 8)
+  if(is_compressed(darktable.mipmap_cache->compression_type, buf->width, buf->height))
   {
-    squish_decompress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    // plain dxt1, also reads what squish wrote for the high quality setting:
+    dt_image_uncompress_dxt1(buf->buf, scratchmem, buf->width, buf->height);
     return scratchmem;
   }
   else
-#endif
   {
     return buf->buf;
   }
@@ -1391,16 +1475,18 @@ dt_mipmap_cache_compress(
   dt_mipmap_buffer_t *buf,
   uint8_t *const scratchmem)
 {
-#ifdef HAVE_SQUISH
   // only do something if compression is on, don't compress skulls:
-  if(darktable.mipmap_cache->compression_type && buf->width > 8 && buf->height > 8)
+  if(!is_compressed(darktable.mipmap_cache->compression_type, buf->width, buf->height)) return;
+#ifdef HAVE_SQUISH
+  // high quality: cluster fit
+  if(darktable.mipmap_cache->compression_type == 2)
   {
-    int flags = squish_dxt1;
-    // low quality:
-    if(darktable.mipmap_cache->compression_type == 1) flags |= squish_colour_range_fit;
     squish_compress_image(scratchmem, buf->width, buf->height, buf->buf, squish_dxt1);
+    return;
   }
 #endif
+  // low quality, or no squish: our own range fit, a lot faster.
+  dt_image_compress_dxt1(scratchmem, buf->buf, buf->width, buf->height);
 }
 
 
@@ -99,17 +99,34 @@ typedef struct dt_mipmap_cache_one_t
   long int stats_misses;      // nothing returned at all.
   long int stats_fetches;     // texture was fetched (either as a stand-in or as per request)
   long int stats_standin;     // texture used as stand-in
+  long int stats_prefetch;    // texture was fetched by the prefetcher
+  long int stats_prefetch_hit;// prefetched texture was requested later on
 }
 dt_mipmap_cache_one_t;
 
+// maximum number of images the prefetcher keeps track of
+#define DT_MIPMAP_PREFETCH_MAX 512
+
 typedef struct dt_mipmap_cache_t
 {
   // one cache per mipmap level
   dt_mipmap_cache_one_t mip[DT_MIPMAP_NONE];
   // global setting: which compression type are we using?
   int compression_type; // 0 - none, 1 - low quality, 2 - slow
-  // per-thread cache of uncompressed buffers, in case compression is requested.
-  dt_mipmap_cache_one_t scratchmem;
+  // size of the per-thread uncompressed buffers, in case compression is requested.
+  size_t scratchmem_size;
+  // the calling thread's uncompressed buffer, freed when the thread exits.
+  pthread_key_t scratchmem;
+  // images to load ahead of time, see dt_mipmap_cache_prefetch().
+  struct
+  {
+    dt_pthread_mutex_t mutex;
+    uint32_t imgid[DT_MIPMAP_PREFETCH_MAX];
+    dt_mipmap_size_t mip[DT_MIPMAP_PREFETCH_MAX];
+    int num, pos;         // length of the list and next entry to load
+    int jobs, max_jobs;   // prefetch jobs in the control queue
+    int serial;           // to tell the jobs apart
+  } prefetch;
 }
 dt_mipmap_cache_t;
 
@@ -158,6 +175,22 @@ dt_mipmap_cache_write_release(
   dt_mipmap_cache_t *cache,
   dt_mipmap_buffer_t *buf);
 
+// replace the list of thumbnails to load in the background by the given one,
+// in order. entries left over from the previous list are dropped. the jobs
+// go to the end of the control queue after each image, so everything else
+// the user is waiting for runs first.
+void
+dt_mipmap_cache_prefetch(
+  dt_mipmap_cache_t *cache,
+  const uint32_t *imgids,
+  const dt_mipmap_size_t *mips,
+  const int num);
+
+// load the next image of the prefetch list, used by the prefetch job.
+void
+dt_mipmap_cache_prefetch_next(
+  dt_mipmap_cache_t *cache);
+
 // remove thumbnails, so they will be regenerated:
 void
 dt_mipmap_cache_remove(
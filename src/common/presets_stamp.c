@@ -0,0 +1,88 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_UNIT_TEST
+#include "common/darktable.h"
+#include "common/debug.h"
+#endif
+#include "common/presets_stamp.h"
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+static void _key(char *key, const size_t size, const char *op)
+{
+  snprintf(key, size, "presets_stamp/%s", op);
+}
+
+void dt_presets_stamp_cleanup(struct sqlite3 *db)
+{
+  // operations with a stamp keep their presets, they are replaced once the stamp doesn't match any more.
+  // 15 is strlen("presets_stamp/") + 1.
+  DT_DEBUG_SQLITE3_EXEC(db, "DELETE FROM presets WHERE writeprotect = 1 AND operation NOT IN "
+                            "(SELECT substr(key, 15) FROM db_info WHERE key LIKE 'presets_stamp/%')",
+                        NULL, NULL, NULL);
+}
+
+int dt_presets_stamp_matches(struct sqlite3 *db, const char *op, const char *stamp)
+{
+  int match = 0;
+  if(!stamp) return match;
+  char key[64];
+  _key(key, sizeof(key), op);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "SELECT value FROM db_info WHERE key = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    match = !strcmp((const char *)sqlite3_column_text(stmt, 0), stamp);
+  sqlite3_finalize(stmt);
+  return match;
+}
+
+void dt_presets_stamp_clear(struct sqlite3 *db, const char *op)
+{
+  char key[64];
+  _key(key, sizeof(key), op);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM presets WHERE writeprotect = 1 AND operation = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "DELETE FROM db_info WHERE key = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+void dt_presets_stamp_store(struct sqlite3 *db, const char *op, const char *stamp)
+{
+  if(!stamp) return;
+  char key[64];
+  _key(key, sizeof(key), op);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "INSERT OR REPLACE INTO db_info (key, value) VALUES (?1, ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, key, -1, SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, stamp, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,45 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_COMMON_PRESETS_STAMP_H
+#define DT_COMMON_PRESETS_STAMP_H
+
+/*
+ * the built-in presets of an iop plugin only change with the plugin binary. what they were
+ * last written for is kept as a stamp per operation in db_info, under presets_stamp/<op>,
+ * and they are only written again when the stamp changed.
+ */
+
+struct sqlite3;
+
+/** drop the write protected presets at startup, except for the operations with a stamp. */
+void dt_presets_stamp_cleanup(struct sqlite3 *db);
+
+/** true if the built-in presets of op were last written for stamp. */
+int dt_presets_stamp_matches(struct sqlite3 *db, const char *op, const char *stamp);
+
+/** drop the built-in presets of op and its stamp, before they are written again. */
+void dt_presets_stamp_clear(struct sqlite3 *db, const char *op);
+
+/** remember that the built-in presets of op are now written for stamp. */
+void dt_presets_stamp_store(struct sqlite3 *db, const char *op, const char *stamp);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -37,6 +37,9 @@
 #include <stdio.h>
 #include <glib.h>
 
+// images a style is applied to per transaction
+#define DT_STYLES_APPLY_BATCH 256
+
 typedef struct
 {
   GString 	*name;
@@ -418,30 +421,126 @@ dt_styles_create_from_image (const char *name,const char *description,int32_t im
   return FALSE;
 }
 
+/* apply the style to all images in the list: a handful of statements and one transaction per batch of images,
+   whatever the number of images. */
+static void
+_styles_apply_to_images(const char *name, gboolean duplicate, GList *imgs)
+{
+  int id=0;
+  sqlite3_stmt *stmt;
+
+  if ((id=dt_styles_get_id_by_name(name)) == 0) return;
+
+  /* check if we should make duplicates before applying style, their history is copied over in one go */
+  GList *dest = NULL, *src = NULL;
+  for (GList *l = imgs; l; l = g_list_next(l))
+  {
+    const int32_t imgid = GPOINTER_TO_INT(l->data);
+    int32_t newimgid = imgid;
+    if (duplicate)
+    {
+      newimgid = dt_image_duplicate (imgid);
+      if(newimgid == -1) continue;
+      src = g_list_prepend(src, GINT_TO_POINTER(imgid));
+    }
+    dest = g_list_prepend(dest, GINT_TO_POINTER(newimgid));
+  }
+  dest = g_list_reverse(dest);
+  if (duplicate)
+  {
+    src = g_list_reverse(src);
+    dt_history_copy_on_duplicates(src, dest);
+    g_list_free(src);
+  }
+
+  /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items",NULL,NULL,NULL);
+
+  /* copy history items from styles onto temp table */
+  DT_DEBUG_SQLITE3_PREPARE_V2
+    (dt_database_get(darktable.db),
+     "INSERT INTO MEMORY.style_items SELECT * FROM style_items WHERE styleid=?1 ORDER BY multi_priority DESC;", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
+  sqlite3_step (stmt);
+  sqlite3_finalize (stmt);
+
+  /* the tag */
+  guint tagid=0;
+  gchar ntag[512]= {0};
+  g_snprintf(ntag,sizeof(ntag),"darktable|style|%s",name);
+  const gboolean tag = dt_tag_new(ntag,&tagid);
+
+  sqlite3_stmt *target_stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT OR IGNORE INTO memory.paste_targets (imgid, offs) VALUES (?1, 0)", -1, &target_stmt, NULL);
+  GList *l = dest;
+  while (l)
+  {
+    dt_database_start_transaction(darktable.db);
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.paste_targets", NULL, NULL, NULL);
+    for (int n = 0; l && n < DT_STYLES_APPLY_BATCH; l = g_list_next(l), n++)
+    {
+      DT_DEBUG_SQLITE3_BIND_INT(target_stmt, 1, GPOINTER_TO_INT(l->data));
+      sqlite3_step (target_stmt);
+      sqlite3_reset (target_stmt);
+      sqlite3_clear_bindings (target_stmt);
+    }
+
+    /* merge onto history stack, let's find history offest in destination images */
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "UPDATE memory.paste_targets SET offs = (SELECT IFNULL(MAX(num)+1, 0) FROM history WHERE history.imgid = paste_targets.imgid)", NULL, NULL, NULL);
+
+    /* copy the style items into the history */
+    DT_DEBUG_SQLITE3_EXEC
+      (dt_database_get(darktable.db),
+       "INSERT INTO history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) SELECT t.imgid,t.offs+s.rowid,s.module,s.operation,s.op_params,s.enabled,s.blendop_params,s.blendop_version,s.multi_priority,s.multi_name FROM memory.paste_targets t, MEMORY.style_items s", NULL, NULL, NULL);
+
+    /* add tag */
+    if (tag)
+    {
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "INSERT OR REPLACE INTO tagged_images (imgid, tagid) SELECT imgid, ?1 FROM memory.paste_targets", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+      sqlite3_step (stmt);
+      sqlite3_finalize (stmt);
+    }
+    dt_database_release_transaction(darktable.db);
+  }
+  sqlite3_finalize (target_stmt);
+
+  /* reload the darkroom if needed, remove old obsolete thumbnails and update xmp files */
+  dt_history_images_changed(dest);
+  g_list_free(dest);
+
+  /* if we have created a duplicate, reset collected images */
+  if (duplicate)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
+
+  /* redraw center view to update visible mipmaps */
+  dt_control_queue_redraw_center();
+}
+
 void
 dt_styles_apply_to_selection(const char *name,gboolean duplicate)
 {
-  gboolean selected = FALSE;
-
   /* write current history changes so nothing gets lost, do that only in the darkroom as there is nothing to be
      save when in the lighttable (and it would write over current history stack) */
   const dt_view_t *cv = dt_view_manager_get_current_view(darktable.view_manager);
   if(cv->view((dt_view_t*)cv) == DT_VIEW_DARKROOM)
     dt_dev_write_history(darktable.develop);
 
-  /* for each selected image apply style */
+  /* apply style to all selected images at once */
+  GList *imgs = NULL;
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images", -1, &stmt, NULL);
   while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    int imgid = sqlite3_column_int (stmt, 0);
-    dt_styles_apply_to_image (name,duplicate,imgid);
-    selected = TRUE;
-  }
+    imgs = g_list_prepend(imgs, GINT_TO_POINTER(sqlite3_column_int (stmt, 0)));
   sqlite3_finalize(stmt);
+  imgs = g_list_reverse(imgs);
 
-  if (!selected)
+  if (imgs)
+    _styles_apply_to_images(name, duplicate, imgs);
+  else
     dt_control_log(_("no image selected!"));
+
+  g_list_free(imgs);
 }
 
 void
@@ -466,75 +565,9 @@ dt_styles_create_from_selection()
 void
 dt_styles_apply_to_image(const char *name,gboolean duplicate, int32_t imgid)
 {
-  int id=0;
-  sqlite3_stmt *stmt;
-  int32_t newimgid;
-
-  if ((id=dt_styles_get_id_by_name(name)) != 0)
-  {
-    /* check if we should make a duplicate before applying style */
-    if (duplicate)
-    {
-      newimgid = dt_image_duplicate (imgid);
-      if(newimgid != -1) dt_history_copy_and_paste_on_image(imgid, newimgid, FALSE, NULL);
-    }
-    else
-      newimgid = imgid;
-
-    /* merge onto history stack, let's find history offest in destination image */
-    int32_t offs = 0;
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "SELECT MAX(num)+1 FROM history WHERE imgid = ?1", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    if (sqlite3_step (stmt) == SQLITE_ROW) offs = sqlite3_column_int (stmt, 0);
-    sqlite3_finalize (stmt);
-
-    /* delete all items from the temp styles_items, this table is used only to get a ROWNUM of the results */
-    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.style_items",NULL,NULL,NULL);
-
-    /* copy history items from styles onto temp table */
-    DT_DEBUG_SQLITE3_PREPARE_V2
-      (dt_database_get(darktable.db),
-       "INSERT INTO MEMORY.style_items SELECT * FROM style_items WHERE styleid=?1 ORDER BY multi_priority DESC;", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
-
-    /* copy the style items into the history */
-    DT_DEBUG_SQLITE3_PREPARE_V2
-      (dt_database_get(darktable.db),
-       "INSERT INTO history (imgid,num,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name) SELECT ?1,?2+rowid,module,operation,op_params,enabled,blendop_params,blendop_version,multi_priority,multi_name FROM MEMORY.style_items", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newimgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offs);
-    sqlite3_step (stmt);
-    sqlite3_finalize (stmt);
-
-    /* add tag */
-    guint tagid=0;
-    gchar ntag[512]= {0};
-    g_snprintf(ntag,sizeof(ntag),"darktable|style|%s",name);
-    if (dt_tag_new(ntag,&tagid))
-      dt_tag_attach(tagid,newimgid);
-
-    /* if current image in develop reload history */
-    if (dt_dev_is_current_image(darktable.develop, newimgid))
-    {
-      dt_dev_reload_history_items (darktable.develop);
-      dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-    }
-
-    /* update xmp file */
-    dt_image_synch_xmp(newimgid);
-
-    /* remove old obsolete thumbnails */
-    dt_mipmap_cache_remove(darktable.mipmap_cache, newimgid);
-
-    /* if we have created a duplicate, reset collected images */
-    if (duplicate)
-      dt_control_signal_raise(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED);
-
-    /* redraw center view to update visible mipmaps */
-    dt_control_queue_redraw_center();
-  }
+  GList *imgs = g_list_prepend(NULL, GINT_TO_POINTER(imgid));
+  _styles_apply_to_images(name, duplicate, imgs);
+  g_list_free(imgs);
 }
 
 void
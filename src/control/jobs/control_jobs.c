@@ -70,35 +70,27 @@ void dt_control_write_sidecar_files_job_init(dt_job_t *job)
   dt_control_image_enumerator_job_selected_init(t);
 }
 
-int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
+void dt_control_write_sidecar_files_list(GList *imgs)
 {
-  int imgid = -1;
-  dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
-  GList *t = t1->index;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "UPDATE images SET write_timestamp = STRFTIME('%s', 'now') WHERE id = ?1", -1, &stmt, NULL);
-  while(t)
+  dt_job_t j;
+  dt_control_job_init(&j, "write sidecar files");
+  j.execute = &dt_control_write_sidecar_files_job_run;
+  dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)j.param;
+  t->index = imgs;
+  // don't lose the sidecars if the queue is full
+  if(dt_control_add_job(darktable.control, &j))
   {
-    gboolean from_cache = FALSE;
-    imgid = GPOINTER_TO_INT(t->data);
-    const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, (int32_t)imgid);
-    char dtfilename[DT_MAX_PATH_LEN+8];
-    dt_image_full_path(img->id, dtfilename, DT_MAX_PATH_LEN, &from_cache);
-    dt_image_path_append_version(img->id, dtfilename, DT_MAX_PATH_LEN);
-    g_strlcat(dtfilename, ".xmp", DT_MAX_PATH_LEN);
-    if(!dt_exif_xmp_write(imgid, dtfilename))
-    {
-      // put the timestamp into db. this can't be done in exif.cc since that code gets called
-      // for the copy exporter, too
-      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-      sqlite3_step(stmt);
-      sqlite3_reset(stmt);
-      sqlite3_clear_bindings(stmt);
-    }
-    dt_image_cache_read_release(darktable.image_cache, img);
-    t = g_list_delete_link(t, t);
+    dt_image_write_sidecar_files(imgs);
+    g_list_free(imgs);
   }
-  sqlite3_finalize(stmt);
+}
+
+int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
+  dt_image_write_sidecar_files(t1->index);
+  g_list_free(t1->index);
+  t1->index = NULL;
   return 0;
 }
 
@@ -1199,6 +1191,8 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
           etagid = 0;
     dt_tag_new("darktable|changed",&tagid);
     dt_tag_new("darktable|exported",&etagid);
+    // reuse one pixelpipe per thread for all images of this job:
+    dt_imageio_export_pipe_acquire();
 
     while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
     {
@@ -1258,7 +1252,8 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
       if(mstorage->finalize_store) mstorage->finalize_store(mstorage, sdata);
       mstorage->free_params(mstorage, sdata);
     }
-    // all threads free their fdata
+    // all threads free their fdata and export pipe
+    dt_imageio_export_pipe_release();
     mformat->free_params (mformat, fdata);
 #ifdef _OPENMP
   }
@@ -76,6 +76,8 @@ int32_t dt_control_time_offset_job_run(dt_job_t *job);
 #endif
 
 void dt_control_write_sidecar_files();
+/** write the sidecars of the images in the list (takes ownership) in the background */
+void dt_control_write_sidecar_files_list(GList *imgs);
 void dt_control_delete_images();
 void dt_control_duplicate_images();
 void dt_control_flip_images(const int32_t cw);
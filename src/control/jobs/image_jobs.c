@@ -48,6 +48,21 @@ int32_t dt_image_load_job_run(dt_job_t *job)
   return 0;
 }
 
+void dt_image_prefetch_job_init(dt_job_t *job, int32_t serial)
+{
+  dt_control_job_init(job, "prefetch thumbnails");
+  job->execute = &dt_image_prefetch_job_run;
+  // so parallel prefetch jobs are not taken for duplicates:
+  job->param[0] = serial;
+}
+
+int32_t dt_image_prefetch_job_run(dt_job_t *job)
+{
+  // one image per job, it queues itself again if there are more:
+  dt_mipmap_cache_prefetch_next(darktable.mipmap_cache);
+  return 0;
+}
+
 int32_t dt_image_import_job_run(dt_job_t *job)
 {
   int id;
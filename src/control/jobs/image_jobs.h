@@ -33,6 +33,9 @@ dt_image_load_t;
 int32_t dt_image_load_job_run(dt_job_t *job);
 void dt_image_load_job_init(dt_job_t *job, int32_t imgid, dt_mipmap_size_t mip);
 
+int32_t dt_image_prefetch_job_run(dt_job_t *job);
+void dt_image_prefetch_job_init(dt_job_t *job, int32_t serial);
+
 typedef struct dt_image_import_t
 {
   uint32_t film_id;
@@ -22,52 +22,12 @@
 #include "develop/masks.h"
 #include "common/gaussian.h"
 #include "blend.h"
+#include "develop/blend_sse.h"
 
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
 
 typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, size_t stride, int flag);
-
-static inline void _RGB_2_HSL(const float *RGB, float *HSL)
-{
-  float H, S, L;
-
-  float R = RGB[0];
-  float G = RGB[1];
-  float B = RGB[2];
-
-  float var_Min = fminf(R, fminf(G, B));
-  float var_Max = fmaxf(R, fmaxf(G, B));
-  float del_Max = var_Max - var_Min;
-
-  L = (var_Max + var_Min) / 2.0f;
-
-  if (del_Max < 1e-6f)
-  {
-    H = 0.0f;
-    S = 0.0f;
-  }
-  else
-  {
-    if (L < 0.5f) S = del_Max / (var_Max + var_Min);
-    else          S = del_Max / (2.0f - var_Max - var_Min);
-
-    float del_R = (((var_Max - R) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_G = (((var_Max - G) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-    float del_B = (((var_Max - B) / 6.0f) + (del_Max / 2.0f)) / del_Max;
-
-    if      (R == var_Max) H = del_B - del_G;
-    else if (G == var_Max) H = (1.0f / 3.0f) + del_R - del_B;
-    else if (B == var_Max) H = (2.0f / 3.0f) + del_G - del_R;
-    else H = 0.0f;   // make GCC happy
-
-    if (H < 0.0f) H += 1.0f;
-    if (H > 1.0f) H -= 1.0f;
-  }
-
-  HSL[0] = H;
-  HSL[1] = S;
-  HSL[2] = L;
-}
+typedef void (_blend_mask_func)(const dt_develop_blendif_t *bi, const float gopacity, const float *a, const float *b, float *mask, const size_t width);
 
 static inline float _Hue_2_RGB(float v1, float v2, float vH)
 {
@@ -192,18 +152,6 @@ static inline void _HSV_2_RGB(const float *HSV, float *RGB)
   }
 }
 
-static inline void _Lab_2_LCH(const float *Lab, float *LCH)
-{
-  float var_H = atan2f(Lab[2], Lab[1]);
-
-  if (var_H > 0.0f) var_H = var_H / (2.0f*M_PI);
-  else              var_H = 1.0f - fabs(var_H) / (2.0f*M_PI);
-
-  LCH[0] = Lab[0];
-  LCH[1] = sqrtf(Lab[1]*Lab[1] + Lab[2]*Lab[2]);
-  LCH[2] = var_H;
-}
-
 static inline void _LCH_2_Lab(const float *LCH, float *Lab)
 {
   Lab[0] = LCH[0];
@@ -1931,26 +1879,32 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     return;
   }
 
+  /* get channel max values depending on colorspace */
+  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
+
+  /* four channel Lab and rgb rows can use the sse operators */
+  const int sse = (cst == iop_cs_Lab || cst == iop_cs_rgb);
+
   /* select the blend operator */
   switch (blend_mode)
   {
     case DEVELOP_BLEND_LIGHTEN:
-      blend = _blend_lighten;
+      blend = sse ? _blend_lighten_sse : _blend_lighten;
       break;
     case DEVELOP_BLEND_DARKEN:
-      blend = _blend_darken;
+      blend = sse ? _blend_darken_sse : _blend_darken;
       break;
     case DEVELOP_BLEND_MULTIPLY:
-      blend = _blend_multiply;
+      blend = sse ? _blend_multiply_sse : _blend_multiply;
       break;
     case DEVELOP_BLEND_AVERAGE:
-      blend = _blend_average;
+      blend = sse ? _blend_average_sse : _blend_average;
       break;
     case DEVELOP_BLEND_ADD:
-      blend = _blend_add;
+      blend = sse ? _blend_add_sse : _blend_add;
       break;
     case DEVELOP_BLEND_SUBSTRACT:
-      blend = _blend_substract;
+      blend = sse ? _blend_substract_sse : _blend_substract;
       break;
     case DEVELOP_BLEND_DIFFERENCE:
       blend = _blend_difference;
@@ -1959,7 +1913,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       blend = _blend_difference2;
       break;
     case DEVELOP_BLEND_SCREEN:
-      blend = _blend_screen;
+      blend = sse ? _blend_screen_sse : _blend_screen;
       break;
     case DEVELOP_BLEND_OVERLAY:
       blend = _blend_overlay;
@@ -1996,7 +1950,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       break;
     case DEVELOP_BLEND_NORMAL:
     case DEVELOP_BLEND_BOUNDED:
-      blend = _blend_normal_bounded;
+      blend = sse ? _blend_normal_bounded_sse : _blend_normal_bounded;
       break;
     case DEVELOP_BLEND_COLORADJUST:
       blend = _blend_coloradjust;
@@ -2018,7 +1972,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     case DEVELOP_BLEND_NORMAL2:
     case DEVELOP_BLEND_UNBOUNDED:
     default:
-      blend = _blend_normal_unbounded;
+      blend = sse ? _blend_normal_unbounded_sse : _blend_normal_unbounded;
       break;
   }
 
@@ -2031,9 +1985,6 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   /* check if we only should blend lightness channel. will affect only Lab space */
   const int blendflag = self->flags() & IOP_FLAGS_BLEND_ONLY_LIGHTNESS;
 
-  /* get channel max values depending on colorspace */
-  const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(self);
-
   /* correct bpp per pixel for raw
      \TODO actually invest why channels per pixel is 4 in raw..
   */
@@ -2041,13 +1992,16 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     ch = 1;
 
   /* allocate space for blend mask */
-  float *mask = dt_alloc_align(64, (size_t)roi_out->width*roi_out->height*sizeof(float));
+  float *mask = dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)roi_out->width*roi_out->height*sizeof(float));
   if(!mask)
   {
     dt_control_log(_("could not allocate buffer for blending"));
     return;
   }
 
+  /* set if blending already happened while making the mask */
+  int blended = 0;
+
   if(mask_mode == DEVELOP_MASK_ENABLED)
   {
     /* blend uniformly (no drawn or parametric mask) */
@@ -2117,13 +2071,26 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       for (size_t i=0; i<buffsize; i++) mask[i] = fill;
     }
 
-  
+
+    /* the parametric part of the mask, resolved for the colorspace once instead of per pixel */
+    dt_develop_blendif_t blendif;
+    _blendif_init(&blendif, cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine);
+    _blend_mask_func *make_mask = (cst == iop_cs_Lab) ? _blend_make_mask_Lab_sse
+                                  : (cst == iop_cs_rgb) ? _blend_make_mask_rgb_sse : NULL;
+
+    const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
+    const int gaussian = d->radius > 0.0f ? 1 : 0;
+    const float radius = fabs(d->radius);
+
+    /* check if mask should be suppressed temporarily (i.e. just set to global opacity value) */
+    const int suppress = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH);
+
+    /* unless the mask gets blurred or suppressed as a whole, every mask row only depends
+       on its own pixels. blend it right away then, while the row is still in cache. */
+    blended = !maskblur && !suppress;
+
 #ifdef _OPENMP
-#if !defined(__SUNOS__) && !defined(__NetBSD__) && !defined(__WIN32__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
-#else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
-#endif
+    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch,blendif,make_mask,blended)
 #endif
     for (size_t y=0; y<roi_out->height; y++)
     {
@@ -2133,13 +2100,22 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + iindex;
       float *out = (float *)o + oindex;
       float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
-    }
 
+      if(make_mask)
+        make_mask(&blendif, opacity, in, out, m, roi_out->width);
+      else
+        _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+
+      if(blended)
+      {
+        blend(cst, in, out, m, stride, blendflag);
+
+        if(mask_display && cst != iop_cs_RAW)
+          for(size_t j=0; j<stride; j+=4)
+            out[j+3] = in[j+3];
+      }
+    }
 
-    const int maskblur = fabs(d->radius) <= 0.1f ? 0 : 1;
-    const int gaussian = d->radius > 0.0f ? 1 : 0;
-    const float radius = fabs(d->radius);
 
     if(maskblur)
     {
@@ -2164,8 +2140,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     }
 
 
-    /* check if mask should be suppressed temporarily (i.e. just set to global opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
+    if(suppress)
     {
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__WIN32__)
@@ -2182,26 +2157,29 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
   }
 
   /* now apply blending with per-pixel opacity value as defined in mask */
+  if(!blended)
+  {
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__WIN32__)
-  #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
+    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
 #else
-  #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
+    #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
 #endif
 #endif
-  for (size_t y=0; y<roi_out->height; y++)
-  {
-    size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs)*ch;
-    size_t oindex = (size_t)y * roi_out->width*ch;
-    size_t stride = (size_t)roi_out->width*ch;
-    float *in = (float *)i + iindex;
-    float *out = (float *)o + oindex;
-    float *m = (float *)mask + y * roi_out->width;
-    blend(cst, in, out, m, stride, blendflag);
-
-    if(mask_display && cst != iop_cs_RAW)
-      for(size_t j=0; j<stride; j+=4)
-        out[j+3] = in[j+3];
+    for (size_t y=0; y<roi_out->height; y++)
+    {
+      size_t iindex = ((size_t)(y + yoffs) * iwidth + xoffs)*ch;
+      size_t oindex = (size_t)y * roi_out->width*ch;
+      size_t stride = (size_t)roi_out->width*ch;
+      float *in = (float *)i + iindex;
+      float *out = (float *)o + oindex;
+      float *m = (float *)mask + y * roi_out->width;
+      blend(cst, in, out, m, stride, blendflag);
+
+      if(mask_display && cst != iop_cs_RAW)
+        for(size_t j=0; j<stride; j+=4)
+          out[j+3] = in[j+3];
+    }
   }
 
   /* check if _this_ module should expose mask. */
@@ -2210,7 +2188,7 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     piece->pipe->mask_display = 1;
   }
 
-  dt_free_align(mask);
+  dt_dev_pixelpipe_scratch_put(piece->pipe, mask);
 }
 
 
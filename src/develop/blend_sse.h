@@ -0,0 +1,499 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DT_DEVELOP_BLEND_SSE_H
+#define DT_DEVELOP_BLEND_SSE_H
+
+// sse versions of the parametric mask and of the most used blend operators.
+// the colorspace is resolved once per image instead of once per pixel. only
+// four channel Lab and rgb buffers end up here, raw data keeps going through
+// the scalar code in blend.c. the includer provides dt_iop_colorspace_type_t
+// and the DEVELOP_* enums, so src/tests can use this without the rest of dt.
+
+#include <math.h>
+#include <xmmintrin.h>
+
+static inline void _RGB_2_HSL(const float *RGB, float *HSL)
+{
+  float H, S, L;
+
+  float R = RGB[0];
+  float G = RGB[1];
+  float B = RGB[2];
+
+  float var_Min = fminf(R, fminf(G, B));
+  float var_Max = fmaxf(R, fmaxf(G, B));
+  float del_Max = var_Max - var_Min;
+
+  L = (var_Max + var_Min) / 2.0f;
+
+  if (del_Max < 1e-6f)
+  {
+    H = 0.0f;
+    S = 0.0f;
+  }
+  else
+  {
+    if (L < 0.5f) S = del_Max / (var_Max + var_Min);
+    else          S = del_Max / (2.0f - var_Max - var_Min);
+
+    float del_R = (((var_Max - R) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+    float del_G = (((var_Max - G) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+    float del_B = (((var_Max - B) / 6.0f) + (del_Max / 2.0f)) / del_Max;
+
+    if      (R == var_Max) H = del_B - del_G;
+    else if (G == var_Max) H = (1.0f / 3.0f) + del_R - del_B;
+    else if (B == var_Max) H = (2.0f / 3.0f) + del_G - del_R;
+    else H = 0.0f;   // make GCC happy
+
+    if (H < 0.0f) H += 1.0f;
+    if (H > 1.0f) H -= 1.0f;
+  }
+
+  HSL[0] = H;
+  HSL[1] = S;
+  HSL[2] = L;
+}
+
+static inline void _Lab_2_LCH(const float *Lab, float *LCH)
+{
+  float var_H = atan2f(Lab[2], Lab[1]);
+
+  if (var_H > 0.0f) var_H = var_H / (2.0f*M_PI);
+  else              var_H = 1.0f - fabs(var_H) / (2.0f*M_PI);
+
+  LCH[0] = Lab[0];
+  LCH[1] = sqrtf(Lab[1]*Lab[1] + Lab[2]*Lab[2]);
+  LCH[2] = var_H;
+}
+
+
+/** blendif settings of one module, resolved for the colorspace it works in */
+typedef struct dt_develop_blendif_t
+{
+  int num;                                      // number of channels with a ramp
+  int channel[DEVELOP_BLENDIF_SIZE];            // blendif channel of each ramp
+  int invert[DEVELOP_BLENDIF_SIZE];             // ramp is inverted
+  float p[DEVELOP_BLENDIF_SIZE][4];             // ramp corners
+  float rise[DEVELOP_BLENDIF_SIZE];             // width of the rising edge, at least 0.01
+  float fall[DEVELOP_BLENDIF_SIZE];             // width of the falling edge, at least 0.01
+  float constant;                               // contribution of channels spanning the whole range
+  int polar;                                    // LCh or HSL values are needed
+  int incl;
+  int inv;
+}
+dt_develop_blendif_t;
+
+static inline void _blendif_init(dt_develop_blendif_t *bi, dt_iop_colorspace_type_t cst, const unsigned int blendif,
+                                 const float *parameters, const unsigned int mask_mode, const unsigned int mask_combine)
+{
+  unsigned int channel_mask = 0;
+
+  if(mask_mode & DEVELOP_MASK_CONDITIONAL)
+    channel_mask = (cst == iop_cs_Lab) ? DEVELOP_BLENDIF_Lab_MASK : (cst == iop_cs_rgb) ? DEVELOP_BLENDIF_RGB_MASK : 0;
+
+  bi->num = 0;
+  bi->constant = 1.0f;
+  bi->polar = 0;
+  bi->incl = (mask_combine & DEVELOP_COMBINE_INCL) ? 1 : 0;
+  bi->inv = (mask_combine & DEVELOP_COMBINE_INV) ? 1 : 0;
+
+  for(int ch=0; ch<=DEVELOP_BLENDIF_MAX; ch++)
+  {
+    if((channel_mask & (1<<ch)) == 0) continue;
+
+    if((blendif & (1<<ch)) == 0)
+    {
+      bi->constant *= !(blendif & (1<<(ch+16))) == !bi->incl ? 1.0f : 0.0f;
+      continue;
+    }
+
+    const int k = bi->num++;
+    bi->channel[k] = ch;
+    bi->invert[k] = (blendif & (1<<(ch+16))) ? 1 : 0;
+    for(int c=0; c<4; c++) bi->p[k][c] = parameters[4*ch+c];
+    bi->rise[k] = fmaxf(0.01f, parameters[4*ch+1]-parameters[4*ch+0]);
+    bi->fall[k] = fmaxf(0.01f, parameters[4*ch+3]-parameters[4*ch+2]);
+    if(ch >= 8) bi->polar = 1;
+  }
+}
+
+static inline __m128 _blend_clamp_sse(const __m128 x, const __m128 min, const __m128 max)
+{
+  return _mm_min_ps(_mm_max_ps(x, min), max);
+}
+
+/* load four pixels, repeating the first one past the end of the row */
+static inline void _blend_load4_sse(const float *p, const int n, __m128 *v)
+{
+  for(int k=0; k<4; k++) v[k] = _mm_loadu_ps(p + 4*(k < n ? k : 0));
+}
+
+/* turn the scaled channels of n <= 4 pixels into mask values, combined with the drawn mask */
+static inline void _blendif_combine_sse(const dt_develop_blendif_t *bi, const __m128 *scaled, const float gopacity, float *mask, const int n)
+{
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 result = _mm_set1_ps(bi->constant);
+
+  for(int k=0; k<bi->num; k++)
+  {
+    const __m128 x = scaled[bi->channel[k]];
+    const __m128 p0 = _mm_set1_ps(bi->p[k][0]);
+    const __m128 p1 = _mm_set1_ps(bi->p[k][1]);
+    const __m128 p2 = _mm_set1_ps(bi->p[k][2]);
+    const __m128 p3 = _mm_set1_ps(bi->p[k][3]);
+
+    const __m128 plateau = _mm_and_ps(_mm_cmpge_ps(x, p1), _mm_cmple_ps(x, p2));
+    const __m128 rising = _mm_and_ps(_mm_cmpgt_ps(x, p0), _mm_cmplt_ps(x, p1));
+    const __m128 falling = _mm_andnot_ps(rising, _mm_and_ps(_mm_cmpgt_ps(x, p2), _mm_cmplt_ps(x, p3)));
+
+    __m128 factor = _mm_and_ps(plateau, one);
+    factor = _mm_or_ps(factor, _mm_and_ps(rising, _mm_div_ps(_mm_sub_ps(x, p0), _mm_set1_ps(bi->rise[k]))));
+    factor = _mm_or_ps(factor, _mm_and_ps(falling, _mm_sub_ps(one, _mm_div_ps(_mm_sub_ps(x, p2), _mm_set1_ps(bi->fall[k])))));
+
+    if(bi->invert[k]) factor = _mm_sub_ps(one, factor);
+
+    result = _mm_mul_ps(result, bi->incl ? _mm_sub_ps(one, factor) : factor);
+  }
+
+  const __m128 conditional = bi->incl ? _mm_sub_ps(one, result) : result;
+
+  float f[4] = { 0.0f };
+  for(int k=0; k<n; k++) f[k] = mask[k];
+  const __m128 form = _mm_loadu_ps(f);
+
+  __m128 opacity = bi->incl ? _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, form), _mm_sub_ps(one, conditional)))
+                            : _mm_mul_ps(form, conditional);
+  if(bi->inv) opacity = _mm_sub_ps(one, opacity);
+
+  _mm_storeu_ps(f, _mm_mul_ps(opacity, _mm_set1_ps(gopacity)));
+  for(int k=0; k<n; k++) mask[k] = f[k];
+}
+
+/* generate blend mask for one row of Lab pixels */
+static void _blend_make_mask_Lab_sse(const dt_develop_blendif_t *bi, const float gopacity, const float *a, const float *b, float *mask, const size_t width)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 L_scale = _mm_set1_ps(100.0f);
+  const __m128 ab_offset = _mm_set1_ps(128.0f);
+  const __m128 ab_scale = _mm_set1_ps(1.0f/256.0f);
+
+  for(size_t i=0; i<width; i+=4)
+  {
+    const int n = width - i < 4 ? width - i : 4;
+    __m128 scaled[DEVELOP_BLENDIF_SIZE];
+
+    if(bi->num)
+    {
+      __m128 pa[4], pb[4];
+      _blend_load4_sse(a + 4*i, n, pa);
+      _blend_load4_sse(b + 4*i, n, pb);
+      _MM_TRANSPOSE4_PS(pa[0], pa[1], pa[2], pa[3]);
+      _MM_TRANSPOSE4_PS(pb[0], pb[1], pb[2], pb[3]);
+
+      scaled[DEVELOP_BLENDIF_L_in] = _blend_clamp_sse(_mm_div_ps(pa[0], L_scale), zero, one);
+      scaled[DEVELOP_BLENDIF_A_in] = _blend_clamp_sse(_mm_mul_ps(_mm_add_ps(pa[1], ab_offset), ab_scale), zero, one);
+      scaled[DEVELOP_BLENDIF_B_in] = _blend_clamp_sse(_mm_mul_ps(_mm_add_ps(pa[2], ab_offset), ab_scale), zero, one);
+      scaled[DEVELOP_BLENDIF_L_out] = _blend_clamp_sse(_mm_div_ps(pb[0], L_scale), zero, one);
+      scaled[DEVELOP_BLENDIF_A_out] = _blend_clamp_sse(_mm_mul_ps(_mm_add_ps(pb[1], ab_offset), ab_scale), zero, one);
+      scaled[DEVELOP_BLENDIF_B_out] = _blend_clamp_sse(_mm_mul_ps(_mm_add_ps(pb[2], ab_offset), ab_scale), zero, one);
+
+      if(bi->polar)
+      {
+        // hue needs atan2, no point in vectorizing that by hand
+        float C_in[4], h_in[4], C_out[4], h_out[4];
+        for(int k=0; k<4; k++)
+        {
+          float LCH_input[3], LCH_output[3];
+          const size_t p = 4*(i + (k < n ? k : 0));
+          _Lab_2_LCH(a + p, LCH_input);
+          _Lab_2_LCH(b + p, LCH_output);
+          C_in[k] = LCH_input[1] / (128.0f*sqrtf(2.0f));
+          h_in[k] = LCH_input[2];
+          C_out[k] = LCH_output[1] / (128.0f*sqrtf(2.0f));
+          h_out[k] = LCH_output[2];
+        }
+        scaled[DEVELOP_BLENDIF_C_in] = _blend_clamp_sse(_mm_loadu_ps(C_in), zero, one);
+        scaled[DEVELOP_BLENDIF_h_in] = _blend_clamp_sse(_mm_loadu_ps(h_in), zero, one);
+        scaled[DEVELOP_BLENDIF_C_out] = _blend_clamp_sse(_mm_loadu_ps(C_out), zero, one);
+        scaled[DEVELOP_BLENDIF_h_out] = _blend_clamp_sse(_mm_loadu_ps(h_out), zero, one);
+      }
+    }
+
+    _blendif_combine_sse(bi, scaled, gopacity, mask + i, n);
+  }
+}
+
+/* generate blend mask for one row of rgb pixels */
+static void _blend_make_mask_rgb_sse(const dt_develop_blendif_t *bi, const float gopacity, const float *a, const float *b, float *mask, const size_t width)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 wr = _mm_set1_ps(0.3f), wg = _mm_set1_ps(0.59f), wb = _mm_set1_ps(0.11f);
+
+  for(size_t i=0; i<width; i+=4)
+  {
+    const int n = width - i < 4 ? width - i : 4;
+    __m128 scaled[DEVELOP_BLENDIF_SIZE];
+
+    if(bi->num)
+    {
+      __m128 pa[4], pb[4];
+      _blend_load4_sse(a + 4*i, n, pa);
+      _blend_load4_sse(b + 4*i, n, pb);
+      _MM_TRANSPOSE4_PS(pa[0], pa[1], pa[2], pa[3]);
+      _MM_TRANSPOSE4_PS(pb[0], pb[1], pb[2], pb[3]);
+
+      scaled[DEVELOP_BLENDIF_GRAY_in] = _blend_clamp_sse(_mm_add_ps(_mm_add_ps(_mm_mul_ps(wr, pa[0]), _mm_mul_ps(wg, pa[1])), _mm_mul_ps(wb, pa[2])), zero, one);
+      scaled[DEVELOP_BLENDIF_RED_in] = _blend_clamp_sse(pa[0], zero, one);
+      scaled[DEVELOP_BLENDIF_GREEN_in] = _blend_clamp_sse(pa[1], zero, one);
+      scaled[DEVELOP_BLENDIF_BLUE_in] = _blend_clamp_sse(pa[2], zero, one);
+      scaled[DEVELOP_BLENDIF_GRAY_out] = _blend_clamp_sse(_mm_add_ps(_mm_add_ps(_mm_mul_ps(wr, pb[0]), _mm_mul_ps(wg, pb[1])), _mm_mul_ps(wb, pb[2])), zero, one);
+      scaled[DEVELOP_BLENDIF_RED_out] = _blend_clamp_sse(pb[0], zero, one);
+      scaled[DEVELOP_BLENDIF_GREEN_out] = _blend_clamp_sse(pb[1], zero, one);
+      scaled[DEVELOP_BLENDIF_BLUE_out] = _blend_clamp_sse(pb[2], zero, one);
+
+      if(bi->polar)
+      {
+        float HSL_input[4][4], HSL_output[4][4];
+        for(int k=0; k<4; k++)
+        {
+          const size_t p = 4*(i + (k < n ? k : 0));
+          _RGB_2_HSL(a + p, HSL_input[k]);
+          _RGB_2_HSL(b + p, HSL_output[k]);
+          HSL_input[k][3] = HSL_output[k][3] = 0.0f;
+        }
+        __m128 hi[4], ho[4];
+        for(int k=0; k<4; k++)
+        {
+          hi[k] = _mm_loadu_ps(HSL_input[k]);
+          ho[k] = _mm_loadu_ps(HSL_output[k]);
+        }
+        _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+        _MM_TRANSPOSE4_PS(ho[0], ho[1], ho[2], ho[3]);
+        scaled[DEVELOP_BLENDIF_H_in] = _blend_clamp_sse(hi[0], zero, one);
+        scaled[DEVELOP_BLENDIF_S_in] = _blend_clamp_sse(hi[1], zero, one);
+        scaled[DEVELOP_BLENDIF_l_in] = _blend_clamp_sse(hi[2], zero, one);
+        scaled[DEVELOP_BLENDIF_H_out] = _blend_clamp_sse(ho[0], zero, one);
+        scaled[DEVELOP_BLENDIF_S_out] = _blend_clamp_sse(ho[1], zero, one);
+        scaled[DEVELOP_BLENDIF_l_out] = _blend_clamp_sse(ho[2], zero, one);
+      }
+    }
+
+    _blendif_combine_sse(bi, scaled, gopacity, mask + i, n);
+  }
+}
+
+
+/* pixel access for the blend operators below: Lab gets scaled to 0..1 for L
+   and -1..1 for a and b, rgb is used as is. */
+static inline __m128 _blend_load_sse(const int Lab, const float *p)
+{
+  const __m128 v = _mm_loadu_ps(p);
+  return Lab ? _mm_div_ps(v, _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f)) : v;
+}
+
+/* write back a blended pixel. with flag set only L is blended in Lab. */
+static inline void _blend_store_sse(const int Lab, const int flag, const __m128 ta, __m128 tb, const float opacity, float *p)
+{
+  if(Lab)
+  {
+    if(flag) tb = _mm_move_ss(ta, tb);
+    tb = _mm_mul_ps(tb, _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f));
+  }
+  _mm_storeu_ps(p, tb);
+  p[3] = opacity;
+}
+
+static inline __m128 _blend_min_sse(const int Lab)
+{
+  return Lab ? _mm_set_ps(0.0f, -1.0f, -1.0f, 0.0f) : _mm_setzero_ps();
+}
+
+/* broadcast lane 0 */
+static inline __m128 _blend_L_sse(const __m128 v)
+{
+  return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+}
+
+/* normal blend with clamping */
+static void _blend_normal_bounded_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(tb, o)), min, max);
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* normal blend without any clamping */
+static void _blend_normal_unbounded_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(one, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 r = _mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(tb, o));
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* lighten and darken only differ in the selection of the pixel */
+static inline void _blend_lighten_darken_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag,
+                                             const int lighten)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 sel = lighten ? _mm_max_ps(ta, tb) : _mm_min_ps(ta, tb);
+    __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(sel, o)), min, max);
+    if(Lab)
+    {
+      // chroma follows the change in lightness
+      const __m128 d = _blend_L_sse(_mm_max_ps(_mm_sub_ps(tb, r), _mm_sub_ps(r, tb)));
+      const __m128 ab = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(max, d)), _mm_mul_ps(_mm_mul_ps(half, _mm_add_ps(ta, tb)), d));
+      r = _mm_move_ss(_blend_clamp_sse(ab, min, max), r);
+    }
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* lighten */
+static void _blend_lighten_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  _blend_lighten_darken_sse(cst, a, b, mask, stride, flag, 1);
+}
+
+/* darken */
+static void _blend_darken_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  _blend_lighten_darken_sse(cst, a, b, mask, stride, flag, 0);
+}
+
+/* multiply */
+static void _blend_multiply_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 zero = _mm_setzero_ps(), min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f), eps = _mm_set1_ps(0.01f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    __m128 r;
+    if(Lab)
+    {
+      const __m128 la = _blend_clamp_sse(ta, zero, max), lb = _blend_clamp_sse(tb, zero, max);
+      const __m128 L = _blend_L_sse(_blend_clamp_sse(_mm_add_ps(_mm_mul_ps(la, io), _mm_mul_ps(_mm_mul_ps(la, lb), o)), zero, max));
+      const __m128 ratio = _mm_div_ps(_mm_mul_ps(_mm_add_ps(ta, tb), L), _mm_max_ps(_blend_L_sse(ta), eps));
+      r = _mm_move_ss(_blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(ratio, o)), min, max), L);
+    }
+    else
+      r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(_mm_mul_ps(ta, tb), o)), min, max);
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* average */
+static void _blend_average_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f), half = _mm_set1_ps(0.5f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(_mm_mul_ps(_mm_add_ps(ta, tb), half), o)), min, max);
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* add */
+static void _blend_add_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(_mm_add_ps(ta, tb), o)), min, max);
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* substract */
+static void _blend_substract_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f);
+  // |min + max| per channel
+  const __m128 range = Lab ? _mm_set_ps(1.0f, 0.0f, 0.0f, 1.0f) : max;
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(_mm_sub_ps(_mm_add_ps(tb, ta), range), o)), min, max);
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+/* screen */
+static void _blend_screen_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  const int Lab = cst == iop_cs_Lab;
+  const __m128 zero = _mm_setzero_ps(), min = _blend_min_sse(Lab), max = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f), eps = _mm_set1_ps(0.01f);
+
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const __m128 o = _mm_set1_ps(mask[i]), io = _mm_sub_ps(max, o);
+    const __m128 ta = _blend_load_sse(Lab, a + j), tb = _blend_load_sse(Lab, b + j);
+    const __m128 la = _blend_clamp_sse(ta, zero, max), lb = _blend_clamp_sse(tb, zero, max);
+    const __m128 s = _mm_sub_ps(max, _mm_mul_ps(_mm_sub_ps(max, la), _mm_sub_ps(max, lb)));
+    __m128 r = _blend_clamp_sse(_mm_add_ps(_mm_mul_ps(la, io), _mm_mul_ps(s, o)), zero, max);
+    if(Lab)
+    {
+      const __m128 L = _blend_L_sse(r);
+      const __m128 ratio = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(half, _mm_add_ps(ta, tb)), L), _mm_max_ps(_blend_L_sse(ta), eps));
+      r = _mm_move_ss(_blend_clamp_sse(_mm_add_ps(_mm_mul_ps(ta, io), _mm_mul_ps(ratio, o)), min, max), L);
+    }
+    _blend_store_sse(Lab, flag, ta, r, mask[i], b + j);
+  }
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -44,6 +44,8 @@
 #define DT_DEV_AVERAGE_DELAY_START            250
 #define DT_DEV_PREVIEW_AVERAGE_DELAY_START     50
 #define DT_DEV_AVERAGE_DELAY_COUNT              5
+#define DT_DEV_FRAME_BUDGET                    40 // ms
+#define DT_DEV_COALESCE_STEP                    5 // ms
 
 
 const gchar* dt_dev_histogram_type_names[DT_DEV_HISTOGRAM_N] = { "logarithmic", "linear", "waveform" };
@@ -264,6 +266,25 @@ restart:
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
 }
 
+// called when the full pipe got interrupted by new history items or zoom/pan events.
+// instead of jumping right back in (and getting interrupted again by the next slider
+// event), give the preview pipe the chance to put its low resolution result on screen
+// first and collect all changes arriving within one frame budget into a single run.
+// the full resolution image is then refined from the cached input of the focussed
+// module once the input settled.
+static void _dev_coalesce_changes(dt_develop_t *dev)
+{
+  uint32_t timestamp = dev->timestamp;
+  for(int waited = 0; waited < DT_DEV_FRAME_BUDGET; waited += DT_DEV_COALESCE_STEP)
+  {
+    if(dev->gui_leaving || dev->image_force_reload) return;
+    dt_iop_nap(DT_DEV_COALESCE_STEP*1000);
+    const int preview_pending = dev->gui_attached && dev->preview_dirty;
+    if(dev->timestamp == timestamp && !preview_pending) return;
+    timestamp = dev->timestamp;
+  }
+}
+
 void dt_dev_process_image_job(dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&dev->pipe_mutex);
@@ -352,13 +373,18 @@ restart:
       return;
     }
     // or because the pipeline changed?
-    else goto restart;
+    _dev_coalesce_changes(dev);
+    goto restart;
   }
   dt_show_times(&start, "[dev_process_image] pixel pipeline processing", NULL);
   dt_dev_average_delay_update(&start, &dev->average_delay);
 
   // maybe we got zoomed/panned in the meantime?
-  if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED) goto restart;
+  if(dev->pipe->changed != DT_DEV_PIPE_UNCHANGED)
+  {
+    _dev_coalesce_changes(dev);
+    goto restart;
+  }
 
   // cool, we got a new image!
   dev->image_dirty = 0;
@@ -21,6 +21,7 @@
 #include "common/opencl.h"
 #include "common/dtpthread.h"
 #include "common/debug.h"
+#include "common/presets_stamp.h"
 #include "common/interpolation.h"
 #include "bauhaus/bauhaus.h"
 #include "control/control.h"
@@ -45,6 +46,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <gmodule.h>
+#include <glib/gstdio.h>
 #include <xmmintrin.h>
 #include <time.h>
 
@@ -922,19 +924,40 @@ void dt_iop_reload_defaults(dt_iop_module_t *module)
     _iop_gui_update_header(module);
 }
 
+// the built-in presets only change with the plugin binary, see common/presets_stamp.h
+static gchar *
+presets_stamp(dt_iop_module_so_t *module_so, const char *libname)
+{
+  GStatBuf st;
+  if(g_stat(libname, &st)) return NULL;
+  return g_strdup_printf("%d:%d:%s:%ld:%ld", module_so->version(), dt_develop_blend_version(),
+                         PACKAGE_VERSION, (long)st.st_mtime, (long)st.st_size);
+}
+
 static void
-init_presets(dt_iop_module_so_t *module_so)
+init_presets(dt_iop_module_so_t *module_so, const char *libname)
 {
-  if(module_so->init_presets) module_so->init_presets(module_so);
+  gchar *stamp = presets_stamp(module_so, libname);
+  if(module_so->init_presets && !dt_presets_stamp_matches(dt_database_get(darktable.db), module_so->op, stamp))
+  {
+    dt_presets_stamp_clear(dt_database_get(darktable.db), module_so->op);
+    module_so->init_presets(module_so);
+    dt_presets_stamp_store(dt_database_get(darktable.db), module_so->op, stamp);
+  }
+  g_free(stamp);
 
   // this seems like a reasonable place to check for and update legacy
   // presets.
 
   int32_t module_version = module_so->version();
 
+  // only look at the presets that actually need an update
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select name, op_version, op_params, blendop_version, blendop_params from presets where operation = ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select name, op_version, op_params, blendop_version, blendop_params from presets "
+                              "where operation = ?1 and (op_version < ?2 or blendop_version < ?3 or blendop_params is null)", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module_so->op, strlen(module_so->op), SQLITE_TRANSIENT);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, module_version);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, dt_develop_blend_version());
 
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -1130,6 +1153,9 @@ void dt_iop_load_modules_so()
   if(!dir) return;
   const int name_offset = strlen(SHARED_MODULE_PREFIX),
             name_end    = strlen(SHARED_MODULE_PREFIX) + strlen(SHARED_MODULE_SUFFIX);
+  double load_time = 0.0, presets_time = 0.0;
+  // all the preset inserts and updates go into one transaction instead of one per row
+  dt_database_start_transaction(darktable.db);
   while((d_name = g_dir_read_name(dir)))
   {
       // get lib*.so
@@ -1140,14 +1166,19 @@ void dt_iop_load_modules_so()
     module = (dt_iop_module_so_t *)malloc(sizeof(dt_iop_module_so_t));
     memset(module,0,sizeof(dt_iop_module_so_t));
     gchar *libname = g_module_build_path(plugindir, (const gchar *)op);
+    double start = dt_get_wtime();
     if(dt_iop_load_module_so(module, libname, op))
     {
+      g_free(libname);
       free(module);
       continue;
     }
-    g_free(libname);
+    load_time += dt_get_wtime() - start;
     res = g_list_append(res, module);
-    init_presets(module);
+    start = dt_get_wtime();
+    init_presets(module, libname);
+    presets_time += dt_get_wtime() - start;
+    g_free(libname);
     // Calling the accelerator initialization callback, if present
     init_key_accels(module);
 
@@ -1167,8 +1198,11 @@ void dt_iop_load_modules_so()
                             NC_("accel", "show preset menu"), 0, 0);
     }
   }
+  dt_database_release_transaction(darktable.db);
   g_dir_close(dir);
   darktable.iop = res;
+  dt_print(DT_DEBUG_PERF, "[iop_load_modules] %d modules: %.3f s opening plugins, %.3f s presets\n",
+           g_list_length(res), load_time, presets_time);
 }
 
 int dt_iop_load_module(dt_iop_module_t *module, dt_iop_module_so_t *module_so, dt_develop_t *dev)
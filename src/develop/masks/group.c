@@ -438,10 +438,18 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
 
     if (sel)
     {
-      const int ok = dt_masks_get_mask_roi(module,piece,sel,roi,bufs);
+      int bbox[4];
+      const int ok = _masks_get_mask_roi_bbox(module,piece,sel,roi,bufs,bbox);
       const float op = fpt->opacity;
       const int state = fpt->state;
 
+      // outside of its box the shape is zero, which leaves union, difference and exclusion alone
+      const int inverse = state & DT_MASKS_STATE_INVERSE;
+      const int x0 = inverse ? 0 : bbox[0];
+      const int y0 = inverse ? 0 : bbox[1];
+      const int x1 = inverse ? width : bbox[0] + bbox[2];
+      const int y1 = inverse ? height : bbox[1] + bbox[3];
+
       if (ok) 
       {
         //first see if we need to invert this shape
@@ -471,8 +479,8 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
           #pragma omp parallel for shared(bufs,buffer)
 #endif
 #endif
-          for (int y=0; y<height; y++)
-            for (int x=0; x<width; x++)
+          for (int y=y0; y<y1; y++)
+            for (int x=x0; x<x1; x++)
             {
               size_t index = (size_t)y*width + x;
               buffer[index] = fmaxf(buffer[index], bufs[index]*op);
@@ -506,8 +514,8 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
           #pragma omp parallel for shared(bufs,buffer)
 #endif
 #endif
-          for (int y=0; y<height; y++)
-            for (int x=0; x<width; x++)
+          for (int y=y0; y<y1; y++)
+            for (int x=x0; x<x1; x++)
             {
               size_t index = (size_t)y*width + x;
               float b1 = buffer[index];
@@ -524,8 +532,8 @@ static int dt_group_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t
           #pragma omp parallel for shared(bufs,buffer)
 #endif
 #endif
-          for (int y=0; y<height; y++)
-            for (int x=0; x<width; x++)
+          for (int y=y0; y<y1; y++)
+            for (int x=x0; x<x1; x++)
             {
               size_t index = (size_t)y*width + x;
               float b1 = buffer[index];
@@ -24,6 +24,9 @@
 #include "common/debug.h"
 #include "common/mipmap_cache.h"
 
+/** render a form like dt_masks_get_mask_roi() and return the part of the roi it touches in bbox (x, y, width, height) */
+static int _masks_get_mask_roi_bbox(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer, int *bbox);
+
 #include "develop/masks/circle.c"
 #include "develop/masks/path.c"
 #include "develop/masks/brush.c"
@@ -426,7 +429,7 @@ int dt_masks_get_mask(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt
   return 0;
 }
 
-int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer)
+static int _masks_render_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer)
 {
   if (form->type & DT_MASKS_CIRCLE)
   {
@@ -455,6 +458,197 @@ int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece
   return 0;
 }
 
+/** one form rendered for the darkroom pipes, cropped to the part which is not zero */
+typedef struct _masks_raster_t
+{
+  uint64_t hash;    // form, roi and everything that distorts the form on its way to the module
+  int ok;           // what rendering the form returned
+  int bbox[4];      // x, y, width and height of the stored part within the roi
+  float *buffer;    // bbox[2]*bbox[3] values
+}
+_masks_raster_t;
+
+// most recently used first, protected by _raster_cache_lock
+static GList *_raster_cache = NULL;
+static size_t _raster_cache_size = 0;
+G_LOCK_DEFINE_STATIC(_raster_cache_lock);
+
+static uint64_t _masks_hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+  const unsigned char *str = (const unsigned char *)data;
+  for(size_t i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+static uint64_t _masks_raster_hash(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi)
+{
+  uint64_t hash = 5381;
+
+  const int length = dt_masks_group_get_hash_buffer_length(form);
+  char *str = malloc(length);
+  dt_masks_group_get_hash_buffer(form, str);
+  hash = _masks_hash_bytes(hash, str, length);
+  free(str);
+
+  hash = _masks_hash_bytes(hash, &roi->x, sizeof(roi->x));
+  hash = _masks_hash_bytes(hash, &roi->y, sizeof(roi->y));
+  hash = _masks_hash_bytes(hash, &roi->width, sizeof(roi->width));
+  hash = _masks_hash_bytes(hash, &roi->height, sizeof(roi->height));
+  hash = _masks_hash_bytes(hash, &roi->scale, sizeof(roi->scale));
+
+  const dt_dev_pixelpipe_t *pipe = piece->pipe;
+  hash = _masks_hash_bytes(hash, &pipe->image.id, sizeof(pipe->image.id));
+  hash = _masks_hash_bytes(hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  hash = _masks_hash_bytes(hash, &pipe->iheight, sizeof(pipe->iheight));
+  hash = _masks_hash_bytes(hash, &pipe->iscale, sizeof(pipe->iscale));
+
+  // the points go through dt_dev_distort_transform_plus() up to the module itself. for the module
+  // we take its params: the hash of its own piece includes all its forms, so any edit would
+  // invalidate every other form of the group as well.
+  GList *modules = g_list_first(module->dev->iop);
+  GList *pieces = g_list_first(pipe->nodes);
+  while(modules && pieces)
+  {
+    const dt_iop_module_t *m = (dt_iop_module_t *)modules->data;
+    const dt_dev_pixelpipe_iop_t *p = (dt_dev_pixelpipe_iop_t *)pieces->data;
+    if(m->priority > module->priority) break;
+    const int enabled = m->enabled || p->enabled;
+    hash = _masks_hash_bytes(hash, &enabled, sizeof(enabled));
+    if(m == module)
+      hash = _masks_hash_bytes(hash, m->params, m->params_size);
+    else if(enabled)
+      hash = _masks_hash_bytes(hash, &p->hash, sizeof(p->hash));
+    modules = g_list_next(modules);
+    pieces = g_list_next(pieces);
+  }
+  return hash;
+}
+
+static void _masks_raster_free(_masks_raster_t *r)
+{
+  dt_free_align(r->buffer);
+  free(r);
+}
+
+void dt_masks_raster_cache_clear(void)
+{
+  G_LOCK(_raster_cache_lock);
+  while(_raster_cache)
+  {
+    _masks_raster_free((_masks_raster_t *)_raster_cache->data);
+    _raster_cache = g_list_delete_link(_raster_cache, _raster_cache);
+  }
+  _raster_cache_size = 0;
+  G_UNLOCK(_raster_cache_lock);
+}
+
+static int _masks_get_mask_roi_bbox(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer, int *bbox)
+{
+  const int width = roi->width;
+  const int height = roi->height;
+
+  bbox[0] = bbox[1] = 0;
+  bbox[2] = width;
+  bbox[3] = height;
+
+  // only single forms of the interactive pipes are kept: these get rendered over and over with the same
+  // roi while one form of a group is edited. export and groups (combined from cached forms) go straight.
+  const size_t max_size = (size_t)MAX(0, dt_conf_get_int("plugins/darkroom/masks/raster_cache")) << 20;
+  if(!module || (form->type & DT_MASKS_GROUP) || !module->dev->gui_attached || max_size == 0
+     || (piece->pipe != module->dev->pipe && piece->pipe != module->dev->preview_pipe))
+    return _masks_render_roi(module,piece,form,roi,buffer);
+
+  double start = dt_get_wtime();
+  const uint64_t hash = _masks_raster_hash(module,piece,form,roi);
+
+  G_LOCK(_raster_cache_lock);
+  for(GList *l = _raster_cache; l; l = g_list_next(l))
+  {
+    _masks_raster_t *r = (_masks_raster_t *)l->data;
+    if(r->hash != hash) continue;
+
+    _raster_cache = g_list_concat(l, g_list_remove_link(_raster_cache, l));
+    memset(buffer, 0, (size_t)width*height*sizeof(float));
+    for(int j=0; j<r->bbox[3]; j++)
+      memcpy(buffer + (size_t)(r->bbox[1]+j)*width + r->bbox[0], r->buffer + (size_t)j*r->bbox[2], r->bbox[2]*sizeof(float));
+    memcpy(bbox, r->bbox, sizeof(r->bbox));
+    const int ok = r->ok;
+    G_UNLOCK(_raster_cache_lock);
+
+    if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks %s] raster cache hit took %0.04f sec\n", form->name, dt_get_wtime()-start);
+    return ok;
+  }
+  G_UNLOCK(_raster_cache_lock);
+
+  const int ok = _masks_render_roi(module,piece,form,roi,buffer);
+  if(!ok) return ok;
+
+  // find the rows and columns the form reaches into
+  int x0 = width, x1 = -1, y0 = height, y1 = -1;
+  for(int j=0; j<height; j++)
+  {
+    const float *row = buffer + (size_t)j*width;
+    int first = 0, last = width-1;
+    while(first < width && row[first] == 0.0f) first++;
+    if(first == width) continue;
+    while(row[last] == 0.0f) last--;
+    x0 = MIN(x0, first);
+    x1 = MAX(x1, last);
+    y0 = MIN(y0, j);
+    y1 = j;
+  }
+  if(y1 < 0)
+  {
+    // nothing at all, store an empty box
+    x0 = y0 = 0;
+    x1 = y1 = -1;
+  }
+
+  bbox[0] = x0;
+  bbox[1] = y0;
+  bbox[2] = x1 - x0 + 1;
+  bbox[3] = y1 - y0 + 1;
+
+  const size_t size = (size_t)bbox[2]*bbox[3]*sizeof(float);
+  if(size > max_size) return ok;
+
+  _masks_raster_t *r = (_masks_raster_t *)malloc(sizeof(_masks_raster_t));
+  if(!r) return ok;
+  r->buffer = size ? (float *)dt_alloc_align(64, size) : NULL;
+  if(size && !r->buffer)
+  {
+    free(r);
+    return ok;
+  }
+  r->hash = hash;
+  r->ok = ok;
+  memcpy(r->bbox, bbox, sizeof(r->bbox));
+  for(int j=0; j<bbox[3]; j++)
+    memcpy(r->buffer + (size_t)j*bbox[2], buffer + (size_t)(bbox[1]+j)*width + bbox[0], bbox[2]*sizeof(float));
+
+  G_LOCK(_raster_cache_lock);
+  _raster_cache = g_list_prepend(_raster_cache, r);
+  _raster_cache_size += size;
+  while(_raster_cache_size > max_size)
+  {
+    GList *last = g_list_last(_raster_cache);
+    _masks_raster_t *old = (_masks_raster_t *)last->data;
+    _raster_cache_size -= (size_t)old->bbox[2]*old->bbox[3]*sizeof(float);
+    _masks_raster_free(old);
+    _raster_cache = g_list_delete_link(_raster_cache, last);
+  }
+  G_UNLOCK(_raster_cache_lock);
+
+  if (darktable.unmuted & DT_DEBUG_PERF) dt_print(DT_DEBUG_MASKS, "[masks %s] raster cache miss took %0.04f sec\n", form->name, dt_get_wtime()-start);
+  return ok;
+}
+
+int dt_masks_get_mask_roi(dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, dt_masks_form_t *form, const dt_iop_roi_t *roi, float *buffer)
+{
+  int bbox[4];
+  return _masks_get_mask_roi_bbox(module,piece,form,roi,buffer,bbox);
+}
+
 dt_masks_form_t *dt_masks_create(dt_masks_type_t type)
 {
   dt_masks_form_t *form = (dt_masks_form_t *)malloc(sizeof(dt_masks_form_t));
@@ -482,6 +676,8 @@ dt_masks_form_t *dt_masks_get_from_id(dt_develop_t *dev, int id)
 
 void dt_masks_read_forms(dt_develop_t *dev)
 {
+  dt_masks_raster_cache_clear();
+
   //first we have to remove all existing entries from the list
   if (dev->forms)
   {
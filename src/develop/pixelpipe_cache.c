@@ -182,13 +182,13 @@ void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
   }
 }
 
-void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data)
+void dt_dev_pixelpipe_cache_reweight(dt_dev_pixelpipe_cache_t *cache, void *data, int weight)
 {
   for(int k=0; k<cache->entries; k++)
   {
     if(cache->data[k] == data)
     {
-      cache->used[k] = -cache->entries;
+      cache->used[k] = MIN(weight, -cache->entries);
     }
   }
 }
@@ -18,6 +18,7 @@
 */
 #include "develop/pixelpipe.h"
 #include "develop/blend.h"
+#include "develop/masks.h"
 #include "develop/tiling.h"
 #include "gui/gtk.h"
 #include "control/control.h"
@@ -31,11 +32,13 @@
 #include "common/histogram.h"
 
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <strings.h>
 #include <stdlib.h>
 #include <math.h>
 #include <unistd.h>
+#include <emmintrin.h>
 
 typedef enum dt_pixelpipe_flow_t
 {
@@ -133,6 +136,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->mask_display = 0;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
+  memset(&pipe->scratch, 0, sizeof(pipe->scratch));
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
   dt_pthread_mutex_init(&(pipe->busy_mutex), NULL);
   return 1;
@@ -156,11 +160,100 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  dt_free_align(pipe->scratch.base);
+  memset(&pipe->scratch, 0, sizeof(pipe->scratch));
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
 }
 
+// every scratch buffer is preceded by one of these, padded to keep the buffer aligned.
+#define DT_DEV_SCRATCH_HEADER 64
+typedef struct _scratch_header_t
+{
+  size_t size;      // bytes including this header
+  size_t prev_top;  // offset of the block below this one in the arena
+  int freed;
+  int heap;         // 1 if this block did not fit into the arena
+}
+_scratch_header_t;
+
+void *dt_dev_pixelpipe_scratch_get(dt_dev_pixelpipe_t *pipe, size_t size)
+{
+  dt_dev_pixelpipe_scratch_t *s = &pipe->scratch;
+  const size_t need = DT_DEV_SCRATCH_HEADER + ((size + 63) & ~(size_t)63);
+  _scratch_header_t *hdr;
+  if(s->base && s->used + need <= s->size)
+  {
+    hdr = (_scratch_header_t *)(s->base + s->used);
+    hdr->prev_top = s->top;
+    hdr->heap = 0;
+    s->top = s->used;
+    s->used += need;
+  }
+  else
+  {
+    // doesn't fit, hand out heap memory and remember to grow before the next run.
+    hdr = (_scratch_header_t *)dt_alloc_align(64, need);
+    if(!hdr) return NULL;
+    hdr->prev_top = 0;
+    hdr->heap = 1;
+    s->heap += need;
+  }
+  hdr->size = need;
+  hdr->freed = 0;
+  s->peak = MAX(s->peak, s->used + s->heap);
+  return (uint8_t *)hdr + DT_DEV_SCRATCH_HEADER;
+}
+
+void dt_dev_pixelpipe_scratch_put(dt_dev_pixelpipe_t *pipe, void *buf)
+{
+  if(!buf) return;
+  dt_dev_pixelpipe_scratch_t *s = &pipe->scratch;
+  _scratch_header_t *hdr = (_scratch_header_t *)((uint8_t *)buf - DT_DEV_SCRATCH_HEADER);
+  if(hdr->heap)
+  {
+    s->heap -= hdr->size;
+    dt_free_align(hdr);
+    return;
+  }
+  hdr->freed = 1;
+  // pop everything that has been returned from the top of the stack
+  while(s->used > 0)
+  {
+    _scratch_header_t *top = (_scratch_header_t *)(s->base + s->top);
+    if(!top->freed) break;
+    s->used = s->top;
+    s->top = top->prev_top;
+  }
+}
+
+// called before each run: drop whatever was left over and grow the arena to what the last run needed.
+static void _scratch_begin(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_scratch_t *s = &pipe->scratch;
+  s->used = s->top = 0;
+  size_t want = s->peak;
+  const int limit = dt_conf_get_int("host_memory_limit");
+  if(limit > 0) want = MIN(want, (size_t)limit * 1024 * 1024);
+  if(want > s->size)
+  {
+    // round up to whole megabytes to avoid regrowing for every little change in roi
+    want = (want + (1<<20) - 1) & ~(size_t)((1<<20) - 1);
+    dt_free_align(s->base);
+    s->base = dt_alloc_align(64, want);
+    s->size = s->base ? want : 0;
+  }
+  s->peak = 0;
+}
+
+static void _scratch_end(dt_dev_pixelpipe_t *pipe)
+{
+  dt_dev_pixelpipe_scratch_t *s = &pipe->scratch;
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_process] [%s] scratch peak %.1f MB, arena %.1f MB\n",
+           _pipe_type_to_str(pipe->type), s->peak/(1024.0*1024.0), s->size/(1024.0*1024.0));
+}
+
 void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
 {
   // FIXME: either this or all process() -> gdk mutices have to be changed!
@@ -206,6 +299,7 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
       piece->data = NULL;
       piece->hash = 0;
       piece->process_cl_ready = 0;
+      piece->commit_hash = 0;
       dt_iop_init_pipe(piece->module, pipe,piece);
       pipe->nodes = g_list_append(pipe->nodes, piece);
     }
@@ -227,6 +321,7 @@ void dt_dev_pixelpipe_synch(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, GList *
     if(piece->module == hist->module)
     {
       piece->enabled = hist->enabled;
+      piece->commit_hash = 0;
       dt_iop_commit_params(hist->module, hist->params, hist->blend_params, pipe, piece);
     }
     nodes = g_list_next(nodes);
@@ -242,6 +337,7 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   {
     dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
     piece->hash = 0;
+    piece->commit_hash = 0;
     piece->enabled = piece->module->default_enabled;
     dt_iop_commit_params(piece->module, piece->module->default_params, piece->module->default_blendop_params, pipe, piece);
     nodes = g_list_next(nodes);
@@ -256,6 +352,159 @@ void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
   dt_pthread_mutex_unlock(&pipe->busy_mutex);
 }
 
+static uint64_t _hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+  const char *str = (const char *)data;
+  for(size_t i=0; i<length; i++) hash = ((hash << 5) + hash) ^ str[i];
+  return hash;
+}
+
+// everything of the image a module might look at in commit_params (camera, lens, mosaic, embedded profile),
+// but not its identity. that way consecutive images from the same camera share their committed pieces.
+static uint64_t _image_hash(const dt_image_t *img)
+{
+  uint64_t hash = 5381;
+  hash = _hash_bytes(hash, &img->exif_inited, offsetof(dt_image_t, exif_datetime_taken) - offsetof(dt_image_t, exif_inited));
+  hash = _hash_bytes(hash, &img->width, sizeof(img->width));
+  hash = _hash_bytes(hash, &img->height, sizeof(img->height));
+  hash = _hash_bytes(hash, &img->flags, sizeof(img->flags));
+  hash = _hash_bytes(hash, &img->filters, sizeof(img->filters));
+  hash = _hash_bytes(hash, &img->bpp, sizeof(img->bpp));
+  hash = _hash_bytes(hash, img->d65_color_matrix, sizeof(img->d65_color_matrix));
+  hash = _hash_bytes(hash, &img->colorspace, sizeof(img->colorspace));
+  hash = _hash_bytes(hash, &img->legacy_flip, sizeof(img->legacy_flip));
+  hash = _hash_bytes(hash, &img->raw_black_level, sizeof(img->raw_black_level));
+  hash = _hash_bytes(hash, &img->raw_white_point, sizeof(img->raw_white_point));
+  if(img->profile) hash = _hash_bytes(hash, img->profile, img->profile_size);
+  return hash;
+}
+
+// the preferences modules read in commit_params. a committed piece is only reused while these are unchanged.
+static const char *_commit_conf_keys[] =
+{
+  "plugins/lighttable/export/iccprofile",   // colorout
+  "plugins/lighttable/export/iccintent",    // colorout
+  "plugins/lighttable/export/force_lcms2",  // colorout
+  NULL
+};
+
+static uint64_t _conf_hash(uint64_t hash)
+{
+  for(int k=0; _commit_conf_keys[k]; k++)
+  {
+    gchar *value = dt_conf_get_string(_commit_conf_keys[k]);
+    if(value) hash = _hash_bytes(hash, value, strlen(value) + 1);
+    g_free(value);
+  }
+  return hash;
+}
+
+void dt_dev_pixelpipe_synch_all_changed(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  uint64_t image_hash = _image_hash(&pipe->image);
+  image_hash = _conf_hash(image_hash);
+  image_hash = _hash_bytes(image_hash, &pipe->iwidth, sizeof(pipe->iwidth));
+  image_hash = _hash_bytes(image_hash, &pipe->iheight, sizeof(pipe->iheight));
+  image_hash = _hash_bytes(image_hash, &pipe->iscale, sizeof(pipe->iscale));
+  GList *nodes = pipe->nodes;
+  while(nodes)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    dt_iop_module_t *module = piece->module;
+
+    // the last history item of this module wins, same as replaying the whole stack in synch_all:
+    dt_iop_params_t *params = module->default_params;
+    dt_develop_blend_params_t *blend_params = module->default_blendop_params;
+    int enabled = module->default_enabled;
+    GList *history = dev->history;
+    for(int k=0; k<dev->history_end && history; k++)
+    {
+      dt_dev_history_item_t *hist = (dt_dev_history_item_t *)history->data;
+      if(hist->module == module)
+      {
+        params = hist->params;
+        blend_params = hist->blend_params;
+        enabled = hist->enabled;
+      }
+      history = g_list_next(history);
+    }
+
+    uint64_t hash = _hash_bytes(image_hash, &enabled, sizeof(enabled));
+    hash = _hash_bytes(hash, params, module->params_size);
+    if(module->flags() & IOP_FLAGS_SUPPORTS_BLENDING)
+      hash = _hash_bytes(hash, blend_params, sizeof(dt_develop_blend_params_t));
+    dt_masks_form_t *grp = dt_masks_get_from_id(dev, blend_params->mask_id);
+    const int length = dt_masks_group_get_hash_buffer_length(grp);
+    if(length > 0)
+    {
+      char *str = malloc(length);
+      dt_masks_group_get_hash_buffer(grp, str);
+      hash = _hash_bytes(hash, str, length);
+      free(str);
+    }
+
+    if(piece->commit_hash != 0 && piece->commit_hash == hash)
+    {
+      // nothing commit_params would see has changed, keep piece->data as it is.
+      piece->enabled = piece->commit_enabled;
+      piece->process_cl_ready = piece->commit_process_cl_ready;
+      piece->hash = piece->commit_piece_hash;
+      memcpy(piece->blendop_data, blend_params, sizeof(dt_develop_blend_params_t));
+      memcpy(module->blend_params, blend_params, sizeof(dt_develop_blend_params_t));
+    }
+    else
+    {
+      piece->enabled = enabled;
+      dt_iop_commit_params(module, params, blend_params, pipe, piece);
+      piece->commit_hash = hash;
+      piece->commit_enabled = piece->enabled;
+      piece->commit_process_cl_ready = piece->process_cl_ready;
+      piece->commit_piece_hash = piece->hash;
+    }
+    nodes = g_list_next(nodes);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+}
+
+int dt_dev_pixelpipe_rebind_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
+{
+  dt_pthread_mutex_lock(&pipe->busy_mutex);
+  if(g_list_length(pipe->nodes) != g_list_length(dev->iop))
+  {
+    dt_pthread_mutex_unlock(&pipe->busy_mutex);
+    return 0;
+  }
+  GList *nodes = pipe->nodes;
+  GList *modules = dev->iop;
+  while(nodes)
+  {
+    const dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    const dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+    if(piece->module->so != module->so || piece->module->multi_priority != module->multi_priority)
+    {
+      dt_pthread_mutex_unlock(&pipe->busy_mutex);
+      return 0;
+    }
+    nodes = g_list_next(nodes);
+    modules = g_list_next(modules);
+  }
+  nodes = pipe->nodes;
+  modules = dev->iop;
+  while(nodes)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+    piece->module  = (dt_iop_module_t *)modules->data;
+    piece->iscale  = pipe->iscale;
+    piece->iwidth  = pipe->iwidth;
+    piece->iheight = pipe->iheight;
+    nodes = g_list_next(nodes);
+    modules = g_list_next(modules);
+  }
+  dt_pthread_mutex_unlock(&pipe->busy_mutex);
+  return 1;
+}
+
 void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
 {
   dt_pthread_mutex_lock(&pipe->busy_mutex);
@@ -333,6 +582,130 @@ histogram_collect(dt_iop_module_t *module, const void *pixel, const dt_iop_roi_t
   free(histogram_params);
 }
 
+// helper for the display histogram and the waveform of the darkroom, collected at the
+// very end of the preview pipe. both are filled in one pass: every thread owns a strip of
+// waveform columns (and the corresponding image columns), so the waveform needs no
+// per-thread copies, and the 8-bit output is only read where the histogram samples it.
+static void
+histogram_collect_final(dt_develop_t *dev, const uint8_t *pixel, const dt_iop_roi_t *roi_out, const float *box,
+                        const float *input, const dt_iop_roi_t *roi_in)
+{
+  const int wf_width = (dev->histogram_waveform_width != 0 && input) ? dev->histogram_waveform_width : 0;
+  const int wf_height = dev->histogram_waveform_height;
+  const int nthreads = omp_get_max_threads();
+
+  // map the input columns to waveform columns once, strips are then plain column ranges.
+  // 1.0 is at 8/9 of the height!
+  const double bin_width = wf_width ? (double)(roi_in->width) / (double)wf_width : 1.0;
+  int *col_start = NULL;
+  uint32_t *buf = NULL;
+  if(wf_width)
+  {
+    col_start = (int *)malloc(sizeof(int) * (wf_width + 1));
+    int out_x = 0;
+    col_start[0] = 0;
+    for(int x = 0; x < roi_in->width; x++)
+    {
+      const int bin = MIN(x / bin_width, wf_width - 1);
+      while(out_x < bin) col_start[++out_x] = x;
+    }
+    while(out_x < wf_width) col_start[++out_x] = roi_in->width;
+    buf = (uint32_t *)calloc((size_t)wf_height * wf_width * 3, sizeof(uint32_t));
+  }
+
+  float *partial_hists = (float *)calloc((size_t)nthreads * 4 * 64, sizeof(float));
+
+  const int box_x0 = box[0], box_y0 = box[1], box_x1 = box[2], box_y1 = box[3];
+  const int rows = MAX(roi_out->height, wf_width ? roi_in->height : 0);
+
+#ifdef _OPENMP
+  #pragma omp parallel num_threads(nthreads)
+#endif
+  {
+    const int t = omp_get_thread_num(), nt = omp_get_num_threads();
+    float *hist = partial_hists + 4 * 64 * t;
+
+    // this thread's strip in waveform and output columns:
+    const int wa = wf_width * t / nt, wb = wf_width * (t + 1) / nt;
+    const int ha = roi_out->width * t / nt, hb = roi_out->width * (t + 1) / nt;
+    // first histogram sample column in this strip (samples every 4th pixel of the box):
+    const int hx0 = box_x0 + ((MAX(ha, box_x0) - box_x0 + 3) & ~3), hx1 = MIN(hb - 1, box_x1);
+
+    const __m128 wf_scale = _mm_set1_ps(-8.0f / 9.0f);
+    const __m128 wf_height_m1 = _mm_set1_ps(wf_height - 1);
+    const __m128 one = _mm_set1_ps(1.0f), zero = _mm_setzero_ps();
+
+    for(int j = 0; j < rows; j++)
+    {
+      if(wf_width && j < roi_in->height)
+      {
+        const float *in = input + 4 * ((size_t)j * roi_in->width);
+        for(int out_x = wa; out_x < wb; out_x++)
+        {
+          uint32_t *const out = buf + 3 * out_x;
+          for(int x = col_start[out_x]; x < col_start[out_x + 1]; x++)
+          {
+            // out_y = CLAMP(1.0 - (8.0/9.0) * rgb, 0.0, 1.0) * (height - 1), for all channels at once
+            const __m128 v = _mm_load_ps(in + 4 * x);
+            const __m128 y = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_add_ps(one, _mm_mul_ps(wf_scale, v)), zero), one), wf_height_m1);
+            int32_t out_y[4] __attribute__((aligned(16)));
+            _mm_store_si128((__m128i *)out_y, _mm_cvttps_epi32(y));
+            // channels are stored in reverse order in the waveform:
+            for(int k = 0; k < 3; k++) out[(size_t)out_y[2 - k] * wf_width * 3 + k]++;
+          }
+        }
+      }
+
+      if(j >= box_y0 && j <= box_y1 && ((j - box_y0) & 3) == 0 && j < roi_out->height)
+      {
+        const uint8_t *out = pixel + 4 * ((size_t)j * roi_out->width);
+        for(int i = hx0; i <= hx1; i += 4)
+        {
+          uint8_t rgb[3];
+          for(int k = 0; k < 3; k++) rgb[k] = out[4 * i + 2 - k] >> 2;
+          for(int k = 0; k < 3; k++) hist[4 * rgb[k] + k]++;
+          const uint8_t lum = MAX(MAX(rgb[0], rgb[1]), rgb[2]);
+          hist[4 * lum + 3]++;
+        }
+      }
+    }
+  }
+
+  memcpy(dev->histogram, partial_hists, sizeof(float) * 4 * 64);
+  for(int n = 1; n < nthreads; n++)
+    for(int k = 0; k < 4 * 64; k++) dev->histogram[k] += partial_hists[4 * 64 * n + k];
+  free(partial_hists);
+
+  // don't count <= 0 pixels
+  dev->histogram_max = 0;
+  for(int k = 19; k < 4 * 64; k += 4) dev->histogram_max = MAX(dev->histogram_max, dev->histogram[k]);
+
+  if(!wf_width) return;
+
+  // scale the counts into a nice image. putting the pixels into the image directly gets too saturated/clips.
+  // TODO: Find a nicer function to map buf -> image than just clipping
+  memset(dev->histogram_waveform, 0, sizeof(uint32_t) * dev->histogram_waveform_height * dev->histogram_waveform_stride / 4);
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(dev, buf)
+#endif
+  for(int y = 0; y < wf_height; y++)
+  {
+    for(int x = 0; x < wf_width; x++)
+    {
+      const uint32_t *const in = buf + ((size_t)y * wf_width + x) * 3;
+      uint8_t *const out = (uint8_t *)(dev->histogram_waveform + ((size_t)y * wf_width + x));
+      for(int k = 0; k < 3; k++)
+      {
+        if(in[k] == 0) continue;
+        out[k] = CLAMP(in[k] * 0.5, 5, 255);
+      }
+    }
+  }
+
+  free(buf);
+  free(col_start);
+}
+
 #ifdef HAVE_OPENCL
 // helper to get per module histogram for OpenCL
 //
@@ -719,6 +1092,14 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
       return 1;
     }
+    if(module == darktable.develop->gui_module)
+    {
+      // give the input buffer to the currently focussed plugin more weight.
+      // the user is likely to change that one soon, so keep it in cache
+      // across all the cache lines requested by the rest of the pipe. that way
+      // an interrupted run restarts right at this module and not from scratch.
+      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input, -(int)g_list_length(pipe->nodes));
+    }
     if(!strcmp(module->op, "gamma"))
       (void) dt_dev_pixelpipe_cache_get_important(&(pipe->cache), hash, bufsize, output);
     else
@@ -1517,12 +1898,6 @@ dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
     // in case we get this buffer from the cache, also get the processed max:
     for(int k=0; k<3; k++) piece->processed_maximum[k] = pipe->processed_maximum[k];
     dt_pthread_mutex_unlock(&pipe->busy_mutex);
-    if(module == darktable.develop->gui_module)
-    {
-      // give the input buffer to the currently focussed plugin more weight.
-      // the user is likely to change that one soon, so keep it in cache.
-      dt_dev_pixelpipe_cache_reweight(&(pipe->cache), input);
-    }
 #ifndef _DEBUG
     if(darktable.unmuted & DT_DEBUG_NAN)
 #endif
@@ -1866,85 +2241,10 @@ post_process_collect_info:
         box[2] = roi_out->width-1;
         box[3] = roi_out->height-1;
       }
-      dev->histogram_max = 0;
-      memset(dev->histogram, 0, sizeof(float)*4*64);
-      for(int j=box[1]; j<=box[3]; j+=4) for(int i=box[0]; i<=box[2]; i+=4)
-        {
-          uint8_t rgb[3];
-          for(int k=0; k<3; k++)
-            rgb[k] = pixel[4*j*roi_out->width+4*i+2-k]>>2;
-
-          for(int k=0; k<3; k++)
-            dev->histogram[4*rgb[k]+k] ++;
-          uint8_t lum = MAX(MAX(rgb[0], rgb[1]), rgb[2]);
-          dev->histogram[4*lum+3] ++;
-        }
-
-      // don't count <= 0 pixels
-      for(int k=19; k<4*64; k+=4) dev->histogram_max = dev->histogram_max > dev->histogram[k] ? dev->histogram_max : dev->histogram[k];
-
-      // calculate the waveform histogram. since this is drawn pixel by pixel we have to do it in the correct size (thus the weird gui stuff :().
-      // this HAS to be done on the float input data, otherwise we get really ugly artefacts due to rounding issues when putting colors into the bins.
-//       dt_pthread_mutex_lock(&dev->histogram_waveform_mutex);
-      if(dev->histogram_waveform_width != 0 && input)
-      {
-        uint32_t *buf = (uint32_t*)calloc(dev->histogram_waveform_height * dev->histogram_waveform_width * 3, sizeof(uint32_t));
-        memset(dev->histogram_waveform, 0, sizeof(uint32_t) * dev->histogram_waveform_height * dev->histogram_waveform_stride / 4);
-
-        // 1.0 is at 8/9 of the height!
-        const double bin_width = (double)(roi_in.width) / (double)dev->histogram_waveform_width,
-                     _height = (double)(dev->histogram_waveform_height - 1);
-        float *pixel = (float *)input;
-//         uint32_t mincol[3] = {UINT32_MAX,UINT32_MAX,UINT32_MAX}, maxcol[3] = {0,0,0};
-
-        // count the colors into buf ...
-        for(int y = 0; y < roi_in.height; y ++)
-        {
-          for(int x = 0; x < roi_in.width; x ++)
-          {
-            float rgb[3];
-            for(int k=0; k<3; k++)
-              rgb[k] = pixel[4*y*roi_in.width+4*x+2-k];
-
-            const int out_x = MIN(x / bin_width, dev->histogram_waveform_width - 1);
-            for(int k = 0; k < 3; k++)
-            {
-              const int out_y = CLAMP(1.0 - (8.0/9.0) * rgb[k], 0.0, 1.0) * _height;
-              uint32_t * const out = buf + (out_y * dev->histogram_waveform_width * 3 + out_x * 3 + k);
-              (*out)++;
-//               mincol[k] = MIN(mincol[k], *out);
-//               maxcol[k] = MAX(maxcol[k], *out);
-            }
-          }
-        }
-
-        // TODO: Find a nicer function to map buf -> image than just clipping
-//         float factor[3];
-//         for(int k = 0; k < 3; k++)
-//           factor[k] = 255.0 / (float)(maxcol[k] - mincol[k]); // leave some clipping
-
-        // ... and scale that into a nice image. putting the pixels into the image directly gets too saturated/clips.
-        for(int y = 0; y < dev->histogram_waveform_height; y++)
-        {
-          for(int x = 0; x < dev->histogram_waveform_width; x++)
-          {
-            uint32_t * const in = buf + (y * dev->histogram_waveform_width + x) * 3;
-            uint8_t * const out = (uint8_t*)(dev->histogram_waveform + (y * dev->histogram_waveform_width + x));
-            for(int k = 0; k < 3; k++)
-            {
-              if(in[k] == 0) continue;
-              out[k] = CLAMP(in[k] * 0.5, 5, 255);
-//               if(in[k] == 0)
-//                 out[k] = 0;
-//               else
-//                 out[k] = (float)(in[k] - mincol[k]) * factor[k];
-            }
-          }
-        }
-
-        free(buf);
-      }
-//       dt_pthread_mutex_unlock(&dev->histogram_waveform_mutex);
+      // calculate the histogram and the waveform in one go. the waveform is drawn pixel by pixel, so we have
+      // to do it in the correct size (thus the weird gui stuff :(). it HAS to be done on the float input data,
+      // otherwise we get really ugly artefacts due to rounding issues when putting colors into the bins.
+      histogram_collect_final(dev, pixel, roi_out, box, (const float *)input, &roi_in);
 
 
       dt_pthread_mutex_unlock(&pipe->busy_mutex);
@@ -2080,6 +2380,8 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
 
   if(pipe->devid >= 0) dt_opencl_events_reset(pipe->devid);
 
+  _scratch_begin(pipe);
+
   dt_iop_roi_t roi = (dt_iop_roi_t)
   {
     x, y, width, height, scale
@@ -2151,6 +2453,7 @@ restart:
     pipe->devid = -1;
   }
   // ... and in case of other errors ...
+  _scratch_end(pipe);
   if (err)
   {
     pipe->processing = 0;
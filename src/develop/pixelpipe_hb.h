@@ -56,6 +56,10 @@ typedef struct dt_dev_pixelpipe_iop_t
   dt_iop_roi_t buf_in, buf_out;    // theoretical full buffer regions of interest, as passed through modify_roi_out
   int process_cl_ready;            // set this to 0 in commit_params to temporarily disable the use of process_cl
   float processed_maximum[3];      // sensor saturation after this iop, used internally for caching
+  uint64_t commit_hash;            // hash of everything the last commit_params saw, 0 if unknown
+  int commit_enabled;              // enabled and process_cl_ready state that commit left behind
+  int commit_process_cl_ready;
+  uint64_t commit_piece_hash;
 }
 dt_dev_pixelpipe_iop_t;
 
@@ -69,6 +73,24 @@ typedef enum dt_dev_pixelpipe_change_t
 }
 dt_dev_pixelpipe_change_t;
 
+/**
+ * scratch memory modules can borrow temporary buffers from during one pipe run.
+ * this is a simple stack: buffers should be returned in reverse order, out of order
+ * returns are accepted but only reclaimed once everything above them is gone.
+ * requests that do not fit go to the heap, the arena is then grown (bounded by
+ * host_memory_limit) between runs so steady state processing does not allocate.
+ */
+typedef struct dt_dev_pixelpipe_scratch_t
+{
+  uint8_t *base;  // arena memory, 64 byte aligned
+  size_t size;    // capacity of the arena
+  size_t used;    // current top of stack
+  size_t top;     // offset of the topmost block
+  size_t peak;    // highest demand (arena + heap) seen during the current run
+  size_t heap;    // bytes currently borrowed from the heap because the arena was too small
+}
+dt_dev_pixelpipe_scratch_t;
+
 /**
  * this encapsulates the gegl pixel pipeline.
  * a develop module will need several of these:
@@ -124,6 +146,8 @@ typedef struct dt_dev_pixelpipe_t
   int devid;
   // image struct as it was when the pixelpipe was initialized. copied to avoid race conditions.
   dt_image_t image;
+  // temporary buffers for modules, reset on every run
+  dt_dev_pixelpipe_scratch_t scratch;
 }
 dt_dev_pixelpipe_t;
 
@@ -163,12 +187,22 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t
 void dt_dev_pixelpipe_synch_all(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 // adjust gegl:nop output node according to history stack (history pop event)
 void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// like synch_all, but only calls commit_params for pieces whose parameters or image did change since the last call.
+void dt_dev_pixelpipe_synch_all_changed(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
+// move the existing nodes over to the modules of another develop with the same module stack. returns 0 if the stacks differ.
+int dt_dev_pixelpipe_rebind_nodes(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 
 // process region of interest of pixels. returns 1 if pipe was altered during processing.
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width, int height, float scale);
 
+// borrow a 64 byte aligned temporary buffer, valid until it is returned or the pipe run ends.
+// not thread safe, call it outside of parallel regions. returns NULL if out of memory.
+void *dt_dev_pixelpipe_scratch_get(dt_dev_pixelpipe_t *pipe, size_t size);
+// return a buffer obtained from dt_dev_pixelpipe_scratch_get. NULL is ignored.
+void dt_dev_pixelpipe_scratch_put(dt_dev_pixelpipe_t *pipe, void *buf);
+
 // disable given op and all that comes after it in the pipe:
 void dt_dev_pixelpipe_disable_after(dt_dev_pixelpipe_t *pipe, const char *op);
 // disable given op and all that comes before it in the pipe:
@@ -700,13 +700,13 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] (%d x %d) tiles with max dimensions %d x %d and overlap %d\n", tiles_x, tiles_y, width, height, overlap);
 
   /* reserve input and output buffers for tiles */
-  input = dt_alloc_align(64, (size_t)width*height*in_bpp);
+  input = dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)width*height*in_bpp);
   if(input == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc input buffer for module '%s'\n", self->op);
     goto error;
   }
-  output = dt_alloc_align(64, (size_t)width*height*out_bpp);
+  output = dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)width*height*out_bpp);
   if(output == NULL)
   {
     dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] could not alloc output buffer for module '%s'\n", self->op);
@@ -798,8 +798,8 @@ _default_process_tiling_ptp (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(output != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, output);
+  if(input != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, input);
   piece->pipe->tiling = 0;
   return;
 
@@ -808,8 +808,8 @@ error:
   // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(output != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, output);
+  if(input != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, input);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_ptp] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
@@ -1042,13 +1042,13 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
 
 
       /* prepare input tile buffer */
-      input = dt_alloc_align(64, (size_t)iroi_full.width*iroi_full.height*in_bpp);
+      input = dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)iroi_full.width*iroi_full.height*in_bpp);
       if(input == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc input buffer for module '%s'\n", self->op);
         goto error;
       }
-      output = dt_alloc_align(64, (size_t)oroi_full.width*oroi_full.height*out_bpp);
+      output = dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)oroi_full.width*oroi_full.height*out_bpp);
       if(output == NULL)
       {
         dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] could not alloc output buffer for module '%s'\n", self->op);
@@ -1087,8 +1087,8 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
       for(size_t j=0; j<oroi_good.height; j++)
         memcpy((char *)ovoid+ooffs+j*opitch, (char *)output+((j+origin_y)*oroi_full.width+origin_x)*out_bpp, (size_t)oroi_good.width*out_bpp);
 
-      dt_free_align(input);
-      dt_free_align(output);
+      dt_dev_pixelpipe_scratch_put(piece->pipe, output);
+      dt_dev_pixelpipe_scratch_put(piece->pipe, input);
       input = output = NULL;
     }
 
@@ -1096,8 +1096,8 @@ _default_process_tiling_roi (struct dt_iop_module_t *self, struct dt_dev_pixelpi
   for(int k=0; k<3; k++)
     piece->pipe->processed_maximum[k] = processed_maximum_new[k];
 
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(output != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, output);
+  if(input != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, input);
   piece->pipe->tiling = 0;
   return;
 
@@ -1106,8 +1106,8 @@ error:
   // fall through
 
 fallback:
-  if(input != NULL) dt_free_align(input);
-  if(output != NULL) dt_free_align(output);
+  if(output != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, output);
+  if(input != NULL) dt_dev_pixelpipe_scratch_put(piece->pipe, input);
   piece->pipe->tiling = 0;
   dt_print(DT_DEBUG_DEV, "[default_process_tiling_roi] fall back to standard processing for module '%s'\n", self->op);
   self->process(self, piece, ivoid, ovoid, roi_in, roi_out);
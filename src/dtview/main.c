@@ -208,7 +208,7 @@ mime(dt_imageio_module_data_t *data)
 }
 
 static int
-write_image (dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+write_image (dt_imageio_module_data_t *data, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const int offx = (width  - data->width )/2;
   const int offy = (height - data->height)/2;
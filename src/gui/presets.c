@@ -21,6 +21,7 @@
 #endif
 #include "common/darktable.h"
 #include "common/debug.h"
+#include "common/presets_stamp.h"
 #include "develop/blend.h"
 #include "develop/develop.h"
 #include "gui/gtk.h"
@@ -75,8 +76,9 @@ dt_gui_presets_edit_dialog_t;
 // so beware, don't use any darktable.gui stuff here .. (or change this behaviour in darktable.c)
 void dt_gui_presets_init()
 {
-  // remove auto generated presets from plugins, not the user included ones.
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM presets WHERE writeprotect = 1", NULL, NULL, NULL);
+  // remove auto generated presets from plugins, not the user included ones. iop plugins with
+  // unchanged presets keep theirs, init_presets() only writes them when the plugin changed.
+  dt_presets_stamp_cleanup(dt_database_get(darktable.db));
 }
 
 void dt_gui_presets_add_generic(const char *name, dt_dev_operation_t op, const int32_t version, const void *params, const int32_t params_size, const int32_t enabled)
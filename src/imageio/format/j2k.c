@@ -313,7 +313,7 @@ static void cinema_setup_encoder(opj_cparameters_t *parameters,opj_image_t *imag
   parameters->cp_disto_alloc = 1;
 }
 
-int write_image (dt_imageio_module_data_t *j2k_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+int write_image (dt_imageio_module_data_t *j2k_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const float * in = (const float *)in_tmp;
   dt_imageio_j2k_t * j2k = (dt_imageio_j2k_t*)j2k_tmp;
@@ -494,7 +494,7 @@ int write_image (dt_imageio_module_data_t *j2k_tmp, const char *filename, const
 
   /* add exif data blob. seems to not work for j2k files :( */
   if(exif && j2k->format == JP2_CFMT)
-    rc = dt_exif_write_blob(exif,exif_len,filename);
+    rc = dt_exif_write_blob(exif,exif_len,filename,NULL);
 
   /* free image data */
   opj_image_destroy(image);
@@ -24,6 +24,7 @@
 #include "common/imageio_module.h"
 #include "common/imageio.h"
 #include "common/colorspaces.h"
+#include "common/exif.h"
 #include "control/conf.h"
 #include "common/imageio_format.h"
 #include "dtgtk/slider.h"
@@ -321,8 +322,139 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
+// raw data input: we do libjpeg's color conversion and chroma downsampling ourselves, so it
+// can run on all cores. the arithmetic follows jccolor.c and jcsample.c exactly, so the
+// output is identical to feeding rgb scanlines.
+#define DT_JPEG_SCALEBITS 16
+#define DT_JPEG_FIX(x) ((int32_t)((x) * (1L << DT_JPEG_SCALEBITS) + 0.5))
+#define DT_JPEG_CHUNK 16 // imcu rows converted in one go
+
+static inline int
+_jpeg_rgb_to_ycc(const uint8_t *px, const int c)
+{
+  const int32_t r = px[0], g = px[1], b = px[2];
+  const int32_t half = 1 << (DT_JPEG_SCALEBITS - 1), offset = 128 << DT_JPEG_SCALEBITS;
+  if(c == 0)
+    return (DT_JPEG_FIX(0.29900) * r + DT_JPEG_FIX(0.58700) * g + DT_JPEG_FIX(0.11400) * b + half) >> DT_JPEG_SCALEBITS;
+  if(c == 1)
+    return (-DT_JPEG_FIX(0.16874) * r - DT_JPEG_FIX(0.33126) * g + DT_JPEG_FIX(0.5) * b + offset + half - 1) >> DT_JPEG_SCALEBITS;
+  return (DT_JPEG_FIX(0.5) * r - DT_JPEG_FIX(0.41869) * g - DT_JPEG_FIX(0.08131) * b + offset + half - 1) >> DT_JPEG_SCALEBITS;
+}
+
+// one downsampled row of component c. the image is edge-extended to the padded width,
+// and vertically to a whole row group, as libjpeg's prep controller does.
+static void
+_jpeg_component_row(const uint8_t *in, const int width, const int height, const int c,
+                    const int hx, const int vy, const int row, JSAMPROW out, const int cols)
+{
+  const uint8_t *in0 = in + (size_t)MIN(row * vy, height - 1) * width * 4;
+  const uint8_t *in1 = in + (size_t)MIN(row * vy + vy - 1, height - 1) * width * 4;
+  if(hx == 1 && vy == 1)
+  {
+    for(int i = 0; i < cols; i++) out[i] = _jpeg_rgb_to_ycc(in0 + 4 * MIN(i, width - 1), c);
+  }
+  else if(hx == 2 && vy == 1)
+  {
+    int bias = 0; // 0, 1, 0, 1, ...
+    for(int i = 0; i < cols; i++)
+    {
+      out[i] = (_jpeg_rgb_to_ycc(in0 + 4 * MIN(2 * i, width - 1), c)
+                + _jpeg_rgb_to_ycc(in0 + 4 * MIN(2 * i + 1, width - 1), c) + bias) >> 1;
+      bias ^= 1;
+    }
+  }
+  else if(hx == 2 && vy == 2)
+  {
+    int bias = 1; // 1, 2, 1, 2, ...
+    for(int i = 0; i < cols; i++)
+    {
+      const int x0 = 4 * MIN(2 * i, width - 1), x1 = 4 * MIN(2 * i + 1, width - 1);
+      out[i] = (_jpeg_rgb_to_ycc(in0 + x0, c) + _jpeg_rgb_to_ycc(in0 + x1, c)
+                + _jpeg_rgb_to_ycc(in1 + x0, c) + _jpeg_rgb_to_ycc(in1 + x1, c) + bias) >> 2;
+      bias ^= 3;
+    }
+  }
+  else
+  {
+    const int n = hx * vy;
+    for(int i = 0; i < cols; i++)
+    {
+      int sum = 0;
+      for(int v = 0; v < vy; v++)
+      {
+        const uint8_t *r = in + (size_t)MIN(row * vy + v, height - 1) * width * 4;
+        for(int h = 0; h < hx; h++) sum += _jpeg_rgb_to_ycc(r + 4 * MIN(hx * i + h, width - 1), c);
+      }
+      out[i] = (sum + n / 2) / n;
+    }
+  }
+}
+
+static int
+_jpeg_write_raw(j_compress_ptr cinfo, const uint8_t *in, const int width, const int height)
+{
+  const int vmax = cinfo->max_v_samp_factor, hmax = cinfo->max_h_samp_factor;
+  const int imcu_rows = (height + vmax * DCTSIZE - 1) / (vmax * DCTSIZE);
+  // rows padded to whole row groups, beyond that the last downsampled row is repeated
+  const int padded_height = (height + vmax - 1) / vmax * vmax;
+
+  uint8_t *plane[3] = { NULL };
+  JSAMPROW *rows[3] = { NULL };
+  int rc = 0;
+  for(int c = 0; c < 3; c++)
+  {
+    const jpeg_component_info *comp = cinfo->comp_info + c;
+    const size_t cols = (size_t)comp->width_in_blocks * DCTSIZE, nrows = (size_t)DT_JPEG_CHUNK * comp->v_samp_factor * DCTSIZE;
+    plane[c] = malloc(cols * nrows);
+    rows[c] = malloc(sizeof(JSAMPROW) * nrows);
+    if(!plane[c] || !rows[c])
+    {
+      rc = 1;
+      goto exit;
+    }
+    for(size_t k = 0; k < nrows; k++) rows[c][k] = plane[c] + k * cols;
+  }
+
+  for(int m0 = 0; m0 < imcu_rows; m0 += DT_JPEG_CHUNK)
+  {
+    const int count = MIN(DT_JPEG_CHUNK, imcu_rows - m0);
+    for(int c = 0; c < 3; c++)
+    {
+      const jpeg_component_info *comp = cinfo->comp_info + c;
+      const int hx = hmax / comp->h_samp_factor, vy = vmax / comp->v_samp_factor;
+      const int cols = comp->width_in_blocks * DCTSIZE, crows = comp->v_samp_factor * DCTSIZE;
+      const int last_row = padded_height / vy - 1;
+      JSAMPROW *crow = rows[c];
+#ifdef _OPENMP
+      #pragma omp parallel for schedule(static) shared(crow, in)
+#endif
+      for(int k = 0; k < count * crows; k++)
+        _jpeg_component_row(in, width, height, c, hx, vy, MIN((m0 * crows) + k, last_row), crow[k], cols);
+    }
+    for(int m = 0; m < count; m++)
+    {
+      JSAMPARRAY data[3];
+      for(int c = 0; c < 3; c++) data[c] = rows[c] + m * cinfo->comp_info[c].v_samp_factor * DCTSIZE;
+      jpeg_write_raw_data(cinfo, data, vmax * DCTSIZE);
+    }
+  }
+
+exit:
+  for(int c = 0; c < 3; c++)
+  {
+    free(plane[c]);
+    free(rows[c]);
+  }
+  return rc;
+}
+#undef DT_JPEG_SCALEBITS
+#undef DT_JPEG_FIX
+#undef DT_JPEG_CHUNK
+
+#define MAX_BYTES_IN_XMP_MARKER 65533
+
 int
-write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, int imgid)
+write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t*)jpg_tmp;
   const uint8_t*in =(const uint8_t*)in_tmp;
@@ -354,6 +486,9 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
   if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
   if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
   jpg->cinfo.optimize_coding = 1;
+  // smoothing happens in libjpeg's downsampler, keep that on the scanline path.
+  const int raw = jpg->cinfo.smoothing_factor == 0 && dt_conf_get_bool("plugins/imageio/format/jpeg/multithreaded");
+  jpg->cinfo.raw_data_in = raw;
 
   jpeg_start_compress(&(jpg->cinfo), TRUE);
 
@@ -374,19 +509,49 @@ write_image (dt_imageio_module_data_t *jpg_tmp, const char *filename, const void
   if(exif && exif_len > 0 && exif_len < 65534)
     jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, exif, exif_len);
 
-  uint8_t row[3*jpg->width];
-  const uint8_t *buf;
-  while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+  // the xmp packet goes into its own APP1 marker. if it doesn't fit, exiv2 has to add it afterwards as extended xmp.
+  int attach_xmp = 0;
+  if(xmp)
+  {
+    static const char xmp_ns[] = "http://ns.adobe.com/xap/1.0/";
+    const size_t ns_len = sizeof(xmp_ns), xmp_len = strlen(xmp);
+    if(ns_len + xmp_len <= MAX_BYTES_IN_XMP_MARKER)
+    {
+      JOCTET *marker = (JOCTET *)malloc(ns_len + xmp_len);
+      memcpy(marker, xmp_ns, ns_len);
+      memcpy(marker + ns_len, xmp, xmp_len);
+      jpeg_write_marker(&(jpg->cinfo), JPEG_APP0+1, marker, ns_len + xmp_len);
+      free(marker);
+    }
+    else attach_xmp = 1;
+  }
+
+  if(raw)
   {
-    JSAMPROW tmp[1];
-    buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
-    for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
-    tmp[0] = row;
-    jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    if(_jpeg_write_raw(&(jpg->cinfo), in, jpg->width, jpg->height))
+    {
+      jpeg_destroy_compress(&(jpg->cinfo));
+      fclose(f);
+      return 1;
+    }
+  }
+  else
+  {
+    uint8_t row[3*jpg->width];
+    const uint8_t *buf;
+    while(jpg->cinfo.next_scanline < jpg->cinfo.image_height)
+    {
+      JSAMPROW tmp[1];
+      buf = in + (size_t)jpg->cinfo.next_scanline * jpg->cinfo.image_width * 4;
+      for(int i=0; i<jpg->width; i++) for(int k=0; k<3; k++) row[3*i+k] = buf[4*i+k];
+      tmp[0] = row;
+      jpeg_write_scanlines(&(jpg->cinfo), tmp, 1);
+    }
   }
   jpeg_finish_compress (&(jpg->cinfo));
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
+  if(attach_xmp) dt_exif_xmp_attach(imgid, filename);
   return 0;
 }
 
@@ -506,7 +671,7 @@ extension(dt_imageio_module_data_t *data)
 int
 flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 void init(dt_imageio_module_format_t *self)
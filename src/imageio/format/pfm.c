@@ -28,7 +28,7 @@
 
 DT_MODULE(1)
 
-int write_image (dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif, int exif_len, int imgid)
+int write_image (dt_imageio_module_data_t *data, const char *filename, const void *ivoid, void *exif, int exif_len, const char *xmp, int imgid)
 {
   const dt_imageio_module_data_t * const pfm = data;
   int status = 0;
@@ -29,6 +29,7 @@
 #include "common/imageio_format.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <png.h>
 #include <inttypes.h>
 #include <zlib.h>
@@ -123,7 +124,7 @@ static void PNGwriteRawProfile(png_struct *ping,
 }
 
 int
-write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *in_void, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_png_t*p=(dt_imageio_png_t*)p_tmp;
   const int width = p->width, height = p->height;
@@ -169,6 +170,20 @@ write_image (dt_imageio_module_data_t *p_tmp, const char *filename, const void *
                p->bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
 
+#ifdef PNG_iTXt_SUPPORTED
+  if(xmp)
+  {
+    // same chunk exiv2 would write, but without rewriting the file afterwards
+    png_text text;
+    memset(&text, 0, sizeof(text));
+    text.compression = PNG_ITXT_COMPRESSION_NONE;
+    text.key = (png_charp)"XML:com.adobe.xmp";
+    text.text = (png_charp)xmp;
+    text.itxt_length = strlen(xmp);
+    png_set_text(png_ptr, info_ptr, &text, 1);
+  }
+#endif
+
   png_write_info(png_ptr, info_ptr);
 
   // png_bytep row_pointer = (png_bytep) in;
@@ -438,7 +453,11 @@ void gui_reset (dt_imageio_module_format_t *self) {}
 
 int flags(dt_imageio_module_data_t *data)
 {
+#ifdef PNG_iTXt_SUPPORTED
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
+#else
   return FORMAT_FLAGS_SUPPORT_XMP;
+#endif
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
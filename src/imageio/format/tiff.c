@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <inttypes.h>
 #include <tiffio.h>
+#include <zlib.h>
 #include "common/darktable.h"
 #include "common/imageio_module.h"
 #include "common/imageio.h"
@@ -51,7 +52,122 @@ typedef struct dt_imageio_tiff_gui_t
 dt_imageio_tiff_gui_t;
 
 
-int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif, int exif_len, int imgid)
+// copy rows [y0, y0+rows) of the 4 channel input into a packed rgb strip.
+static void _tiff_pack_rows(const dt_imageio_tiff_t *d, const void *in_void, uint8_t *strip, const int y0, const int rows)
+{
+  const size_t bytes = d->bpp / 8;
+  const size_t rowsize = (size_t)d->width * 3 * bytes;
+  for(int y = 0; y < rows; y++)
+  {
+    const uint8_t *in = (const uint8_t *)in_void + (size_t)(y0 + y) * d->width * 4 * bytes;
+    uint8_t *out = strip + y * rowsize;
+    for(int x = 0; x < d->width; x++)
+    {
+      memcpy(out, in, 3 * bytes);
+      in += 4 * bytes;
+      out += 3 * bytes;
+    }
+  }
+}
+
+// apply the tiff predictor to one row, the same way libtiff's encoder does it.
+static void _tiff_predict_row(const dt_imageio_tiff_t *d, uint8_t *row, const int predictor, const int swab)
+{
+  const size_t n = (size_t)d->width * 3;
+  if(predictor == 3)
+  {
+    // floating point predictor: split into byte planes, most significant first, then difference bytes
+    const size_t cc = n * 4;
+    uint8_t *tmp = malloc(cc);
+    if(!tmp) return;
+    const uint32_t *f = (const uint32_t *)row;
+    for(size_t i = 0; i < n; i++)
+      for(int b = 0; b < 4; b++)
+        tmp[b * n + i] = (f[i] >> (8 * (3 - b))) & 0xff;
+    for(size_t i = cc - 1; i >= 3; i--) tmp[i] -= tmp[i - 3];
+    memcpy(row, tmp, cc);
+    free(tmp);
+  }
+  else if(d->bpp == 16)
+  {
+    uint16_t *r = (uint16_t *)row;
+    if(predictor == 2)
+      for(size_t i = n - 1; i >= 3; i--) r[i] -= r[i - 3];
+    if(swab) TIFFSwabArrayOfShort(r, n);
+  }
+  else if(d->bpp == 32)
+  {
+    uint32_t *r = (uint32_t *)row;
+    if(predictor == 2)
+      for(size_t i = n - 1; i >= 3; i--) r[i] -= r[i - 3];
+    if(swab) TIFFSwabArrayOfLong(r, n);
+  }
+  else if(predictor == 2)
+  {
+    for(size_t i = n - 1; i >= 3; i--) row[i] -= row[i - 3];
+  }
+}
+
+// compress several strips at once with zlib and write them out in order as raw strips.
+// predictor and byte order are handled like libtiff's encoder, so readers see the same data.
+static int _tiff_write_deflate_strips(TIFF *tif, const dt_imageio_tiff_t *d, const void *in_void, const int predictor)
+{
+  const size_t rowsize = (size_t)d->width * 3 * d->bpp / 8;
+  const size_t stripesize = rowsize * DT_TIFFIO_STRIPE;
+  const uLong boundsize = compressBound(stripesize);
+  const int nstrips = (d->height + DT_TIFFIO_STRIPE - 1) / DT_TIFFIO_STRIPE;
+  const int batch = MIN(nstrips, 2 * dt_get_num_threads());
+  const int swab = TIFFIsByteSwapped(tif);
+
+  uint8_t *raw = malloc(stripesize * batch);
+  uint8_t *packed = malloc(boundsize * batch);
+  uLongf *packed_len = malloc(sizeof(uLongf) * batch);
+  int rc = 0;
+  if(!raw || !packed || !packed_len)
+  {
+    rc = 1;
+    goto exit;
+  }
+
+  for(int s0 = 0; s0 < nstrips && !rc; s0 += batch)
+  {
+    const int count = MIN(batch, nstrips - s0);
+    int err = 0;
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic) shared(raw, packed, packed_len, d, in_void) reduction(|:err)
+#endif
+    for(int k = 0; k < count; k++)
+    {
+      const int y0 = (s0 + k) * DT_TIFFIO_STRIPE;
+      const int rows = MIN(DT_TIFFIO_STRIPE, d->height - y0);
+      uint8_t *strip = raw + k * stripesize;
+      _tiff_pack_rows(d, in_void, strip, y0, rows);
+      for(int y = 0; y < rows; y++) _tiff_predict_row(d, strip + y * rowsize, predictor, swab);
+      packed_len[k] = boundsize;
+      if(compress2(packed + k * boundsize, &packed_len[k], strip, rowsize * rows, 9) != Z_OK) err = 1;
+    }
+    if(err)
+    {
+      rc = 1;
+      break;
+    }
+    for(int k = 0; k < count; k++)
+      if(TIFFWriteRawStrip(tif, s0 + k, packed + k * boundsize, packed_len[k]) < 0)
+      {
+        rc = 1;
+        break;
+      }
+  }
+
+exit:
+  free(raw);
+  free(packed);
+  free(packed_len);
+  return rc;
+}
+
+
+int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_imageio_tiff_t *d=(dt_imageio_tiff_t*)d_tmp;
 
@@ -147,6 +263,14 @@ int write_image (dt_imageio_module_data_t *d_tmp, const char *filename, const vo
   stripesize = rowsize * DT_TIFFIO_STRIPE;
   stripe = 0;
 
+  if(d->compress > 0 && dt_conf_get_bool("plugins/imageio/format/tiff/multithreaded"))
+  {
+    uint16_t predictor = 1;
+    TIFFGetField(tif, TIFFTAG_PREDICTOR, &predictor);
+    rc = _tiff_write_deflate_strips(tif, d, in_void, predictor);
+    goto exit;
+  }
+
   rowdata = malloc(stripesize);
   if (!rowdata)
   {
@@ -249,9 +373,9 @@ exit:
     TIFFClose(tif);
     tif = NULL;
   }
-  if(!rc && exif)
+  if(!rc && (exif || xmp))
   {
-    rc = dt_exif_write_blob(exif,exif_len,filename);
+    rc = dt_exif_write_blob(exif,exif_len,filename,xmp);
     // Until we get symbolic error status codes, if rc is 1, return 0
     rc = (rc == 1) ? 0 : 1;
   }
@@ -451,7 +575,7 @@ void gui_reset   (dt_imageio_module_format_t *self)
 
 int flags(dt_imageio_module_data_t *data)
 {
-  return FORMAT_FLAGS_SUPPORT_XMP;
+  return FORMAT_FLAGS_SUPPORT_XMP | FORMAT_FLAGS_EMBED_XMP;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -29,6 +29,44 @@ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#endif
+
+/*******************************************************************
+ * Value vector arithmetic, with an sse path for 4-vectors (the    *
+ * rgb + homogeneous weight case used by the bilateral filter).    *
+ *******************************************************************/
+template <int VD>
+static inline void permutohedral_accumulate(float *dst, const float *src, const float weight)
+{
+  for (int k = 0; k < VD; k++)
+    dst[k] += weight*src[k];
+}
+
+template <int VD>
+static inline void permutohedral_blur(float *dst, const float *vm1, const float *val, const float *vp1)
+{
+  for (int k = 0; k < VD; k++)
+    dst[k] = 0.25f*vm1[k] + 0.5f*val[k] + 0.25f*vp1[k];
+}
+
+#ifdef __SSE2__
+template <>
+inline void permutohedral_accumulate<4>(float *dst, const float *src, const float weight)
+{
+  _mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_mul_ps(_mm_set1_ps(weight), _mm_loadu_ps(src))));
+}
+
+template <>
+inline void permutohedral_blur<4>(float *dst, const float *vm1, const float *val, const float *vp1)
+{
+  const __m128 quarter = _mm_set1_ps(0.25f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 outer = _mm_add_ps(_mm_loadu_ps(vm1), _mm_loadu_ps(vp1));
+  _mm_storeu_ps(dst, _mm_add_ps(_mm_mul_ps(quarter, outer), _mm_mul_ps(half, _mm_loadu_ps(val))));
+}
+#endif
 
 /*******************************************************************
  * Hash table implementation for permutohedral lattice             *
@@ -64,6 +102,20 @@ public:
     delete[] values;
   }
 
+  /* Upper bound of the memory used per stored vector: the table is grown
+   * before it is half full, so there are never more than 4 entries and 2
+   * key/value slots per stored vector. */
+  static size_t bytesPerVector()
+  {
+    return 4*sizeof(Entry) + 2*(KD*sizeof(short) + VD*sizeof(float));
+  }
+
+  /* Memory used by an empty table. */
+  static size_t bytesInitial()
+  {
+    return (1 << 15)*sizeof(Entry) + (1 << 14)*(KD*sizeof(short) + VD*sizeof(float));
+  }
+
   // Returns the number of vectors stored.
   int size()
   {
@@ -82,6 +134,25 @@ public:
     return values;
   }
 
+  /* Makes room for n vectors in an empty table, so that filling it
+   * does not need to grow and rehash on the way. */
+  void reserve(size_t n)
+  {
+    if (filled > 0 || n < capacity/2-1) return;
+    while (n >= capacity/2-1)
+    {
+      capacity *= 2;
+      capacity_bits = (capacity_bits << 1) | 1;
+    }
+    delete[] entries;
+    delete[] keys;
+    delete[] values;
+    entries = new Entry[capacity];
+    keys = new short[KD*capacity/2];
+    values = new float[VD*capacity/2];
+    memset(values, 0, sizeof(float)*VD*capacity/2);
+  }
+
   /* Returns the index into the hash table for a given key.
    *     key: a pointer to the position vector.
    *       h: hash of the position vector.
@@ -91,10 +162,12 @@ public:
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
 
-    // Double hash table size if necessary
-    if (filled >= (capacity/2)-1)
+    // Double hash table size if necessary. Only inserting lookups may
+    // grow the table, pure lookups are run concurrently during blur/slice.
+    if (create && filled >= (capacity/2)-1)
     {
       grow();
+      h = hash(key) & capacity_bits;
     }
 
     // Find the entry with the given key
@@ -134,14 +207,19 @@ public:
    */
   float *lookup(const short *k, bool create = true)
   {
-    size_t h = hash(k) & capacity_bits;
-    int offset = lookupOffset(k, h, create);
+    return lookup(k, hash(k), create);
+  }
+
+  /* Same as above, for a key whose hash is already known. */
+  float *lookup(const short *k, size_t h, bool create)
+  {
+    int offset = lookupOffset(k, h & capacity_bits, create);
     if (offset < 0) return NULL;
     else return values + offset;
-  };
+  }
 
   /* Hash function used in this implementation. A simple base conversion. */
-  size_t hash(const short *key)
+  static size_t hash(const short *key)
   {
     size_t k = 0;
     for (int i = 0; i < KD; i++)
@@ -211,11 +289,20 @@ private:
  *                                                                *
  * PermutohedralLattice::filter(...) does all the work.           *
  *                                                                *
+ * Every thread splats into its own hash table. These are then    *
+ * merged in parallel into shards, each shard owning the lattice  *
+ * points whose hash maps to it, and the splat tables are freed.  *
+ * Blur looks up the shard of a key the same way, so no locking   *
+ * is needed anywhere. The memory needed per input point is       *
+ * bounded, see memoryPerPoint().                                 *
+ *                                                                *
  ******************************************************************/
 template <int D, int VD>
 class PermutohedralLattice
 {
 public:
+  typedef HashTablePermutohedral<D,VD> HashTable;
+
   /* Constructor
    *     d_ : dimensionality of key vectors
    *    vd_ : dimensionality of value vectors
@@ -265,7 +352,10 @@ public:
     }
     scaleFactor = scaleFactorTmp;
 
-    hashTables = new HashTablePermutohedral<D,VD>[nThreads];
+    hashTables = new HashTable[nThreads];
+    // with a single thread the splat table is used as the only shard.
+    nShards = 1;
+    shards = hashTables;
   }
 
 
@@ -274,18 +364,252 @@ public:
     delete[] scaleFactor;
     delete[] replay;
     delete[] canonical;
+    if (shards != hashTables) delete[] shards;
     delete[] hashTables;
   }
 
+  /* Upper bound of the memory needed per input point. Each point has D+1 replay
+   * entries and touches at most D+1 lattice vertices, which during the merge live
+   * in a splat table and a shard, with a sort index and a remap entry each. The
+   * tiling code uses this to keep the lattice within the host memory limit. */
+  static size_t memoryPerPoint()
+  {
+    return (D+1)*(sizeof(ReplayEntry) + 2*HashTable::bytesPerVector() + 2*sizeof(int));
+  }
+
+  /* Memory needed independently of the number of input points. */
+  static size_t memoryOverhead(int nThreads)
+  {
+    return 2*nThreads*HashTable::bytesInitial();
+  }
 
   /* Performs splatting with given position and value vectors */
-  void splat(float *position, float *value, size_t replay_index, int thread_index=0)
+  void splat(const float *position, const float *value, size_t replay_index, int thread_index=0)
+  {
+    short keys[(D+1)*D];
+    float barycentric[D+2];
+
+    simplex(position, keys, barycentric);
+
+    // Splat the value into each vertex of the simplex, with barycentric weights.
+    for (int remainder = 0; remainder <= D; remainder++)
+    {
+      // Retrieve pointer to the value at this vertex.
+      float *val = hashTables[thread_index].lookup(keys + remainder*D, true);
+
+      // Accumulate values with barycentric weight.
+      permutohedral_accumulate<VD>(val, value, barycentric[remainder]);
+
+      // Record this interaction to use later when slicing
+      replay[replay_index*(D+1)+remainder].table = thread_index;
+      replay[replay_index*(D+1)+remainder].offset = val - hashTables[thread_index].getValues();
+      replay[replay_index*(D+1)+remainder].weight = barycentric[remainder];
+    }
+  }
+
+  /* Merge the multiple threads' hash tables into the shards. */
+  void merge_splat_threads(void)
+  {
+    if (nThreads <= 1)
+      return;
+
+    nShards = nThreads;
+    shards = new HashTable[nShards];
+
+    // Sort the vertices of every splat table by destination shard (counting sort),
+    // so that every shard can afterwards pick up its vertices without scanning.
+    int *order[nThreads];
+    int *offset_remap[nThreads];
+    size_t *start = new size_t[nThreads*(nShards+1)];
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(order, offset_remap, start)
+#endif
+    for (int t = 0; t < nThreads; t++)
+    {
+      const short *keys = hashTables[t].getKeys();
+      const int filled = hashTables[t].size();
+      size_t *st = start + t*(nShards+1);
+      memset(st, 0, sizeof(size_t)*(nShards+1));
+      for (int j = 0; j < filled; j++)
+        st[shard(HashTable::hash(keys + j*D)) + 1]++;
+      for (int s = 0; s < nShards; s++)
+        st[s+1] += st[s];
+      size_t pos[nShards];
+      memcpy(pos, st, sizeof(size_t)*nShards);
+      order[t] = new int[filled > 0 ? filled : 1];
+      offset_remap[t] = new int[filled > 0 ? filled : 1];
+      for (int j = 0; j < filled; j++)
+        order[t][pos[shard(HashTable::hash(keys + j*D))]++] = j;
+    }
+
+    // Every shard accumulates its vertices of all splat tables.
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 1) shared(order, offset_remap, start)
+#endif
+    for (int s = 0; s < nShards; s++)
+    {
+      size_t count = 0;
+      for (int t = 0; t < nThreads; t++)
+        count += start[t*(nShards+1) + s+1] - start[t*(nShards+1) + s];
+      shards[s].reserve(count);
+      for (int t = 0; t < nThreads; t++)
+      {
+        const short *oldKeys = hashTables[t].getKeys();
+        const float *oldVals = hashTables[t].getValues();
+        for (size_t i = start[t*(nShards+1) + s]; i < start[t*(nShards+1) + s+1]; i++)
+        {
+          const int j = order[t][i];
+          float *val = shards[s].lookup(oldKeys + j*D, true);
+          permutohedral_accumulate<VD>(val, oldVals + j*VD, 1.0f);
+          offset_remap[t][j] = val - shards[s].getValues();
+        }
+      }
+    }
+
+    for (int t = 0; t < nThreads; t++)
+      delete[] order[t];
+    delete[] start;
+
+    /* Rewrite the replay structure from the above generated table. The shard is
+     * found again from the key, which saves storing it per vertex. */
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) shared(offset_remap)
+#endif
+    for (size_t i = 0; i < nData*(D+1); i++)
+    {
+      const int t = replay[i].table;
+      const int j = replay[i].offset/VD;
+      replay[i].table = shard(HashTable::hash(hashTables[t].getKeys() + j*D));
+      replay[i].offset = offset_remap[t][j];
+    }
+
+    for (int t = 0; t < nThreads; t++)
+      delete[] offset_remap[t];
+
+    // the splat tables are not needed any more, release their memory early.
+    delete[] hashTables;
+    hashTables = new HashTable[0];
+    nThreads = 0;
+  }
+
+  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
+   * containing each position vector were calculated and stored in the splatting step.
+   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
+   */
+  void slice(float *col, size_t replay_index)
+  {
+    for (int j = 0; j < VD; j++) col[j] = 0;
+    for (int i = 0; i <= D; i++)
+    {
+      ReplayEntry r = replay[replay_index*(D+1)+i];
+      permutohedral_accumulate<VD>(col, shards[r.table].getValues() + r.offset, r.weight);
+    }
+  }
+
+  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
+  void blur()
+  {
+    // Prepare arrays
+    float *newValue[nShards];
+    float *oldValue[nShards];
+    float *hashTableBase[nShards];
+    for (int s = 0; s < nShards; s++)
+    {
+      newValue[s] = new float[VD*(shards[s].size() > 0 ? shards[s].size() : 1)];
+      oldValue[s] = hashTableBase[s] = shards[s].getValues();
+    }
+
+    float zero[VD];
+    for (int k = 0; k < VD; k++) zero[k] = 0;
+
+    // For each of d+1 axes,
+    for (int j = 0; j <= D; j++)
+    {
+      // For each shard and each vertex in it,
+      for (int s = 0; s < nShards; s++)
+      {
+        const int size = shards[s].size();
+        const short *keys = shards[s].getKeys();
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) shared(j, s, oldValue, newValue, hashTableBase, zero)
+#endif
+        for (int i = 0; i < size; i++)   // blur point i in dimension j
+        {
+          const short *key = keys + i*(D); // keys to current vertex
+          short neighbor1[D+1];
+          short neighbor2[D+1];
+          for (int k = 0; k < D; k++)
+          {
+            neighbor1[k] = key[k] + 1;
+            neighbor2[k] = key[k] - 1;
+          }
+          neighbor1[j] = key[j] - D;
+          neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
+
+          const float *oldVal = oldValue[s] + i*VD;
+          float *newVal = newValue[s] + i*VD;
+
+          const float *vm1 = neighbor(neighbor1, oldValue, hashTableBase, zero); // look up first neighbor
+          const float *vp1 = neighbor(neighbor2, oldValue, hashTableBase, zero); // look up second neighbor
+
+          // Mix values of the three vertices
+          permutohedral_blur<VD>(newVal, vm1, oldVal, vp1);
+        }
+      }
+      for (int s = 0; s < nShards; s++)
+      {
+        float *tmp = newValue[s];
+        newValue[s] = oldValue[s];
+        oldValue[s] = tmp;
+      }
+      // the freshest data is now in oldValue, and newValue is ready to be written over
+    }
+
+    // depending where we ended up, we may have to copy data
+    for (int s = 0; s < nShards; s++)
+    {
+      if (oldValue[s] != hashTableBase[s])
+      {
+        memcpy(hashTableBase[s], oldValue[s], shards[s].size()*VD*sizeof(float));
+        delete[] oldValue[s];
+      }
+      else
+      {
+        delete[] newValue[s];
+      }
+    }
+  }
+
+private:
+
+  /* Shard owning the lattice point with hash h. The bits are scrambled, as the
+   * low bits also select the bucket inside the shard's hash table. */
+  int shard(size_t h) const
+  {
+    unsigned int x = (unsigned int)(h ^ (h >> 16));
+    x *= 0x45d9f3bu;
+    x ^= x >> 16;
+    return x % nShards;
+  }
+
+  /* Value of a neighbouring vertex during blur, or zero if it does not exist. */
+  const float *neighbor(const short *key, float *const *oldValue, float *const *hashTableBase, const float *zero)
+  {
+    const size_t h = HashTable::hash(key);
+    const int s = shard(h);
+    const float *v = shards[s].lookup(key, h, false);
+    if (v) return v - hashTableBase[s] + oldValue[s];
+    return zero;
+  }
+
+  /* Computes the vertices of the simplex enclosing position (D keys per vertex,
+   * all but the last coordinate - it's redundant because they sum to zero)
+   * and the barycentric weights of position within it. */
+  void simplex(const float *position, short *keys, float *barycentric)
   {
     float elevated[D+1];
     int greedy[D+1];
     int rank[D+1];
-    float barycentric[D+2];
-    short key[D];
 
     // first rotate position into the (d+1)-dimensional hyperplane
     elevated[D] = -D*position[D-1]*scaleFactor[D-1];
@@ -353,7 +677,7 @@ public:
     }
 
     // Compute barycentric coordinates (See pg.10 of paper.)
-    memset(barycentric, 0, sizeof barycentric);
+    memset(barycentric, 0, sizeof(float)*(D+2));
     for (int i = 0; i <= D; i++)
     {
       barycentric[D-rank[i]] += (elevated[i] - greedy[i]) * scale;
@@ -361,148 +685,15 @@ public:
     }
     barycentric[0] += 1.0f + barycentric[D+1];
 
-    // Splat the value into each vertex of the simplex, with barycentric weights.
+    // Compute the location of the lattice points explicitly.
     for (int remainder = 0; remainder <= D; remainder++)
-    {
-      // Compute the location of the lattice point explicitly (all but the last coordinate - it's redundant because they sum to zero)
       for (int i = 0; i < D; i++)
-        key[i] = greedy[i] + canonical[remainder*(D+1) + rank[i]];
-
-      // Retrieve pointer to the value at this vertex.
-      float * val = hashTables[thread_index].lookup(key, true);
-
-      // Accumulate values with barycentric weight.
-      for (int i = 0; i < VD; i++)
-        val[i] += barycentric[remainder]*value[i];
-
-      // Record this interaction to use later when slicing
-      replay[replay_index*(D+1)+remainder].table = thread_index;
-      replay[replay_index*(D+1)+remainder].offset = val - hashTables[thread_index].getValues();
-      replay[replay_index*(D+1)+remainder].weight = barycentric[remainder];
-    }
-  }
-
-  /* Merge the multiple threads' hash tables into the totals. */
-  void merge_splat_threads(void)
-  {
-    if (nThreads <= 1)
-      return;
-
-    /* Merge the multiple hash tables into one, creating an offset remap table. */
-    int *offset_remap[nThreads];
-    for (int i = 1; i < nThreads; i++)
-    {
-      const short *oldKeys = hashTables[i].getKeys();
-      const float *oldVals = hashTables[i].getValues();
-      const int filled = hashTables[i].size();
-      offset_remap[i] = new int[filled];
-      for (int j = 0; j < filled; j++)
-      {
-        float *val = hashTables[0].lookup(oldKeys+j*D, true);
-        const float *oldVal = oldVals + j*VD;
-        for (int k = 0; k < VD; k++)
-          val[k] += oldVal[k];
-        offset_remap[i][j] = val - hashTables[0].getValues();
-      }
-    }
-
-    /* Rewrite the offsets in the replay structure from the above generated table. */
-    for (int i = 0; i < nData*(D+1); i++)
-      if (replay[i].table > 0)
-        replay[i].offset = offset_remap[replay[i].table][replay[i].offset/VD];
-
-    for (int i = 1; i < nThreads; i++)
-      delete[] offset_remap[i];
-  }
-
-  /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
-   * containing each position vector were calculated and stored in the splatting step.
-   * We may reuse this to accelerate the algorithm. (See pg. 6 in paper.)
-   */
-  void slice(float *col, size_t replay_index)
-  {
-    float *base = hashTables[0].getValues();
-    for (int j = 0; j < VD; j++) col[j] = 0;
-    for (int i = 0; i <= D; i++)
-    {
-      ReplayEntry r = replay[replay_index*(D+1)+i];
-      for (int j = 0; j < VD; j++)
-      {
-        col[j] += r.weight*base[r.offset + j];
-      }
-    }
-  }
-
-  /* Performs a Gaussian blur along each projected axis in the hyperplane. */
-  void blur()
-  {
-    // Prepare arrays
-    float *newValue = new float[VD*hashTables[0].size()];
-    float *oldValue = hashTables[0].getValues();
-    float *hashTableBase = oldValue;
-
-    float zero[VD];
-    for (int k = 0; k < VD; k++) zero[k] = 0;
-
-    // For each of d+1 axes,
-    for (int j = 0; j <= D; j++)
-    {
-#ifdef _OPENMP
-      #pragma omp parallel for shared(j, oldValue, newValue, hashTableBase, zero)
-#endif
-      // For each vertex in the lattice,
-      for (int i = 0; i < hashTables[0].size(); i++)   // blur point i in dimension j
-      {
-        const short *key    = hashTables[0].getKeys() + i*(D); // keys to current vertex
-        short neighbor1[D+1];
-        short neighbor2[D+1];
-        for (int k = 0; k < D; k++)
-        {
-          neighbor1[k] = key[k] + 1;
-          neighbor2[k] = key[k] - 1;
-        }
-        neighbor1[j] = key[j] - D;
-        neighbor2[j] = key[j] + D; // keys to the neighbors along the given axis.
-
-        float *oldVal = oldValue + i*VD;
-        float *newVal = newValue + i*VD;
-
-        float *vm1, *vp1;
-
-        vm1 = hashTables[0].lookup(neighbor1, false); // look up first neighbor
-        if (vm1) vm1 = vm1 - hashTableBase + oldValue;
-        else vm1 = zero;
-
-        vp1 = hashTables[0].lookup(neighbor2, false); // look up second neighbor
-        if (vp1) vp1 = vp1 - hashTableBase + oldValue;
-        else vp1 = zero;
-
-        // Mix values of the three vertices
-        for (int k = 0; k < VD; k++)
-          newVal[k] = (0.25f*vm1[k] + 0.5f*oldVal[k] + 0.25f*vp1[k]);
-      }
-      float *tmp = newValue;
-      newValue = oldValue;
-      oldValue = tmp;
-      // the freshest data is now in oldValue, and newValue is ready to be written over
-    }
-
-    // depending where we ended up, we may have to copy data
-    if (oldValue != hashTableBase)
-    {
-      memcpy(hashTableBase, oldValue, hashTables[0].size()*VD*sizeof(float));
-      delete[] oldValue;
-    }
-    else
-    {
-      delete[] newValue;
-    }
+        keys[remainder*D + i] = greedy[i] + canonical[remainder*(D+1) + rank[i]];
   }
 
-private:
-
-  int nData;
+  size_t nData;
   int nThreads;
+  int nShards;
   const float *scaleFactor;
   const int *canonical;
 
@@ -514,7 +705,8 @@ private:
     float weight;
   } *replay;
 
-  HashTablePermutohedral<D,VD> *hashTables;
+  HashTable *hashTables;
+  HashTable *shards;
 };
 
 #endif
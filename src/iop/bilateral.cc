@@ -292,8 +292,18 @@ extern "C"
     sigma[0] = data->sigma[0] * roi_in->scale / piece->iscale;
     sigma[1] = data->sigma[1] * roi_in->scale / piece->iscale;
     const int rad = (int)(3.0*fmaxf(sigma[0],sigma[1])+1.0);
-    tiling->factor = 2 + 50;
-    tiling->overhead = 0;
+    if(rad <= 6)
+    {
+      // naive version, no lattice needed.
+      tiling->factor = 2;
+      tiling->overhead = 0;
+    }
+    else
+    {
+      // the lattice has a hard upper bound per pixel, so tiling keeps us within the memory limit.
+      tiling->factor = 2 + (float)PermutohedralLattice<5,4>::memoryPerPoint() / (piece->colors * sizeof(float));
+      tiling->overhead = PermutohedralLattice<5,4>::memoryOverhead(omp_get_max_threads());
+    }
     tiling->overlap = rad;
     tiling->xalign = 1;
     tiling->yalign = 1;
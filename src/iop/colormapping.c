@@ -24,7 +24,6 @@
 #include "develop/imageop.h"
 #include "develop/tiling.h"
 #include "control/control.h"
-#include "common/points.h"
 #include "common/opencl.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -33,6 +32,7 @@
 #include "dtgtk/resetlabel.h"
 #include "common/bilateral.h"
 #include "common/bilateralcl.h"
+#include "common/kmeans.h"
 
 #include <stdlib.h>
 #include <math.h>
@@ -274,126 +274,20 @@ get_clusters(const float *col, const int n, float mean[n][2], float *weight)
 }
 
 
-static int
-get_cluster(const float *col, const int n, float mean[n][2])
-{
-  float mdist = FLT_MAX;
-  int cluster = 0;
-  for(int k=0; k<n; k++)
-  {
-    const float dist = (col[1]-mean[k][0])*(col[1]-mean[k][0]) + (col[2]-mean[k][1])*(col[2]-mean[k][1]);
-    if(dist < mdist)
-    {
-      mdist = dist;
-      cluster = k;
-    }
-  }
-  return cluster;
-}
-
 static void
-kmeans(const float *col, const int width, const int height, const int n, float mean_out[n][2], float var_out[n][2], float weight_out[n])
+kmeans(const float *col, const int width, const int height, const int ch, const int n, float mean_out[n][2], float var_out[n][2], float weight_out[n])
 {
-  const int nit = 40; // number of iterations
-  const int samples = width*height * 0.2; // samples: only a fraction of the buffer.
-
-  float mean[n][2], var[n][2];
-  int cnt[n], count;
-
-  float a_min = FLT_MAX, b_min = FLT_MAX, a_max = FLT_MIN, b_max = FLT_MIN;
-
-  for(int s=0; s<samples; s++)
-  {
-    const int j = CLAMP(dt_points_get()*height, 0, height-1);
-    const int i = CLAMP(dt_points_get()*width, 0, width-1);
-
-    const float a = col[4*(width*j + i)+1];
-    const float b = col[4*(width*j + i)+2];
-
-    a_min = fmin(a, a_min);
-    a_max = fmax(a, a_max);
-    b_min = fmin(b, b_min);
-    b_max = fmax(b, b_max);
-  }
-
-  // init n clusters for a, b channels at random
-  for(int k=0; k<n; k++)
-  {
-    mean_out[k][0] = 0.9f * (a_min + (a_max - a_min) * dt_points_get());
-    mean_out[k][1] = 0.9f * (b_min + (b_max - b_min) * dt_points_get());
-    var_out[k][0] = var_out[k][1] = weight_out[k] = 0.0f;
-    mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-  }
-  for(int it=0; it<nit; it++)
-  {
-    for(int k=0; k<n; k++) cnt[k] = 0;
-    // randomly sample col positions inside roi
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) schedule(static) shared(col,var,mean,mean_out,cnt)
-#endif
-    for(int s=0; s<samples; s++)
-    {
-      const int j = CLAMP(dt_points_get()*height, 0, height-1);
-      const int i = CLAMP(dt_points_get()*width, 0, width-1);
-      // for each sample: determine cluster, update new mean, update var
-      for(int k=0; k<n; k++)
-      {
-        const float L = col[4*(width*j+i)];
-        const float Lab[3] = {L, col[4*(width*j + i)+1], col[4*(width*j + i)+2]};
-        // determine dist to mean_out
-        const int c = get_cluster(Lab, n, mean_out);
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        cnt[c]++;
-        // update mean, var
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][0]  += Lab[1]*Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][1]  += Lab[2]*Lab[2];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][0] += Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][1] += Lab[2];
-      }
-    }
-    // swap old/new means
-    for(int k=0; k<n; k++)
-    {
-      if(cnt [k] == 0) continue;
-      mean_out[k][0] = mean[k][0]/cnt[k];
-      mean_out[k][1] = mean[k][1]/cnt[k];
-      var_out[k][0] = var[k][0]/cnt[k] - mean_out[k][0]*mean_out[k][0];
-      var_out[k][1] = var[k][1]/cnt[k] - mean_out[k][1]*mean_out[k][1];
-      mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-    }
+  const int nit = 40; // max number of iterations
+  const int samples = dt_conf_get_int("plugins/darkroom/kmeans_samples");
 
-    // determine weight of clusters
-    count = 0;
-    for(int k=0; k<n; k++) count += cnt[k];
-    for(int k=0; k<n; k++) weight_out[k] = (count > 0) ? (float)cnt[k]/count : 0.0f;
-
-    // printf("it %d  %d means:\n", it, n);
-    // for(int k=0;k<n;k++) printf("mean %f %f -- var %f %f -- weight %f\n", mean_out[k][0], mean_out[k][1], var_out[k][0], var_out[k][1], weight_out[k]);
-  }
+  // only ever called for the acquire buttons, which should really acquire
+  dt_kmeans_ab(col, width, height, ch, n, samples, nit, 1, mean_out, var_out, weight_out);
 
   for(int k=0; k<n; k++)
   {
     // "eliminate" clusters with a variance of zero
     if(var_out[k][0] == 0.0f || var_out[k][1] == 0.0f)
       mean_out[k][0] = mean_out[k][1] = var_out[k][0] = var_out[k][1] = weight_out[k] = 0;
-
-    // we actually want the std deviation.
-    var_out[k][0] = sqrtf(var_out[k][0]);
-    var_out[k][1] = sqrtf(var_out[k][1]);
   }
 
   // simple bubblesort of clusters in order of ascending weight: just a convenience for the user to keep cluster display a bit more consistent in GUI
@@ -993,7 +887,7 @@ gui_post_expose (struct dt_iop_module_t *self, cairo_t *cr, int32_t fwidth, int3
     invert_histogram(hist, p->source_ihist);
 
     // get n color clusters
-    kmeans(buffer, width, height, p->n, p->source_mean, p->source_var, p->source_weight);
+    kmeans(buffer, width, height, ch, p->n, p->source_mean, p->source_var, p->source_weight);
 
     p->flag |= HAS_SOURCE;
     new_source_clusters = 1;
@@ -1004,7 +898,7 @@ gui_post_expose (struct dt_iop_module_t *self, cairo_t *cr, int32_t fwidth, int3
     capture_histogram(buffer, width, height, p->target_hist);
 
     // get n color clusters
-    kmeans(buffer, width, height, p->n, p->target_mean, p->target_var, p->target_weight);
+    kmeans(buffer, width, height, ch, p->n, p->target_mean, p->target_var, p->target_weight);
 
     p->flag |= HAS_TARGET;
   }
@@ -546,6 +546,7 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
 {
   dt_iop_colorout_params_t *p = (dt_iop_colorout_params_t *)p1;
   dt_iop_colorout_data_t *d = (dt_iop_colorout_data_t *)piece->data;
+  // pooled export pipes only commit again if these change, see _commit_conf_keys in develop/pixelpipe_hb.c
   gchar *overprofile = dt_conf_get_string("plugins/lighttable/export/iccprofile");
   const int overintent = dt_conf_get_int("plugins/lighttable/export/iccintent");
   const int high_quality_processing = dt_conf_get_bool("plugins/lighttable/export/force_lcms2");
@@ -22,7 +22,7 @@
 #include "develop/develop.h"
 #include "develop/imageop.h"
 #include "control/control.h"
-#include "common/points.h"
+#include "common/kmeans.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include "dtgtk/button.h"
@@ -217,100 +217,14 @@ get_clusters(const float *col, const int n, float mean[n][2], float *weight)
   if(sum > 0) for(int k=0; k<n; k++) weight[k] /= sum;
 }
 
-static int
-get_cluster(const float *col, const int n, float mean[n][2])
-{
-  float mdist = FLT_MAX;
-  int cluster = 0;
-  for(int k=0; k<n; k++)
-  {
-    const float dist = (col[1]-mean[k][0])*(col[1]-mean[k][0]) + (col[2]-mean[k][1])*(col[2]-mean[k][1]);
-    if(dist < mdist)
-    {
-      mdist = dist;
-      cluster = k;
-    }
-  }
-  return cluster;
-}
-
 static void
-kmeans(const float *col, const dt_iop_roi_t *roi, const int n, float mean_out[n][2], float var_out[n][2])
+kmeans(const float *col, const dt_iop_roi_t *roi, const int n, const int refresh, float mean_out[n][2], float var_out[n][2])
 {
-  // TODO: check params here:
-  const int nit = 10; // number of iterations
-  const int samples = roi->width*roi->height * 0.2; // samples: only a fraction of the buffer.
+  const int nit = 10; // max number of iterations
+  const int samples = dt_conf_get_int("plugins/darkroom/kmeans_samples");
+  float weight[n];
 
-  float mean[n][2], var[n][2];
-  int cnt[n];
-
-  // init n clusters for a, b channels at random
-  for(int k=0; k<n; k++)
-  {
-    mean_out[k][0] = 20.0f-40.0f*dt_points_get();
-    mean_out[k][1] = 20.0f-40.0f*dt_points_get();
-    var_out[k][0] = var_out[k][1] = 0.0f;
-    mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-  }
-  for(int it=0; it<nit; it++)
-  {
-    for(int k=0; k<n; k++) cnt[k] = 0;
-    // randomly sample col positions inside roi
-#ifdef _OPENMP
-    #pragma omp parallel for default(none) schedule(static) shared(roi,col,var,mean,mean_out,cnt)
-#endif
-    for(int s=0; s<samples; s++)
-    {
-      const int j = dt_points_get()*roi->height, i = dt_points_get()*roi->width;
-      // for each sample: determine cluster, update new mean, update var
-      for(int k=0; k<n; k++)
-      {
-        const float L = col[3*(roi->width*j+i)];
-        const float Lab[3] = {L, col[3*(roi->width*j + i)+1], col[3*(roi->width*j + i)+2]};
-        // determine dist to mean_out
-        const int c = get_cluster(Lab, n, mean_out);
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        cnt[c]++;
-        // update mean, var
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][0]  += Lab[1]*Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        var[c][1]  += Lab[2]*Lab[2];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][0] += Lab[1];
-#ifdef _OPENMP
-        #pragma omp atomic
-#endif
-        mean[c][1] += Lab[2];
-      }
-    }
-    // swap old/new means
-    for(int k=0; k<n; k++)
-    {
-      if(cnt [k] == 0) continue;
-      mean_out[k][0] = mean[k][0]/cnt[k];
-      mean_out[k][1] = mean[k][1]/cnt[k];
-      var_out[k][0] = var[k][0]/cnt[k] - mean_out[k][0]*mean_out[k][0];
-      var_out[k][1] = var[k][1]/cnt[k] - mean_out[k][1]*mean_out[k][1];
-      mean[k][0] = mean[k][1] = var[k][0] = var[k][1] = 0.0f;
-    }
-    // printf("it %d  %d means:\n", it, n);
-    // for(int k=0;k<n;k++) printf("%f %f -- var %f %f\n", mean_out[k][0], mean_out[k][1], var_out[k][0], var_out[k][1]);
-  }
-  for(int k=0; k<n; k++)
-  {
-    // we actually want the std deviation.
-    var_out[k][0] = sqrtf(var_out[k][0]);
-    var_out[k][1] = sqrtf(var_out[k][1]);
-  }
+  dt_kmeans_ab(col, roi->width, roi->height, 3, n, samples, nit, refresh, mean_out, var_out, weight);
 }
 
 void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
@@ -333,7 +247,8 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
       invert_histogram(hist, data->hist);
 
       // get n clusters
-      kmeans(in, roi_in, data->n, data->mean, data->var);
+      // acquire pressed: don't hand out an old fit
+      kmeans(in, roi_in, data->n, 1, data->mean, data->var);
 
       // notify gui that commit_params should let stuff flow back!
       data->flag = ACQUIRED;
@@ -364,7 +279,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
 
     // cluster input buffer
     float mean[data->n][2], var[data->n][2];
-    kmeans(in, roi_in, data->n, mean, var);
+    kmeans(in, roi_in, data->n, 0, mean, var);
 
     // get mapping from input clusters to target clusters
     int mapio[data->n];
@@ -637,6 +637,76 @@ modify_roi_in (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piec
     roi_in->height = piece->pipe->image.height;
 }
 
+// extra lines for demosaic to have proper neighbours at the band ends (amaze needs 16)
+#define DEMOSAIC_ZOOM_MARGIN 16
+
+// output lines demosaic_zoom resamples at a time, and the full resolution lines it demosaics for them
+static int
+demosaic_zoom_band(const struct dt_interpolation *itor, const float scale, const int height, int *max_lines)
+{
+  // lines read by the resampling filter around the projection of an output line
+  const float radius = itor->width / fminf(scale, 1.0f);
+  // about 192 full resolution lines per band
+  const int band = MAX(1, (int)(192 * scale));
+  *max_lines = MIN(height, (int)ceilf(band / scale + 2.0f * radius) + 4 + 2 * DEMOSAIC_ZOOM_MARGIN + 2);
+  return band;
+}
+
+/** demosaic and clip and zoom in one go: demosaic a band of a few hundred full
+ * resolution lines at a time and resample it to the output right away, so the full
+ * resolution rgb image never exists. in is the mosaiced roi_in, out is roi_out. */
+static void
+demosaic_zoom(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const float *const in, float *out,
+              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out, const int method)
+{
+  dt_iop_demosaic_data_t *data = (dt_iop_demosaic_data_t *)piece->data;
+  const struct dt_interpolation *itor = dt_interpolation_new(DT_INTERPOLATION_USERPREF);
+  const float scale = roi_out->scale;
+  // full resolution size, as the unfused path demosaiced to:
+  const int width  = roi_out->width / scale;
+  const int height = roi_out->height / scale;
+  const float radius = itor->width / fminf(scale, 1.0f);
+  const int margin = DEMOSAIC_ZOOM_MARGIN;
+  int max_lines;
+  const int band = demosaic_zoom_band(itor, scale, height, &max_lines);
+
+  float *tmp = (float *)dt_alloc_align(16, (size_t)width * max_lines * 4 * sizeof(float));
+
+  for(int oy0 = 0; oy0 < roi_out->height; oy0 += band)
+  {
+    const int oy1 = MIN(roi_out->height, oy0 + band);
+    // full resolution lines the resampling of oy0..oy1 reads,
+    const int y0 = MAX(0, (int)floorf(oy0 / scale - radius) - 1);
+    const int y1 = MIN(height, (int)ceilf((oy1 - 1) / scale + radius) + 2);
+    // and the ones we demosaic, starting on the same bayer phase.
+    int d0 = MAX(0, y0 - margin) & ~1;
+    const int d1 = MIN(height, MIN(d0 + max_lines, y1 + margin));
+    // amaze mirrors 48 lines at the borders, keep the last band that high
+    if(d1 - d0 < 64) d0 = MAX(0, d1 - 64) & ~1;
+
+    dt_iop_roi_t rin = *roi_in, rout = *roi_out;
+    // the last band sees the rest of the input, like the whole image would
+    rin.height = (d1 == height ? roi_in->height : d1) - d0;
+    rout.x = rout.y = 0;
+    rout.width = width;
+    rout.height = d1 - d0;
+    rout.scale = 1.0f;
+    const float *band_in = in + (size_t)d0 * roi_in->width;
+    if(method != DT_IOP_DEMOSAIC_AMAZE)
+      demosaic_ppg(tmp, band_in, &rout, &rin, data->filters, data->median_thrs);
+    else
+      amaze_demosaic_RT(self, piece, band_in, tmp, &rin, &rout, data->filters);
+
+    // resample output lines oy0..oy1. the filter indexes lines of the whole full
+    // resolution image, tmp holds d0..d1 of them.
+    const dt_iop_roi_t zin = { 0, d0, width, height, 1.0f };
+    const dt_iop_roi_t zout = { 0, oy0, roi_out->width, oy1 - oy0, scale };
+    dt_interpolation_resample_band(itor, out + (size_t)4 * oy0 * roi_out->width, &zout, roi_out->width * 4 * sizeof(float),
+                                   tmp, &zin, width * 4 * sizeof(float));
+  }
+  dt_free_align(tmp);
+}
+
 static int get_quality()
 {
   int qual = 1;
@@ -714,14 +784,7 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
           (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) ||  // or in darkroom mode and quality requested by user settings
           (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))              // we assume you always want that for exports.
   {
-    // demosaic and then clip and zoom
-    // roo.x = roi_out->x / global_scale;
-    // roo.y = roi_out->y / global_scale;
-    roo.width  = roi_out->width / roi_out->scale;
-    roo.height = roi_out->height / roi_out->scale;
-    roo.scale = 1.0f;
-
-    float *tmp = (float *)dt_alloc_align(16, (size_t)roo.width*roo.height*4*sizeof(float));
+    // demosaic and then clip and zoom, band by band
     if(data->green_eq != DT_IOP_GREEN_EQ_NO)
     {
       float *in = (float *)dt_alloc_align(16, (size_t)roi_in->height*roi_in->width*sizeof(float));
@@ -743,24 +806,11 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *i, v
           break;
       }
       // wanted ppg or zoomed out a lot and quality is limited to 1
-      if(demosaicing_method != DT_IOP_DEMOSAIC_AMAZE)
-        demosaic_ppg(tmp, in, &roo, &roi, data->filters, data->median_thrs);
-      else
-        amaze_demosaic_RT(self, piece, in, tmp, &roi, &roo, data->filters);
+      demosaic_zoom(self, piece, in, (float *)o, roi_in, roi_out, demosaicing_method);
       dt_free_align(in);
     }
     else
-    {
-      if(demosaicing_method != DT_IOP_DEMOSAIC_AMAZE)
-        demosaic_ppg(tmp, pixels, &roo, &roi, data->filters, data->median_thrs);
-      else
-        amaze_demosaic_RT(self, piece, pixels, tmp, &roi, &roo, data->filters);
-    }
-    roi = *roi_out;
-    roi.x = roi.y = 0;
-    roi.scale = roi_out->scale;
-    dt_iop_clip_and_zoom((float *)o, tmp, &roi, &roo, roi.width, roo.width);
-    dt_free_align(tmp);
+      demosaic_zoom(self, piece, pixels, (float *)o, roi_in, roi_out, demosaicing_method);
   }
   else
   {
@@ -1111,7 +1161,13 @@ void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop
     tiling->factor += fmax(0.25f, smooth);
   else if(roi_out->scale > 0.5f ||
           (piece->pipe->type == DT_DEV_PIXELPIPE_FULL && qual > 0) || (piece->pipe->type == DT_DEV_PIXELPIPE_EXPORT))
-    tiling->factor += fmax(1.25f, smooth);
+  {
+    // demosaic_zoom only keeps a band of full resolution rgb lines, plus the green equilibrated copy of the input
+    int max_lines;
+    demosaic_zoom_band(dt_interpolation_new(DT_INTERPOLATION_USERPREF), roi_out->scale, roi_out->height / roi_out->scale, &max_lines);
+    const float band = (float)max_lines / roi_in->height + (data->green_eq != DT_IOP_GREEN_EQ_NO ? 0.25f : 0.0f);
+    tiling->factor += fmax(band, smooth);
+  }
   else
     tiling->factor += fmax(0.25f, smooth);
 
@@ -131,12 +131,11 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   const int numl_cap = MIN(DT_IOP_EQUALIZER_MAX_LEVEL-l1+1.5, numl);
   // printf("level range in %d %d: %f %f, cap: %d\n", 1, d->num_levels, l1, lm, numl_cap);
 
-  // TODO: fixed alloc for data piece at capped resolution?
   float **tmp = (float **)malloc((size_t)sizeof(float *)*numl_cap);
   for(int k=1; k<numl_cap; k++)
   {
     const int wd = (int)(1 + (width>>(k-1))), ht = (int)(1 + (height>>(k-1)));
-    tmp[k] = (float *)malloc((size_t)sizeof(float)*wd*ht);
+    tmp[k] = (float *)dt_dev_pixelpipe_scratch_get(piece->pipe, (size_t)sizeof(float)*wd*ht);
   }
 
   for(int level=1; level<numl_cap; level++) dt_iop_equalizer_wtf(out, tmp, level, width, height);
@@ -200,7 +199,7 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   // printf("applied\n");
   for(int level=numl_cap-1; level>0; level--) dt_iop_equalizer_iwtf(out, tmp, level, width, height);
 
-  for(int k=1; k<numl_cap; k++) free(tmp[k]);
+  for(int k=numl_cap-1; k>0; k--) dt_dev_pixelpipe_scratch_put(piece->pipe, tmp[k]);
   free(tmp);
   // printf("thread %d finished equalizer", (int)pthread_self());
   // if(piece->iscale != 1.0) printf(" for preview\n");
@@ -33,6 +33,7 @@
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
 #include <gtk/gtk.h>
+#include <glib/gstdio.h>
 #include <inttypes.h>
 
 #include <librsvg/rsvg.h>
@@ -48,7 +49,11 @@
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 DT_MODULE_INTROSPECTION(2, dt_iop_watermark_params_t)
 
-// gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5,data,length);
+// number of parsed svg documents and rasterized tiles per document kept around
+#define DT_IOP_WATERMARK_CACHE_DOCS 4
+#define DT_IOP_WATERMARK_CACHE_TILES 4
+// tiles larger than this are rendered for the visible region only and not cached
+#define DT_IOP_WATERMARK_CACHE_MAX_TILE (64*1024*1024)
 
 typedef enum dt_iop_watermark_base_scale_t
 {
@@ -97,6 +102,41 @@ typedef struct dt_iop_watermark_gui_data_t
 }
 dt_iop_watermark_gui_data_t;
 
+/** the watermark rendered at a given scale and sub pixel offset, premultiplied cairo argb */
+typedef struct dt_iop_watermark_tile_t
+{
+  float scale, dx, dy;
+  int width, height, stride;
+  guint8 *image;
+  gint refs;      // one for the cache, one for each pipe compositing it
+}
+dt_iop_watermark_tile_t;
+
+/** a parsed svg document after variable substitution, keyed by its checksum */
+typedef struct dt_iop_watermark_doc_t
+{
+  gchar *checksum;
+  RsvgHandle *svg;
+  RsvgDimensionData dimension;
+  GList *tiles;   // most recently used first
+}
+dt_iop_watermark_doc_t;
+
+/**
+ * shared by all pipes, so exporting a batch of images with the same watermark
+ * reads and parses the svg once and renders it once per scale.
+ */
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  // raw contents of the last loaded svg file
+  gchar *filename;
+  time_t mtime;
+  gchar *filedata;
+  GList *docs;    // most recently used first
+}
+dt_iop_watermark_global_data_t;
+
 int
 legacy_params (dt_iop_module_t *self, const void *const old_params, const int old_version, void *new_params, const int new_version)
 {
@@ -226,10 +266,28 @@ static gchar *_string_substitute(gchar *string,const gchar *search,const gchar *
   return result;
 }
 
-static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_data_t *data, const dt_image_t *image)
+// returns a copy of the contents of the svg file, from the cache unless the file changed. gd->lock must be held.
+static gchar *_watermark_get_file(dt_iop_watermark_global_data_t *gd, const gchar *filename)
 {
-  gsize length;
+  struct stat st;
+  if(g_stat(filename, &st)) return NULL;
+
+  if(!gd->filedata || strcmp(gd->filename, filename) || gd->mtime != st.st_mtime)
+  {
+    gchar *filedata = NULL;
+    if(!g_file_get_contents(filename, &filedata, NULL, NULL)) return NULL;
+    g_free(gd->filedata);
+    g_free(gd->filename);
+    gd->filedata = filedata;
+    gd->filename = g_strdup(filename);
+    gd->mtime = st.st_mtime;
+  }
+  return g_strdup(gd->filedata);
+}
 
+static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_data_t *data, const dt_image_t *image)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
   gchar *svgdoc=NULL;
   gchar configdir[DT_MAX_PATH_LEN];
   gchar datadir[DT_MAX_PATH_LEN];
@@ -271,7 +329,15 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
   time_t t = time(NULL);
   (void)localtime_r(&t, &tt_cur);
 
-  if( g_file_get_contents( filename, &svgdata, &length, NULL) )
+  dt_pthread_mutex_lock(&gd->lock);
+  svgdata = _watermark_get_file(gd, filename);
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  // no variables in there, spare the metadata lookups and the substitution passes
+  if( svgdata && !strstr(svgdata, "$(") )
+    return svgdata;
+
+  if( svgdata )
   {
     // File is loaded lets substitute strings if found...
 
@@ -580,52 +646,164 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
 }
 
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+static void _watermark_unref_tile(gpointer data)
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
+  dt_iop_watermark_tile_t *tile = (dt_iop_watermark_tile_t *)data;
+  if(!g_atomic_int_dec_and_test(&tile->refs)) return;
+  g_free(tile->image);
+  free(tile);
+}
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
-  if (!svgdoc)
+static void _watermark_free_doc(gpointer data)
+{
+  dt_iop_watermark_doc_t *doc = (dt_iop_watermark_doc_t *)data;
+  g_list_free_full(doc->tiles, _watermark_unref_tile);
+  g_object_unref(doc->svg);
+  g_free(doc->checksum);
+  free(doc);
+}
+
+// returns the parsed svg document, from the cache if it was seen before. gd->lock must be held.
+static dt_iop_watermark_doc_t *_watermark_get_doc(dt_iop_watermark_global_data_t *gd, const gchar *svgdoc)
+{
+  gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, svgdoc, -1);
+  for(GList *iter = gd->docs; iter; iter = g_list_next(iter))
   {
-    memcpy(ovoid, ivoid, (size_t)sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    dt_iop_watermark_doc_t *doc = (dt_iop_watermark_doc_t *)iter->data;
+    if(!strcmp(doc->checksum, checksum))
+    {
+      gd->docs = g_list_delete_link(gd->docs, iter);
+      gd->docs = g_list_prepend(gd->docs, doc);
+      g_free(checksum);
+      return doc;
+    }
   }
 
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
   RsvgHandle *svg = rsvg_handle_new_from_data ((const guint8 *)svgdoc,strlen (svgdoc),&error);
-  g_free (svgdoc);
   if (!svg || error)
   {
-    memcpy(ovoid, ivoid, (size_t)sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    if(error) g_error_free(error);
+    if(svg) g_object_unref(svg);
+    g_free(checksum);
+    return NULL;
   }
 
+  dt_iop_watermark_doc_t *doc = (dt_iop_watermark_doc_t *)malloc(sizeof(dt_iop_watermark_doc_t));
+  doc->checksum = checksum;
+  doc->svg = svg;
+  doc->tiles = NULL;
+  rsvg_handle_get_dimensions (svg,&doc->dimension);
+
+  gd->docs = g_list_prepend(gd->docs, doc);
+  if(g_list_length(gd->docs) > DT_IOP_WATERMARK_CACHE_DOCS)
+  {
+    GList *last = g_list_last(gd->docs);
+    _watermark_free_doc(last->data);
+    gd->docs = g_list_delete_link(gd->docs, last);
+  }
+  return doc;
+}
+
+// renders the svg at the given scale into a new width x height argb buffer, with the svg origin at (dx,dy).
+static guint8 *_watermark_render(RsvgHandle *svg, const float scale, const float dx, const float dy, const int width, const int height, int *stride)
+{
   /* setup stride for performance */
-  int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,roi_out->width);
+  *stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,width);
 
   /* create cairo memory surface */
-  guint8 *image= (guint8 *)g_malloc (stride*roi_out->height);
-  memset (image,0,(size_t)stride*roi_out->height);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data (image,CAIRO_FORMAT_ARGB32,roi_out->width,roi_out->height,stride);
+  guint8 *image = (guint8 *)g_malloc0 ((size_t)*stride*height);
+  cairo_surface_t *surface = cairo_image_surface_create_for_data (image,CAIRO_FORMAT_ARGB32,width,height,*stride);
   if (cairo_surface_status(surface)!=	CAIRO_STATUS_SUCCESS)
   {
-//   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
+    cairo_surface_destroy (surface);
     g_free (image);
-    memcpy(ovoid, ivoid, (size_t)sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    return NULL;
   }
 
   /* create cairo context and setup transformation/scale */
   cairo_t *cr = cairo_create (surface);
+  cairo_translate (cr,dx,dy);
+  cairo_scale(cr, scale, scale);
+
+  /* render svg into surface*/
+  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+  rsvg_handle_render_cairo (svg,cr);
+  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+  /* ensure that all operations on surface finishing up */
+  cairo_destroy (cr);
+  cairo_surface_flush (surface);
+  cairo_surface_destroy (surface);
+  return image;
+}
+
+// returns the rasterized watermark, from the cache if it was rendered before, or NULL if it is too large to be cached. gd->lock must be held.
+static dt_iop_watermark_tile_t *_watermark_get_tile(dt_iop_watermark_doc_t *doc, const float scale, const float dx, const float dy, const int width, const int height)
+{
+  for(GList *iter = doc->tiles; iter; iter = g_list_next(iter))
+  {
+    dt_iop_watermark_tile_t *tile = (dt_iop_watermark_tile_t *)iter->data;
+    if(tile->scale == scale && tile->dx == dx && tile->dy == dy && tile->width == width && tile->height == height)
+    {
+      doc->tiles = g_list_delete_link(doc->tiles, iter);
+      doc->tiles = g_list_prepend(doc->tiles, tile);
+      return tile;
+    }
+  }
+
+  if((size_t)cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, width)*height > DT_IOP_WATERMARK_CACHE_MAX_TILE)
+    return NULL;
+
+  dt_iop_watermark_tile_t *tile = (dt_iop_watermark_tile_t *)malloc(sizeof(dt_iop_watermark_tile_t));
+  tile->scale = scale;
+  tile->dx = dx;
+  tile->dy = dy;
+  tile->width = width;
+  tile->height = height;
+  tile->refs = 1;
+  tile->image = _watermark_render(doc->svg, scale, dx, dy, width, height, &tile->stride);
+  if(!tile->image)
+  {
+    free(tile);
+    return NULL;
+  }
+
+  doc->tiles = g_list_prepend(doc->tiles, tile);
+  if(g_list_length(doc->tiles) > DT_IOP_WATERMARK_CACHE_TILES)
+  {
+    GList *last = g_list_last(doc->tiles);
+    _watermark_unref_tile(last->data);
+    doc->tiles = g_list_delete_link(doc->tiles, last);
+  }
+  return tile;
+}
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+  const int ch = piece->colors;
+
+  /* the watermark only covers its bounding box, everything else is passed through */
+  memcpy(ovoid, ivoid, (size_t)sizeof(float)*ch*roi_out->width*roi_out->height);
+
+  /* Load svg if not loaded */
+  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
+  if (!svgdoc) return;
+
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_watermark_doc_t *doc = _watermark_get_doc(gd, svgdoc);
+  g_free (svgdoc);
+  if (!doc)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    return;
+  }
 
   /* get the dimension of svg */
-  RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions (svg,&dimension);
+  const RsvgDimensionData dimension = doc->dimension;
 
   //  width/height of current (possibly cropped) image
   const float iw = piece->buf_in.width;
@@ -724,54 +902,85 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   else if( data->alignment == 2 ||  data->alignment == 5 || data->alignment==8 )
     tx=iw-svg_width;
 
-  // translate to position
-  cairo_translate (cr,-roi_in->x,-roi_in->y);
-
   // add translation for the given value in GUI (xoffset,yoffset)
   tx += data->xoffset*wbase;
   ty += data->yoffset*hbase;
 
-  cairo_translate (cr,tx*roi_out->scale,ty*roi_out->scale);
-
-  // now set proper scale for the watermark itself
-  cairo_scale(cr, scale, scale);
+  // position of the svg origin in the output, split into whole pixels and the sub pixel
+  // offset the watermark needs to be rendered with.
+  const float ox = tx*roi_out->scale - roi_in->x;
+  const float oy = ty*roi_out->scale - roi_in->y;
+  const int x0 = floorf(ox), y0 = floorf(oy);
+  const float dx = ox - x0, dy = oy - y0;
+  const int tw = ceilf(dimension.width*scale + dx);
+  const int th = ceilf(dimension.height*scale + dy);
+
+  // visible part of the watermark
+  const int i0 = MAX(0, x0), i1 = MIN(roi_out->width, x0 + tw);
+  const int j0 = MAX(0, y0), j1 = MIN(roi_out->height, y0 + th);
+  if(i0 >= i1 || j0 >= j1)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    return;
+  }
 
-  /* render svg into surface*/
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  rsvg_handle_render_cairo (svg,cr);
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  // keep what we use alive without the lock, other pipes may evict it meanwhile
+  guint8 *image, *tmp = NULL;
+  int stride, ix, iy;
+  dt_iop_watermark_tile_t *tile = _watermark_get_tile(doc, scale, dx, dy, tw, th);
+  RsvgHandle *svg = NULL;
+  if(tile)
+    g_atomic_int_inc(&tile->refs);
+  else
+    svg = (RsvgHandle *)g_object_ref(doc->svg);
+  dt_pthread_mutex_unlock(&gd->lock);
 
-  /* ensure that all operations on surface finishing up */
-  cairo_surface_flush (surface);
+  if(tile)
+  {
+    image = tile->image;
+    stride = tile->stride;
+    ix = x0;
+    iy = y0;
+  }
+  else
+  {
+    // too large to be kept around, render the visible part only
+    image = tmp = _watermark_render(svg, scale, ox - i0, oy - j0, i1 - i0, j1 - j0, &stride);
+    g_object_unref(svg);
+    ix = i0;
+    iy = j0;
+  }
 
   /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity/100.0;
-  /*
-  #ifdef _OPENMP
-  	#pragma omp parallel for default(none) shared(roi_out, in, out,sd,opacity) schedule(static)
-  #endif
-  */
-  for(int j=0; j<roi_out->height; j++) for(int i=0; i<roi_out->width; i++)
+  if(image)
+  {
+    const float opacity = data->opacity/100.0;
+#ifdef _OPENMP
+    #pragma omp parallel for shared(roi_out, ivoid, ovoid, image, stride, ix, iy) schedule(static)
+#endif
+    for(int j=j0; j<j1; j++)
     {
-      float alpha = (sd[3]/255.0)*opacity;
-      /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0-alpha)*in[0]) + (opacity*(sd[2]/255.0));
-      out[1] = ((1.0-alpha)*in[1]) + (opacity*(sd[1]/255.0));
-      out[2] = ((1.0-alpha)*in[2]) + (opacity*(sd[0]/255.0));
-      out[3] = in[3];
-
-      out+=ch;
-      in+=ch;
-      sd+=4;
+      const float *in = (const float *)ivoid + ((size_t)j*roi_out->width + i0)*ch;
+      float *out = (float *)ovoid + ((size_t)j*roi_out->width + i0)*ch;
+      const guint8 *sd = image + (size_t)(j - iy)*stride + 4*(i0 - ix);
+      for(int i=i0; i<i1; i++)
+      {
+        float alpha = (sd[3]/255.0)*opacity;
+        /* svg uses a premultiplied alpha, so only use opacity for the blending */
+        out[0] = ((1.0-alpha)*in[0]) + (opacity*(sd[2]/255.0));
+        out[1] = ((1.0-alpha)*in[1]) + (opacity*(sd[1]/255.0));
+        out[2] = ((1.0-alpha)*in[2]) + (opacity*(sd[0]/255.0));
+
+        out+=ch;
+        in+=ch;
+        sd+=4;
+      }
     }
-
+  }
 
   /* clean up */
-  cairo_surface_destroy (surface);
-  g_object_unref (svg);
-  g_free (image);
-
+  if(tile) _watermark_unref_tile(tile);
+  g_free (tmp);
 }
 
 static void
@@ -1009,6 +1218,28 @@ void init(dt_iop_module_t *module)
   memcpy(module->default_params, &tmp, sizeof(dt_iop_watermark_params_t));
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  module->data = gd;
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->filename = NULL;
+  gd->mtime = 0;
+  gd->filedata = NULL;
+  gd->docs = NULL;
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->docs, _watermark_free_doc);
+  g_free(gd->filedata);
+  g_free(gd->filename);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void cleanup(dt_iop_module_t *module)
 {
   free(module->gui_data);
@@ -596,6 +596,8 @@ dt_lib_load_modules ()
   if(!dir) return 1;
   const int name_offset = strlen(SHARED_MODULE_PREFIX),
             name_end    = strlen(SHARED_MODULE_PREFIX) + strlen(SHARED_MODULE_SUFFIX);
+  // write all presets in one go
+  dt_database_start_transaction(darktable.db);
   while((d_name = g_dir_read_name(dir)))
   {
     // get lib*.(so|dll)
@@ -621,6 +623,7 @@ dt_lib_load_modules ()
       module->init_key_accels(module);
 
   }
+  dt_database_release_transaction(darktable.db);
   g_dir_close(dir);
 
   darktable.lib->plugins = res;
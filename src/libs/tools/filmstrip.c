@@ -724,7 +724,6 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
 
   const int col_start = max_cols/2 - strip->offset;
   const int empty_edge = (width - (max_cols * wd))/2;
-  int step_res = SQLITE_ROW;
 
   sqlite3_stmt *stmt = NULL;
 
@@ -754,6 +753,16 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset - max_cols/2);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_cols);
 
+  // fetch the ids first, to load the decorations of all thumbnails in one go:
+  const int first_col = MAX(0, col_start);
+  int32_t imgids[max_cols];
+  int num_imgids = 0;
+  while(first_col + num_imgids < max_cols && sqlite3_step(stmt) == SQLITE_ROW)
+    imgids[num_imgids++] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  dt_view_image_meta_load(darktable.view_manager, imgids, num_imgids);
+  dt_view_prefetch_thumbnails(darktable.view_manager, MAX(0, offset - max_cols/2), max_cols, 1,
+                              dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, 0.8*wd, 0.8*ht));
 
   cairo_save(cr);
   cairo_translate(cr, empty_edge, 0.0f);
@@ -765,14 +774,9 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
       continue;
     }
 
-    if(step_res != SQLITE_DONE)
-    {
-      step_res = sqlite3_step(stmt);
-    }
-
-    if(step_res == SQLITE_ROW)
+    if(col - first_col < num_imgids)
     {
-      int id = sqlite3_column_int(stmt, 0);
+      int id = imgids[col - first_col];
       // set mouse over id
       if(seli == col)
       {
@@ -786,16 +790,10 @@ static gboolean _lib_filmstrip_expose_callback(GtkWidget *widget, GdkEventExpose
       dt_view_image_expose(&(strip->image_over), id, cr, wd, ht, max_cols, img_pointerx, img_pointery, FALSE);
       cairo_restore(cr);
     }
-    else if (step_res == SQLITE_DONE)
-    {
-      /* do nothing, just add some empty thumb frames */
-    }
-    else goto failure;
+    /* else: do nothing, just add some empty thumb frames */
     cairo_translate(cr, wd, 0.0f);
   }
-failure:
   cairo_restore(cr);
-  sqlite3_finalize(stmt);
 
   if(darktable.gui->center_tooltip == 1) // set in this round
   {
@@ -18,12 +18,19 @@
 #include "lua/database.h"
 #include "lua/image.h"
 #include "lua/film.h"
+#include "lua/tags.h"
 #include "lua/types.h"
+#include "common/colorlabels.h"
 #include "common/debug.h"
 #include "common/darktable.h"
 #include "common/grealpath.h"
 #include "common/image.h"
 #include "common/film.h"
+#include "common/tags.h"
+#include "control/conf.h"
+#include "control/control.h"
+#include "control/jobs/control_jobs.h"
+#include "metadata_gen.h"
 #include <errno.h>
 
 /***********************************************************************
@@ -170,6 +177,436 @@ static int database_index(lua_State*L)
   return 1;
 }
 
+/***********************************************************************
+  bulk access: read or write some fields of many images in one go
+
+  all the sql runs without the lua lock held. images are passed through
+  memory.lua_images, which is only used inside a transaction taken with
+  dt_database_start_transaction().
+  arguments are checked before anything is allocated, as the luaL_check*
+  calls don't return on error.
+ **********************************************************************/
+
+typedef enum
+{
+  BULK_INT,
+  BULK_DOUBLE,
+  BULK_STRING,
+  BULK_IMAGE,
+  BULK_FILM,
+  BULK_RATING,
+  BULK_LOCAL_COPY,
+  BULK_TAGS,
+  BULK_COLOR_LABELS
+} bulk_type_t;
+
+typedef struct bulk_field_t
+{
+  const char *name;
+  const char *column; // expression on images i, film_rolls f
+  bulk_type_t type;
+  int metadata;       // key in meta_data instead of column, or -1
+}
+bulk_field_t;
+
+static const bulk_field_t bulk_fields[] =
+{
+  { "filename", "i.filename", BULK_STRING, -1 },
+  { "path", "f.folder", BULK_STRING, -1 },
+  { "film", "i.film_id", BULK_FILM, -1 },
+  { "group_leader", "i.group_id", BULK_IMAGE, -1 },
+  { "width", "i.width", BULK_INT, -1 },
+  { "height", "i.height", BULK_INT, -1 },
+  { "rating", "i.flags", BULK_RATING, -1 },
+  { "local_copy", "i.flags", BULK_LOCAL_COPY, -1 },
+  { "exif_maker", "i.maker", BULK_STRING, -1 },
+  { "exif_model", "i.model", BULK_STRING, -1 },
+  { "exif_lens", "i.lens", BULK_STRING, -1 },
+  { "exif_exposure", "i.exposure", BULK_DOUBLE, -1 },
+  { "exif_aperture", "i.aperture", BULK_DOUBLE, -1 },
+  { "exif_iso", "i.iso", BULK_DOUBLE, -1 },
+  { "exif_focal_length", "i.focal_length", BULK_DOUBLE, -1 },
+  { "exif_focus_distance", "i.focus_distance", BULK_DOUBLE, -1 },
+  { "exif_crop", "i.crop", BULK_DOUBLE, -1 },
+  { "exif_datetime_taken", "i.datetime_taken", BULK_STRING, -1 },
+  { "longitude", "i.longitude", BULK_DOUBLE, -1 },
+  { "latitude", "i.latitude", BULK_DOUBLE, -1 },
+  { "creator", NULL, BULK_STRING, DT_METADATA_XMP_DC_CREATOR },
+  { "publisher", NULL, BULK_STRING, DT_METADATA_XMP_DC_PUBLISHER },
+  { "title", NULL, BULK_STRING, DT_METADATA_XMP_DC_TITLE },
+  { "description", NULL, BULK_STRING, DT_METADATA_XMP_DC_DESCRIPTION },
+  { "rights", NULL, BULK_STRING, DT_METADATA_XMP_DC_RIGHTS },
+  // tag names, separated by ?1 (see below)
+  { "tags", "(select group_concat(tg.name, ?1) from tagged_images ti, tags tg where ti.imgid = i.id and tg.id = ti.tagid)",
+    BULK_TAGS, -1 },
+  { "color_labels", "(select sum(1 << c.color) from color_labels c where c.imgid = i.id)", BULK_COLOR_LABELS, -1 },
+  { NULL, NULL, 0, -1 }
+};
+
+// separates the tag names in one column, can't be part of a tag name.
+#define BULK_TAG_SEPARATOR "\x1f"
+
+typedef struct bulk_value_t
+{
+  int null;
+  int i;
+  double d;
+  char *s;
+}
+bulk_value_t;
+
+static int bulk_find_field(const char *name)
+{
+  for(int k=0; bulk_fields[k].name; k++)
+    if(!strcmp(bulk_fields[k].name, name)) return k;
+  return -1;
+}
+
+// read a table of images at index. needs the lua lock.
+static GArray *bulk_get_images(lua_State *L, int index)
+{
+  luaL_checktype(L, index, LUA_TTABLE);
+  const int num = luaL_len(L, index);
+  // luaA_to raises on anything that's not an image, so go through memory owned by lua first
+  dt_lua_image_t *buf = lua_newuserdata(L, sizeof(dt_lua_image_t) * MAX(num, 1));
+  for(int k=1; k<=num; k++)
+  {
+    lua_rawgeti(L, index, k);
+    luaA_to(L, dt_lua_image_t, buf + k-1, -1);
+    lua_pop(L, 1);
+  }
+  GArray *imgids = g_array_sized_new(FALSE, FALSE, sizeof(int), num);
+  g_array_append_vals(imgids, buf, num);
+  lua_pop(L, 1);
+  return imgids;
+}
+
+// fill memory.lua_images, all images of the db if imgids is NULL. needs a transaction.
+static void bulk_set_images(GArray *imgids)
+{
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.lua_images", NULL, NULL, NULL);
+  if(!imgids)
+  {
+    DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                          "insert into memory.lua_images (imgid) select id from images order by id", NULL, NULL, NULL);
+    return;
+  }
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "insert into memory.lua_images (imgid) values (?1)", -1, &stmt, NULL);
+  for(guint k=0; k<imgids->len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(imgids, int, k));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+}
+
+static void bulk_push_value(lua_State *L, const bulk_field_t *field, const bulk_value_t *v)
+{
+  if(v->null && field->type != BULK_TAGS && field->type != BULK_COLOR_LABELS && field->type != BULK_STRING)
+  {
+    lua_pushnil(L);
+    return;
+  }
+  switch(field->type)
+  {
+    case BULK_INT:
+      lua_pushinteger(L, v->i);
+      break;
+    case BULK_DOUBLE:
+      lua_pushnumber(L, v->d);
+      break;
+    case BULK_STRING:
+      lua_pushstring(L, v->s ? v->s : "");
+      break;
+    case BULK_IMAGE:
+      luaA_push(L, dt_lua_image_t, &v->i);
+      break;
+    case BULK_FILM:
+      luaA_push(L, dt_lua_film_t, &v->i);
+      break;
+    case BULK_RATING:
+      {
+        // same as image.rating
+        int score = v->i & 0x7;
+        if(score > 6) score = 5;
+        if(score == 6) score = -1;
+        lua_pushinteger(L, score);
+        break;
+      }
+    case BULK_LOCAL_COPY:
+      lua_pushboolean(L, v->i & DT_IMAGE_LOCAL_COPY);
+      break;
+    case BULK_TAGS:
+      {
+        lua_newtable(L);
+        if(v->s)
+        {
+          gchar **names = g_strsplit(v->s, BULK_TAG_SEPARATOR, -1);
+          for(int k=0; names[k]; k++)
+          {
+            lua_pushstring(L, names[k]);
+            lua_rawseti(L, -2, k+1);
+          }
+          g_strfreev(names);
+        }
+        break;
+      }
+    case BULK_COLOR_LABELS:
+      {
+        lua_newtable(L);
+        int n = 0;
+        for(int k=0; dt_colorlabels_name[k]; k++)
+          if(v->i & (1<<k))
+          {
+            lua_pushstring(L, dt_colorlabels_name[k]);
+            lua_rawseti(L, -2, ++n);
+          }
+        break;
+      }
+  }
+}
+
+static int database_get_fields(lua_State *L)
+{
+  // get_fields({ "field", ... } [, { image, ... }]) -> { image = { ... }, field = { ... }, ... }
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const int nf = luaL_len(L, 1);
+  int fields[nf+1];
+  for(int k=0; k<nf; k++)
+  {
+    lua_rawgeti(L, 1, k+1);
+    const char *name = luaL_checkstring(L, -1);
+    fields[k] = bulk_find_field(name);
+    if(fields[k] < 0) return luaL_error(L, "unknown image field : %s", name);
+    lua_pop(L, 1);
+  }
+  GArray *imgids = NULL;
+  if(!lua_isnoneornil(L, 2)) imgids = bulk_get_images(L, 2);
+
+  // one query for all fields, in the order of the images:
+  GString *query = g_string_new("select t.imgid");
+  for(int k=0; k<nf; k++)
+  {
+    const bulk_field_t *field = bulk_fields + fields[k];
+    if(field->metadata >= 0)
+      g_string_append_printf(query, ", (select value from meta_data m where m.id = i.id and m.key = %d)", field->metadata);
+    else
+      g_string_append_printf(query, ", %s", field->column);
+  }
+  g_string_append(query, " from memory.lua_images t, images i, film_rolls f "
+                         "where i.id = t.imgid and f.id = i.film_id order by t.rowid");
+
+  GArray *values = g_array_new(FALSE, TRUE, sizeof(bulk_value_t));
+  int rows = 0;
+
+  dt_lua_unlock(false);
+  dt_database_start_transaction(darktable.db);
+  bulk_set_images(imgids);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query->str, -1, &stmt, NULL);
+  if(strstr(query->str, "?1")) DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, BULK_TAG_SEPARATOR, -1, SQLITE_STATIC);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    for(int k=0; k<=nf; k++)
+    {
+      bulk_value_t v = { 0 };
+      v.null = sqlite3_column_type(stmt, k) == SQLITE_NULL;
+      v.i = sqlite3_column_int(stmt, k);
+      if(k > 0 && bulk_fields[fields[k-1]].type == BULK_DOUBLE) v.d = sqlite3_column_double(stmt, k);
+      if(k > 0 && (bulk_fields[fields[k-1]].type == BULK_STRING || bulk_fields[fields[k-1]].type == BULK_TAGS) && !v.null)
+        v.s = g_strdup((const char *)sqlite3_column_text(stmt, k));
+      g_array_append_val(values, v);
+    }
+    rows++;
+  }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "delete from memory.lua_images", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
+  dt_lua_lock();
+
+  lua_newtable(L);
+  lua_createtable(L, rows, 0);
+  for(int r=0; r<rows; r++)
+  {
+    const bulk_value_t *v = &g_array_index(values, bulk_value_t, r*(nf+1));
+    luaA_push(L, dt_lua_image_t, &v->i);
+    lua_rawseti(L, -2, r+1);
+  }
+  lua_setfield(L, -2, "image");
+  for(int k=0; k<nf; k++)
+  {
+    const bulk_field_t *field = bulk_fields + fields[k];
+    lua_createtable(L, rows, 0);
+    for(int r=0; r<rows; r++)
+    {
+      bulk_value_t *v = &g_array_index(values, bulk_value_t, r*(nf+1) + k+1);
+      bulk_push_value(L, field, v);
+      lua_rawseti(L, -2, r+1);
+      g_free(v->s);
+    }
+    lua_setfield(L, -2, field->name);
+  }
+
+  g_array_free(values, TRUE);
+  g_string_free(query, TRUE);
+  if(imgids) g_array_free(imgids, TRUE);
+  return 1;
+}
+
+// check that the field key of the table at index is nil or a table of tags or tag names. needs the lua lock.
+static void bulk_check_tags(lua_State *L, int index, const char *key)
+{
+  lua_getfield(L, index, key);
+  if(!lua_isnil(L, -1))
+  {
+    luaL_checktype(L, -1, LUA_TTABLE);
+    const int num = luaL_len(L, -1);
+    for(int k=1; k<=num; k++)
+    {
+      lua_rawgeti(L, -1, k);
+      if(!luaL_testudata(L, -1, "dt_lua_tag_t")) luaL_checkstring(L, -1);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+}
+
+// read the tags of a table checked by bulk_check_tags(). needs the lua lock.
+static void bulk_get_tags(lua_State *L, int index, const char *key, GArray *tagids, GPtrArray *names)
+{
+  lua_getfield(L, index, key);
+  if(!lua_isnil(L, -1))
+  {
+    const int num = luaL_len(L, -1);
+    for(int k=1; k<=num; k++)
+    {
+      lua_rawgeti(L, -1, k);
+      if(luaL_testudata(L, -1, "dt_lua_tag_t"))
+      {
+        dt_lua_tag_t tagid;
+        luaA_to(L, dt_lua_tag_t, &tagid, -1);
+        g_array_append_val(tagids, tagid);
+      }
+      else
+        g_ptr_array_add(names, g_strdup(lua_tostring(L, -1)));
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+}
+
+static int database_set_fields(lua_State *L)
+{
+  // set_fields({ image, ... }, { creator = "...", ..., attach_tags = { ... }, detach_tags = { ... } })
+  luaL_checktype(L, 2, LUA_TTABLE);
+  for(int k=0; bulk_fields[k].name; k++)
+  {
+    if(bulk_fields[k].metadata < 0) continue;
+    lua_getfield(L, 2, bulk_fields[k].name);
+    if(!lua_isnil(L, -1)) luaL_checkstring(L, -1);
+    lua_pop(L, 1);
+  }
+  bulk_check_tags(L, 2, "attach_tags");
+  bulk_check_tags(L, 2, "detach_tags");
+  GArray *imgids = bulk_get_images(L, 1);
+
+  // nothing raises from here on
+  int keys[sizeof(bulk_fields) / sizeof(bulk_fields[0])];
+  gchar *metadata[sizeof(bulk_fields) / sizeof(bulk_fields[0])];
+  int nm = 0;
+  for(int k=0; bulk_fields[k].name; k++)
+  {
+    if(bulk_fields[k].metadata < 0) continue;
+    lua_getfield(L, 2, bulk_fields[k].name);
+    if(!lua_isnil(L, -1))
+    {
+      keys[nm] = bulk_fields[k].metadata;
+      metadata[nm++] = g_strdup(lua_tostring(L, -1));
+    }
+    lua_pop(L, 1);
+  }
+  GArray *attach = g_array_new(FALSE, FALSE, sizeof(guint)), *detach = g_array_new(FALSE, FALSE, sizeof(guint));
+  GPtrArray *attach_names = g_ptr_array_new_with_free_func(g_free), *detach_names = g_ptr_array_new_with_free_func(g_free);
+  bulk_get_tags(L, 2, "attach_tags", attach, attach_names);
+  bulk_get_tags(L, 2, "detach_tags", detach, detach_names);
+
+  dt_lua_unlock(false);
+  sqlite3 *db = dt_database_get(darktable.db);
+  sqlite3_stmt *stmt;
+  dt_database_start_transaction(darktable.db);
+  bulk_set_images(imgids);
+
+  for(int k=0; k<nm; k++)
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "delete from meta_data where key = ?1 and id in (select imgid from memory.lua_images)",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keys[k]);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if(metadata[k][0] == '\0') continue;
+    DT_DEBUG_SQLITE3_PREPARE_V2(db, "insert into meta_data (id, key, value) select imgid, ?1, ?2 from memory.lua_images",
+                                -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, keys[k]);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, metadata[k], -1, SQLITE_STATIC);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  }
+
+  // tag names are created when attached, and ignored when detached but unknown:
+  for(guint k=0; k<attach_names->len; k++)
+  {
+    guint tagid;
+    if(dt_tag_new(g_ptr_array_index(attach_names, k), &tagid)) g_array_append_val(attach, tagid);
+  }
+  for(guint k=0; k<detach_names->len; k++)
+  {
+    guint tagid;
+    if(dt_tag_exists(g_ptr_array_index(detach_names, k), &tagid)) g_array_append_val(detach, tagid);
+  }
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "insert or replace into tagged_images (imgid, tagid) select imgid, ?1 from memory.lua_images",
+                              -1, &stmt, NULL);
+  for(guint k=0; k<attach->len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(attach, guint, k));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_PREPARE_V2(db, "delete from tagged_images where tagid = ?1 and imgid in (select imgid from memory.lua_images)",
+                              -1, &stmt, NULL);
+  for(guint k=0; k<detach->len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, g_array_index(detach, guint, k));
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+
+  DT_DEBUG_SQLITE3_EXEC(db, "delete from memory.lua_images", NULL, NULL, NULL);
+  dt_database_release_transaction(darktable.db);
+
+  const int tags_changed = attach->len + detach->len > 0;
+  if(imgids->len && (nm || tags_changed) && dt_conf_get_bool("write_sidecar_files"))
+  {
+    GList *imgs = NULL;
+    for(int k=imgids->len-1; k>=0; k--) imgs = g_list_prepend(imgs, GINT_TO_POINTER(g_array_index(imgids, int, k)));
+    dt_control_write_sidecar_files_list(imgs);
+  }
+  if(tags_changed && darktable.gui) dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+  dt_lua_lock();
+
+  for(int k=0; k<nm; k++) g_free(metadata[k]);
+  g_array_free(attach, TRUE);
+  g_array_free(detach, TRUE);
+  g_ptr_array_free(attach_names, TRUE);
+  g_ptr_array_free(detach_names, TRUE);
+  g_array_free(imgids, TRUE);
+  return 0;
+}
+
 int dt_lua_init_database(lua_State * L)
 {
 
@@ -190,6 +627,10 @@ int dt_lua_init_database(lua_State * L)
   dt_lua_register_type_callback_stack_typeid(L,type_id,"move_image");
   lua_pushcfunction(L,dt_lua_copy_image);
   dt_lua_register_type_callback_stack_typeid(L,type_id,"copy_image");
+  lua_pushcfunction(L,database_get_fields);
+  dt_lua_register_type_callback_stack_typeid(L,type_id,"get_fields");
+  lua_pushcfunction(L,database_set_fields);
+  dt_lua_register_type_callback_stack_typeid(L,type_id,"set_fields");
 
   return 0;
 }
@@ -18,6 +18,7 @@
 #include "lua/luastorage.h"
 #include "lua/image.h"
 #include <stdio.h>
+#include <string.h>
 #include <common/darktable.h>
 #include "common/imageio_module.h"
 #include "common/file_location.h"
@@ -31,11 +32,32 @@ typedef struct {
   GList* imgids;
   GList* file_names;
   gboolean data_created;
+  // export threads only touch the lists and the batch under this mutex
+  dt_pthread_mutex_t mutex;
+  GList* pending;     // lua_storage_pending_t waiting for the store callback, newest first
+  gboolean draining;  // one export thread is currently feeding pending to lua
+  gboolean failed;    // a batched store call asked to cancel the export
 } lua_storage_t;
 
+typedef struct {
+  int imgid;
+  char * file_name;
+  int num;
+  dt_imageio_module_data_t *fdata; // copy of the export thread's format parameters for this image
+} lua_storage_pending_t;
+
+static void free_pending(gpointer data)
+{
+  lua_storage_pending_t *p = (lua_storage_pending_t*)data;
+  free(p->fdata);
+  free(p);
+}
+
 typedef struct {
   char * name;
   GList * supported_formats;
+  gboolean has_store;
+  gboolean batch_store;
 } lua_storage_gui_t;
 
 static const char* name_wrapper(const struct dt_imageio_module_storage_t *self)
@@ -56,6 +78,76 @@ static int default_dimension_wrapper    (struct dt_imageio_module_storage_t *sel
   return 0;
 };
 
+static int call_store(struct dt_imageio_module_storage_t *self,struct dt_imageio_module_data_t *self_data, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const char *complete_name, const int num, const int total, const gboolean high_quality)
+{
+  // needs the lua lock
+  lua_storage_t *d = (lua_storage_t*) self_data;
+  lua_State *L =darktable.lua_state.state;
+  if(!d->data_created) {
+    lua_pushlightuserdata(L,d);
+    lua_newtable(L);
+    lua_settable(L,LUA_REGISTRYINDEX);
+    d->data_created = true;
+  }
+
+  lua_getfield(L,LUA_REGISTRYINDEX,"dt_lua_storages");
+  lua_getfield(L,-1,self->plugin_name);
+  lua_getfield(L,-1,"store");
+
+  if(lua_isnil(L,-1)) {
+    lua_pop(L,3);
+    return 1;
+  }
+
+  luaA_push_typeid(L,self->parameter_lua_type,self_data);
+  luaA_push(L,dt_lua_image_t,&imgid);
+  luaA_push_typeid(L,format->parameter_lua_type,fdata);
+  lua_pushstring(L,complete_name);
+  lua_pushnumber(L,num);
+  lua_pushnumber(L,total);
+  lua_pushboolean(L,high_quality);
+  lua_pushlightuserdata(L,self_data);
+  lua_gettable(L,LUA_REGISTRYINDEX);
+  dt_lua_do_chunk(L,8,1);
+  int result = lua_toboolean(L,-1);
+  lua_pop(L,3);
+  return result;
+}
+
+static void drain_store(struct dt_imageio_module_storage_t *self,struct dt_imageio_module_data_t *self_data, dt_imageio_module_format_t *format, const int total, const gboolean high_quality)
+{
+  // called by the one thread that set d->draining. the other export threads keep
+  // queueing images, we hand them to lua in batches, one lock per batch, until
+  // nothing is left. that way only this thread waits for the lua lock.
+  lua_storage_t *d = (lua_storage_t*) self_data;
+  while(1)
+  {
+    dt_pthread_mutex_lock(&d->mutex);
+    GList *batch = g_list_reverse(d->pending);
+    d->pending = NULL;
+    if(!batch) d->draining = FALSE;
+    dt_pthread_mutex_unlock(&d->mutex);
+    if(!batch) return;
+
+    int failed = 0;
+    gboolean has_lock = dt_lua_lock();
+    for(GList *it = batch; it; it = g_list_next(it))
+    {
+      lua_storage_pending_t *p = (lua_storage_pending_t*)it->data;
+      if(!failed) failed = call_store(self, self_data, p->imgid, format, p->fdata, p->file_name, p->num, total, high_quality);
+    }
+    dt_lua_unlock(has_lock);
+    g_list_free_full(batch, free_pending);
+
+    if(failed)
+    {
+      dt_pthread_mutex_lock(&d->mutex);
+      d->failed = TRUE;
+      dt_pthread_mutex_unlock(&d->mutex);
+    }
+  }
+}
+
 static int store_wrapper(struct dt_imageio_module_storage_t *self,struct dt_imageio_module_data_t *self_data, const int imgid, dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int num, const int total, const gboolean high_quality)
 {
   /* construct a temporary file name */
@@ -71,56 +163,50 @@ static int store_wrapper(struct dt_imageio_module_storage_t *self,struct dt_imag
   g_strlcpy( end, format->extension(fdata), sizeof(dirname)-(end-dirname));
 
   gchar* complete_name = g_build_filename( tmpdir, filename, (char *)NULL );
+  g_free(filename);
 
   if(dt_imageio_export(imgid, complete_name, format, fdata, high_quality,FALSE,self,self_data) != 0)
   {
     fprintf(stderr, "[%s] could not export to file: `%s'!\n", self->name(self),complete_name);
     g_free(complete_name);
-    g_free(filename);
     return 1;
   }
 
   lua_storage_t *d = (lua_storage_t*) self_data;
+  lua_storage_gui_t *gui = (lua_storage_gui_t*)self->gui_data;
+  dt_pthread_mutex_lock(&d->mutex);
   d->imgids = g_list_prepend(d->imgids,(void*)(intptr_t)imgid);
   d->file_names = g_list_prepend(d->file_names,complete_name);
-
-  gboolean has_lock = dt_lua_lock();
-  if(!d->data_created) {
-    lua_pushlightuserdata(darktable.lua_state.state,d);
-    lua_newtable(darktable.lua_state.state);
-    lua_settable(darktable.lua_state.state,LUA_REGISTRYINDEX);
-    d->data_created = true;
+  if(!gui->has_store) {
+    // nothing to do in lua before finalize
+    dt_pthread_mutex_unlock(&d->mutex);
+    return 0;
   }
 
-
-
-  lua_State *L =darktable.lua_state.state;
-
-  lua_getfield(L,LUA_REGISTRYINDEX,"dt_lua_storages");
-  lua_getfield(L,-1,self->plugin_name);
-  lua_getfield(L,-1,"store");
-
-  if(lua_isnil(L,-1)) {
-    lua_pop(L,3);
-    dt_lua_unlock(has_lock);
-    g_free(filename);
-    return 1;
+  if(gui->batch_store) {
+    lua_storage_pending_t *p = malloc(sizeof(lua_storage_pending_t));
+    p->imgid = imgid;
+    p->file_name = complete_name; // owned by d->file_names
+    p->num = num;
+    // fdata belongs to the export thread that queued the image and holds this image's size
+    const size_t fdata_size = luaA_type_size(format->parameter_lua_type);
+    p->fdata = malloc(fdata_size);
+    memcpy(p->fdata, fdata, fdata_size);
+    d->pending = g_list_prepend(d->pending,p);
+    const gboolean drain = !d->draining;
+    d->draining = TRUE;
+    dt_pthread_mutex_unlock(&d->mutex);
+    if(drain) drain_store(self, self_data, format, total, high_quality);
+    dt_pthread_mutex_lock(&d->mutex);
+    const int result = d->failed;
+    dt_pthread_mutex_unlock(&d->mutex);
+    return result;
   }
+  dt_pthread_mutex_unlock(&d->mutex);
 
-  luaA_push_typeid(L,self->parameter_lua_type,self_data);
-  luaA_push(L,dt_lua_image_t,&imgid);
-  luaA_push_typeid(L,format->parameter_lua_type,fdata);
-  lua_pushstring(L,complete_name);
-  lua_pushnumber(L,num);
-  lua_pushnumber(L,total);
-  lua_pushboolean(L,high_quality);
-  lua_pushlightuserdata(L,self_data);
-  lua_gettable(L,LUA_REGISTRYINDEX);
-  dt_lua_do_chunk(L,8,1);
-  int result = lua_toboolean(L,-1);
-  lua_pop(L,3);
+  gboolean has_lock = dt_lua_lock();
+  int result = call_store(self, self_data, imgid, format, fdata, complete_name, num, total, high_quality);
   dt_lua_unlock(has_lock);
-  g_free(filename);
   return result;
 
 }
@@ -196,6 +282,8 @@ static void finalize_store_wrapper (struct dt_imageio_module_storage_t *self, dt
 
   luaA_push_typeid(L,self->parameter_lua_type,data);
 
+  // all store calls have returned by now, and the thread draining the batches
+  // only returns once nothing is pending, so every image went through store.
   lua_storage_t *d = (lua_storage_t*) data;
   GList* imgids =d->imgids;
   GList* file_names = d->file_names;
@@ -231,6 +319,10 @@ static void* get_params_wrapper   (struct dt_imageio_module_storage_t *self)
   d->imgids = NULL;
   d->file_names = NULL;
   d->data_created = false;
+  dt_pthread_mutex_init(&d->mutex,NULL);
+  d->pending = NULL;
+  d->draining = FALSE;
+  d->failed = FALSE;
   return d;
 }
 
@@ -243,6 +335,8 @@ static int32_t free_param_wrapper_job(struct dt_job_t *job)
   lua_storage_t *d = ((free_param_wrapper_data*) job->param)->data;
   g_list_free(d->imgids);
   g_list_free_full(d->file_names,free);
+  g_list_free_full(d->pending,free_pending);
+  dt_pthread_mutex_destroy(&d->mutex);
   if(d->data_created) {
     gboolean has_lock = dt_lua_lock();
     lua_pushlightuserdata(darktable.lua_state.state,d);
@@ -299,7 +393,7 @@ static dt_imageio_module_storage_t ref_storage =
 
 static int register_storage(lua_State *L)
 {
-  lua_settop(L,6);
+  lua_settop(L,7);
   lua_getfield(L,LUA_REGISTRYINDEX,"dt_lua_storages");
   lua_newtable(L);
 
@@ -318,13 +412,19 @@ static int register_storage(lua_State *L)
   lua_setfield(L,-2,"name");
   data->name = strdup(name);
   data->supported_formats = NULL;
+  data->has_store = FALSE;
 
   if(!lua_isnoneornil(L,3)) {
     luaL_checktype(L,3,LUA_TFUNCTION);
     lua_pushvalue(L,3);
     lua_setfield(L,-2,"store");
+    data->has_store = TRUE;
   }
 
+  // store calls may be queued and run in batches: export threads don't wait for each
+  // other in the lua lock, but a store call can't cancel the image it was called for.
+  data->batch_store = lua_toboolean(L,7);
+
   if(lua_isnil(L,4) )
   {
     storage->finalize_store = NULL;
@@ -0,0 +1,191 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// define the few dt helpers, so we don't need to include the rest of dt:
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+static inline void *dt_alloc_align(size_t a, size_t s)
+{
+  void *p = NULL;
+  return posix_memalign(&p, a, s) ? NULL : p;
+}
+#define dt_free_align(A) free(A)
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define CLAMPS(A, L, H) ((A) > (L) ? ((A) < (H) ? (A) : (H)) : (L))
+#ifdef _OPENMP
+#  include <omp.h>
+#  define dt_get_num_threads() omp_get_max_threads()
+#  define dt_get_thread_num() omp_get_thread_num()
+#else
+#  define dt_get_num_threads() 1
+#  define dt_get_thread_num() 0
+#  define omp_set_num_threads(N)
+#  define omp_get_num_procs() 1
+#endif
+
+// accuracy check against a plain serial version, and thread scaling of the bilateral grid.
+#include "common/bilateral.h"
+
+static double
+wtime()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+// straight forward single threaded splat, blur and slice, as the grid used to do it.
+static void
+reference_splat(dt_bilateral_t *b, const float *in)
+{
+  for(int j=0; j<b->height; j++) for(int i=0; i<b->width; i++)
+  {
+    float x, y, z;
+    image_to_grid(b, i, j, in[4*((size_t)j*b->width+i)], &x, &y, &z);
+    const int xi = MIN((int)x, b->size_x-2), yi = MIN((int)y, b->size_y-2), zi = MIN((int)z, b->size_z-2);
+    const float xf = x - xi, yf = y - yi, zf = z - zi;
+    for(int k=0; k<8; k++)
+      b->buf[xi + (k&1) + b->size_x*(yi + !!(k&2) + b->size_y*(zi + !!(k&4)))] +=
+        ((k&1)?xf:(1.0f-xf)) * ((k&2)?yf:(1.0f-yf)) * ((k&4)?zf:(1.0f-zf)) * 100.0f/(b->sigma_s*b->sigma_s);
+  }
+}
+
+static void
+reference_blur_line(float *buf, const size_t stride, const int n, const float w0, const float w1, const float w2, const float s)
+{
+  float tmp[n+4];
+  tmp[0] = tmp[1] = tmp[n+2] = tmp[n+3] = 0.0f;
+  for(int i=0; i<n; i++) tmp[i+2] = buf[i*stride];
+  for(int i=0; i<n; i++) buf[i*stride] = w0*tmp[i+2] + w1*(tmp[i+3] + s*tmp[i+1]) + w2*(tmp[i+4] + s*tmp[i]);
+}
+
+static void
+reference_blur(dt_bilateral_t *b)
+{
+  const size_t ox = 1, oy = b->size_x, oz = b->size_x*b->size_y;
+  for(int z=0; z<b->size_z; z++) for(int y=0; y<b->size_y; y++)
+    reference_blur_line(b->buf + y*oy + z*oz, ox, b->size_x, 6.f/16.f, 4.f/16.f, 1.f/16.f, 1.0f);
+  for(int z=0; z<b->size_z; z++) for(int x=0; x<b->size_x; x++)
+    reference_blur_line(b->buf + x*ox + z*oz, oy, b->size_y, 6.f/16.f, 4.f/16.f, 1.f/16.f, 1.0f);
+  for(int y=0; y<b->size_y; y++) for(int x=0; x<b->size_x; x++)
+    reference_blur_line(b->buf + x*ox + y*oy, oz, b->size_z, 0.0f, 4.f/16.f, 2.f/16.f, -1.0f);
+}
+
+static void
+reference_slice(const dt_bilateral_t *b, const float *in, float *out, const float detail)
+{
+  const float norm = -detail * b->sigma_r * 0.04f;
+  for(int j=0; j<b->height; j++) for(int i=0; i<b->width; i++)
+  {
+    const size_t index = 4*((size_t)j*b->width+i);
+    float x, y, z;
+    image_to_grid(b, i, j, in[index], &x, &y, &z);
+    const int xi = MIN((int)x, b->size_x-2), yi = MIN((int)y, b->size_y-2), zi = MIN((int)z, b->size_z-2);
+    const float xf = x - xi, yf = y - yi, zf = z - zi;
+    float L = 0.0f;
+    for(int k=0; k<8; k++)
+      L += b->buf[xi + (k&1) + b->size_x*(yi + !!(k&2) + b->size_y*(zi + !!(k&4)))] *
+           ((k&1)?xf:(1.0f-xf)) * ((k&2)?yf:(1.0f-yf)) * ((k&4)?zf:(1.0f-zf));
+    out[index] = MAX(0.0f, in[index] + norm*L);
+  }
+}
+
+int main(int argc, char *arg[])
+{
+  const int wd = argc > 1 ? atoi(arg[1]) : 4000;
+  const int ht = argc > 2 ? atoi(arg[2]) : 3000;
+  const int max_threads = argc > 3 ? atoi(arg[3]) : 64;
+  const float sigma_s = 16.0f, sigma_r = 8.0f, detail = 1.0f;
+  const int runs = 3;
+
+  float *in = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  float *out = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  float *ref = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  srand(42);
+  // smooth gradients and some noise, so the grid is not uniformly filled:
+  for(int j=0; j<ht; j++) for(int i=0; i<wd; i++)
+  {
+    const size_t k = 4*((size_t)j*wd+i);
+    in[k] = 50.0f + 40.0f*sinf(i*0.003f)*cosf(j*0.005f) + 10.0f*rand()/(float)RAND_MAX;
+    in[k+1] = in[k+2] = in[k+3] = 0.5f;
+  }
+
+  // accuracy against the serial reference, splatting straight into the grid and through slabs:
+  for(int threads=1; threads<=max_threads; threads*=max_threads)
+  {
+    omp_set_num_threads(threads);
+    dt_bilateral_t *b = dt_bilateral_init(wd, ht, sigma_s, sigma_r);
+    reference_splat(b, in);
+    reference_blur(b);
+    reference_slice(b, in, ref, detail);
+    dt_bilateral_free(b);
+    b = dt_bilateral_init(wd, ht, sigma_s, sigma_r);
+    dt_bilateral_splat(b, in);
+    dt_bilateral_blur(b);
+    dt_bilateral_slice(b, in, out, detail);
+    dt_bilateral_free(b);
+    float err = 0.0f;
+    for(size_t k=0; k<(size_t)wd*ht*4; k+=4) err = MAX(err, fabsf(out[k] - ref[k]));
+    fprintf(stderr, "[%s] bilateral grid vs. serial reference, %d threads, max error %g\n",
+            err < 1e-3f ? "passed" : "FAILED", threads, err);
+    if(err >= 1e-3f) exit(1);
+    if(max_threads == 1) break;
+  }
+
+  fprintf(stderr, "%dx%d, sigma %g %g, %d cores\n", wd, ht, sigma_s, sigma_r, omp_get_num_procs());
+  fprintf(stderr, "threads   splat ms   blur ms  slice ms  total ms  speedup\n");
+  double single = 0.0;
+  for(int threads=1; threads<=max_threads; threads*=2)
+  {
+    omp_set_num_threads(threads);
+    double t[3] = { 0.0, 0.0, 0.0 };
+    for(int r=0; r<runs; r++)
+    {
+      dt_bilateral_t *b = dt_bilateral_init(wd, ht, sigma_s, sigma_r);
+      double start = wtime();
+      dt_bilateral_splat(b, in);
+      t[0] += wtime() - start;
+      start = wtime();
+      dt_bilateral_blur(b);
+      t[1] += wtime() - start;
+      start = wtime();
+      dt_bilateral_slice(b, in, out, detail);
+      t[2] += wtime() - start;
+      dt_bilateral_free(b);
+    }
+    const double total = t[0] + t[1] + t[2];
+    if(threads == 1) single = total;
+    fprintf(stderr, "%7d %10.1f %9.1f %9.1f %9.1f %8.2f\n", threads,
+            1e3*t[0]/runs, 1e3*t[1]/runs, 1e3*t[2]/runs, 1e3*total/runs, single/total);
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(ref);
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
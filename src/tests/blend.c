@@ -0,0 +1,316 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// define the few dt types, so we don't need to include the rest of dt:
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#define CLAMP_RANGE(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+typedef enum dt_iop_colorspace_type_t { iop_cs_RAW, iop_cs_Lab, iop_cs_rgb } dt_iop_colorspace_type_t;
+enum { DEVELOP_MASK_CONDITIONAL = 0x04 };
+enum { DEVELOP_COMBINE_INV = 0x01, DEVELOP_COMBINE_INCL = 0x02 };
+enum
+{
+  DEVELOP_BLENDIF_L_in = 0, DEVELOP_BLENDIF_A_in = 1, DEVELOP_BLENDIF_B_in = 2,
+  DEVELOP_BLENDIF_L_out = 4, DEVELOP_BLENDIF_A_out = 5, DEVELOP_BLENDIF_B_out = 6,
+  DEVELOP_BLENDIF_GRAY_in = 0, DEVELOP_BLENDIF_RED_in = 1, DEVELOP_BLENDIF_GREEN_in = 2, DEVELOP_BLENDIF_BLUE_in = 3,
+  DEVELOP_BLENDIF_GRAY_out = 4, DEVELOP_BLENDIF_RED_out = 5, DEVELOP_BLENDIF_GREEN_out = 6, DEVELOP_BLENDIF_BLUE_out = 7,
+  DEVELOP_BLENDIF_C_in = 8, DEVELOP_BLENDIF_h_in = 9, DEVELOP_BLENDIF_C_out = 12, DEVELOP_BLENDIF_h_out = 13,
+  DEVELOP_BLENDIF_H_in = 8, DEVELOP_BLENDIF_S_in = 9, DEVELOP_BLENDIF_l_in = 10,
+  DEVELOP_BLENDIF_H_out = 12, DEVELOP_BLENDIF_S_out = 13, DEVELOP_BLENDIF_l_out = 14,
+  DEVELOP_BLENDIF_MAX = 14, DEVELOP_BLENDIF_SIZE = 16,
+  DEVELOP_BLENDIF_Lab_MASK = 0x3377, DEVELOP_BLENDIF_RGB_MASK = 0x77FF
+};
+
+// accuracy check against the per pixel scalar code of blend.c, and speed of both.
+#include "develop/blend_sse.h"
+
+typedef void (row_func)(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag);
+
+static double
+wtime()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+// the scalar blendif factor, with the switch on the colorspace for every pixel.
+static float
+reference_factor(dt_iop_colorspace_type_t cst, const float *input, const float *output, const unsigned int blendif,
+                 const float *parameters, const unsigned int mask_combine)
+{
+  float result = 1.0f;
+  float scaled[DEVELOP_BLENDIF_SIZE] = { 0.5f };
+  unsigned int channel_mask = 0;
+  const int incl = mask_combine & DEVELOP_COMBINE_INCL;
+
+  if(cst == iop_cs_Lab)
+  {
+    scaled[DEVELOP_BLENDIF_L_in] = CLAMP_RANGE(input[0] / 100.0f, 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_A_in] = CLAMP_RANGE((input[1] + 128.0f)/256.0f, 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_B_in] = CLAMP_RANGE((input[2] + 128.0f)/256.0f, 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_L_out] = CLAMP_RANGE(output[0] / 100.0f, 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_A_out] = CLAMP_RANGE((output[1] + 128.0f)/256.0f, 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_B_out] = CLAMP_RANGE((output[2] + 128.0f)/256.0f, 0.0f, 1.0f);
+    float LCH_input[3], LCH_output[3];
+    _Lab_2_LCH(input, LCH_input);
+    _Lab_2_LCH(output, LCH_output);
+    scaled[DEVELOP_BLENDIF_C_in] = CLAMP_RANGE(LCH_input[1] / (128.0f*sqrtf(2.0f)), 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_h_in] = CLAMP_RANGE(LCH_input[2], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_C_out] = CLAMP_RANGE(LCH_output[1] / (128.0f*sqrtf(2.0f)), 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_h_out] = CLAMP_RANGE(LCH_output[2], 0.0f, 1.0f);
+    channel_mask = DEVELOP_BLENDIF_Lab_MASK;
+  }
+  else
+  {
+    scaled[DEVELOP_BLENDIF_GRAY_in] = CLAMP_RANGE(0.3f*input[0] + 0.59f*input[1] + 0.11f*input[2], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_RED_in] = CLAMP_RANGE(input[0], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_GREEN_in] = CLAMP_RANGE(input[1], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_BLUE_in] = CLAMP_RANGE(input[2], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_GRAY_out] = CLAMP_RANGE(0.3f*output[0] + 0.59f*output[1] + 0.11f*output[2], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_RED_out] = CLAMP_RANGE(output[0], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_GREEN_out] = CLAMP_RANGE(output[1], 0.0f, 1.0f);
+    scaled[DEVELOP_BLENDIF_BLUE_out] = CLAMP_RANGE(output[2], 0.0f, 1.0f);
+    float HSL_input[3], HSL_output[3];
+    _RGB_2_HSL(input, HSL_input);
+    _RGB_2_HSL(output, HSL_output);
+    for(int k=0; k<3; k++)
+    {
+      scaled[DEVELOP_BLENDIF_H_in + k] = CLAMP_RANGE(HSL_input[k], 0.0f, 1.0f);
+      scaled[DEVELOP_BLENDIF_H_out + k] = CLAMP_RANGE(HSL_output[k], 0.0f, 1.0f);
+    }
+    channel_mask = DEVELOP_BLENDIF_RGB_MASK;
+  }
+
+  for(int ch=0; ch<=DEVELOP_BLENDIF_MAX; ch++)
+  {
+    if((channel_mask & (1<<ch)) == 0) continue;
+    if((blendif & (1<<ch)) == 0)
+    {
+      result *= !(blendif & (1<<(ch+16))) == !incl ? 1.0f : 0.0f;
+      continue;
+    }
+    const float *p = parameters + 4*ch;
+    float factor;
+    if(scaled[ch] >= p[1] && scaled[ch] <= p[2]) factor = 1.0f;
+    else if(scaled[ch] > p[0] && scaled[ch] < p[1]) factor = (scaled[ch] - p[0])/fmax(0.01f, p[1]-p[0]);
+    else if(scaled[ch] > p[2] && scaled[ch] < p[3]) factor = 1.0f - (scaled[ch] - p[2])/fmax(0.01f, p[3]-p[2]);
+    else factor = 0.0f;
+    if((blendif & (1<<(ch+16))) != 0) factor = 1.0f - factor;
+    result *= incl ? 1.0f - factor : factor;
+  }
+  return incl ? 1.0f - result : result;
+}
+
+static void
+reference_mask(dt_iop_colorspace_type_t cst, const unsigned int blendif, const float *parameters, const unsigned int mask_combine,
+               const float gopacity, const float *a, const float *b, float *mask, size_t width)
+{
+  for(size_t i=0; i<width; i++)
+  {
+    const float form = mask[i];
+    const float conditional = reference_factor(cst, a + 4*i, b + 4*i, blendif, parameters, mask_combine);
+    float opacity = (mask_combine & DEVELOP_COMBINE_INCL) ? 1.0f - (1.0f - form) * (1.0f - conditional) : form * conditional;
+    opacity = (mask_combine & DEVELOP_COMBINE_INV) ? 1.0f - opacity : opacity;
+    mask[i] = opacity*gopacity;
+  }
+}
+
+// the scalar blend operators, one pixel channel at a time in the scaled Lab or in rgb.
+enum { NORMAL_BOUNDED, NORMAL_UNBOUNDED, LIGHTEN, DARKEN, MULTIPLY, AVERAGE, ADD, SUBSTRACT, SCREEN, NUM_MODES };
+static const char *mode_names[NUM_MODES] =
+  { "bounded", "unbounded", "lighten", "darken", "multiply", "average", "add", "substract", "screen" };
+static row_func *sse_funcs[NUM_MODES] =
+{
+  _blend_normal_bounded_sse, _blend_normal_unbounded_sse, _blend_lighten_sse, _blend_darken_sse, _blend_multiply_sse,
+  _blend_average_sse, _blend_add_sse, _blend_substract_sse, _blend_screen_sse
+};
+
+static float
+reference_channel(const int mode, const float a, const float b, const float o, const float min, const float max)
+{
+  switch(mode)
+  {
+    case NORMAL_BOUNDED: return CLAMP_RANGE(a * (1.0f - o) + b * o, min, max);
+    case NORMAL_UNBOUNDED: return a * (1.0f - o) + b * o;
+    case LIGHTEN: return CLAMP_RANGE(a * (1.0f - o) + fmax(a, b) * o, min, max);
+    case DARKEN: return CLAMP_RANGE(a * (1.0f - o) + fmin(a, b) * o, min, max);
+    case MULTIPLY: return CLAMP_RANGE(a * (1.0f - o) + a * b * o, min, max);
+    case AVERAGE: return CLAMP_RANGE(a * (1.0f - o) + (a + b)/2.0f * o, min, max);
+    case ADD: return CLAMP_RANGE(a * (1.0f - o) + (a + b) * o, min, max);
+    case SUBSTRACT: return CLAMP_RANGE(a * (1.0f - o) + ((b + a) - fabs(min + max)) * o, min, max);
+    case SCREEN:
+    {
+      const float la = CLAMP_RANGE(a, 0.0f, 1.0f), lb = CLAMP_RANGE(b, 0.0f, 1.0f);
+      return CLAMP_RANGE(la * (1.0f - o) + (1.0f - (1.0f - la) * (1.0f - lb)) * o, 0.0f, 1.0f);
+    }
+  }
+  return 0.0f;
+}
+
+static void
+reference_blend(const int mode, dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, size_t stride, int flag)
+{
+  for(size_t i=0, j=0; j<stride; i++, j+=4)
+  {
+    const float o = mask[i];
+    if(cst == iop_cs_Lab)
+    {
+      const float ta[3] = { a[j]/100.0f, a[j+1]/128.0f, a[j+2]/128.0f };
+      float tb[3] = { b[j]/100.0f, b[j+1]/128.0f, b[j+2]/128.0f };
+      const float tbo = tb[0];
+      tb[0] = reference_channel(mode, mode == MULTIPLY || mode == SCREEN ? CLAMP_RANGE(ta[0], 0.0f, 1.0f) : ta[0],
+                                mode == MULTIPLY || mode == SCREEN ? CLAMP_RANGE(tb[0], 0.0f, 1.0f) : tb[0], o, 0.0f, 1.0f);
+      for(int k=1; k<3; k++)
+      {
+        if(flag) tb[k] = ta[k];
+        else if(mode == LIGHTEN || mode == DARKEN)
+        {
+          const float d = fabs(tbo - tb[0]);
+          tb[k] = CLAMP_RANGE(ta[k] * (1.0f - d) + 0.5f * (ta[k] + tb[k]) * d, -1.0f, 1.0f);
+        }
+        else if(mode == MULTIPLY || mode == SCREEN)
+        {
+          const float w = mode == SCREEN ? 0.5f : 1.0f;
+          tb[k] = CLAMP_RANGE(ta[k] * (1.0f - o) + w * (ta[k] + tb[k]) * tb[0]/fmax(ta[0], 0.01f) * o, -1.0f, 1.0f);
+        }
+        else tb[k] = reference_channel(mode, ta[k], tb[k], o, -1.0f, 1.0f);
+      }
+      b[j] = tb[0]*100.0f;
+      b[j+1] = tb[1]*128.0f;
+      b[j+2] = tb[2]*128.0f;
+    }
+    else
+      for(int k=0; k<3; k++) b[j+k] = reference_channel(mode, a[j+k], b[j+k], o, 0.0f, 1.0f);
+    b[j+3] = o;
+  }
+}
+
+static void
+fill(dt_iop_colorspace_type_t cst, float *buf, const int wd, const int ht, const int seed)
+{
+  srand(seed);
+  for(size_t k=0; k<(size_t)wd*ht; k++)
+  {
+    const float r[3] = { rand()/(float)RAND_MAX, rand()/(float)RAND_MAX, rand()/(float)RAND_MAX };
+    if(cst == iop_cs_Lab)
+    {
+      buf[4*k] = 110.0f*r[0] - 5.0f;
+      buf[4*k+1] = 280.0f*r[1] - 140.0f;
+      buf[4*k+2] = 280.0f*r[2] - 140.0f;
+    }
+    else for(int c=0; c<3; c++) buf[4*k+c] = 1.1f*r[c] - 0.05f;
+    buf[4*k+3] = 0.5f;
+  }
+}
+
+int main(int argc, char *arg[])
+{
+  // odd width, so the tail of the four pixel groups is covered too
+  const int wd = argc > 1 ? atoi(arg[1]) : 2001;
+  const int ht = argc > 2 ? atoi(arg[2]) : 1000;
+  const size_t npix = (size_t)wd*ht;
+  const float opacity = 0.8f;
+  int failed = 0;
+
+  float *a = malloc(sizeof(float)*4*npix);
+  float *b = malloc(sizeof(float)*4*npix);
+  float *out = malloc(sizeof(float)*4*npix);
+  float *ref = malloc(sizeof(float)*4*npix);
+  float *mask = malloc(sizeof(float)*npix);
+  float *mref = malloc(sizeof(float)*npix);
+
+  // ramps on a few channels, including the hue ones, some of them inverted, plus whole range channels
+  float parameters[4*DEVELOP_BLENDIF_SIZE];
+  for(int ch=0; ch<DEVELOP_BLENDIF_SIZE; ch++)
+  {
+    parameters[4*ch+0] = 0.05f + 0.02f*ch;
+    parameters[4*ch+1] = 0.3f;
+    parameters[4*ch+2] = 0.6f + 0.01f*ch;
+    parameters[4*ch+3] = 0.9f;
+  }
+  parameters[4*DEVELOP_BLENDIF_A_in+1] = parameters[4*DEVELOP_BLENDIF_A_in+0];     // steep edge
+  const unsigned int blendifs[] = { 0x0, 0x0071, 0x1006 | (0x4 << 16), 0x3377 | (0x1100 << 16), 0x77ff | (0x0202 << 16) };
+
+  for(dt_iop_colorspace_type_t cst = iop_cs_Lab; cst <= iop_cs_rgb; cst++)
+  {
+    const char *cs_name = cst == iop_cs_Lab ? "Lab" : "rgb";
+    fill(cst, a, wd, ht, 1);
+    fill(cst, b, wd, ht, 2);
+
+    for(int k=0; k<(int)(sizeof(blendifs)/sizeof(blendifs[0])); k++) for(unsigned int combine=0; combine<4; combine++)
+    {
+      dt_develop_blendif_t bi;
+      _blendif_init(&bi, cst, blendifs[k], parameters, DEVELOP_MASK_CONDITIONAL, combine);
+      for(size_t i=0; i<npix; i++) mask[i] = mref[i] = (i % 7) / 6.0f;
+      for(int j=0; j<ht; j++)
+      {
+        const size_t o = (size_t)j*wd;
+        reference_mask(cst, blendifs[k], parameters, combine, opacity, a + 4*o, b + 4*o, mref + o, wd);
+        if(cst == iop_cs_Lab) _blend_make_mask_Lab_sse(&bi, opacity, a + 4*o, b + 4*o, mask + o, wd);
+        else _blend_make_mask_rgb_sse(&bi, opacity, a + 4*o, b + 4*o, mask + o, wd);
+      }
+      float err = 0.0f;
+      for(size_t i=0; i<npix; i++) err = MAX(err, fabsf(mask[i] - mref[i]));
+      if(err >= 1e-4f) failed = 1;
+      fprintf(stderr, "[%s] %s mask, blendif %08x, combine %u, max error %g\n",
+              err < 1e-4f ? "passed" : "FAILED", cs_name, blendifs[k], combine, err);
+    }
+
+    for(int i=0; i<(int)npix; i++) mask[i] = (i % 11) / 10.0f;
+    for(int mode=0; mode<NUM_MODES; mode++) for(int flag=0; flag<=(cst == iop_cs_Lab); flag++)
+    {
+      memcpy(out, b, sizeof(float)*4*npix);
+      memcpy(ref, b, sizeof(float)*4*npix);
+      double t[2];
+      double start = wtime();
+      for(int j=0; j<ht; j++)
+        reference_blend(mode, cst, a + 4*(size_t)j*wd, ref + 4*(size_t)j*wd, mask + (size_t)j*wd, 4*(size_t)wd, flag);
+      t[0] = wtime() - start;
+      start = wtime();
+      for(int j=0; j<ht; j++)
+        sse_funcs[mode](cst, a + 4*(size_t)j*wd, out + 4*(size_t)j*wd, mask + (size_t)j*wd, 4*(size_t)wd, flag);
+      t[1] = wtime() - start;
+      float err = 0.0f;
+      for(size_t k=0; k<4*npix; k++)
+        err = MAX(err, fabsf(out[k] - ref[k]) / (cst == iop_cs_Lab ? 128.0f : 1.0f));
+      if(err >= 1e-4f) failed = 1;
+      fprintf(stderr, "[%s] %s %-9s flag %d, max error %g, scalar %.1f ms, sse %.1f ms\n",
+              err < 1e-4f ? "passed" : "FAILED", cs_name, mode_names[mode], flag, err, 1e3*t[0], 1e3*t[1]);
+    }
+  }
+
+  free(a);
+  free(b);
+  free(out);
+  free(ref);
+  free(mask);
+  free(mref);
+  exit(failed);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
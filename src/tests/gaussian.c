@@ -0,0 +1,170 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// define the few dt helpers, so we don't need to include the rest of dt:
+#define _XOPEN_SOURCE 600
+#include <stdlib.h>
+static inline void *dt_alloc_align(size_t a, size_t s)
+{
+  void *p = NULL;
+  return posix_memalign(&p, a, s) ? NULL : p;
+}
+#define dt_free_align(A) free(A)
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#ifdef _OPENMP
+#  include <omp.h>
+#  define dt_get_num_threads() omp_get_max_threads()
+#  define dt_get_thread_num() omp_get_thread_num()
+#else
+#  define dt_get_num_threads() 1
+#  define dt_get_thread_num() 0
+#endif
+// and skip the opencl header, which pulls in all of dt without opencl support:
+#define DT_OPENCL_H
+
+// micro benchmark and accuracy check for the recursive gaussian blur and its box filter approximation.
+#include "common/gaussian.h"
+#include "common/gaussian.c"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+static double
+wtime()
+{
+  struct timeval t;
+  gettimeofday(&t, NULL);
+  return t.tv_sec + 1e-6*t.tv_usec;
+}
+
+// straight forward single column version of the zero order filter, along one line of len values.
+static void
+reference_line(const float *in, float *out, const int len, const size_t stride, const float sigma)
+{
+  float a0, a1, a2, a3, b1, b2, coefp, coefn;
+  compute_gauss_params(sigma, DT_IOP_GAUSSIAN_ZERO, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  float xp = in[0], yb = xp*coefp, yp = yb;
+  for(int k=0; k<len; k++)
+  {
+    const float xc = in[k*stride];
+    const float yc = a0*xc + a1*xp - b1*yp - b2*yb;
+    out[k*stride] = yc;
+    xp = xc;
+    yb = yp;
+    yp = yc;
+  }
+  float xn = in[(len-1)*stride], xa = xn, yn = xn*coefn, ya = yn;
+  for(int k=len-1; k>=0; k--)
+  {
+    const float xc = in[k*stride];
+    const float yc = a2*xn + a3*xa - b1*yn - b2*ya;
+    xa = xn;
+    xn = xc;
+    ya = yn;
+    yn = yc;
+    out[k*stride] += yc;
+  }
+}
+
+static float
+max_error(const float *a, const float *b, const size_t n)
+{
+  float err = 0.0f;
+  for(size_t k=0; k<n; k++) err = MAX(err, fabsf(a[k] - b[k]));
+  return err;
+}
+
+static float
+mean_error(const float *a, const float *b, const size_t n)
+{
+  double err = 0.0;
+  for(size_t k=0; k<n; k++) err += fabsf(a[k] - b[k]);
+  return err / n;
+}
+
+int main(int argc, char *arg[])
+{
+  const int wd = argc > 1 ? atoi(arg[1]) : 2000;
+  const int ht = argc > 2 ? atoi(arg[2]) : 1500;
+  const int runs = 5;
+  const float max[4] = { 1.0f, 1.0f, 1.0f, 1.0f }, min[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+  float *in = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  float *out = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  float *ref = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  float *tmp = dt_alloc_align(64, sizeof(float)*wd*ht*4);
+  srand(42);
+  for(size_t k=0; k<(size_t)wd*ht*4; k++) in[k] = rand()/(float)RAND_MAX;
+
+  // accuracy of the vectorized filter against the scalar reference, single channel.
+  {
+    const float sigma = 5.0f;
+    for(int i=0; i<wd; i++) reference_line(in + i, tmp + i, ht, wd, sigma);
+    for(int j=0; j<ht; j++) reference_line(tmp + (size_t)j*wd, ref + (size_t)j*wd, wd, 1, sigma);
+    dt_gaussian_t *g = dt_gaussian_init(wd, ht, 1, max, min, sigma, DT_IOP_GAUSSIAN_ZERO);
+    dt_gaussian_blur(g, in, out);
+    dt_gaussian_free(g);
+    const float err = max_error(out, ref, (size_t)wd*ht);
+    fprintf(stderr, "[%s] vectorized blur vs. reference, max error %g\n", err < 1e-4f ? "passed" : "FAILED", err);
+    if(err >= 1e-4f) exit(1);
+  }
+
+  fprintf(stderr, "%dx%d, %d threads\n", wd, ht, dt_get_num_threads());
+  fprintf(stderr, "channels  sigma   recursive MPix/s   box MPix/s   box mean error\n");
+  const float sigmas[] = { 2.0f, 8.0f, 32.0f, 100.0f };
+  for(int ch=1; ch<=4; ch+=3)
+  {
+    for(int s=0; s<sizeof(sigmas)/sizeof(sigmas[0]); s++)
+    {
+      double mpix[2] = { 0.0, 0.0 };
+      dt_gaussian_t *g = dt_gaussian_init(wd, ht, ch, max, min, sigmas[s], DT_IOP_GAUSSIAN_ZERO);
+      // sigmas below DT_GAUSSIAN_BOX_MIN_SIGMA are never approximated.
+      const int approximate = sigmas[s] >= DT_GAUSSIAN_BOX_MIN_SIGMA;
+      for(int approx=0; approx<=approximate; approx++)
+      {
+        g->approximate = approx;
+        float *res = approx ? out : ref;
+        const double start = wtime();
+        for(int r=0; r<runs; r++)
+        {
+          if(ch == 4) dt_gaussian_blur_4c(g, in, res);
+          else dt_gaussian_blur(g, in, res);
+        }
+        mpix[approx] = runs*(double)wd*ht/(wtime() - start)/1e6;
+      }
+      dt_gaussian_free(g);
+      if(approximate)
+        fprintf(stderr, "%8d %6.0f %18.1f %12.1f %16.5f\n", ch, sigmas[s], mpix[0], mpix[1], mean_error(out, ref, (size_t)wd*ht*ch));
+      else
+        fprintf(stderr, "%8d %6.0f %18.1f %12s %16s\n", ch, sigmas[s], mpix[0], "-", "-");
+    }
+  }
+
+  dt_free_align(in);
+  dt_free_align(out);
+  dt_free_align(ref);
+  dt_free_align(tmp);
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,109 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2014 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// stub out the bits of dt the sql debug macros need:
+#include <sqlite3.h>
+#include <stdio.h>
+#include <assert.h>
+#include <stdlib.h>
+#define dt_print(A, ...)
+#define dt_database_get(A) (A)
+static struct { sqlite3 *db; } darktable;
+
+// unit test for the built-in preset stamps: simulates a couple of starts
+// the way dt_gui_presets_init() and dt_iop_load_modules_so() run them.
+#include "common/debug.h"
+#include "common/presets_stamp.c"
+
+static int init_presets_calls = 0;
+
+static void init_presets(const char *op, const char *stamp)
+{
+  if(dt_presets_stamp_matches(darktable.db, op, stamp)) return;
+  dt_presets_stamp_clear(darktable.db, op);
+  char sql[256];
+  snprintf(sql, sizeof(sql), "INSERT INTO presets (name, operation, writeprotect) VALUES ('%s built-in', '%s', 1)",
+           stamp, op);
+  sqlite3_exec(darktable.db, sql, NULL, NULL, NULL);
+  dt_presets_stamp_store(darktable.db, op, stamp);
+  init_presets_calls++;
+}
+
+static void start(const char *exposure_stamp)
+{
+  // gui/presets.c
+  dt_presets_stamp_cleanup(darktable.db);
+  // develop/imageop.c
+  init_presets("exposure", exposure_stamp);
+  init_presets("colorout", "1:5:1.4:0:0");
+  // libs are not stamped and add their presets on every start
+  sqlite3_exec(darktable.db, "INSERT INTO presets (name, operation, writeprotect) VALUES ('lib', 'export', 1)",
+               NULL, NULL, NULL);
+}
+
+static int count(const char *where)
+{
+  char sql[256];
+  snprintf(sql, sizeof(sql), "SELECT count(*) FROM presets WHERE %s", where);
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(darktable.db, sql, -1, &stmt, NULL);
+  sqlite3_step(stmt);
+  const int c = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+  return c;
+}
+
+int main(int argc, char *argv[])
+{
+  sqlite3_open(":memory:", &darktable.db);
+  sqlite3_exec(darktable.db, "CREATE TABLE db_info (key VARCHAR PRIMARY KEY, value VARCHAR)", NULL, NULL, NULL);
+  sqlite3_exec(darktable.db, "CREATE TABLE presets (name VARCHAR, operation VARCHAR, writeprotect INTEGER)",
+               NULL, NULL, NULL);
+  sqlite3_exec(darktable.db, "INSERT INTO presets (name, operation, writeprotect) VALUES ('mine', 'exposure', 0)",
+               NULL, NULL, NULL);
+
+  start("3:5:1.4:0:0");
+  assert(init_presets_calls == 2);
+  assert(count("operation = 'exposure' AND writeprotect = 1") == 1);
+
+  // second start with unchanged plugins: nothing is rewritten and nothing is lost
+  start("3:5:1.4:0:0");
+  assert(init_presets_calls == 2);
+  assert(count("operation = 'exposure' AND writeprotect = 1") == 1);
+  assert(count("operation = 'colorout' AND writeprotect = 1") == 1);
+  assert(count("operation = 'export'") == 1);
+  assert(count("writeprotect = 0") == 1);
+
+  // a changed plugin replaces its own presets only
+  start("4:5:1.4:0:0");
+  assert(init_presets_calls == 3);
+  assert(count("operation = 'exposure' AND writeprotect = 1") == 1);
+  assert(count("name = '4:5:1.4:0:0 built-in'") == 1);
+  assert(count("operation = 'colorout' AND writeprotect = 1") == 1);
+  assert(count("writeprotect = 0") == 1);
+
+  sqlite3_close(darktable.db);
+  fprintf(stderr, "presets: ok\n");
+  exit(0);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
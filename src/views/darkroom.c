@@ -1368,6 +1368,7 @@ void leave(dt_view_t *self)
     dev->form_gui = NULL;
     dev->form_visible = NULL;
   }
+  dt_masks_raster_cache_clear();
 
   // take care of the overexposed window
   if(dev->overexposed.timeout > 0)
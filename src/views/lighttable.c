@@ -92,7 +92,6 @@ typedef struct dt_library_t
   int32_t full_preview_id;
   int32_t full_preview_rowid;
   int display_focus;
-  gboolean offset_changed;
   GdkColor star_color;
   int images_in_row;
 
@@ -171,8 +170,6 @@ void switch_layout_to(dt_library_t *lib, int new_layout)
 
     if(lib->center) lib->offset = 0;
     lib->center = 0;
-
-    lib->offset_changed = TRUE;
   }
 }
 
@@ -231,7 +228,6 @@ static void move_view(dt_library_t *lib, direction dir)
   }
 
   lib->first_visible_filemanager = lib->offset;
-  lib->offset_changed = TRUE;
 }
 
 /* This function allows the file manager view to zoom "around" the image
@@ -265,7 +261,6 @@ void zoom_around_image(dt_library_t *lib, double pointerx, double pointery, int
 
   lib->offset = zoom_anchor_image - pi - (pj * new_images_in_row);
   lib->first_visible_filemanager = lib->offset;
-  lib->offset_changed = TRUE;
   lib->images_in_row = new_images_in_row;
 }
 
@@ -344,7 +339,6 @@ static void _set_position(dt_view_t *self, uint32_t pos)
 {
   dt_library_t *lib = (dt_library_t *)self->data;
   lib->first_visible_filemanager = lib->first_visible_zoomable = lib->offset = pos;
-  lib->offset_changed = TRUE;
   dt_control_queue_redraw_center();
 }
 
@@ -453,8 +447,6 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
 {
   dt_library_t *lib = (dt_library_t *)self->data;
 
-  gboolean offset_changed = FALSE;
-
   /* query new collection count */
   lib->collection_count = dt_collection_get_count (darktable.collection);
 
@@ -473,8 +465,6 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   cairo_set_source_rgb (cr, .2, .2, .2);
   cairo_paint(cr);
 
-  offset_changed = lib->offset_changed;
-
   const float wd = width/(float)iir;
   const float ht = width/(float)iir;
 
@@ -588,6 +578,8 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   }
 
 end_query_cache:
+  // stars, labels, selection etc. for all of them in one go:
+  dt_view_image_meta_load(darktable.view_manager, query_ids, max_rows*max_cols);
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image =0;
@@ -789,40 +781,13 @@ escape_image_loop:
 escape_border_loop:
   cairo_restore(cr);
 after_drawing:
-  /* check if offset was changed and we need to prefetch thumbs */
-  if (offset_changed)
+  /* queue thumbnails around the visible area, the view keeps track of where we're heading */
   {
-    int32_t imgids_num = 0;
-    const int prefetchrows = .5*max_rows+1;
-    int32_t imgids[prefetchrows*iir];
-
-    /* clear and reset main query */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-    /* setup offest and row for prefetch */
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset + max_rows*iir);
-    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, prefetchrows*iir);
-
-    // prefetch jobs in inverse order: supersede previous jobs: most important last
-    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW && imgids_num < prefetchrows*iir)
-      imgids[imgids_num++] = sqlite3_column_int(lib->statements.main_query, 0);
-
-    float imgwd = iir == 1 ? 0.97 : 0.8;
-    dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
-                             darktable.mipmap_cache,
-                             imgwd*wd, imgwd*(iir==1?height:ht));
-    while(imgids_num > 0)
-    {
-      imgids_num --;
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_read_get(
-        darktable.mipmap_cache,
-        &buf,
-        imgids[imgids_num],
-        mip,
-        DT_MIPMAP_PREFETCH);
-    }
+    const float imgwd = iir == 1 ? 0.97 : 0.8;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
+                                   darktable.mipmap_cache,
+                                   imgwd*wd, imgwd*(iir==1?height:ht));
+    dt_view_prefetch_thumbnails(darktable.view_manager, offset, max_rows*iir, iir, mip);
   }
 
   if(query_ids)
@@ -853,6 +818,28 @@ after_drawing:
 
 #define DT_LIBRARY_MAX_ZOOM 13
 
+// the rows of the zoomable lighttable are DT_LIBRARY_MAX_ZOOM images apart,
+// collect the visible part of each and load their decorations with one query.
+static void
+_zoomable_load_meta(dt_library_t *lib, int offset, const int max_rows, const int max_cols)
+{
+  int32_t *imgids = (int32_t *)calloc(max_rows*max_cols, sizeof(int32_t));
+  if(!imgids) return;
+  int cnt = 0;
+  for(int row = 0; row < max_rows; row++, offset += DT_LIBRARY_MAX_ZOOM)
+  {
+    if(offset < 0) continue;
+    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 1, offset);
+    DT_DEBUG_SQLITE3_BIND_INT(lib->statements.main_query, 2, max_cols);
+    while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
+      imgids[cnt++] = sqlite3_column_int(lib->statements.main_query, 0);
+  }
+  dt_view_image_meta_load(darktable.view_manager, imgids, cnt);
+  free(imgids);
+}
+
 static void
 expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, int32_t pointerx, int32_t pointery)
 {
@@ -1022,6 +1009,18 @@ expose_zoomable (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height, in
   cairo_translate(cr, -offset_x*wd, -offset_y*ht);
   cairo_translate(cr, -MIN(offset_i*wd, 0.0), 0.0);
 
+  // load stars, labels, selection etc. of all visible images in one go:
+  _zoomable_load_meta(lib, offset, max_rows, max_cols);
+  // and queue thumbnails around it. the grid is DT_LIBRARY_MAX_ZOOM wide, treat its rows as contiguous:
+  {
+    const float imgwd = zoom == 1 ? 0.97 : 0.8;
+    const dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(
+                                   darktable.mipmap_cache,
+                                   imgwd*wd, imgwd*(zoom==1?height:ht));
+    dt_view_prefetch_thumbnails(darktable.view_manager, MAX(0, offset), max_rows*DT_LIBRARY_MAX_ZOOM,
+                                DT_LIBRARY_MAX_ZOOM, mip);
+  }
+
   for(int row = 0; row < max_rows; row++)
   {
     if(offset < 0)
@@ -1173,7 +1172,8 @@ void expose_full_preview(dt_view_t *self, cairo_t *cr, int32_t width, int32_t he
           &lib->full_res_thumb,
           &lib->full_res_thumb_wd,
           &lib->full_res_thumb_ht,
-          &lib->full_res_thumb_orientation))
+          &lib->full_res_thumb_orientation,
+          0, 0))
         lib->full_res_thumb_id = lib->full_preview_id;
 
       if(lib->full_res_thumb_id == lib->full_preview_id)
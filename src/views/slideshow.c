@@ -110,7 +110,7 @@ mime(dt_imageio_module_data_t *data)
 }
 
 static int
-write_image (dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif, int exif_len, int imgid)
+write_image (dt_imageio_module_data_t *datai, const char *filename, const void *in, void *exif, int exif_len, const char *xmp, int imgid)
 {
   dt_slideshow_format_t *data = (dt_slideshow_format_t *)datai;
   dt_pthread_mutex_lock(&data->d->lock);
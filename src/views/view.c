@@ -20,6 +20,7 @@
 
 #include "common/darktable.h"
 #include "common/collection.h"
+#include "common/colorlabels.h"
 #include "common/image_cache.h"
 #include "common/mipmap_cache.h"
 #include "common/debug.h"
@@ -41,6 +42,14 @@
 #include <math.h>
 
 #define DECORATION_SIZE_LIMIT 40
+// start the thumbnail decoration snapshot over when it grows larger than this
+#define DT_VIEW_IMAGE_META_MAX 4096
+
+static void _view_image_meta_invalidate(gpointer instance, gpointer user_data)
+{
+  dt_view_manager_t *vm = (dt_view_manager_t *)user_data;
+  g_hash_table_remove_all(vm->image_meta.images);
+}
 
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
@@ -48,9 +57,18 @@ void dt_view_manager_init(dt_view_manager_t *vm)
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid = ?1", -1, &vm->statements.is_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from selected_images where imgid = ?1", -1, &vm->statements.delete_from_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or ignore into selected_images values (?1)", -1, &vm->statements.make_selected, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select num from history where imgid = ?1", -1, &vm->statements.have_history, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select color from color_labels where imgid=?1", -1, &vm->statements.get_color, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = (select group_id from images where id=?1) and id != ?2", -1, &vm->statements.get_grouped, NULL);
+
+  /* thumbnail decorations, loaded in batches by the views */
+  vm->image_meta.images = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  vm->image_meta.changes = sqlite3_total_changes(dt_database_get(darktable.db));
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
+                            G_CALLBACK(_view_image_meta_invalidate), (gpointer)vm);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_CHANGED,
+                            G_CALLBACK(_view_image_meta_invalidate), (gpointer)vm);
+
+  vm->prefetch.offset = vm->prefetch.visible = -1;
+  vm->prefetch.time = 0.0;
+  vm->prefetch.velocity = 0.0f;
 
   int res=0, midx=0;
   char *modules[] =
@@ -85,6 +103,70 @@ void dt_view_manager_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(int k=0; k<vm->num_views; k++) dt_view_unload_module(vm->view + k);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_image_meta_invalidate), (gpointer)vm);
+  g_hash_table_destroy(vm->image_meta.images);
+}
+
+// query the decorations of the given images and put them into the snapshot
+static void _view_image_meta_fetch(dt_view_manager_t *vm, const int32_t *imgids, const int count)
+{
+  GString *ids = g_string_sized_new(12*count);
+  for(int k=0; k<count; k++)
+    if(imgids[k] > 0 && !g_hash_table_lookup(vm->image_meta.images, GINT_TO_POINTER(imgids[k])))
+      g_string_append_printf(ids, "%s%d", ids->len ? "," : "", imgids[k]);
+  if(!ids->len)
+  {
+    g_string_free(ids, TRUE);
+    return;
+  }
+
+  // images that are gone from the db get an empty entry, so they are not queried on every expose:
+  for(int k=0; k<count; k++)
+    if(imgids[k] > 0 && !g_hash_table_lookup(vm->image_meta.images, GINT_TO_POINTER(imgids[k])))
+      g_hash_table_insert(vm->image_meta.images, GINT_TO_POINTER(imgids[k]), g_malloc0(sizeof(dt_view_image_meta_t)));
+
+  // color_labels has a unique (imgid, color) index, so the sum is a bit mask:
+  gchar *query = g_strdup_printf(
+                   "SELECT i.id, i.flags, i.group_id, i.filename, "
+                   "EXISTS (SELECT 1 FROM selected_images AS s WHERE s.imgid = i.id), "
+                   "EXISTS (SELECT 1 FROM history AS h WHERE h.imgid = i.id), "
+                   "EXISTS (SELECT 1 FROM images AS g WHERE g.group_id = i.group_id AND g.id != i.id), "
+                   "(SELECT IFNULL(SUM(1 << l.color), 0) FROM color_labels AS l WHERE l.imgid = i.id) "
+                   "FROM images AS i WHERE i.id IN (%s)", ids->str);
+  g_string_free(ids, TRUE);
+
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int imgid = sqlite3_column_int(stmt, 0);
+    dt_view_image_meta_t *meta = (dt_view_image_meta_t *)g_hash_table_lookup(vm->image_meta.images, GINT_TO_POINTER(imgid));
+    if(!meta) continue;
+    meta->flags = sqlite3_column_int(stmt, 1);
+    meta->group_id = sqlite3_column_int(stmt, 2);
+    const char *filename = (const char *)sqlite3_column_text(stmt, 3);
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    g_strlcpy(meta->ext, ext ? ext + 1 : "", sizeof(meta->ext));
+    meta->selected = sqlite3_column_int(stmt, 4);
+    meta->altered = sqlite3_column_int(stmt, 5);
+    meta->grouped = sqlite3_column_int(stmt, 6);
+    meta->colorlabels = sqlite3_column_int(stmt, 7);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+}
+
+void dt_view_image_meta_load(dt_view_manager_t *vm, const int32_t *imgids, const int count)
+{
+  // selection, labels, history and grouping are changed all over the place without
+  // a signal. any write to the db might have touched them, so start over then:
+  const int changes = sqlite3_total_changes(dt_database_get(darktable.db));
+  if(changes != vm->image_meta.changes || g_hash_table_size(vm->image_meta.images) > DT_VIEW_IMAGE_META_MAX)
+  {
+    g_hash_table_remove_all(vm->image_meta.images);
+    vm->image_meta.changes = changes;
+  }
+  _view_image_meta_fetch(vm, imgids, count);
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -759,18 +841,25 @@ dt_view_image_expose(
   // this is a gui thread only thing. no mutex required:
   imgsel = dt_control_get_mouse_over_id();//  darktable.control->global_settings.lib_image_mouse_over_id;
 
+  // decorations come from the snapshot, grids load it for all their thumbnails
+  // before drawing. single images are drawn on their own, check them here:
+  dt_view_manager_t *vm = darktable.view_manager;
+  if(zoom == 1 || full_preview) dt_view_image_meta_load(vm, (const int32_t *)&imgid, 1);
+  dt_view_image_meta_t *meta = (dt_view_image_meta_t *)g_hash_table_lookup(vm->image_meta.images, GINT_TO_POINTER(imgid));
+  if(!meta)
+  {
+    _view_image_meta_fetch(vm, (const int32_t *)&imgid, 1);
+    meta = (dt_view_image_meta_t *)g_hash_table_lookup(vm->image_meta.images, GINT_TO_POINTER(imgid));
+  }
+  dt_view_image_meta_t meta_none = { 0 };
+  if(!meta) meta = &meta_none;
+
 #if DRAW_SELECTED == 1
-  /* clear and reset statements */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-  /* bind imgid to prepared statments */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-  /* lets check if imgid is selected */
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
-    selected = 1;
+  selected = meta->selected;
 #endif
 
-  const dt_image_t *img = dt_image_cache_read_testget(darktable.image_cache, imgid);
+  // the full image is only needed for the file name and exif data on single images:
+  const dt_image_t *img = NULL;
 
   if(selected == 1 && zoom != 1) // If zoom == 1 there is no need to set colors here
   {
@@ -783,10 +872,9 @@ dt_view_image_expose(
     bgcol = 0.8;  // mouse over
     fontcol = 0.7;
     outlinecol = 0.6;
-    // if the user points at this image, we really want it:
-    if(!img)
-      img = dt_image_cache_read_get(darktable.image_cache, imgid);
   }
+  if(zoom == 1 || full_preview)
+    img = dt_image_cache_read_get(darktable.image_cache, imgid);
   float imgwd = 0.90f;
   if(zoom == 1)
   {
@@ -817,11 +905,9 @@ dt_view_image_expose(
     cairo_set_source_rgb(cr, outlinecol, outlinecol, outlinecol);
     cairo_stroke(cr);
 
-    if(img)
+    if(meta->ext[0])
     {
-      const char *ext = img->filename + strlen(img->filename);
-      while(ext > img->filename && *ext != '.') ext--;
-      ext++;
+      const char *ext = meta->ext;
       cairo_set_source_rgb(cr, fontcol, fontcol, fontcol);
       cairo_select_font_face (cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
       cairo_set_font_size (cr, .25*width);
@@ -950,9 +1036,9 @@ dt_view_image_expose(
       float x, y;
       if(zoom != 1) y = 0.90*height;
       else y = .12*fscale;
-      gboolean image_is_rejected = (img && ((img->flags & 0x7) == 6));
+      gboolean image_is_rejected = ((meta->flags & 0x7) == 6);
 
-      if(img) for(int k=0; k<5; k++)
+      for(int k=0; k<5; k++)
         {
           if(zoom != 1) x = (0.41+k*0.12)*width;
           else x = (.08+k*0.04)*fscale;
@@ -967,7 +1053,7 @@ dt_view_image_expose(
               *image_over = DT_VIEW_STAR_1 + k;
               cairo_fill(cr);
             }
-            else if((img->flags & 0x7) > k)
+            else if((meta->flags & 0x7) > k)
             {
               cairo_fill_preserve(cr);
               cairo_set_source_rgb(cr, 1.0-bordercol, 1.0-bordercol, 1.0-bordercol);
@@ -1008,7 +1094,7 @@ dt_view_image_expose(
       cairo_set_line_width(cr, 1.5);
 
 #if DRAW_AUDIO == 1
-      if(img && (img->flags & DT_IMAGE_HAS_WAV))
+      if(meta->flags & DT_IMAGE_HAS_WAV)
       {
         // align to right
         float s = (r1+r2)*.5;
@@ -1027,15 +1113,10 @@ dt_view_image_expose(
 
 
 #if DRAW_GROUPING == 1
-      DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_grouped);
-      DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_grouped);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 1, imgid);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 2, imgid);
-
       /* lets check if imgid is in a group */
-      if(sqlite3_step(darktable.view_manager->statements.get_grouped) == SQLITE_ROW)
+      if(meta->grouped)
         is_grouped = 1;
-      else if(img && darktable.gui->expanded_group_id == img->group_id)
+      else if(darktable.gui->expanded_group_id == meta->group_id)
         darktable.gui->expanded_group_id = -1;
 #endif
 
@@ -1057,23 +1138,18 @@ dt_view_image_expose(
           _y = y - (.17*.04)*fscale;
         }
         cairo_save(cr);
-        if(img && (imgid != img->group_id))
+        if(imgid != meta->group_id)
           cairo_set_source_rgb(cr, fontcol, fontcol, fontcol);
         dtgtk_cairo_paint_grouping(cr, _x, _y, s, s, 23);
         cairo_restore(cr);
         // mouse is over the grouping icon
-        if(img && fabs(px-_x-.5*s) <= .8*s && fabs(py-_y-.5*s) <= .8*s)
+        if(fabs(px-_x-.5*s) <= .8*s && fabs(py-_y-.5*s) <= .8*s)
           *image_over = DT_VIEW_GROUP;
       }
 
 #if DRAW_HISTORY == 1
-      DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.have_history);
-      DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.have_history);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.have_history, 1, imgid);
-
       /* lets check if imgid has history */
-      if(sqlite3_step(darktable.view_manager->statements.have_history) == SQLITE_ROW)
-        altered = 1;
+      altered = meta->altered;
 #endif
 
     // image altered?
@@ -1089,7 +1165,7 @@ dt_view_image_expose(
         else x = (.04+8*0.04)*fscale;
         dt_view_draw_altered(cr, x, y, s);
         //g_print("px = %d, x = %.4f, py = %d, y = %.4f\n", px, x, py, y);
-        if(img && fabsf(px-x) <= 1.2*s && fabsf(py-y) <= 1.2*s) // mouse hovers over the altered-icon -> history tooltip!
+        if(fabsf(px-x) <= 1.2*s && fabsf(py-y) <= 1.2*s) // mouse hovers over the altered-icon -> history tooltip!
         {
           darktable.gui->center_tooltip = 1;
         }
@@ -1114,16 +1190,10 @@ dt_view_image_expose(
     const float y = zoom == 1 ? 0.17*fscale: 0.1*height;
     const float r = zoom == 1 ? 0.01*fscale : 0.03*width;
 
-    /* clear and reset prepared statement */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_color);
-    DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_color);
-
-    /* setup statement and iterate rows */
-    DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_color, 1, imgid);
-    while(sqlite3_step(darktable.view_manager->statements.get_color) == SQLITE_ROW)
+    for(int col=0; col<DT_COLORLABELS_LAST; col++)
     {
+      if(!(meta->colorlabels & (1 << col))) continue;
       cairo_save(cr);
-      int col = sqlite3_column_int(darktable.view_manager->statements.get_color, 0);
       // see src/dtgtk/paint.c
       dtgtk_cairo_paint_label(cr, x+(3*r*col)-5*r, y-r, r*2, r*2, col);
       cairo_restore(cr);
@@ -1132,14 +1202,14 @@ dt_view_image_expose(
 #endif
 
 #if DRAW_LOCAL_COPY == 1
-  if (img && width > DECORATION_SIZE_LIMIT)
+  if (width > DECORATION_SIZE_LIMIT)
   {
     // copy status:
     const float x = zoom == 1 ? (0.07)*fscale : .21*width;
     const float y = zoom == 1 ? 0.17*fscale: 0.1*height;
     const float r = zoom == 1 ? 0.01*fscale : 0.03*width;
     const int xoffset = 6;
-    gboolean has_local_copy = (img && (img->flags & DT_IMAGE_LOCAL_COPY));
+    gboolean has_local_copy = (meta->flags & DT_IMAGE_LOCAL_COPY) != 0;
     cairo_save(cr);
     dtgtk_cairo_paint_local_copy(cr, x+(3*r*xoffset)-5*r, y-r, r*2, r*2, has_local_copy);
     cairo_restore(cr);
@@ -1395,6 +1465,75 @@ void dt_view_filmstrip_prefetch()
   sqlite3_finalize(stmt);
 }
 
+void dt_view_prefetch_thumbnails(dt_view_manager_t *vm, const int offset, const int visible,
+                                 const int per_row, const dt_mipmap_size_t mip)
+{
+  // nothing moved, the queued list is still good:
+  if(offset == vm->prefetch.offset && visible == vm->prefetch.visible) return;
+
+  // scroll speed in images per second. smooth it a bit, and forget it after a pause:
+  const double now = dt_get_wtime();
+  const double dt = now - vm->prefetch.time;
+  const float v = (vm->prefetch.offset >= 0 && dt > 0.0 && dt < 0.5) ? (offset - vm->prefetch.offset)/dt : 0.0f;
+  vm->prefetch.velocity = (dt < 0.5) ? 0.5f*(vm->prefetch.velocity + v) : 0.0f;
+  vm->prefetch.offset = offset;
+  vm->prefetch.visible = visible;
+  vm->prefetch.time = now;
+
+  const gchar *query = dt_collection_get_query(darktable.collection);
+  if(!query || visible <= 0) return;
+
+  // look ahead as far as the user gets in half a second, at least one screen, at most four.
+  // behind, half a screen if idle and one line if scrolling:
+  const float speed = fabsf(vm->prefetch.velocity);
+  const int dir = vm->prefetch.velocity < 0.0f ? -1 : 1;
+  int ahead = CLAMP((int)(0.5f*speed), visible, 4*visible);
+  int behind = speed > 0.0f ? per_row : visible/2;
+  // don't push out what is on screen now:
+  const int capacity = dt_cache_capacity(&darktable.mipmap_cache->mip[mip].cache)/2 - visible;
+  ahead = MIN(ahead, MAX(0, capacity - behind));
+  behind = MIN(behind, MAX(0, capacity - ahead));
+  const int before = dir > 0 ? behind : ahead;
+  const int after  = dir > 0 ? ahead : behind;
+  const int start = MAX(0, offset - before);
+  const int num = offset - start + visible + after;
+  if(num <= visible) return;
+
+  uint32_t *ids = (uint32_t *)calloc(num, sizeof(uint32_t));
+  uint32_t *imgids = (uint32_t *)malloc(sizeof(uint32_t)*num);
+  dt_mipmap_size_t *mips = (dt_mipmap_size_t *)malloc(sizeof(dt_mipmap_size_t)*num);
+  if(ids && imgids && mips)
+  {
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, start);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
+    for(int k=0; k<num && sqlite3_step(stmt) == SQLITE_ROW; k++)
+      ids[k] = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    // in order of importance: the next screen in scroll direction, then what's right
+    // behind, then the rest ahead. that is only passed by quickly, a smaller mip will do.
+    const int first = offset - start, last = first + visible - 1;
+    const dt_mipmap_size_t far_mip = MAX(DT_MIPMAP_0, (int)mip - 1);
+    int cnt = 0;
+#define APPEND(i, m) if((i) >= 0 && (i) < num && ids[i] > 0) { imgids[cnt] = ids[i]; mips[cnt++] = (m); }
+    for(int k=1; k<=MIN(ahead, visible); k++)
+      APPEND(dir > 0 ? last + k : first - k, mip);
+    for(int k=1; k<=behind; k++)
+      APPEND(dir > 0 ? first - k : last + k, mip);
+    for(int k=visible+1; k<=ahead; k++)
+      APPEND(dir > 0 ? last + k : first - k, far_mip);
+#undef APPEND
+
+    dt_mipmap_cache_prefetch(darktable.mipmap_cache, imgids, mips, cnt);
+    dt_print(DT_DEBUG_LIGHTTABLE, "[view_prefetch] %d images at %.1f images/s\n", cnt, vm->prefetch.velocity);
+  }
+  free(ids);
+  free(imgids);
+  free(mips);
+}
+
 void dt_view_manager_view_toolbox_add(dt_view_manager_t *vm,GtkWidget *tool)
 {
   if (vm->proxy.view_toolbox.module)
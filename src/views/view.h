@@ -128,6 +128,17 @@ dt_view_image_expose(
   int32_t py,
   gboolean full_preview);
 
+/** decorations drawn on a thumbnail, as loaded by dt_view_image_meta_load(). */
+typedef struct dt_view_image_meta_t
+{
+  int32_t flags;        // dt_image_t flags: stars, rejected, audio, local copy
+  int32_t group_id;
+  int32_t colorlabels;  // one bit per color label
+  uint8_t selected, altered, grouped;
+  char ext[8];          // file extension
+}
+dt_view_image_meta_t;
+
 /** Set the selection bit to a given value for the specified image */
 void dt_view_set_selection(int imgid, int value);
 /** toggle selection of given image. */
@@ -149,20 +160,31 @@ typedef struct dt_view_manager_t
    */
   struct
   {
-    /* select num from history where imgid = ?1*/
-    sqlite3_stmt *have_history;
     /* select * from selected_images where imgid = ?1 */
     sqlite3_stmt *is_selected;
     /* delete from selected_images where imgid = ?1 */
     sqlite3_stmt *delete_from_selected;
     /* insert into selected_images values (?1) */
     sqlite3_stmt *make_selected;
-    /* select color from color_labels where imgid=?1 */
-    sqlite3_stmt *get_color;
-    /* select images in group from images where imgid=?1 (also bind to ?2) */
-    sqlite3_stmt *get_grouped;
   } statements;
 
+  /* snapshot of thumbnail decorations, so drawing doesn't query the db */
+  struct
+  {
+    /* imgid -> dt_view_image_meta_t */
+    GHashTable *images;
+    /* sqlite3_total_changes() when the snapshot was started */
+    int changes;
+  } image_meta;
+
+  /* scroll tracking for dt_view_prefetch_thumbnails() */
+  struct
+  {
+    int offset, visible;   /* visible range of the collection last time */
+    double time;           /* when that was */
+    float velocity;        /* smoothed scroll speed in images per second */
+  } prefetch;
+
 
   /*
    * Proxy
@@ -256,6 +278,17 @@ dt_view_manager_t;
 void dt_view_manager_init(dt_view_manager_t *vm);
 void dt_view_manager_cleanup(dt_view_manager_t *vm);
 
+/** load the decorations of the given images into the snapshot used by dt_view_image_expose(),
+ *  with one query for all images not in there yet. starts over if the db changed since. */
+void dt_view_image_meta_load(dt_view_manager_t *vm, const int32_t *imgids, const int count);
+
+/** queue thumbnails around the visible part of the collection for loading in the background.
+ *  offset and visible give the range on screen, per_row the images one line of scrolling moves,
+ *  mip the size they are drawn at. looks further ahead the faster the user scrolls.
+ *  cheap to call on every expose, only does something if the range changed. */
+void dt_view_prefetch_thumbnails(dt_view_manager_t *vm, const int offset, const int visible,
+                                 const int per_row, const dt_mipmap_size_t mip);
+
 /** return translated name. */
 const char *dt_view_manager_name (dt_view_manager_t *vm);
 /** switch to this module. returns non-null if the module fails to change. */